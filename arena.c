@@ -0,0 +1,49 @@
+#include <stdlib.h> // calloc, free
+
+#include "arena.h"
+
+#define RZ_ARENA_ALIGN (sizeof(max_align_t))
+
+static rz_arena_chunk_t *rz_arena_chunk(size_t size)
+{
+    // calloc: память арены выдаётся уже обнулённой
+    rz_arena_chunk_t *chunk = calloc(1, sizeof(rz_arena_chunk_t) + size);
+    if (chunk)
+        chunk->size = size;
+    return chunk;
+}
+
+bool rz_arena_init(rz_arena_p arena, size_t size)
+{
+    arena->chunk_size = size;
+    arena->head = rz_arena_chunk(size);
+    return arena->head != NULL;
+}
+
+void *rz_arena_alloc(rz_arena_p arena, size_t size)
+{
+    size = (size + RZ_ARENA_ALIGN - 1) & ~(RZ_ARENA_ALIGN - 1);
+    rz_arena_chunk_t *chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        // Новый кусок; старый остаётся в списке до освобождения арены
+        chunk = rz_arena_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+        if (!chunk)
+            return NULL;
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    void *p = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+void rz_arena_free(rz_arena_p arena)
+{
+    while (arena->head)
+    {
+        rz_arena_chunk_t *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Chunk of arena memory
+ *
+ */
+typedef struct rz_arena_chunk_s
+{
+	struct rz_arena_chunk_s *next;
+	size_t size, used;
+	max_align_t data[];
+} rz_arena_chunk_t;
+
+/**
+ * @brief Bump allocator: everything allocated from it is released at once
+ *
+ */
+typedef struct rz_arena_s
+{
+	rz_arena_chunk_t *head; // current chunk, older chunks follow by next
+	size_t chunk_size;		// size of next chunk
+} rz_arena_t, *rz_arena_p;
+
+/**
+ * @brief Initialize arena with first chunk of given size
+ *
+ * @param arena arena instance
+ * @param size size of first and following chunks in bytes
+ * @return true on success
+ */
+bool rz_arena_init(rz_arena_p arena, size_t size);
+
+/**
+ * @brief Allocate zeroed memory, aligned for any type
+ *
+ * When current chunk is full a new one is added, so allocations
+ * larger than chunk size are possible.
+ *
+ * @param arena arena instance
+ * @param size size in bytes
+ * @return void* memory or NULL when out of memory
+ */
+void *rz_arena_alloc(rz_arena_p arena, size_t size);
+
+/**
+ * @brief Release all chunks of arena
+ *
+ * @param arena arena instance
+ */
+void rz_arena_free(rz_arena_p arena);
+
+#endif // ARENA_H__
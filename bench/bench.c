@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "machine.h"
+#include "jit.h"
+
+#if defined(_WIN32)
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Гостевые ядра для измерения скорости симулятора. Каждое ядро — бесконечный
+// цикл RV32I, исполнение останавливает только бюджет инструкций.
+
+#define BENCH_CODE_MAX 256u
+#define BENCH_LABELS 16u
+#define BENCH_DEFAULT_INSTRUCTIONS 20000000ULL
+#define BENCH_BASELINE_MAX 64u
+
+// Регистры по ABI
+enum
+{
+    ZERO = 0, RA = 1, SP = 2, GP = 3,
+    T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9,
+    A0 = 10, A1 = 11, A2 = 12, A3 = 13,
+    S2 = 18, S3 = 19, S4 = 20, S5 = 21, S6 = 22, S7 = 23, S8 = 24, S9 = 25,
+    T3 = 28, T4 = 29,
+};
+
+// Мини-ассемблер: команды пишутся подряд, переходы на метки разрешаются в конце
+typedef struct
+{
+    uint32_t code[BENCH_CODE_MAX];
+    unsigned count;
+    unsigned labels[BENCH_LABELS];
+    struct
+    {
+        unsigned at, label;
+    } fixups[BENCH_CODE_MAX];
+    unsigned fixup_count;
+} bench_asm_t;
+
+static void emit(bench_asm_t *a, uint32_t word)
+{
+    if (a->count < BENCH_CODE_MAX)
+        a->code[a->count] = word;
+    ++a->count;
+}
+
+static void label(bench_asm_t *a, unsigned l)
+{
+    a->labels[l] = a->count;
+}
+
+#define OP_R(f7, f3, rd, rs1, rs2) \
+    ((uint32_t)(f7) << 25 | (uint32_t)(rs2) << 20 | (uint32_t)(rs1) << 15 | (uint32_t)(f3) << 12 | (uint32_t)(rd) << 7 | 0x33u)
+#define OP_I(op, f3, rd, rs1, imm) \
+    (((uint32_t)(imm) & 0xFFFu) << 20 | (uint32_t)(rs1) << 15 | (uint32_t)(f3) << 12 | (uint32_t)(rd) << 7 | (op))
+#define OP_S(f3, rs1, rs2, imm)                                                                            \
+    (((uint32_t)(imm) >> 5 & 0x7Fu) << 25 | (uint32_t)(rs2) << 20 | (uint32_t)(rs1) << 15 | (uint32_t)(f3) << 12 | \
+     ((uint32_t)(imm) & 0x1Fu) << 7 | 0x23u)
+
+#define ADD(rd, a, b) OP_R(0x00, 0, rd, a, b)
+#define SUB(rd, a, b) OP_R(0x20, 0, rd, a, b)
+#define SLTU(rd, a, b) OP_R(0x00, 3, rd, a, b)
+#define XOR(rd, a, b) OP_R(0x00, 4, rd, a, b)
+#define OR(rd, a, b) OP_R(0x00, 6, rd, a, b)
+#define AND(rd, a, b) OP_R(0x00, 7, rd, a, b)
+#define MUL(rd, a, b) OP_R(0x01, 0, rd, a, b)
+#define MULHU(rd, a, b) OP_R(0x01, 3, rd, a, b)
+#define DIVU(rd, a, b) OP_R(0x01, 5, rd, a, b)
+#define REM(rd, a, b) OP_R(0x01, 6, rd, a, b)
+#define ADDI(rd, rs, imm) OP_I(0x13u, 0, rd, rs, imm)
+#define ANDI(rd, rs, imm) OP_I(0x13u, 7, rd, rs, imm)
+#define SLLI(rd, rs, sh) OP_I(0x13u, 1, rd, rs, sh)
+#define SRLI(rd, rs, sh) OP_I(0x13u, 5, rd, rs, sh)
+#define LW(rd, rs, imm) OP_I(0x03u, 2, rd, rs, imm)
+#define LBU(rd, rs, imm) OP_I(0x03u, 4, rd, rs, imm)
+#define JALR(rd, rs, imm) OP_I(0x67u, 0, rd, rs, imm)
+#define SW(rs2, rs1, imm) OP_S(2, rs1, rs2, imm)
+#define SB(rs2, rs1, imm) OP_S(0, rs1, rs2, imm)
+#define LUI(rd, imm20) ((uint32_t)(imm20) << 12 | (uint32_t)(rd) << 7 | 0x37u)
+#define MV(rd, rs) ADDI(rd, rs, 0)
+#define RET JALR(ZERO, RA, 0)
+
+// Загрузка 32-битной константы парой LUI + ADDI
+static void li(bench_asm_t *a, unsigned rd, uint32_t value)
+{
+    uint32_t hi = (value + 0x800u) >> 12;
+    if (hi)
+        emit(a, LUI(rd, hi & 0xFFFFFu));
+    emit(a, ADDI(rd, hi ? rd : ZERO, value & 0xFFFu));
+}
+
+// Условный переход (funct3 BEQ=0, BNE=1, BLT=4, BGE=5) и JAL на метку
+static void branch(bench_asm_t *a, unsigned f3, unsigned rs1, unsigned rs2, unsigned l)
+{
+    a->fixups[a->fixup_count].at = a->count;
+    a->fixups[a->fixup_count++].label = l;
+    emit(a, (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | (uint32_t)f3 << 12 | 0x63u);
+}
+
+static void jal(bench_asm_t *a, unsigned rd, unsigned l)
+{
+    a->fixups[a->fixup_count].at = a->count;
+    a->fixups[a->fixup_count++].label = l;
+    emit(a, (uint32_t)rd << 7 | 0x6Fu);
+}
+
+static bool bench_link(bench_asm_t *a)
+{
+    if (a->count > BENCH_CODE_MAX)
+        return false;
+    for (unsigned i = 0; i < a->fixup_count; ++i)
+    {
+        uint32_t *w = &a->code[a->fixups[i].at];
+        uint32_t off = (a->labels[a->fixups[i].label] - a->fixups[i].at) * 4u;
+        if ((*w & 0x7Fu) == 0x6Fu)
+            *w |= (off >> 20 & 1u) << 31 | (off >> 1 & 0x3FFu) << 21 | (off >> 11 & 1u) << 20 | (off >> 12 & 0xFFu) << 12;
+        else
+            *w |= (off >> 12 & 1u) << 31 | (off >> 5 & 0x3Fu) << 25 | (off >> 1 & 0xFu) << 8 | (off >> 11 & 1u) << 7;
+    }
+    return true;
+}
+
+// Плотный цикл целочисленной арифметики без обращений к памяти
+static void kernel_alu(bench_asm_t *a)
+{
+    enum { LOOP };
+    li(a, T0, 1);
+    li(a, T1, 3);
+    li(a, T2, 5);
+    label(a, LOOP);
+    emit(a, ADD(T0, T0, T1));
+    emit(a, XOR(T1, T1, T0));
+    emit(a, SLLI(T2, T0, 3));
+    emit(a, SRLI(T3, T1, 2));
+    emit(a, OR(T0, T0, T3));
+    emit(a, SUB(T1, T1, T2));
+    emit(a, AND(T2, T2, T0));
+    emit(a, ADDI(T0, T0, 7));
+    emit(a, SLTU(T3, T0, T1));
+    emit(a, ADD(T1, T1, T3));
+    jal(a, ZERO, LOOP);
+}
+
+// Умножение и деление: линейный конгруэнтный генератор, разбор числа на цифры
+static void kernel_muldiv(bench_asm_t *a)
+{
+    enum { LOOP, DIGITS };
+    li(a, S0, 1);
+    li(a, S1, 1664525u);
+    li(a, S2, 1013904223u);
+    li(a, S3, 10);
+    label(a, LOOP);
+    emit(a, MUL(S0, S0, S1));
+    emit(a, ADD(S0, S0, S2));
+    emit(a, MULHU(T0, S0, S1));
+    emit(a, REM(T1, S0, S1));
+    emit(a, ADD(S4, S4, T0));
+    emit(a, XOR(S4, S4, T1));
+    emit(a, SRLI(T0, S0, 16));
+    label(a, DIGITS);
+    emit(a, DIVU(T0, T0, S3));
+    branch(a, 1, T0, ZERO, DIGITS);
+    jal(a, ZERO, LOOP);
+}
+
+// Ветвления, зависящие от данных: xorshift32 и три перехода по его битам
+static void kernel_branch(bench_asm_t *a)
+{
+    enum { LOOP, SKIP1, SKIP2, SKIP3 };
+    li(a, S0, 0x12345678u);
+    label(a, LOOP);
+    emit(a, SLLI(T0, S0, 13));
+    emit(a, XOR(S0, S0, T0));
+    emit(a, SRLI(T0, S0, 17));
+    emit(a, XOR(S0, S0, T0));
+    emit(a, SLLI(T0, S0, 5));
+    emit(a, XOR(S0, S0, T0));
+    emit(a, ANDI(T1, S0, 1));
+    branch(a, 0, T1, ZERO, SKIP1);
+    emit(a, ADDI(S1, S1, 1));
+    label(a, SKIP1);
+    emit(a, ANDI(T1, S0, 2));
+    branch(a, 1, T1, ZERO, SKIP2);
+    emit(a, ADDI(S2, S2, -1));
+    label(a, SKIP2);
+    branch(a, 4, S0, ZERO, SKIP3);
+    emit(a, ADDI(S3, S3, 1));
+    label(a, SKIP3);
+    jal(a, ZERO, LOOP);
+}
+
+// Копирование 8 КиБ слов из одной половины данных в другую, по четыре за шаг
+static void kernel_memcpy(bench_asm_t *a)
+{
+    enum { OUTER, LOOP };
+    li(a, S0, DATA_OFFSET);
+    li(a, T2, DATA_SIZE / 2);
+    label(a, OUTER);
+    emit(a, MV(T0, S0));
+    emit(a, ADD(T1, S0, T2));
+    emit(a, ADD(T3, S0, T2));
+    label(a, LOOP);
+    emit(a, LW(A0, T0, 0));
+    emit(a, LW(A1, T0, 4));
+    emit(a, LW(A2, T0, 8));
+    emit(a, LW(A3, T0, 12));
+    emit(a, SW(A0, T1, 0));
+    emit(a, SW(A1, T1, 4));
+    emit(a, SW(A2, T1, 8));
+    emit(a, SW(A3, T1, 12));
+    emit(a, ADDI(T0, T0, 16));
+    emit(a, ADDI(T1, T1, 16));
+    branch(a, 1, T0, T3, LOOP);
+    jal(a, ZERO, OUTER);
+}
+
+// Побайтовый поиск конца строки длиной почти во всю область данных
+static void kernel_strlen(bench_asm_t *a)
+{
+    enum { FILL, OUTER, LOOP };
+    li(a, S0, DATA_OFFSET);
+    emit(a, MV(T0, S0));
+    li(a, T1, DATA_SIZE - 1);
+    li(a, T2, 'a');
+    label(a, FILL);
+    emit(a, SB(T2, T0, 0));
+    emit(a, ADDI(T0, T0, 1));
+    emit(a, ADDI(T1, T1, -1));
+    branch(a, 1, T1, ZERO, FILL);
+    label(a, OUTER);
+    emit(a, MV(T0, S0));
+    label(a, LOOP);
+    emit(a, LBU(T1, T0, 0));
+    emit(a, ADDI(T0, T0, 1));
+    branch(a, 1, T1, ZERO, LOOP);
+    emit(a, SUB(A0, T0, S0));
+    jal(a, ZERO, OUTER);
+}
+
+// Рекурсивное fib(20): JAL/JALR и кадры стека
+static void kernel_recursive(bench_asm_t *a)
+{
+    enum { OUTER, FIB, RETURN };
+    label(a, OUTER);
+    li(a, A0, 20);
+    jal(a, RA, FIB);
+    jal(a, ZERO, OUTER);
+
+    label(a, FIB);
+    li(a, T0, 2);
+    branch(a, 4, A0, T0, RETURN);
+    emit(a, ADDI(SP, SP, -12));
+    emit(a, SW(RA, SP, 8));
+    emit(a, SW(S0, SP, 4));
+    emit(a, SW(S1, SP, 0));
+    emit(a, MV(S0, A0));
+    emit(a, ADDI(A0, A0, -1));
+    jal(a, RA, FIB);
+    emit(a, MV(S1, A0));
+    emit(a, ADDI(A0, S0, -2));
+    jal(a, RA, FIB);
+    emit(a, ADD(A0, A0, S1));
+    emit(a, LW(RA, SP, 8));
+    emit(a, LW(S0, SP, 4));
+    emit(a, LW(S1, SP, 0));
+    emit(a, ADDI(SP, SP, 12));
+    label(a, RETURN);
+    emit(a, RET);
+}
+
+// Вложенные вызовы глубины 8, каждый сохраняет и восстанавливает 11 регистров
+static void kernel_stack(bench_asm_t *a)
+{
+    static const unsigned saved[] = {S0, S1, S2, S3, S4, S5, S6, S7, S8, S9};
+    enum { OUTER, NEST, LEAF };
+    label(a, OUTER);
+    li(a, A0, 8);
+    jal(a, RA, NEST);
+    jal(a, ZERO, OUTER);
+
+    label(a, NEST);
+    emit(a, ADDI(SP, SP, -48));
+    emit(a, SW(RA, SP, 44));
+    for (unsigned i = 0; i < 10; ++i)
+        emit(a, SW(saved[i], SP, 40 - 4 * (int)i));
+    for (unsigned i = 0; i < 10; ++i)
+        emit(a, ADDI(saved[i], A0, (int)i));
+    emit(a, ADDI(A0, A0, -1));
+    branch(a, 0, A0, ZERO, LEAF);
+    jal(a, RA, NEST);
+    label(a, LEAF);
+    for (unsigned i = 0; i < 10; ++i)
+        emit(a, LW(saved[i], SP, 40 - 4 * (int)i));
+    emit(a, LW(RA, SP, 44));
+    emit(a, ADDI(SP, SP, 48));
+    emit(a, RET);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*build)(bench_asm_t *a);
+} bench_kernel_t;
+
+static const bench_kernel_t bench_kernels[] = {
+    {"alu", kernel_alu},
+    {"branch", kernel_branch},
+    {"muldiv", kernel_muldiv},
+    {"memcpy", kernel_memcpy},
+    {"strlen", kernel_strlen},
+    {"recursive", kernel_recursive},
+    {"stack", kernel_stack},
+};
+
+static const struct
+{
+    const char *name;
+    rz_engine_t engine;
+} bench_engines[] = {
+    {"interp", RZ_ENGINE_INTERP},
+    {"threaded", RZ_ENGINE_THREADED},
+    {"jit", RZ_ENGINE_JIT},
+};
+
+#define BENCH_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Пиковый размер резидентной памяти процесса в КиБ
+static unsigned long long bench_peak_rss_kb(void)
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (unsigned long long)pmc.PeakWorkingSetSize / 1024u;
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return (unsigned long long)ru.ru_maxrss / 1024u; // байты
+#else
+    return (unsigned long long)ru.ru_maxrss; // КиБ
+#endif
+#endif
+}
+
+typedef struct
+{
+    char kernel[32], engine[16];
+    double mips;
+} bench_baseline_t;
+
+// Прошлые результаты в CSV того же формата, что пишет --csv
+static size_t bench_read_baseline(const char *path, bench_baseline_t *out, size_t max)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+    char line[256];
+    size_t n = 0;
+    while (n < max && fgets(line, sizeof(line), file))
+    {
+        bench_baseline_t *b = &out[n];
+        unsigned long long instructions;
+        double seconds;
+        if (sscanf(line, "%31[^,],%15[^,],%llu,%lf,%lf", b->kernel, b->engine, &instructions, &seconds, &b->mips) == 5)
+            ++n;
+    }
+    fclose(file);
+    return n;
+}
+
+// Один прогон ядра: свежая машина, код в начале текста, бюджет инструкций
+static bool bench_run(const bench_asm_t *a, rz_engine_t engine, unsigned jit_threshold,
+                      uint64_t instructions, uint64_t *ns)
+{
+    rz_machine_p m = rz_machine_create(0);
+    if (!m)
+        return false;
+    memcpy(mem_access(&m->mem, TEXT_OFFSET), a->code, a->count * sizeof(uint32_t));
+    if (engine == RZ_ENGINE_JIT)
+        rz_jit_set_threshold(m->cpu, jit_threshold);
+    rz_set_engine(m->cpu, engine);
+
+    uint64_t start = rz_clock_ns();
+    rz_run_result_t r = rz_run(m->cpu, instructions);
+    *ns = rz_clock_ns() - start;
+    rz_machine_free(m);
+
+    if (r.reason != RZ_STOP_BUDGET || r.retired != instructions)
+    {
+        fprintf(stderr, "Kernel stopped: %s after %llu instructions\n", rz_stop_name(r.reason),
+                (unsigned long long)r.retired);
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --kernel=NAME        run only this kernel (alu, branch, muldiv, memcpy, strlen,\n"
+            "                       recursive, stack)\n"
+            "  --engine=interp|threaded|jit|all\n"
+            "                       engines to measure, all by default\n"
+            "  --instructions=N     instructions per run (default %llu)\n"
+            "  --repeat=N           runs per kernel, best time is reported\n"
+            "  --jit-threshold=N    executions before a block is translated\n"
+            "  --csv=FILE           write results as CSV, - for stdout\n"
+            "  --baseline=FILE      compare MIPS with CSV of an earlier run\n",
+            prog, BENCH_DEFAULT_INSTRUCTIONS);
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *kernel = NULL;
+    const char *engine = "all";
+    uint64_t instructions = BENCH_DEFAULT_INSTRUCTIONS;
+    unsigned repeat = 3;
+    unsigned jit_threshold = RZ_JIT_DEFAULT_THRESHOLD;
+    const char *csv = NULL;
+    const char *baseline = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--kernel=", 9) == 0)
+        {
+            kernel = arg + 9;
+        }
+        else if (strncmp(arg, "--engine=", 9) == 0)
+        {
+            engine = arg + 9;
+        }
+        else if (strncmp(arg, "--instructions=", 15) == 0)
+        {
+            instructions = strtoull(arg + 15, NULL, 0);
+        }
+        else if (strncmp(arg, "--repeat=", 9) == 0)
+        {
+            repeat = (unsigned)strtoul(arg + 9, NULL, 0);
+        }
+        else if (strncmp(arg, "--jit-threshold=", 16) == 0)
+        {
+            jit_threshold = (unsigned)strtoul(arg + 16, NULL, 0);
+        }
+        else if (strncmp(arg, "--csv=", 6) == 0)
+        {
+            csv = arg + 6;
+        }
+        else if (strncmp(arg, "--baseline=", 11) == 0)
+        {
+            baseline = arg + 11;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (instructions == 0 || repeat == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bench_baseline_t base[BENCH_BASELINE_MAX];
+    size_t base_count = baseline ? bench_read_baseline(baseline, base, BENCH_BASELINE_MAX) : 0;
+
+    FILE *out = NULL;
+    if (csv)
+    {
+        out = strcmp(csv, "-") == 0 ? stdout : fopen(csv, "w");
+        if (!out)
+        {
+            perror(csv);
+            return 1;
+        }
+        fprintf(out, "kernel,engine,instructions,seconds,mips,ns_per_insn,peak_rss_kb\n");
+    }
+
+    if (!rz_jit_available() && (strcmp(engine, "jit") == 0 || strcmp(engine, "all") == 0))
+        fprintf(stderr, "Native translation is not available, jit runs are interpreted\n");
+    fprintf(stderr, "%-10s %-9s %12s %9s %9s %8s %10s%s\n", "kernel", "engine", "instructions", "seconds",
+            "MIPS", "ns/insn", "peak KiB", base_count ? "   vs base" : "");
+
+    bool ok = true, found = false;
+    for (size_t k = 0; k < BENCH_COUNT(bench_kernels); ++k)
+    {
+        if (kernel && strcmp(kernel, bench_kernels[k].name) != 0)
+            continue;
+        bench_asm_t a = {0};
+        bench_kernels[k].build(&a);
+        if (!bench_link(&a))
+        {
+            fprintf(stderr, "%s: kernel does not fit\n", bench_kernels[k].name);
+            ok = false;
+            continue;
+        }
+
+        for (size_t e = 0; e < BENCH_COUNT(bench_engines); ++e)
+        {
+            if (strcmp(engine, "all") != 0 && strcmp(engine, bench_engines[e].name) != 0)
+                continue;
+            found = true;
+
+            // Лучшее из нескольких прогонов меньше всего зависит от шума
+            uint64_t best = UINT64_MAX;
+            for (unsigned r = 0; r < repeat; ++r)
+            {
+                uint64_t ns;
+                if (!bench_run(&a, bench_engines[e].engine, jit_threshold, instructions, &ns))
+                {
+                    ok = false;
+                    break;
+                }
+                if (ns < best)
+                    best = ns;
+            }
+            if (best == UINT64_MAX)
+                continue;
+
+            double seconds = (double)best / 1e9;
+            double mips = best ? (double)instructions * 1e3 / (double)best : 0.0;
+            double ns_per_insn = (double)best / (double)instructions;
+            unsigned long long rss = bench_peak_rss_kb();
+
+            fprintf(stderr, "%-10s %-9s %12llu %9.3f %9.1f %8.2f %10llu", bench_kernels[k].name,
+                    bench_engines[e].name, (unsigned long long)instructions, seconds, mips, ns_per_insn, rss);
+            for (size_t b = 0; b < base_count; ++b)
+                if (strcmp(base[b].kernel, bench_kernels[k].name) == 0 &&
+                    strcmp(base[b].engine, bench_engines[e].name) == 0 && base[b].mips > 0)
+                    fprintf(stderr, " %+8.1f%%", (mips / base[b].mips - 1.0) * 100.0);
+            fputc('\n', stderr);
+
+            if (out)
+                fprintf(out, "%s,%s,%llu,%.6f,%.3f,%.4f,%llu\n", bench_kernels[k].name, bench_engines[e].name,
+                        (unsigned long long)instructions, seconds, mips, ns_per_insn, rss);
+        }
+    }
+
+    if (out && out != stdout)
+        fclose(out);
+    if (!found)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    return ok ? 0 : 2;
+}
@@ -3,193 +3,24 @@
 #include <string.h> // Функции для работы с памятью (memset и др.)
 #include <stdlib.h> // Стандартные функции (malloc, free и др.)
 #include <assert.h> // Макрос assert для отладки
+#include <time.h>   // Часы для ограничения времени исполнения
 
 #include "misc.h"   // Пользовательские типы (rz_register_t и др.)
 #include "cpu.h"    // Интерфейс CPU
 #include "memory.h" // Интерфейс памяти
+#include "machine.h"
 #include "ecall.h"
-
-#define FUNC3_OFFS 12                         // Смещение поля func3 в инструкции (12 бит)
-#define FUNC7_OFFS 24                         // Смещение поля func7 в инструкции (24 бита)
-#define OPCODE_MASK 0b1111111u                // Маска для выделения 7-битного кода операции (opcode)
-#define FUNC3_MASK (0b111u << FUNC3_OFFS)     // Маска для выделения поля func3
-#define FUNC7_MASK (0b1111111u << FUNC7_OFFS) // Маска для выделения поля func7
+#include "exec.h"   // Семантика операций, общая для движков
+#include "threaded.h"
+#include "jit.h"
+#include "profile.h"
+#include "timing.h"
 
 const char *rz_cpu_info(const rz_cpu_p pcpu)
 {
     return pcpu->info;
 }
 
-// Определения форматов инструкций
-enum rz_formats : unsigned
-{
-    LUI_FORMAT = 0b0110111u,
-    AUIPC_FORMAT = 0b0010111u,
-    J_FORMAT = 0b1101111u,
-    JALR_FORMAT = 0b1100111u,
-    R_FORMAT = 0b0110011u,
-    S_FORMAT = 0b0100011u,
-    L_FORMAT = 0b0000011u,
-    I_FORMAT = 0b0010011u,
-    MEM_FORMAT = 0b0001111u,
-    SYS_FORMAT = 0b1110011u,
-    B_FORMAT = 0b1100011u,
-};
-
-// Коды инструкций R-формата с соответствующими func3 и func7
-enum rz_r_codes : unsigned
-{
-    ADD_CODE = R_FORMAT | (0b000u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SUB_CODE = R_FORMAT | (0b000u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
-    XOR_CODE = R_FORMAT | (0b100u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SLL_CODE = R_FORMAT | (0b001u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SLT_CODE = R_FORMAT | (0b010u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SLTU_CODE = R_FORMAT | (0b011u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SRL_CODE = R_FORMAT | (0b101u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SRA_CODE = R_FORMAT | (0b101u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
-    OR_CODE = R_FORMAT | (0b110u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    AND_CODE = R_FORMAT | (0b111u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-};
-
-// Коды инструкций I-формата с func3 и func7 (для сдвигов)
-enum rz_i_codes : unsigned
-{
-    ADDI_CODE = I_FORMAT | (0b000u << FUNC3_OFFS),
-    SLLI_CODE = I_FORMAT | (0b001u << FUNC3_OFFS),
-    SLTI_CODE = I_FORMAT | (0b010u << FUNC3_OFFS),
-    SLTIU_CODE = I_FORMAT | (0b011u << FUNC3_OFFS),
-    XORI_CODE = I_FORMAT | (0b100u << FUNC3_OFFS),
-    ORI_CODE = I_FORMAT | (0b110u << FUNC3_OFFS),
-    ANDI_CODE = I_FORMAT | (0b111u << FUNC3_OFFS),
-    SRLI_CODE = I_FORMAT | (0b101u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
-    SRAI_CODE = I_FORMAT | (0b101u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
-    JALR_CODE = JALR_FORMAT | (0b000u << FUNC3_OFFS),
-};
-
-/**
- * @brief U-format code
- */
-enum rz_u_codes : unsigned
-{
-    LUI_CODE = LUI_FORMAT,
-    AUIPC_CODE = AUIPC_FORMAT,
-};
-
-/**
- * @brief J-format code
- */
-enum rz_j_codes : unsigned
-{
-    JAL_CODE = J_FORMAT,
-};
-
-/**
- * @brief B-format code
- */
-enum rz_b_codes : unsigned
-{
-    BEQ_CODE = B_FORMAT | (0b000u << FUNC3_OFFS),
-    BNE_CODE = B_FORMAT | (0b001u << FUNC3_OFFS),
-    BLT_CODE = B_FORMAT | (0b100u << FUNC3_OFFS),
-    BGE_CODE = B_FORMAT | (0b101u << FUNC3_OFFS),
-    BLTU_CODE = B_FORMAT | (0b110u << FUNC3_OFFS),
-    BGEU_CODE = B_FORMAT | (0b111u << FUNC3_OFFS),
-};
-
-/**
- * @brief L-format code (load instructions)
- */
-enum rz_l_codes : unsigned
-{
-    LB_CODE = L_FORMAT | (0b000u << FUNC3_OFFS),
-    LH_CODE = L_FORMAT | (0b001u << FUNC3_OFFS),
-    LW_CODE = L_FORMAT | (0b010u << FUNC3_OFFS),
-    LBU_CODE = L_FORMAT | (0b100u << FUNC3_OFFS),
-    LHU_CODE = L_FORMAT | (0b101u << FUNC3_OFFS),
-};
-
-/**
- * @brief S-format code (store instructions)
- */
-enum rz_s_codes : unsigned
-{
-    SB_CODE = S_FORMAT | (0b000u << FUNC3_OFFS),
-    SH_CODE = S_FORMAT | (0b001u << FUNC3_OFFS),
-    SW_CODE = S_FORMAT | (0b010u << FUNC3_OFFS),
-};
-
-// Коды для MEM-формата (FENCE и FENCE.I)
-enum rz_mem_codes : unsigned
-{
-    FENCE_CODE = MEM_FORMAT | (0b000u << FUNC3_OFFS),
-    FENCE_I_CODE = MEM_FORMAT | (0b001u << FUNC3_OFFS),
-};
-
-// Коды для sys-формата
-enum rz_sys_codes : unsigned
-{
-    ECALL_CODE = SYS_FORMAT,
-    EBREAK_CODE = SYS_FORMAT | (1u << 20),
-};
-
-// Объединение для декодирования инструкций
-typedef union
-{
-    rz_register_t whole;
-    struct
-    {
-        unsigned op : 7;
-        unsigned rd : 5;
-        unsigned f3 : 3;
-        unsigned rs1 : 5;
-        unsigned rs2 : 5;
-        unsigned f7 : 7;
-    } r;
-    struct
-    {
-        unsigned op : 7;
-        unsigned rd : 5;
-        unsigned f3 : 3;
-        unsigned rs1 : 5;
-        unsigned imm0_11 : 12;
-    } i;
-    struct
-    {
-        unsigned op : 7;
-        unsigned imm0_4 : 5;
-        unsigned f3 : 3;
-        unsigned rs1 : 5;
-        unsigned rs2 : 5;
-        unsigned imm5_11 : 7;
-    } s;
-    struct
-    {
-        unsigned op : 7;
-        unsigned imm11 : 1;
-        unsigned imm1_4 : 4;
-        unsigned f3 : 3;
-        unsigned rs1 : 5;
-        unsigned rs2 : 5;
-        unsigned imm5_10 : 6;
-        unsigned imm12 : 1;
-    } b;
-    struct
-    {
-        unsigned op : 7;
-        unsigned rd : 5;
-        unsigned imm12_31 : 20;
-    } u;
-    struct
-    {
-        unsigned op : 7;
-        unsigned rd : 5;
-        unsigned imm12_19 : 8;
-        unsigned imm11 : 1;
-        unsigned imm1_10 : 10;
-        unsigned imm20 : 1;
-    } j;
-} rz_instruction_t;
-
 // Структура CPU
 // struct rz_cpu_s
 //{
@@ -198,470 +29,680 @@ typedef union
 //};
 
 // Функция создания CPU
-rz_cpu_p rz_create_cpu(void)
+rz_cpu_p rz_create_cpu(rz_machine_p m)
 {
-    rz_cpu_p pcpu = malloc(sizeof(rz_cpu_t));
+    rz_cpu_p pcpu = rz_arena_alloc(&m->arena, sizeof(rz_cpu_t));
+    if (!pcpu)
+        return NULL;
     pcpu->info = "RISC-Z.32.2023";
 
     pcpu->r_pc = TEXT_OFFSET;
+    pcpu->mem = &m->mem;
+    pcpu->machine = m;
 
     memset(pcpu->r_x, 0, sizeof(pcpu->r_x));
+    pcpu->threaded = NULL;
+    pcpu->jit = NULL;
+    pcpu->profile = NULL;
+    pcpu->timing = NULL;
+    pcpu->budget = 0;
+    pcpu->run_budget = 0;
+    pcpu->instret = 0;
+    pcpu->time_base = rz_clock_ns();
+    memset(&pcpu->counters, 0, sizeof(pcpu->counters));
+    pcpu->stop = RZ_STOP_NONE;
+    pcpu->stop_after = RZ_STOP_NONE;
+    pcpu->engine = RZ_ENGINE_INTERP;
+    pcpu->fault = MEM_OK;
+    pcpu->fault_addr = 0;
+    pcpu->exit_code = 0;
     pcpu->r_x[2] = STACK_OFFSET + STACK_SIZE - (unsigned)sizeof(rz_register_t);
     pcpu->r_x[3] = DATA_OFFSET;
 
+    // Память самой структуры принадлежит арене машины
+    if (!rz_icache_init(&pcpu->icache, TEXT_OFFSET, TEXT_SIZE))
+        return NULL;
+
+    if (!rz_trace_init(&pcpu->trace, RZ_TRACE_OFF, RZ_TRACE_DEFAULT_DEPTH))
+    {
+        rz_icache_free(&pcpu->icache);
+        return NULL;
+    }
+
     return pcpu;
 }
 
 // Функция освобождения CPU
 void rz_free_cpu(rz_cpu_p pcpu)
 {
-    free(pcpu);
+    rz_jit_free(pcpu->jit);
+    rz_threaded_free(pcpu->threaded);
+    rz_trace_free(&pcpu->trace);
+    rz_icache_free(&pcpu->icache);
 }
 
-// Функция знакового расширения
-static inline rz_register_t sign_extend(unsigned some_bits, int how_many_bits)
+bool rz_cpu_set_text(rz_cpu_p pcpu, rz_address_t base, size_t size)
 {
-    rz_register_t result = some_bits;
-    if (1 << (how_many_bits - 1) & result)
-        result |= -1 << how_many_bits;
-    return result;
+    rz_icache_t icache;
+    if (!rz_icache_init(&icache, base, size))
+        return false;
+    rz_icache_free(&pcpu->icache);
+    pcpu->icache = icache;
+
+    // Движки построены над старым кэшем и будут созданы заново
+    rz_jit_free(pcpu->jit);
+    pcpu->jit = NULL;
+    rz_threaded_free(pcpu->threaded);
+    pcpu->threaded = NULL;
+    return true;
 }
 
-// Обработка R-формата (арифметика регистр-регистр)
-bool rz_r_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+// Вывод последних записей трассы при аварийной остановке
+static void rz_trace_halt(rz_cpu_p pcpu)
 {
-    printf("[rz_r_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    unsigned opcode_f3_f7 = instr.whole & (OPCODE_MASK | FUNC3_MASK | FUNC7_MASK);
-    switch (opcode_f3_f7)
-    {
-    case ADD_CODE:
-        printf("  ADD x%d = x%d + x%d\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] + pcpu->r_x[instr.r.rs2];
-        break;
-    case SUB_CODE:
-        printf("  SUB x%d = x%d - x%d\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] - pcpu->r_x[instr.r.rs2];
-        break;
-    case XOR_CODE:
-        printf("  XOR x%d = x%d ^ x%d\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] ^ pcpu->r_x[instr.r.rs2];
-        break;
-    case SLL_CODE:
-    {
-        unsigned shamt = pcpu->r_x[instr.r.rs2] & 0x1F;
-        printf("  SLL x%d = x%d << %u\n", instr.r.rd, instr.r.rs1, shamt);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] << shamt;
-    }
-    break;
-    case SLT_CODE:
-        printf("  SLT x%d = (x%d < x%d) ? 1 : 0\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = ((int32_t)pcpu->r_x[instr.r.rs1] < (int32_t)pcpu->r_x[instr.r.rs2]) ? 1 : 0;
-        break;
-    case SLTU_CODE:
-        printf("  SLTU x%d = (x%d < x%d) ? 1 : 0\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = (pcpu->r_x[instr.r.rs1] < pcpu->r_x[instr.r.rs2]) ? 1 : 0;
-        break;
-    case SRL_CODE:
+    if (RZ_TRACE_ENABLED(&pcpu->trace) && pcpu->trace.dump_depth)
+        rz_trace_dump(&pcpu->trace, stderr, pcpu->trace.dump_depth);
+}
+
+// Остановка по ошибке доступа к памяти; PC остаётся на инструкции
+bool rz_cpu_fault(rz_cpu_p pcpu, mem_fault_t fault, rz_address_t addr)
+{
+    fprintf(stderr, "  Memory fault (%s) at address 0x%08X, PC=0x%08X: stopping simulation.\n",
+            mem_fault_name(fault), addr, pcpu->r_pc);
+    pcpu->fault = fault;
+    pcpu->fault_addr = addr;
+    pcpu->stop = RZ_STOP_MEMORY_FAULT;
+    rz_trace_halt(pcpu);
+    return false;
+}
+
+// Поиск пары для только что декодированной в кэш инструкции; следующая
+// декодируется заранее в свой слот. Запись в любую из двух инвалидирует обе
+static void rz_fuse_check(rz_cpu_p pcpu, rz_decoded_p d)
+{
+    rz_address_t next = pcpu->r_pc + d->size;
+    rz_decoded_p b = rz_icache_slot(&pcpu->icache, next);
+    if (b == NULL)
+        return;
+    if (b->op == RZ_OP_UNDECODED)
     {
-        unsigned shamt = pcpu->r_x[instr.r.rs2] & 0x1F;
-        printf("  SRL x%d = x%d >> %u (logical)\n", instr.r.rd, instr.r.rs1, shamt);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] >> shamt;
+        rz_register_t raw;
+        if (mem_fetch(pcpu->mem, next, &raw) != MEM_OK)
+            return; // ошибку выборки сообщит сама инструкция, если до неё дойдёт
+        rz_decode(raw, b);
     }
-    break;
-    case SRA_CODE:
+    d->fuse = rz_fuse_pair(d, b);
+}
+
+// Выборка инструкции: из кэша предекодированных инструкций, если PC попадает
+// в область текста, иначе декодирование во временную запись; NULL — ошибка выборки
+static inline const rz_decoded_t *rz_fetch(rz_cpu_p pcpu, rz_decoded_p scratch)
+{
+    rz_decoded_p d = rz_icache_slot(&pcpu->icache, pcpu->r_pc);
+    if (d != NULL && d->op != RZ_OP_UNDECODED)
+        return d;
+    if (d == NULL)
+        d = scratch;
+
+    rz_register_t raw;
+    mem_fault_t fault = mem_fetch(pcpu->mem, pcpu->r_pc, &raw);
+    if (fault != MEM_OK)
     {
-        unsigned shamt = pcpu->r_x[instr.r.rs2] & 0x1F;
-        printf("  SRA x%d = x%d >> %u (arithmetic)\n", instr.r.rd, instr.r.rs1, shamt);
-        pcpu->r_x[instr.r.rd] = (rz_register_t)((int32_t)pcpu->r_x[instr.r.rs1] >> shamt);
-    }
-    break;
-    case OR_CODE:
-        printf("  OR x%d = x%d | x%d\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] | pcpu->r_x[instr.r.rs2];
-        break;
-    case AND_CODE:
-        printf("  AND x%d = x%d & x%d\n", instr.r.rd, instr.r.rs1, instr.r.rs2);
-        pcpu->r_x[instr.r.rd] = pcpu->r_x[instr.r.rs1] & pcpu->r_x[instr.r.rs2];
-        break;
-    default:
-        printf("  Unknown R-format instruction\n");
-        return false;
+        rz_cpu_fault(pcpu, fault, pcpu->r_pc);
+        return NULL;
     }
-    return true;
+    rz_decode(raw, d);
+    if (d != scratch)
+        rz_fuse_check(pcpu, d);
+    return d;
 }
 
-// Обработка I-формата (арифметика с немедленным)
-bool rz_i_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+// Счётчики, доступные программе (Zicntr); cycle берётся из модели времени,
+// без неё равен instret. Запись и неизвестные CSR — недопустимая инструкция
+static bool rz_csr(rz_cpu_p pcpu, const rz_decoded_t *d)
 {
-    printf("[rz_i_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    unsigned func3 = (instr.whole & FUNC3_MASK) >> FUNC3_OFFS;
-    unsigned func7 = (instr.whole & FUNC7_MASK) >> FUNC7_OFFS;
-
-    switch (instr.whole & OPCODE_MASK)
+    bool write = d->op == RZ_OP_CSRRW || d->op == RZ_OP_CSRRWI || d->rs1 != 0;
+    uint64_t value = 0;
+    switch (d->imm & ~0x80u)
     {
-    case I_FORMAT:
-        switch (func3)
+    case RZ_CSR_CYCLE:
+        if (pcpu->timing)
         {
-        case 0b000: // ADDI
-            printf("  ADDI x%d = x%d + %d\n", instr.i.rd, instr.i.rs1, sign_extend(instr.i.imm0_11, 12));
-            pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] + sign_extend(instr.i.imm0_11, 12);
-            break;
-        case 0b001: // SLLI
-            if (func7 == 0b0000000)
-            {
-                unsigned shamt = instr.i.imm0_11 & 0x1F;
-                printf("  SLLI x%d = x%d << %u\n", instr.i.rd, instr.i.rs1, shamt);
-                pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] << shamt;
-            }
-            else
-            {
-                printf("  Unknown SLLI func7\n");
-                return false;
-            }
-            break;
-        case 0b010: // SLTI
-            printf("  SLTI x%d = (x%d < %d) ? 1 : 0\n", instr.i.rd, instr.i.rs1, sign_extend(instr.i.imm0_11, 12));
-            pcpu->r_x[instr.i.rd] = ((int32_t)pcpu->r_x[instr.i.rs1] < (int32_t)sign_extend(instr.i.imm0_11, 12)) ? 1 : 0;
+            value = rz_timing_cycles(pcpu->timing);
             break;
-        case 0b011: // SLTIU
-            printf("  SLTIU x%d = (x%d < %u) ? 1 : 0\n", instr.i.rd, instr.i.rs1, (unsigned)(instr.i.imm0_11 & 0xFFF));
-            pcpu->r_x[instr.i.rd] = (pcpu->r_x[instr.i.rs1] < (rz_register_t)(instr.i.imm0_11 & 0xFFF)) ? 1 : 0;
-            break;
-        case 0b100: // XORI
-            printf("  XORI x%d = x%d ^ %d\n", instr.i.rd, instr.i.rs1, sign_extend(instr.i.imm0_11, 12));
-            pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] ^ sign_extend(instr.i.imm0_11, 12);
-            break;
-        case 0b101: // SRLI or SRAI
-            if (func7 == 0b0000000)
-            {
-                unsigned shamt = instr.i.imm0_11 & 0x1F;
-                printf("  SRLI x%d = x%d >> %u (logical)\n", instr.i.rd, instr.i.rs1, shamt);
-                pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] >> shamt;
-            }
-            else if (func7 == 0b0100000)
-            {
-                unsigned shamt = instr.i.imm0_11 & 0x1F;
-                printf("  SRAI x%d = x%d >> %u (arithmetic)\n", instr.i.rd, instr.i.rs1, shamt);
-                pcpu->r_x[instr.i.rd] = (rz_register_t)((int32_t)pcpu->r_x[instr.i.rs1] >> shamt);
-            }
-            else
-            {
-                printf("  Unknown SRLI/SRAI func7\n");
-                return false;
-            }
-            break;
-        case 0b110: // ORI
-            printf("  ORI x%d = x%d | %d\n", instr.i.rd, instr.i.rs1, sign_extend(instr.i.imm0_11, 12));
-            pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] | sign_extend(instr.i.imm0_11, 12);
-            break;
-        case 0b111: // ANDI
-            printf("  ANDI x%d = x%d & %d\n", instr.i.rd, instr.i.rs1, sign_extend(instr.i.imm0_11, 12));
-            pcpu->r_x[instr.i.rd] = pcpu->r_x[instr.i.rs1] & sign_extend(instr.i.imm0_11, 12);
-            break;
-        default:
-            printf("  Unknown I-format func3\n");
-            return false;
         }
+        value = rz_cpu_instret(pcpu);
         break;
+    case RZ_CSR_INSTRET:
+        value = rz_cpu_instret(pcpu);
+        break;
+    case RZ_CSR_TIME:
+    {
+        // Время — ввод извне, обработчик машины может его подменить
+        rz_machine_p m = pcpu->machine;
+        value = (rz_clock_ns() - pcpu->time_base) / 1000u; // микросекунды
+        if (m->io.time)
+            value = m->io.time(m->io.ctx, value);
+        break;
+    }
     default:
-        printf("  Unknown I-format opcode\n");
-        return false;
+        write = true;
+        break;
     }
-    return true;
-}
-
-// Обработка JAL (Jump and Link)
-bool rz_j_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
-{
-    printf("[rz_j_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    int32_t imm = 0;
-    imm |= (instr.j.imm20 << 20);
-    imm |= (instr.j.imm12_19 << 12);
-    imm |= (instr.j.imm11 << 11);
-    imm |= (instr.j.imm1_10 << 1);
-
-    if (imm & (1 << 20))
+    if (write)
     {
-        imm |= ~((1 << 21) - 1);
+        fprintf(stderr, "Illegal CSR access %s 0x%03X at PC=0x%08X: stopping simulation.\n",
+                rz_op_name(d->op), d->imm, pcpu->r_pc);
+        pcpu->stop = RZ_STOP_INVALID;
+        rz_trace_halt(pcpu);
+        return false;
     }
-
-    printf("  JAL x%d, offset %d\n", instr.j.rd, imm);
-    pcpu->r_x[instr.j.rd] = pcpu->r_pc + sizeof(rz_instruction_t);
-    pcpu->r_pc = pcpu->r_pc + imm;
-
+    // Старшие половины — cycleh, timeh, instreth
+    pcpu->r_x[d->rd] = (rz_register_t)(d->imm & 0x80u ? value >> 32 : value);
     return true;
 }
 
-// обработка JALR (Jump and Link Register)
-bool rz_jalr_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+// Выполнение предекодированной инструкции: один плоский switch по op.
+// flat — константа места вызова: загрузки и записи идут прямо в окно
+// плоской памяти, ошибку доступа ловит страж в rz_interp_run
+RZ_FORCE_INLINE bool rz_execute(rz_cpu_p pcpu, const rz_decoded_t *d, bool flat)
 {
-    printf("[rz_jalr_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    unsigned func3 = (instr.whole & FUNC3_MASK) >> FUNC3_OFFS;
-    if (func3 != 0b000)
-    {
-        printf("  Unsupported JALR func3: %u\n", func3);
-        return false;
-    }
-
-    int32_t imm = sign_extend(instr.i.imm0_11, 12);
+    rz_register_t *x = pcpu->r_x;
+    rz_register_t pc = pcpu->r_pc;
 
-    rz_register_t target = (pcpu->r_x[instr.i.rs1] + imm) & ~1u;
-    printf("  JALR x%d, x%d + %d = 0x%08X\n", instr.i.rd, instr.i.rs1, imm, target);
-    pcpu->r_x[instr.i.rd] = pcpu->r_pc + sizeof(rz_instruction_t);
-    pcpu->r_pc = target;
-
-    return true;
-}
+    switch (d->op)
+    {
+#define RZ_CASE_SIMPLE(name, expr) \
+    case RZ_OP_##name:             \
+        expr;                      \
+        break;
+        RZ_EXEC_SIMPLE(RZ_CASE_SIMPLE)
+#undef RZ_CASE_SIMPLE
+
+#define RZ_CASE_BRANCH(name, cond)                                           \
+    case RZ_OP_##name:                                                       \
+        if (!(cond))                                                         \
+            break;                                                           \
+        ++pcpu->counters.taken;                                              \
+        pcpu->r_pc = pc + d->imm;                                            \
+        return true;
+        RZ_EXEC_BRANCH(RZ_CASE_BRANCH)
+#undef RZ_CASE_BRANCH
+
+#define RZ_CASE_LOAD(name, bits, type)                                                       \
+    case RZ_OP_##name:                                                                       \
+    {                                                                                        \
+        uint##bits##_t val;                                                                  \
+        mem_fault_t fault = flat ? mem_flat_load##bits(pcpu->mem, RZ_EXEC_ADDR, &val)        \
+                                 : mem_load##bits(pcpu->mem, RZ_EXEC_ADDR, &val);            \
+        if (fault != MEM_OK)                                                                 \
+            return rz_cpu_fault(pcpu, fault, RZ_EXEC_ADDR);                                  \
+        x[d->rd] = (rz_register_t)(type)val;                                                 \
+    }                                                                                        \
+    break;
+        RZ_EXEC_LOAD(RZ_CASE_LOAD)
+#undef RZ_CASE_LOAD
+
+// Запись в текст инвалидирует кэш инструкций
+#define RZ_CASE_STORE(name, bits)                                                            \
+    case RZ_OP_##name:                                                                       \
+    {                                                                                        \
+        rz_address_t addr = RZ_EXEC_ADDR;                                                    \
+        uint##bits##_t val = (uint##bits##_t)x[d->rs2];                                      \
+        mem_fault_t fault = flat ? mem_flat_store##bits(pcpu->mem, addr, val)                \
+                                 : mem_store##bits(pcpu->mem, addr, val);                    \
+        if (fault != MEM_OK)                                                                 \
+            return rz_cpu_fault(pcpu, fault, addr);                                          \
+        rz_icache_invalidate(&pcpu->icache, addr, bits / 8);                                 \
+    }                                                                                        \
+    break;
+        RZ_EXEC_STORE(RZ_CASE_STORE)
+#undef RZ_CASE_STORE
 
-// Обработка B-формата (ветвления)
-bool rz_b_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
-{
-    printf("[rz_b_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    int32_t imm = 0;
-    imm |= (instr.b.imm12 << 12);
-    imm |= (instr.b.imm11 << 11);
-    imm |= (instr.b.imm1_4 << 1);
-    imm |= (instr.b.imm5_10 << 5);
-
-    if (imm & (1 << 12))
+    case RZ_OP_AUIPC:
+        x[d->rd] = pc + d->imm;
+        break;
+    case RZ_OP_JAL:
+        x[d->rd] = pc + d->size;
+        pcpu->r_pc = pc + d->imm;
+        if (pcpu->profile && rz_profile_is_linkage(d))
+            rz_profile_jump(pcpu->profile, d, pc, pcpu->r_pc);
+        return true;
+    case RZ_OP_JALR:
     {
-        imm |= ~((1 << 13) - 1);
+        rz_register_t target = RZ_EXEC_ADDR & ~1u;
+        x[d->rd] = pc + d->size;
+        pcpu->r_pc = target;
+        if (pcpu->profile && rz_profile_is_linkage(d))
+            rz_profile_jump(pcpu->profile, d, pc, target);
     }
+        return true;
 
-    unsigned func3 = (instr.whole & FUNC3_MASK) >> FUNC3_OFFS;
-    bool taken = false;
-
-    switch (func3)
-    {
-    case 0b000: // BEQ
-        taken = (pcpu->r_x[instr.b.rs1] == pcpu->r_x[instr.b.rs2]);
-        printf("  BEQ x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
+    case RZ_OP_FENCE:
         break;
-    case 0b001: // BNE
-        taken = (pcpu->r_x[instr.b.rs1] != pcpu->r_x[instr.b.rs2]);
-        printf("  BNE x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
+    case RZ_OP_FENCE_I:
+        // Код мог быть изменён записями в память — сбрасываем весь кэш
+        rz_icache_flush(&pcpu->icache);
         break;
-    case 0b100: // BLT
-        taken = ((int32_t)pcpu->r_x[instr.b.rs1] < (int32_t)pcpu->r_x[instr.b.rs2]);
-        printf("  BLT x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
-        break;
-    case 0b101: // BGE
-        taken = ((int32_t)pcpu->r_x[instr.b.rs1] >= (int32_t)pcpu->r_x[instr.b.rs2]);
-        printf("  BGE x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
-        break;
-    case 0b110: // BLTU
-        taken = (pcpu->r_x[instr.b.rs1] < pcpu->r_x[instr.b.rs2]);
-        printf("  BLTU x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
+    case RZ_OP_ECALL:
+        // Причину остановки при ошибке выставляет rz_ecall_handle
+        if (!rz_ecall_handle(pcpu->machine))
+            return false;
         break;
-    case 0b111: // BGEU
-        taken = (pcpu->r_x[instr.b.rs1] >= pcpu->r_x[instr.b.rs2]);
-        printf("  BGEU x%d, x%d, offset %d : %s\n", instr.b.rs1, instr.b.rs2, imm, taken ? "taken" : "not taken");
+    case RZ_OP_EBREAK:
+        fprintf(stderr, "  EBREAK encountered at PC=0x%08X: stopping simulation.\n", pc);
+        pcpu->stop = RZ_STOP_EBREAK;
+        rz_trace_halt(pcpu);
+        return false;
+    case RZ_OP_CSRRW:
+    case RZ_OP_CSRRS:
+    case RZ_OP_CSRRC:
+    case RZ_OP_CSRRWI:
+    case RZ_OP_CSRRSI:
+    case RZ_OP_CSRRCI:
+        if (!rz_csr(pcpu, d))
+            return false;
         break;
+    case RZ_OP_BREAKPOINT:
+        // Инструкция под точкой останова не исполняется, PC остаётся на ней
+        pcpu->stop = RZ_STOP_BREAKPOINT;
+        return false;
+
     default:
-        printf("  Unknown B-format func3: %u\n", func3);
-        break;
+        fprintf(stderr, "Invalid instruction %08X format, opcode %02X\n", d->raw, d->raw & 0x7Fu);
+        pcpu->stop = RZ_STOP_INVALID;
+        rz_trace_halt(pcpu);
+        return false;
     }
 
-    if (taken)
-        pcpu->r_pc = pcpu->r_pc + imm;
-    else
-        pcpu->r_pc += sizeof(rz_instruction_t);
-
+    pcpu->r_pc = pc + d->size;
     return true;
 }
 
-// Обработка L-формата (загрузки)
-bool rz_l_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+// Исполнение слитой пары a, b за одну диспетчеризацию, с тем же результатом,
+// что и по отдельности. Первая инструкция вычитается из бюджета здесь же:
+// при ошибке во второй она остаётся выполненной, а PC — на второй
+static bool rz_execute_fused(rz_cpu_p pcpu, const rz_decoded_t *a, const rz_decoded_t *b)
 {
-    printf("[rz_l_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    int32_t imm = sign_extend(instr.i.imm0_11, 12);
-    rz_address_t addr = pcpu->r_x[instr.i.rs1] + imm;
+    rz_register_t *x = pcpu->r_x;
+    rz_register_t pc = pcpu->r_pc, next = pc + a->size;
+    bool taken;
 
-    switch ((instr.whole & FUNC3_MASK) >> FUNC3_OFFS)
+    --pcpu->budget;
+    ++pcpu->counters.ops[a->op];
+
+    switch (a->fuse)
     {
-    case 0b000:
-        printf("  LB x%d, %d(x%d)\n", instr.i.rd, imm, instr.i.rs1);
-        {
-            int8_t val = *(int8_t *)mem_access(addr);
-            pcpu->r_x[instr.i.rd] = (rz_register_t)val;
-        }
+    case RZ_FUSE_LUI_ADDI:
+        x[a->rd] = a->imm;
+        x[b->rd] = x[b->rs1] + b->imm;
+        pcpu->r_pc = next + b->size;
         break;
-    case 0b001:
-        printf("  LH x%d, %d(x%d)\n", instr.i.rd, imm, instr.i.rs1);
-        {
-            int16_t val = *(int16_t *)mem_access(addr);
-            pcpu->r_x[instr.i.rd] = (rz_register_t)val;
-        }
-        break;
-    case 0b010:
-        printf("  LW x%d, %d(x%d)\n", instr.i.rd, imm, instr.i.rs1);
+    case RZ_FUSE_AUIPC_JALR:
+    {
+        x[a->rd] = pc + a->imm;
+        rz_register_t target = (x[b->rs1] + b->imm) & ~1u;
+        x[b->rd] = next + b->size;
+        pcpu->r_pc = target;
+        if (pcpu->profile && rz_profile_is_linkage(b))
+            rz_profile_jump(pcpu->profile, b, next, target);
+    }
+    break;
+    case RZ_FUSE_AUIPC_LOAD:
+    {
+        x[a->rd] = pc + a->imm;
+        rz_address_t addr = x[b->rs1] + b->imm;
+        mem_fault_t fault = MEM_OK;
+        switch (b->op)
         {
-            int32_t val = *(int32_t *)mem_access(addr);
-            pcpu->r_x[instr.i.rd] = (rz_register_t)val;
+#define RZ_FUSE_LOAD(name, bits, type)                     \
+    case RZ_OP_##name:                                     \
+    {                                                      \
+        uint##bits##_t val;                                \
+        fault = mem_load##bits(pcpu->mem, addr, &val);     \
+        if (fault == MEM_OK)                               \
+            x[b->rd] = (rz_register_t)(type)val;           \
+    }                                                      \
+    break;
+            RZ_EXEC_LOAD(RZ_FUSE_LOAD)
+#undef RZ_FUSE_LOAD
         }
-        break;
-    case 0b100:
-        printf("  LBU x%d, %d(x%d)\n", instr.i.rd, imm, instr.i.rs1);
+        if (fault != MEM_OK)
         {
-            uint8_t val = *(uint8_t *)mem_access(addr);
-            pcpu->r_x[instr.i.rd] = (rz_register_t)val;
+            pcpu->r_pc = next;
+            return rz_cpu_fault(pcpu, fault, addr);
         }
-        break;
-    case 0b101:
-        printf("  LHU x%d, %d(x%d)\n", instr.i.rd, imm, instr.i.rs1);
+        pcpu->r_pc = next + b->size;
+    }
+    break;
+    case RZ_FUSE_SLT_BRANCH:
+    {
+        bool is_signed = a->op == RZ_OP_SLT || a->op == RZ_OP_SLTI;
+        rz_register_t rhs = a->op == RZ_OP_SLT || a->op == RZ_OP_SLTU ? x[a->rs2] : a->imm;
+        bool less = is_signed ? (int32_t)x[a->rs1] < (int32_t)rhs : x[a->rs1] < rhs;
+        x[a->rd] = less;
+        taken = less == (b->op == RZ_OP_BNE);
+        goto branch;
+    }
+    case RZ_FUSE_ADDI_BNE:
+        x[a->rd] = x[a->rs1] + a->imm;
+        taken = x[b->rs1] != x[b->rs2];
+    branch:
+        if (taken)
         {
-            uint16_t val = *(uint16_t *)mem_access(addr);
-            pcpu->r_x[instr.i.rd] = (rz_register_t)val;
+            ++pcpu->counters.taken;
+            pcpu->r_pc = next + b->imm;
         }
+        else
+            pcpu->r_pc = next + b->size;
         break;
-    default:
-        printf("  Unknown L-format func3\n");
-        return false;
     }
 
+    ++pcpu->counters.ops[b->op];
+    ++pcpu->counters.fused[a->fuse];
     return true;
 }
 
-// Обработка S-формата (сохранения)
-bool rz_s_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+// Выборка и исполнение одной инструкции
+RZ_FORCE_INLINE bool rz_step(rz_cpu_p pcpu, bool flat)
 {
-    printf("[rz_s_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    int32_t imm = 0;
-    imm |= instr.s.imm0_4;
-    imm |= instr.s.imm5_11 << 5;
+    pcpu->r_x[0] = 0u; // Регистры x0 всегда 0
+
+    rz_decoded_t scratch;
+    const rz_decoded_t *d = rz_fetch(pcpu, &scratch);
+    if (d == NULL)
+        return false;
 
-    if (imm & (1 << 11))
+#if RZ_TRACE_MAX > RZ_TRACE_OFF
+    rz_trace_record_p rec = NULL;
+    if (RZ_TRACE_ENABLED(&pcpu->trace))
     {
-        imm |= ~((1 << 12) - 1);
+        rec = rz_trace_next(&pcpu->trace);
+        rec->pc = pcpu->r_pc;
+        rec->level = (uint8_t)pcpu->trace.level;
+        rec->raw = pcpu->trace.level >= RZ_TRACE_FULL ? d->raw : 0;
+        // У записи в память вместо rd — регистр данных, его значение и пишется
+        rec->rd = d->op >= RZ_OP_SB && d->op <= RZ_OP_SW ? d->rs2 : d->rd;
+        rec->addr = pcpu->r_x[d->rs1] + d->imm;
     }
+#endif
+
+    unsigned op = d->op; // запись кэша может смениться при исполнении
+    bool goon = rz_execute(pcpu, d, flat);
+    if (goon)
+        ++pcpu->counters.ops[op];
+
+#if RZ_TRACE_MAX > RZ_TRACE_OFF
+    if (rec)
+        rec->value = pcpu->r_x[rec->rd];
+#endif
 
-    rz_address_t addr = pcpu->r_x[instr.s.rs1] + imm;
+    return goon;
+}
+
+// Основной цикл обработки инструкции
+bool rz_cycle(rz_cpu_p pcpu)
+{
+    return rz_step(pcpu, false);
+}
 
-    switch ((instr.whole & FUNC3_MASK) >> FUNC3_OFFS)
+// Цикл интерпретатора: весь бюджет исполняется без выхода из функции.
+// Счётчик в регистре, но перед каждой инструкцией виден в структуре CPU,
+// по нему CSR instret читается внутри rz_run. Слитая пара исполняется
+// целиком, если бюджет вмещает обе инструкции и трассировка выключена
+RZ_FORCE_INLINE rz_stop_t rz_interp_loop(rz_cpu_p pcpu, bool flat)
+{
+    bool fuse = !RZ_TRACE_ENABLED(&pcpu->trace);
+    int64_t budget = pcpu->budget;
+    while (budget > 0)
     {
-    case 0b000:
-        printf("  SB x%d, %d(x%d)\n", instr.s.rs2, imm, instr.s.rs1);
-        {
-            uint8_t val = (uint8_t)(pcpu->r_x[instr.s.rs2] & 0xFF);
-            *(uint8_t *)mem_access(addr) = val;
-        }
-        break;
-    case 0b001:
-        printf("  SH x%d, %d(x%d)\n", instr.s.rs2, imm, instr.s.rs1);
-        {
-            uint16_t val = (uint16_t)(pcpu->r_x[instr.s.rs2] & 0xFFFF);
-            *(uint16_t *)mem_access(addr) = val;
-        }
-        break;
-    case 0b010:
-        printf("  SW x%d, %d(x%d)\n", instr.s.rs2, imm, instr.s.rs1);
+        pcpu->budget = budget;
+        const rz_decoded_t *d = rz_icache_slot(&pcpu->icache, pcpu->r_pc);
+        if (fuse && budget > 1 && d != NULL && d->fuse != RZ_FUSE_NONE && d->op != RZ_OP_UNDECODED)
         {
-            uint32_t val = (uint32_t)(pcpu->r_x[instr.s.rs2]);
-            *(uint32_t *)mem_access(addr) = val;
+            pcpu->r_x[0] = 0u;
+            if (!rz_execute_fused(pcpu, d, d + d->size / RZ_INSN_ALIGN))
+                return pcpu->stop;
         }
-        break;
-    default:
-        printf("  Unknown S-format func3\n");
-        return false;
+        else if (!rz_step(pcpu, flat))
+            return pcpu->stop;
+        budget = pcpu->budget - 1;
     }
+    pcpu->budget = 0;
+    return RZ_STOP_BUDGET;
+}
 
-    return true;
+typedef struct rz_interp_flat_s
+{
+    rz_cpu_p pcpu;
+    rz_stop_t stop;
+} rz_interp_flat_t;
+
+static void rz_interp_flat(void *ctx)
+{
+    rz_interp_flat_t *run = ctx;
+    run->stop = rz_interp_loop(run->pcpu, true);
+}
+
+// С плоской памятью ошибка доступа прерывает инструкцию до записи PC и rd,
+// бюджет уже в структуре — остаётся сообщить ошибку как при проверенном
+// доступе. С трассировкой запись инструкции не была бы дописана, поэтому
+// тогда доступ проверяется и с плоской памятью
+static rz_stop_t rz_interp_run(rz_cpu_p pcpu)
+{
+    if (!pcpu->mem->flat || RZ_TRACE_ENABLED(&pcpu->trace))
+        return rz_interp_loop(pcpu, false);
+    rz_interp_flat_t run = {pcpu, RZ_STOP_NONE};
+    rz_address_t addr;
+    if (mem_flat_run(pcpu->mem, rz_interp_flat, &run, &addr))
+        return run.stop;
+    bool mapped = mem_access(pcpu->mem, addr) != NULL;
+    rz_cpu_fault(pcpu, mapped ? MEM_FAULT_PERMISSION : MEM_FAULT_UNMAPPED, addr);
+    return pcpu->stop;
+}
+
+void rz_set_engine(rz_cpu_p pcpu, rz_engine_t engine)
+{
+    pcpu->engine = engine;
+}
+
+rz_run_result_t rz_run(rz_cpu_p pcpu, uint64_t budget)
+{
+    rz_run_result_t result;
+
+    // Счётчик бюджета знаковый, чтобы движки могли вычитать блок целиком
+    pcpu->budget = budget > INT64_MAX ? INT64_MAX : (int64_t)budget;
+    pcpu->stop = pcpu->stop_after = RZ_STOP_NONE;
+    pcpu->run_budget = pcpu->budget;
+
+    // Модели времени нужна каждая инструкция — движки блоков не годятся
+    if (pcpu->timing)
+        result.reason = rz_timing_run(pcpu);
+    else if (pcpu->engine == RZ_ENGINE_THREADED)
+        result.reason = rz_threaded_run(pcpu);
+    else if (pcpu->engine == RZ_ENGINE_JIT)
+        result.reason = rz_jit_run(pcpu);
+    else
+        result.reason = rz_interp_run(pcpu);
+
+    if (result.reason == RZ_STOP_BUDGET && pcpu->stop_after != RZ_STOP_NONE)
+        result.reason = pcpu->stop_after;
+    result.retired = (uint64_t)(pcpu->run_budget - pcpu->budget);
+    pcpu->instret += result.retired;
+    pcpu->budget = pcpu->run_budget = 0;
+    return result;
+}
+
+void rz_cpu_stop_after(rz_cpu_p pcpu, rz_stop_t reason)
+{
+    // Текущая инструкция ещё в бюджете: движок вычтет её и остановится,
+    // а неиспользованный остаток исключается из бюджета всего rz_run
+    pcpu->run_budget -= pcpu->budget - 1;
+    pcpu->budget = 1;
+    pcpu->stop_after = reason;
+}
+
+uint64_t rz_cpu_instret(const rz_cpu_p pcpu)
+{
+    return pcpu->instret + (uint64_t)(pcpu->run_budget - pcpu->budget);
 }
 
-// Обработка MEM-формата (FENCE и FENCE.I)
-bool rz_mem_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+void rz_cpu_get_counters(rz_cpu_p pcpu, rz_counters_t *counters)
 {
-    printf("[rz_mem_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    unsigned func3 = (instr.whole & FUNC3_MASK) >> FUNC3_OFFS;
+    // Движки считают исполнения блоков — переносим их в счётчики CPU
+    rz_threaded_fold(pcpu->threaded);
+    rz_jit_fold(pcpu->jit);
+    *counters = pcpu->counters;
+}
 
-    switch (func3)
+// Группа операции для гистограммы
+static const char *rz_op_group(unsigned op)
+{
+    switch (op)
     {
-    case 0b000:
-        printf("  FENCE\n");
-        return true;
-    case 0b001:
-        printf("  FENCE.I\n");
-        return true;
+    case RZ_OP_JALR:
+        return "JALR";
+    case RZ_OP_LUI:
+        return "LUI";
+    case RZ_OP_AUIPC:
+        return "AUIPC";
+    }
+    if (rz_op_is_muldiv(op))
+        return "M";
+    switch (rz_op_format(op))
+    {
+    case 'R':
+        return "R";
+    case 'I':
+        return "I";
+    case 'L':
+        return "L";
+    case 'S':
+        return "S";
+    case 'B':
+        return "B";
+    case 'J':
+        return "J";
     default:
-        printf("  Unknown MEM-format func3\n");
-        return false;
+        return "SYS";
     }
 }
 
-// Обработка SYS-формата (ECALL, EBREAK)
-bool rz_sys_cycle(rz_cpu_p pcpu, rz_instruction_t instr)
+void rz_cpu_print_counters(rz_cpu_p pcpu, FILE *out)
 {
-    printf("[rz_sys_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
-    if ((instr.whole & (1u << 20)) == 0)
+    static const char *const groups[] = {"R", "M", "I", "L", "S", "B", "J", "JALR", "LUI", "AUIPC", "SYS"};
+    static const char *const segments[MEM_SEGMENTS] = {
+        [TEXT_OFFSET >> MEM_SEGMENT_BITS] = "text",
+        [DATA_OFFSET >> MEM_SEGMENT_BITS] = "data",
+        [STACK_OFFSET >> MEM_SEGMENT_BITS] = "stack",
+    };
+    rz_counters_t c;
+    rz_cpu_get_counters(pcpu, &c);
+
+    uint64_t total = 0, branches = 0;
+    for (unsigned op = 0; op < RZ_OP_COUNT; ++op)
     {
-        printf("  ECALL\n");
-        return rz_ecall_handle(pcpu);
+        total += c.ops[op];
+        if (rz_op_format(op) == 'B')
+            branches += c.ops[op];
     }
-    else
+    fprintf(out, "Instructions: %llu\n", (unsigned long long)total);
+    for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); ++g)
     {
-        fprintf(stderr, "  EBREAK encountered at PC=0x%08X: stopping simulation.\n", pcpu->r_pc);
-        return false;
+        uint64_t n = 0;
+        for (unsigned op = 0; op < RZ_OP_COUNT; ++op)
+            if (strcmp(rz_op_group(op), groups[g]) == 0)
+                n += c.ops[op];
+        if (n)
+            fprintf(out, "  %-6s %14llu\n", groups[g], (unsigned long long)n);
+    }
+    fprintf(out, "Branches: %llu taken, %llu not taken\n", (unsigned long long)c.taken,
+            (unsigned long long)(branches - c.taken));
+
+    uint64_t fused = 0;
+    for (unsigned f = 0; f < RZ_FUSE_COUNT; ++f)
+        fused += c.fused[f];
+    if (fused)
+    {
+        fprintf(out, "Fused pairs: %llu\n", (unsigned long long)fused);
+        for (unsigned f = 0; f < RZ_FUSE_COUNT; ++f)
+            if (c.fused[f])
+                fprintf(out, "  %-13s %14llu\n", rz_fuse_name(f), (unsigned long long)c.fused[f]);
     }
+
+    fprintf(out, "Memory:              loads         stores\n");
+    const uint64_t *loads = pcpu->mem->accesses[MEM_LOAD], *stores = pcpu->mem->accesses[MEM_STORE];
+    for (unsigned seg = 0; seg < MEM_SEGMENTS; ++seg)
+        if (loads[seg] || stores[seg])
+            fprintf(out, "  %08X %-5s %14llu %14llu\n", seg << MEM_SEGMENT_BITS,
+                    segments[seg] ? segments[seg] : "", (unsigned long long)loads[seg],
+                    (unsigned long long)stores[seg]);
 }
 
-// Основной цикл обработки инструкции
-bool rz_cycle(rz_cpu_p pcpu)
+uint64_t rz_clock_ns(void)
 {
-    pcpu->r_x[0] = 0u; // Регистры x0 всегда 0
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
 
-    rz_instruction_t instr = *((rz_instruction_t *)mem_access(pcpu->r_pc));
-    printf("[rz_cycle] PC=0x%08X instr=0x%08X\n", pcpu->r_pc, instr.whole);
+#define RZ_RUN_SLICE (1u << 20) // Инструкций между проверками времени
 
-    bool goon = true;
+rz_run_result_t rz_run_timed(rz_cpu_p pcpu, uint64_t budget, uint64_t timeout_ns)
+{
+    rz_run_result_t total = {RZ_STOP_BUDGET, 0};
+    uint64_t deadline = rz_clock_ns() + timeout_ns;
 
-    switch (instr.whole & OPCODE_MASK)
+    while (total.retired < budget)
     {
-    case R_FORMAT:
-        goon = rz_r_cycle(pcpu, instr);
-        break;
-    case I_FORMAT:
-        goon = rz_i_cycle(pcpu, instr);
-        break;
-    case L_FORMAT:
-        goon = rz_l_cycle(pcpu, instr);
-        break;
-    case S_FORMAT:
-        goon = rz_s_cycle(pcpu, instr);
-        break;
-    case LUI_FORMAT:
-        printf("[rz_cycle] LUI x%d = 0x%X\n", instr.u.rd, instr.u.imm12_31 << 12);
-        pcpu->r_x[instr.u.rd] = instr.u.imm12_31 << 12;
-        break;
-    case AUIPC_FORMAT:
-        printf("[rz_cycle] AUIPC x%d = PC + 0x%X\n", instr.u.rd, instr.u.imm12_31 << 12);
-        pcpu->r_x[instr.u.rd] = (instr.u.imm12_31 << 12) + pcpu->r_pc;
-        break;
-    case J_FORMAT:
-        goon = rz_j_cycle(pcpu, instr);
-        break;
-    case JALR_FORMAT:
-        goon = rz_jalr_cycle(pcpu, instr);
-        break;
-    case MEM_FORMAT:
-        goon = rz_mem_cycle(pcpu, instr);
-        break;
-    case SYS_FORMAT:
-        goon = rz_sys_cycle(pcpu, instr);
-        break;
-    case B_FORMAT:
-        goon = rz_b_cycle(pcpu, instr);
-        break;
-    default:
-        fprintf(stderr, "Invalid instruction %08X format, opcode %02X\n", instr.whole, instr.whole & OPCODE_MASK);
-        goon = false;
+        uint64_t slice = budget - total.retired;
+        if (slice > RZ_RUN_SLICE)
+            slice = RZ_RUN_SLICE;
+
+        rz_run_result_t part = rz_run(pcpu, slice);
+        total.retired += part.retired;
+        total.reason = part.reason;
+        if (part.reason != RZ_STOP_BUDGET)
+            break;
+        if (rz_clock_ns() >= deadline)
+        {
+            total.reason = total.retired < budget ? RZ_STOP_DEADLINE : RZ_STOP_BUDGET;
+            break;
+        }
     }
+    return total;
+}
 
-    if ((instr.whole & OPCODE_MASK) != B_FORMAT &&
-        (instr.whole & OPCODE_MASK) != J_FORMAT &&
-        (instr.whole & OPCODE_MASK) != JALR_FORMAT)
+const char *rz_stop_name(rz_stop_t reason)
+{
+    switch (reason)
     {
-        pcpu->r_pc += sizeof(rz_instruction_t);
+    case RZ_STOP_NONE:
+        return "running";
+    case RZ_STOP_BUDGET:
+        return "instruction budget exhausted";
+    case RZ_STOP_DEADLINE:
+        return "time limit reached";
+    case RZ_STOP_EBREAK:
+        return "EBREAK";
+    case RZ_STOP_EXIT:
+        return "exit";
+    case RZ_STOP_INVALID:
+        return "invalid instruction";
+    case RZ_STOP_ECALL_ERROR:
+        return "environment call error";
+    case RZ_STOP_INPUT_ERROR:
+        return "input error";
+    case RZ_STOP_MEMORY_FAULT:
+        return "memory fault";
+    case RZ_STOP_BREAKPOINT:
+        return "breakpoint";
+    case RZ_STOP_MARKER:
+        return "marker";
     }
-
-    return goon;
+    return "unknown";
 }
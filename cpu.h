@@ -2,9 +2,18 @@
 #define __CPU_H__
 
 #include "misc.h"
+#include "decode.h"
+#include "trace.h"
+#include "memory.h"
 #include <stdbool.h>
+#include <stdio.h>
 
 struct rz_cpu_s;
+struct rz_threaded_s;
+struct rz_jit_s;
+struct rz_profile_s;
+struct rz_timing_s;
+struct rz_machine_s;
 
 /**
  * @brief Types to represent instance of RISC-Z CPU and pointer to it
@@ -13,11 +22,79 @@ struct rz_cpu_s;
 typedef struct rz_cpu_s rz_cpu_t, *rz_cpu_p;
 
 /**
- * @brief Create a RISC-Z CPU
+ * @brief Reasons for CPU to stop
  *
+ */
+typedef enum rz_stop_e : unsigned
+{
+	RZ_STOP_NONE = 0,	 // CPU is able to go on
+	RZ_STOP_BUDGET,		 // instruction budget is exhausted
+	RZ_STOP_DEADLINE,	 // time limit is reached
+	RZ_STOP_EBREAK,		 // EBREAK instruction
+	RZ_STOP_EXIT,		 // exit environment call, see exit_code
+	RZ_STOP_INVALID,	 // invalid instruction
+	RZ_STOP_ECALL_ERROR, // unknown or failed environment call
+	RZ_STOP_INPUT_ERROR, // environment call failed to read input
+	RZ_STOP_MEMORY_FAULT, // fetch, load or store faulted, see fault and fault_addr
+	RZ_STOP_BREAKPOINT,	  // PC reached breakpoint of instruction cache, nothing retired there
+	RZ_STOP_MARKER,		  // marker environment call retired, see machine marker
+} rz_stop_t;
+
+/**
+ * @brief Execution engines
+ *
+ */
+typedef enum rz_engine_e : unsigned
+{
+	RZ_ENGINE_INTERP = 0, // predecoding interpreter
+	RZ_ENGINE_THREADED,	  // threaded code with chained basic blocks
+	RZ_ENGINE_JIT,		  // native translation of hot blocks
+} rz_engine_t;
+
+/**
+ * @brief Read-only counter CSRs (Zicntr), high halves are at +0x80
+ *
+ */
+typedef enum rz_csr_e : unsigned
+{
+	RZ_CSR_CYCLE = 0xC00,	// cycles of attached timing model, else equals instret
+	RZ_CSR_TIME = 0xC01,	// microseconds since CPU creation
+	RZ_CSR_INSTRET = 0xC02, // instructions retired
+} rz_csr_t;
+
+/**
+ * @brief Simulator-side counters, always collected
+ *
+ * Threaded and native engines count executions of whole blocks and
+ * fold them in lazily, so read counters with rz_cpu_get_counters.
+ */
+typedef struct rz_counters_s
+{
+	uint64_t ops[RZ_OP_COUNT]; // retired instructions per operation
+	uint64_t taken;			   // taken conditional branches
+	uint64_t fused[RZ_FUSE_COUNT]; // pairs executed as one operation by the interpreter
+} rz_counters_t;
+
+/**
+ * @brief Result of rz_run
+ *
+ */
+typedef struct rz_run_result_s
+{
+	rz_stop_t reason;
+	uint64_t retired; // instructions retired during the call
+} rz_run_result_t;
+
+/**
+ * @brief Create a RISC-Z CPU of machine
+ *
+ * CPU structure is allocated from the machine arena, fetches, loads and
+ * stores go to the machine memory and environment calls to its I/O.
+ *
+ * @param m machine owning CPU
  * @return rz_cpu_p pointer to CPU instance
  */
-rz_cpu_p rz_create_cpu(void);
+rz_cpu_p rz_create_cpu(struct rz_machine_s *m);
 
 /**
  * @brief Deinitialize RISC-Z CPU instance
@@ -26,6 +103,38 @@ rz_cpu_p rz_create_cpu(void);
  */
 void rz_free_cpu(rz_cpu_p pcpu);
 
+/**
+ * @brief Move instruction cache (and engines built on it) to a new text range
+ *
+ * @param pcpu pointer to CPU instance
+ * @param base first address of executable code
+ * @param size size of executable code in bytes
+ * @return true on success, on failure the old range is kept
+ */
+bool rz_cpu_set_text(rz_cpu_p pcpu, rz_address_t base, size_t size);
+
+/**
+ * @brief Report memory fault and stop CPU with RZ_STOP_MEMORY_FAULT
+ *
+ * @param pcpu pointer to CPU instance
+ * @param fault kind of fault
+ * @param addr guest address which faulted
+ * @return false, to be returned by the faulting instruction
+ */
+bool rz_cpu_fault(rz_cpu_p pcpu, mem_fault_t fault, rz_address_t addr);
+
+/**
+ * @brief Stop rz_run right after the instruction being executed retires
+ *
+ * For handlers called during execution (environment calls): the rest
+ * of the budget is dropped, rz_run returns reason instead of
+ * RZ_STOP_BUDGET and counts only instructions actually retired.
+ *
+ * @param pcpu pointer to CPU instance
+ * @param reason stop reason to report
+ */
+void rz_cpu_stop_after(rz_cpu_p pcpu, rz_stop_t reason);
+
 /**
  * @brief Get CPU info string
  *
@@ -43,10 +152,98 @@ const char *rz_cpu_info(const rz_cpu_p pcpu);
  */
 bool rz_cycle(rz_cpu_p pcpu);
 
+/**
+ * @brief Execute instructions until budget is exhausted or CPU stops
+ *
+ * @param pcpu pointer to CPU instance
+ * @param budget maximum number of instructions to retire
+ * @return rz_run_result_t stop reason and number of retired instructions
+ */
+rz_run_result_t rz_run(rz_cpu_p pcpu, uint64_t budget);
+
+/**
+ * @brief Execute instructions until budget is exhausted, time is out or CPU stops
+ *
+ * Time is checked between slices of instructions, so the deadline
+ * may be overrun by the time of one slice.
+ *
+ * @param pcpu pointer to CPU instance
+ * @param budget maximum number of instructions to retire
+ * @param timeout_ns wall time limit in nanoseconds
+ * @return rz_run_result_t stop reason and number of retired instructions
+ */
+rz_run_result_t rz_run_timed(rz_cpu_p pcpu, uint64_t budget, uint64_t timeout_ns);
+
+/**
+ * @brief Get number of retired instructions, exact also inside rz_run
+ *
+ * @param pcpu pointer to CPU instance
+ * @return uint64_t instructions retired since creation
+ */
+uint64_t rz_cpu_instret(const rz_cpu_p pcpu);
+
+/**
+ * @brief Get simulator counters with block counts of engines folded in
+ *
+ * @param pcpu pointer to CPU instance
+ * @param counters output counters
+ */
+void rz_cpu_get_counters(rz_cpu_p pcpu, rz_counters_t *counters);
+
+/**
+ * @brief Print instructions per format, branches and loads/stores per memory segment
+ *
+ * @param pcpu pointer to CPU instance
+ * @param out output stream
+ */
+void rz_cpu_print_counters(rz_cpu_p pcpu, FILE *out);
+
+/**
+ * @brief Get monotonic wall time
+ *
+ * @return uint64_t time in nanoseconds
+ */
+uint64_t rz_clock_ns(void);
+
+/**
+ * @brief Select execution engine used by rz_run
+ *
+ * @param pcpu pointer to CPU instance
+ * @param engine engine identifier
+ */
+void rz_set_engine(rz_cpu_p pcpu, rz_engine_t engine);
+
+/**
+ * @brief Get text description of stop reason
+ *
+ * @param reason stop reason
+ * @return const char* description
+ */
+const char *rz_stop_name(rz_stop_t reason);
+
 struct rz_cpu_s
 {
 	const char *info;
 	rz_register_t r_pc, r_x[32];
+	rz_memory_p mem;			 // guest memory of the machine
+	struct rz_machine_s *machine; // machine owning CPU
+	int64_t budget;	  // instructions left in current rz_run, engines count it down
+	int64_t run_budget; // budget at start of current rz_run, 0 outside of it
+	uint64_t instret; // instructions retired by rz_run since creation
+	uint64_t time_base; // rz_clock_ns at creation, origin of time CSR
+	rz_counters_t counters;
+	rz_stop_t stop;	  // why the last instruction stopped CPU
+	rz_stop_t stop_after; // reason of rz_cpu_stop_after in current rz_run
+	rz_engine_t engine;
+	mem_fault_t fault;		 // memory fault which stopped CPU
+	rz_address_t fault_addr; // guest address of that fault
+	int32_t exit_code;		 // code passed by the exit environment call
+	rz_icache_t icache; // predecoded instructions of the text region
+	rz_trace_t trace;	// ring buffer of retired instructions
+	struct rz_threaded_s *threaded; // threaded-code engine, created on demand
+	struct rz_jit_s *jit;			// native translator, created on demand
+	struct rz_profile_s *profile;	// sampling profiler, tracks calls and returns
+	struct rz_timing_s *timing;		// timing model, interprets every instruction when set
 };
 
 #endif // CPU_H__
@@ -0,0 +1,734 @@
+#include <stdint.h> // Стандартные целочисленные типы с фиксированным размером
+#include <stdio.h>  // snprintf для дизассемблера
+#include <stdlib.h> // calloc, free
+
+#include "misc.h"
+#include "decode.h"
+
+#define FUNC3_OFFS 12                         // Смещение поля func3 в инструкции (12 бит)
+#define FUNC7_OFFS 25                         // Смещение поля func7 в инструкции (25 бит)
+#define OPCODE_MASK 0b1111111u                // Маска для выделения 7-битного кода операции (opcode)
+#define FUNC3_MASK (0b111u << FUNC3_OFFS)     // Маска для выделения поля func3
+#define FUNC7_MASK (0b1111111u << FUNC7_OFFS) // Маска для выделения поля func7
+
+// Определения форматов инструкций
+enum rz_formats : unsigned
+{
+    LUI_FORMAT = 0b0110111u,
+    AUIPC_FORMAT = 0b0010111u,
+    J_FORMAT = 0b1101111u,
+    JALR_FORMAT = 0b1100111u,
+    R_FORMAT = 0b0110011u,
+    S_FORMAT = 0b0100011u,
+    L_FORMAT = 0b0000011u,
+    I_FORMAT = 0b0010011u,
+    MEM_FORMAT = 0b0001111u,
+    SYS_FORMAT = 0b1110011u,
+    B_FORMAT = 0b1100011u,
+};
+
+// Коды инструкций R-формата с соответствующими func3 и func7
+enum rz_r_codes : unsigned
+{
+    ADD_CODE = R_FORMAT | (0b000u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SUB_CODE = R_FORMAT | (0b000u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
+    XOR_CODE = R_FORMAT | (0b100u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SLL_CODE = R_FORMAT | (0b001u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SLT_CODE = R_FORMAT | (0b010u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SLTU_CODE = R_FORMAT | (0b011u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SRL_CODE = R_FORMAT | (0b101u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SRA_CODE = R_FORMAT | (0b101u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
+    OR_CODE = R_FORMAT | (0b110u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    AND_CODE = R_FORMAT | (0b111u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    // Расширение M: func7 = 0000001
+    MUL_CODE = R_FORMAT | (0b000u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    MULH_CODE = R_FORMAT | (0b001u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    MULHSU_CODE = R_FORMAT | (0b010u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    MULHU_CODE = R_FORMAT | (0b011u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    DIV_CODE = R_FORMAT | (0b100u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    DIVU_CODE = R_FORMAT | (0b101u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    REM_CODE = R_FORMAT | (0b110u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+    REMU_CODE = R_FORMAT | (0b111u << FUNC3_OFFS) | (0b0000001u << FUNC7_OFFS),
+};
+
+// Коды инструкций I-формата с func3 и func7 (для сдвигов)
+enum rz_i_codes : unsigned
+{
+    ADDI_CODE = I_FORMAT | (0b000u << FUNC3_OFFS),
+    SLLI_CODE = I_FORMAT | (0b001u << FUNC3_OFFS),
+    SLTI_CODE = I_FORMAT | (0b010u << FUNC3_OFFS),
+    SLTIU_CODE = I_FORMAT | (0b011u << FUNC3_OFFS),
+    XORI_CODE = I_FORMAT | (0b100u << FUNC3_OFFS),
+    ORI_CODE = I_FORMAT | (0b110u << FUNC3_OFFS),
+    ANDI_CODE = I_FORMAT | (0b111u << FUNC3_OFFS),
+    SRLI_CODE = I_FORMAT | (0b101u << FUNC3_OFFS) | (0b0000000u << FUNC7_OFFS),
+    SRAI_CODE = I_FORMAT | (0b101u << FUNC3_OFFS) | (0b0100000u << FUNC7_OFFS),
+    JALR_CODE = JALR_FORMAT | (0b000u << FUNC3_OFFS),
+};
+
+/**
+ * @brief U-format code
+ */
+enum rz_u_codes : unsigned
+{
+    LUI_CODE = LUI_FORMAT,
+    AUIPC_CODE = AUIPC_FORMAT,
+};
+
+/**
+ * @brief J-format code
+ */
+enum rz_j_codes : unsigned
+{
+    JAL_CODE = J_FORMAT,
+};
+
+/**
+ * @brief B-format code
+ */
+enum rz_b_codes : unsigned
+{
+    BEQ_CODE = B_FORMAT | (0b000u << FUNC3_OFFS),
+    BNE_CODE = B_FORMAT | (0b001u << FUNC3_OFFS),
+    BLT_CODE = B_FORMAT | (0b100u << FUNC3_OFFS),
+    BGE_CODE = B_FORMAT | (0b101u << FUNC3_OFFS),
+    BLTU_CODE = B_FORMAT | (0b110u << FUNC3_OFFS),
+    BGEU_CODE = B_FORMAT | (0b111u << FUNC3_OFFS),
+};
+
+/**
+ * @brief L-format code (load instructions)
+ */
+enum rz_l_codes : unsigned
+{
+    LB_CODE = L_FORMAT | (0b000u << FUNC3_OFFS),
+    LH_CODE = L_FORMAT | (0b001u << FUNC3_OFFS),
+    LW_CODE = L_FORMAT | (0b010u << FUNC3_OFFS),
+    LBU_CODE = L_FORMAT | (0b100u << FUNC3_OFFS),
+    LHU_CODE = L_FORMAT | (0b101u << FUNC3_OFFS),
+};
+
+/**
+ * @brief S-format code (store instructions)
+ */
+enum rz_s_codes : unsigned
+{
+    SB_CODE = S_FORMAT | (0b000u << FUNC3_OFFS),
+    SH_CODE = S_FORMAT | (0b001u << FUNC3_OFFS),
+    SW_CODE = S_FORMAT | (0b010u << FUNC3_OFFS),
+};
+
+// Коды для MEM-формата (FENCE и FENCE.I)
+enum rz_mem_codes : unsigned
+{
+    FENCE_CODE = MEM_FORMAT | (0b000u << FUNC3_OFFS),
+    FENCE_I_CODE = MEM_FORMAT | (0b001u << FUNC3_OFFS),
+};
+
+// Коды для sys-формата
+enum rz_sys_codes : unsigned
+{
+    ECALL_CODE = SYS_FORMAT,
+    EBREAK_CODE = SYS_FORMAT | (1u << 20),
+    CSRRW_CODE = SYS_FORMAT | (0b001u << FUNC3_OFFS),
+    CSRRS_CODE = SYS_FORMAT | (0b010u << FUNC3_OFFS),
+    CSRRC_CODE = SYS_FORMAT | (0b011u << FUNC3_OFFS),
+    CSRRWI_CODE = SYS_FORMAT | (0b101u << FUNC3_OFFS),
+    CSRRSI_CODE = SYS_FORMAT | (0b110u << FUNC3_OFFS),
+    CSRRCI_CODE = SYS_FORMAT | (0b111u << FUNC3_OFFS),
+};
+
+// Объединение для декодирования инструкций
+typedef union
+{
+    rz_register_t whole;
+    struct
+    {
+        unsigned op : 7;
+        unsigned rd : 5;
+        unsigned f3 : 3;
+        unsigned rs1 : 5;
+        unsigned rs2 : 5;
+        unsigned f7 : 7;
+    } r;
+    struct
+    {
+        unsigned op : 7;
+        unsigned rd : 5;
+        unsigned f3 : 3;
+        unsigned rs1 : 5;
+        unsigned imm0_11 : 12;
+    } i;
+    struct
+    {
+        unsigned op : 7;
+        unsigned imm0_4 : 5;
+        unsigned f3 : 3;
+        unsigned rs1 : 5;
+        unsigned rs2 : 5;
+        unsigned imm5_11 : 7;
+    } s;
+    struct
+    {
+        unsigned op : 7;
+        unsigned imm11 : 1;
+        unsigned imm1_4 : 4;
+        unsigned f3 : 3;
+        unsigned rs1 : 5;
+        unsigned rs2 : 5;
+        unsigned imm5_10 : 6;
+        unsigned imm12 : 1;
+    } b;
+    struct
+    {
+        unsigned op : 7;
+        unsigned rd : 5;
+        unsigned imm12_31 : 20;
+    } u;
+    struct
+    {
+        unsigned op : 7;
+        unsigned rd : 5;
+        unsigned imm12_19 : 8;
+        unsigned imm11 : 1;
+        unsigned imm1_10 : 10;
+        unsigned imm20 : 1;
+    } j;
+} rz_instruction_t;
+
+static const char *const op_names[RZ_OP_COUNT] = {
+#define RZ_OP_NAME(name, mnemonic, format) mnemonic,
+    RZ_OPS(RZ_OP_NAME)
+#undef RZ_OP_NAME
+};
+
+static const char op_formats[RZ_OP_COUNT] = {
+#define RZ_OP_FORMAT(name, mnemonic, format) format,
+    RZ_OPS(RZ_OP_FORMAT)
+#undef RZ_OP_FORMAT
+};
+
+const char *rz_op_name(unsigned op)
+{
+    return op < RZ_OP_COUNT ? op_names[op] : "?";
+}
+
+char rz_op_format(unsigned op)
+{
+    return op < RZ_OP_COUNT ? op_formats[op] : '?';
+}
+
+static const char *const fuse_names[RZ_FUSE_COUNT] = {
+    [RZ_FUSE_NONE] = "none",
+#define RZ_FUSE_NAME(name, description) [RZ_FUSE_##name] = description,
+    RZ_FUSIONS(RZ_FUSE_NAME)
+#undef RZ_FUSE_NAME
+};
+
+const char *rz_fuse_name(unsigned fuse)
+{
+    return fuse < RZ_FUSE_COUNT ? fuse_names[fuse] : "?";
+}
+
+// Пары, которые компилятор выдаёт подряд: первая инструкция пишет регистр,
+// который читает вторая. Запись в x0 не сливается — её значение не сохраняется
+rz_fuse_t rz_fuse_pair(const rz_decoded_t *a, const rz_decoded_t *b)
+{
+    if (a->rd == 0)
+        return RZ_FUSE_NONE;
+    switch (a->op)
+    {
+    case RZ_OP_LUI:
+        if (b->op == RZ_OP_ADDI && b->rs1 == a->rd)
+            return RZ_FUSE_LUI_ADDI;
+        break;
+    case RZ_OP_AUIPC:
+        if (b->op == RZ_OP_JALR && b->rs1 == a->rd)
+            return RZ_FUSE_AUIPC_JALR;
+        if (rz_op_format(b->op) == 'L' && b->rs1 == a->rd)
+            return RZ_FUSE_AUIPC_LOAD;
+        break;
+    case RZ_OP_SLT:
+    case RZ_OP_SLTU:
+    case RZ_OP_SLTI:
+    case RZ_OP_SLTIU:
+        // beqz/bnez по результату сравнения
+        if ((b->op == RZ_OP_BEQ || b->op == RZ_OP_BNE) &&
+            ((b->rs1 == a->rd && b->rs2 == 0) || (b->rs1 == 0 && b->rs2 == a->rd)))
+            return RZ_FUSE_SLT_BRANCH;
+        break;
+    case RZ_OP_ADDI:
+        // Шаг счётчика цикла и переход назад
+        if (b->op == RZ_OP_BNE && a->rs1 == a->rd && (b->rs1 == a->rd || b->rs2 == a->rd))
+            return RZ_FUSE_ADDI_BNE;
+        break;
+    }
+    return RZ_FUSE_NONE;
+}
+
+// Функция знакового расширения
+static inline rz_register_t sign_extend(unsigned some_bits, int how_many_bits)
+{
+    rz_register_t result = some_bits;
+    if (1u << (how_many_bits - 1) & result)
+        result |= ~0u << how_many_bits;
+    return result;
+}
+
+// Сборка 32-битных инструкций из кода операции (opcode, func3, func7) и полей
+static inline rz_register_t enc_r(unsigned code, unsigned rd, unsigned rs1, unsigned rs2)
+{
+    return code | rd << 7 | rs1 << 15 | rs2 << 20;
+}
+
+static inline rz_register_t enc_i(unsigned code, unsigned rd, unsigned rs1, rz_register_t imm)
+{
+    return code | rd << 7 | rs1 << 15 | (imm & 0xFFFu) << 20;
+}
+
+static inline rz_register_t enc_s(unsigned code, unsigned rs1, unsigned rs2, rz_register_t imm)
+{
+    return code | (imm & 0x1Fu) << 7 | rs1 << 15 | rs2 << 20 | (imm >> 5 & 0x7Fu) << 25;
+}
+
+static inline rz_register_t enc_b(unsigned code, unsigned rs1, unsigned rs2, rz_register_t imm)
+{
+    return code | (imm >> 11 & 1u) << 7 | (imm >> 1 & 0xFu) << 8 | rs1 << 15 | rs2 << 20 |
+           (imm >> 5 & 0x3Fu) << 25 | (imm >> 12 & 1u) << 31;
+}
+
+static inline rz_register_t enc_j(unsigned code, unsigned rd, rz_register_t imm)
+{
+    return code | rd << 7 | (imm >> 12 & 0xFFu) << 12 | (imm >> 11 & 1u) << 20 |
+           (imm >> 1 & 0x3FFu) << 21 | (imm >> 20 & 1u) << 31;
+}
+
+// Бит b сжатой инструкции c на позицию to
+#define CBIT(c, b, to) (((c) >> (b) & 1u) << (to))
+// Регистры x8..x15 трёхбитных полей rd', rs1', rs2'
+#define CREG(c, lo) (8u + ((c) >> (lo) & 7u))
+
+// Непосредственное значение C.J и C.JAL: imm[11|4|9:8|10|6|7|3:1|5]
+static rz_register_t rz_c_jump_imm(unsigned c)
+{
+    return sign_extend(CBIT(c, 12, 11) | CBIT(c, 11, 4) | CBIT(c, 10, 9) | CBIT(c, 9, 8) | CBIT(c, 8, 10) |
+                           CBIT(c, 7, 6) | CBIT(c, 6, 7) | (c >> 3 & 7u) << 1 | CBIT(c, 2, 5),
+                       12);
+}
+
+// Расширение RV32C: 16-битная инструкция в 32-битный эквивалент, чтобы
+// дальше работали обычные декодер и обработчики; 0 — недопустимая
+// (в том числе формы с плавающей точкой и RV64)
+static rz_register_t rz_expand_compressed(unsigned c)
+{
+    unsigned rd = c >> 7 & 0x1Fu, rs2 = c >> 2 & 0x1Fu;
+    rz_register_t imm6 = sign_extend(CBIT(c, 12, 5) | (c >> 2 & 0x1Fu), 6);
+
+    switch ((c & 3u) << 3 | c >> 13)
+    {
+    case 0b00000: // C.ADDI4SPN
+    {
+        rz_register_t imm = (c >> 11 & 3u) << 4 | (c >> 7 & 0xFu) << 6 | CBIT(c, 6, 2) | CBIT(c, 5, 3);
+        return imm ? enc_i(ADDI_CODE, CREG(c, 2), 2, imm) : 0;
+    }
+    case 0b00010: // C.LW
+        return enc_i(LW_CODE, CREG(c, 2), CREG(c, 7), (c >> 10 & 7u) << 3 | CBIT(c, 6, 2) | CBIT(c, 5, 6));
+    case 0b00110: // C.SW
+        return enc_s(SW_CODE, CREG(c, 7), CREG(c, 2), (c >> 10 & 7u) << 3 | CBIT(c, 6, 2) | CBIT(c, 5, 6));
+
+    case 0b01000: // C.ADDI, C.NOP
+        return enc_i(ADDI_CODE, rd, rd, imm6);
+    case 0b01001: // C.JAL
+        return enc_j(JAL_CODE, 1, rz_c_jump_imm(c));
+    case 0b01010: // C.LI
+        return enc_i(ADDI_CODE, rd, 0, imm6);
+    case 0b01011:
+        if (rd == 2)
+        {
+            // C.ADDI16SP: nzimm[9|4|6|8:7|5]
+            rz_register_t imm = sign_extend(CBIT(c, 12, 9) | CBIT(c, 6, 4) | CBIT(c, 5, 6) | (c >> 3 & 3u) << 7 |
+                                                CBIT(c, 2, 5),
+                                            10);
+            return imm ? enc_i(ADDI_CODE, 2, 2, imm) : 0;
+        }
+        // C.LUI
+        return imm6 ? LUI_CODE | rd << 7 | (imm6 & 0xFFFFFu) << 12 : 0;
+    case 0b01100:
+    {
+        unsigned rs1 = CREG(c, 7);
+        switch (c >> 10 & 3u)
+        {
+        case 0: // C.SRLI, shamt[5] = 1 только в RV64
+            return c & (1u << 12) ? 0 : enc_i(SRLI_CODE, rs1, rs1, rs2);
+        case 1: // C.SRAI
+            return c & (1u << 12) ? 0 : enc_i(SRAI_CODE, rs1, rs1, rs2);
+        case 2: // C.ANDI
+            return enc_i(ANDI_CODE, rs1, rs1, imm6);
+        default:
+        {
+            static const unsigned codes[] = {SUB_CODE, XOR_CODE, OR_CODE, AND_CODE};
+            return c & (1u << 12) ? 0 : enc_r(codes[c >> 5 & 3u], rs1, rs1, CREG(c, 2));
+        }
+        }
+    }
+    case 0b01101: // C.J
+        return enc_j(JAL_CODE, 0, rz_c_jump_imm(c));
+    case 0b01110: // C.BEQZ, C.BNEZ: imm[8|4:3|7:6|2:1|5]
+    case 0b01111:
+    {
+        rz_register_t imm = sign_extend(CBIT(c, 12, 8) | (c >> 10 & 3u) << 3 | (c >> 5 & 3u) << 6 |
+                                            (c >> 3 & 3u) << 1 | CBIT(c, 2, 5),
+                                        9);
+        return enc_b(c >> 13 == 0b110 ? BEQ_CODE : BNE_CODE, CREG(c, 7), 0, imm);
+    }
+
+    case 0b10000: // C.SLLI
+        return c & (1u << 12) ? 0 : enc_i(SLLI_CODE, rd, rd, rs2);
+    case 0b10010: // C.LWSP
+        return rd ? enc_i(LW_CODE, rd, 2, CBIT(c, 12, 5) | (c >> 4 & 7u) << 2 | (c >> 2 & 3u) << 6) : 0;
+    case 0b10100:
+        if (!(c & (1u << 12)))
+        {
+            if (rs2) // C.MV
+                return enc_r(ADD_CODE, rd, 0, rs2);
+            return rd ? enc_i(JALR_CODE, 0, rd, 0) : 0; // C.JR
+        }
+        if (rs2) // C.ADD
+            return enc_r(ADD_CODE, rd, rd, rs2);
+        return rd ? enc_i(JALR_CODE, 1, rd, 0) : EBREAK_CODE; // C.JALR, C.EBREAK
+    case 0b10110: // C.SWSP
+        return enc_s(SW_CODE, 2, rs2, (c >> 9 & 0xFu) << 2 | (c >> 7 & 3u) << 6);
+    default:
+        return 0;
+    }
+}
+
+static void rz_decode_word(rz_register_t raw, rz_decoded_p out);
+
+// Декодирование одной инструкции: все поля и непосредственное значение
+// вычисляются один раз, дальше используется только готовая запись
+void rz_decode(rz_register_t raw, rz_decoded_p out)
+{
+    if ((raw & 3u) == 3u)
+    {
+        rz_decode_word(raw, out);
+        out->size = 4;
+        return;
+    }
+    rz_decode_word(rz_expand_compressed(raw & 0xFFFFu), out);
+    out->raw = raw & 0xFFFFu;
+    out->size = 2;
+}
+
+static void rz_decode_word(rz_register_t raw, rz_decoded_p out)
+{
+    rz_instruction_t instr = {.whole = raw};
+    unsigned opcode_f3 = raw & (OPCODE_MASK | FUNC3_MASK);
+    unsigned opcode_f3_f7 = raw & (OPCODE_MASK | FUNC3_MASK | FUNC7_MASK);
+
+    out->op = RZ_OP_ILLEGAL;
+    out->rd = instr.r.rd;
+    out->rs1 = instr.r.rs1;
+    out->rs2 = instr.r.rs2;
+    out->imm = 0;
+    out->raw = raw;
+    out->fuse = RZ_FUSE_NONE;
+
+    switch (raw & OPCODE_MASK)
+    {
+    case LUI_FORMAT:
+        out->op = RZ_OP_LUI;
+        out->imm = instr.u.imm12_31 << 12;
+        break;
+    case AUIPC_FORMAT:
+        out->op = RZ_OP_AUIPC;
+        out->imm = instr.u.imm12_31 << 12;
+        break;
+    case J_FORMAT:
+        out->op = RZ_OP_JAL;
+        out->imm = sign_extend((instr.j.imm20 << 20) | (instr.j.imm12_19 << 12) |
+                                   (instr.j.imm11 << 11) | (instr.j.imm1_10 << 1),
+                               21);
+        break;
+    case JALR_FORMAT:
+        if (opcode_f3 == JALR_CODE)
+            out->op = RZ_OP_JALR;
+        out->imm = sign_extend(instr.i.imm0_11, 12);
+        break;
+    case B_FORMAT:
+        switch (opcode_f3)
+        {
+        case BEQ_CODE:
+            out->op = RZ_OP_BEQ;
+            break;
+        case BNE_CODE:
+            out->op = RZ_OP_BNE;
+            break;
+        case BLT_CODE:
+            out->op = RZ_OP_BLT;
+            break;
+        case BGE_CODE:
+            out->op = RZ_OP_BGE;
+            break;
+        case BLTU_CODE:
+            out->op = RZ_OP_BLTU;
+            break;
+        case BGEU_CODE:
+            out->op = RZ_OP_BGEU;
+            break;
+        }
+        out->imm = sign_extend((instr.b.imm12 << 12) | (instr.b.imm11 << 11) |
+                                   (instr.b.imm5_10 << 5) | (instr.b.imm1_4 << 1),
+                               13);
+        break;
+    case L_FORMAT:
+        switch (opcode_f3)
+        {
+        case LB_CODE:
+            out->op = RZ_OP_LB;
+            break;
+        case LH_CODE:
+            out->op = RZ_OP_LH;
+            break;
+        case LW_CODE:
+            out->op = RZ_OP_LW;
+            break;
+        case LBU_CODE:
+            out->op = RZ_OP_LBU;
+            break;
+        case LHU_CODE:
+            out->op = RZ_OP_LHU;
+            break;
+        }
+        out->imm = sign_extend(instr.i.imm0_11, 12);
+        break;
+    case S_FORMAT:
+        switch (opcode_f3)
+        {
+        case SB_CODE:
+            out->op = RZ_OP_SB;
+            break;
+        case SH_CODE:
+            out->op = RZ_OP_SH;
+            break;
+        case SW_CODE:
+            out->op = RZ_OP_SW;
+            break;
+        }
+        out->imm = sign_extend(instr.s.imm0_4 | (instr.s.imm5_11 << 5), 12);
+        break;
+    case I_FORMAT:
+        out->imm = sign_extend(instr.i.imm0_11, 12);
+        switch (opcode_f3)
+        {
+        case ADDI_CODE:
+            out->op = RZ_OP_ADDI;
+            break;
+        case SLTI_CODE:
+            out->op = RZ_OP_SLTI;
+            break;
+        case SLTIU_CODE:
+            out->op = RZ_OP_SLTIU;
+            break;
+        case XORI_CODE:
+            out->op = RZ_OP_XORI;
+            break;
+        case ORI_CODE:
+            out->op = RZ_OP_ORI;
+            break;
+        case ANDI_CODE:
+            out->op = RZ_OP_ANDI;
+            break;
+        default:
+            // Сдвиги: shamt уже лежит в поле rs2
+            out->imm = instr.r.rs2;
+            if (opcode_f3_f7 == SLLI_CODE)
+                out->op = RZ_OP_SLLI;
+            else if (opcode_f3_f7 == SRLI_CODE)
+                out->op = RZ_OP_SRLI;
+            else if (opcode_f3_f7 == SRAI_CODE)
+                out->op = RZ_OP_SRAI;
+        }
+        break;
+    case R_FORMAT:
+        switch (opcode_f3_f7)
+        {
+        case ADD_CODE:
+            out->op = RZ_OP_ADD;
+            break;
+        case SUB_CODE:
+            out->op = RZ_OP_SUB;
+            break;
+        case SLL_CODE:
+            out->op = RZ_OP_SLL;
+            break;
+        case SLT_CODE:
+            out->op = RZ_OP_SLT;
+            break;
+        case SLTU_CODE:
+            out->op = RZ_OP_SLTU;
+            break;
+        case XOR_CODE:
+            out->op = RZ_OP_XOR;
+            break;
+        case SRL_CODE:
+            out->op = RZ_OP_SRL;
+            break;
+        case SRA_CODE:
+            out->op = RZ_OP_SRA;
+            break;
+        case OR_CODE:
+            out->op = RZ_OP_OR;
+            break;
+        case AND_CODE:
+            out->op = RZ_OP_AND;
+            break;
+        case MUL_CODE:
+            out->op = RZ_OP_MUL;
+            break;
+        case MULH_CODE:
+            out->op = RZ_OP_MULH;
+            break;
+        case MULHSU_CODE:
+            out->op = RZ_OP_MULHSU;
+            break;
+        case MULHU_CODE:
+            out->op = RZ_OP_MULHU;
+            break;
+        case DIV_CODE:
+            out->op = RZ_OP_DIV;
+            break;
+        case DIVU_CODE:
+            out->op = RZ_OP_DIVU;
+            break;
+        case REM_CODE:
+            out->op = RZ_OP_REM;
+            break;
+        case REMU_CODE:
+            out->op = RZ_OP_REMU;
+            break;
+        }
+        break;
+    case MEM_FORMAT:
+        if (opcode_f3 == FENCE_CODE)
+            out->op = RZ_OP_FENCE;
+        else if (opcode_f3 == FENCE_I_CODE)
+            out->op = RZ_OP_FENCE_I;
+        break;
+    case SYS_FORMAT:
+        // Номер CSR — беззнаковые 12 бит
+        out->imm = instr.i.imm0_11;
+        switch (opcode_f3)
+        {
+        case CSRRW_CODE:
+            out->op = RZ_OP_CSRRW;
+            break;
+        case CSRRS_CODE:
+            out->op = RZ_OP_CSRRS;
+            break;
+        case CSRRC_CODE:
+            out->op = RZ_OP_CSRRC;
+            break;
+        case CSRRWI_CODE:
+            out->op = RZ_OP_CSRRWI;
+            break;
+        case CSRRSI_CODE:
+            out->op = RZ_OP_CSRRSI;
+            break;
+        case CSRRCI_CODE:
+            out->op = RZ_OP_CSRRCI;
+            break;
+        default:
+            out->imm = 0;
+            if (raw == ECALL_CODE)
+                out->op = RZ_OP_ECALL;
+            else if (raw == EBREAK_CODE)
+                out->op = RZ_OP_EBREAK;
+            break;
+        }
+        break;
+    }
+}
+
+int rz_disasm(const rz_decoded_t *d, rz_address_t pc, char *buf, size_t size)
+{
+    const char *name = rz_op_name(d->op);
+    int32_t imm = (int32_t)d->imm;
+
+    switch (rz_op_format(d->op))
+    {
+    case 'R':
+        return snprintf(buf, size, "%s x%u, x%u, x%u", name, d->rd, d->rs1, d->rs2);
+    case 'I':
+        return snprintf(buf, size, "%s x%u, x%u, %d", name, d->rd, d->rs1, imm);
+    case 'L':
+        return snprintf(buf, size, "%s x%u, %d(x%u)", name, d->rd, imm, d->rs1);
+    case 'S':
+        return snprintf(buf, size, "%s x%u, %d(x%u)", name, d->rs2, imm, d->rs1);
+    case 'B':
+        return snprintf(buf, size, "%s x%u, x%u, 0x%08X", name, d->rs1, d->rs2, pc + d->imm);
+    case 'J':
+        return snprintf(buf, size, "%s x%u, 0x%08X", name, d->rd, pc + d->imm);
+    case 'U':
+        return snprintf(buf, size, "%s x%u, 0x%X", name, d->rd, d->imm >> 12);
+    case 'Y':
+        if (d->op >= RZ_OP_CSRRWI)
+            return snprintf(buf, size, "%s x%u, 0x%03X, %u", name, d->rd, d->imm, d->rs1);
+        if (d->op >= RZ_OP_CSRRW)
+            return snprintf(buf, size, "%s x%u, 0x%03X, x%u", name, d->rd, d->imm, d->rs1);
+        return snprintf(buf, size, "%s", name);
+    case 'M':
+        return snprintf(buf, size, "%s", name);
+    default:
+        return snprintf(buf, size, ".word 0x%08X", d->raw);
+    }
+}
+
+bool rz_icache_init(rz_icache_p ic, rz_address_t base, size_t size)
+{
+    ic->base = base;
+    ic->count = size / RZ_INSN_ALIGN;
+    ic->generation = 0;
+    ic->has_breakpoint = false;
+    ic->breakpoint = 0;
+    // calloc: нулевой op — это RZ_OP_UNDECODED
+    ic->lines = calloc(ic->count, sizeof(rz_decoded_t));
+    if (!ic->lines)
+        ic->count = 0;
+    return ic->lines != NULL;
+}
+
+void rz_icache_free(rz_icache_p ic)
+{
+    free(ic->lines);
+    ic->lines = NULL;
+    ic->count = 0;
+}
+
+void rz_icache_flush(rz_icache_p ic)
+{
+    for (size_t i = 0; i < ic->count; ++i)
+        ic->lines[i].op = RZ_OP_UNDECODED;
+    rz_icache_plant(ic);
+    ++ic->generation;
+}
+
+bool rz_icache_set_breakpoint(rz_icache_p ic, rz_address_t pc)
+{
+    if (!rz_icache_slot(ic, pc))
+        return false;
+    rz_icache_clear_breakpoint(ic);
+    ic->breakpoint = pc;
+    ic->has_breakpoint = true;
+    // Инвалидация снимает и слияние предыдущей инструкции с этой
+    rz_icache_invalidate(ic, pc, RZ_INSN_ALIGN);
+    return true;
+}
+
+void rz_icache_clear_breakpoint(rz_icache_p ic)
+{
+    if (!ic->has_breakpoint)
+        return;
+    ic->has_breakpoint = false;
+    rz_icache_invalidate(ic, ic->breakpoint, RZ_INSN_ALIGN);
+}
@@ -0,0 +1,331 @@
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include "misc.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RZ_INSN_ALIGN 2u // instructions start at even addresses (C extension)
+
+/**
+ * @brief List of operations known to the decoder
+ *
+ * X(name, mnemonic, format letter)
+ */
+#define RZ_OPS(X)                  \
+	X(UNDECODED, "?", '?')         \
+	X(ILLEGAL, "illegal", '?')     \
+	X(LUI, "lui", 'U')             \
+	X(AUIPC, "auipc", 'U')         \
+	X(JAL, "jal", 'J')             \
+	X(JALR, "jalr", 'I')           \
+	X(BEQ, "beq", 'B')             \
+	X(BNE, "bne", 'B')             \
+	X(BLT, "blt", 'B')             \
+	X(BGE, "bge", 'B')             \
+	X(BLTU, "bltu", 'B')           \
+	X(BGEU, "bgeu", 'B')           \
+	X(LB, "lb", 'L')               \
+	X(LH, "lh", 'L')               \
+	X(LW, "lw", 'L')               \
+	X(LBU, "lbu", 'L')             \
+	X(LHU, "lhu", 'L')             \
+	X(SB, "sb", 'S')               \
+	X(SH, "sh", 'S')               \
+	X(SW, "sw", 'S')               \
+	X(ADDI, "addi", 'I')           \
+	X(SLTI, "slti", 'I')           \
+	X(SLTIU, "sltiu", 'I')         \
+	X(XORI, "xori", 'I')           \
+	X(ORI, "ori", 'I')             \
+	X(ANDI, "andi", 'I')           \
+	X(SLLI, "slli", 'I')           \
+	X(SRLI, "srli", 'I')           \
+	X(SRAI, "srai", 'I')           \
+	X(ADD, "add", 'R')             \
+	X(SUB, "sub", 'R')             \
+	X(SLL, "sll", 'R')             \
+	X(SLT, "slt", 'R')             \
+	X(SLTU, "sltu", 'R')           \
+	X(XOR, "xor", 'R')             \
+	X(SRL, "srl", 'R')             \
+	X(SRA, "sra", 'R')             \
+	X(OR, "or", 'R')               \
+	X(AND, "and", 'R')             \
+	X(MUL, "mul", 'R')             \
+	X(MULH, "mulh", 'R')           \
+	X(MULHSU, "mulhsu", 'R')       \
+	X(MULHU, "mulhu", 'R')         \
+	X(DIV, "div", 'R')             \
+	X(DIVU, "divu", 'R')           \
+	X(REM, "rem", 'R')             \
+	X(REMU, "remu", 'R')           \
+	X(FENCE, "fence", 'M')         \
+	X(FENCE_I, "fence.i", 'M')     \
+	X(ECALL, "ecall", 'Y')         \
+	X(EBREAK, "ebreak", 'Y')       \
+	X(CSRRW, "csrrw", 'Y')         \
+	X(CSRRS, "csrrs", 'Y')         \
+	X(CSRRC, "csrrc", 'Y')         \
+	X(CSRRWI, "csrrwi", 'Y')       \
+	X(CSRRSI, "csrrsi", 'Y')       \
+	X(CSRRCI, "csrrci", 'Y')       \
+	X(BREAKPOINT, "breakpoint", 'Y')
+
+/**
+ * @brief Operation (handler) identifiers
+ *
+ */
+typedef enum rz_op_e : uint8_t
+{
+#define RZ_OP_ENUM(name, mnemonic, format) RZ_OP_##name,
+	RZ_OPS(RZ_OP_ENUM)
+#undef RZ_OP_ENUM
+	RZ_OP_COUNT
+} rz_op_t;
+
+/**
+ * @brief Instruction pairs fused by the interpreter
+ *
+ * X(name, description)
+ */
+#define RZ_FUSIONS(X)                    \
+	X(LUI_ADDI, "lui+addi")              \
+	X(AUIPC_JALR, "auipc+jalr")          \
+	X(AUIPC_LOAD, "auipc+load")          \
+	X(SLT_BRANCH, "slt+beqz/bnez")       \
+	X(ADDI_BNE, "addi+bne")
+
+/**
+ * @brief Fusion state of a predecoded instruction, first of a pair
+ *
+ */
+typedef enum rz_fuse_e : uint8_t
+{
+	RZ_FUSE_NONE = 0, // does not start a fused pair
+#define RZ_FUSE_ENUM(name, description) RZ_FUSE_##name,
+	RZ_FUSIONS(RZ_FUSE_ENUM)
+#undef RZ_FUSE_ENUM
+	RZ_FUSE_COUNT
+} rz_fuse_t;
+
+/**
+ * @brief Compact predecoded instruction
+ *
+ * Immediate is already sign-extended and shuffled into place,
+ * for branches and jumps it is the PC-relative offset, for CSR
+ * instructions it is the CSR number and rs1 holds uimm of *I forms.
+ * Compressed instructions are decoded as their 32-bit equivalents.
+ */
+typedef struct rz_decoded_s
+{
+	uint8_t op, rd, rs1, rs2;
+	uint8_t size; // length in bytes: 4, or 2 for compressed
+	uint8_t fuse; // rz_fuse_t, pair with the next instruction
+	rz_register_t imm;
+	rz_register_t raw;
+} rz_decoded_t, *rz_decoded_p;
+
+/**
+ * @brief Cache of predecoded instructions of the text region, keyed by PC
+ *
+ */
+typedef struct rz_icache_s
+{
+	rz_address_t base;
+	size_t count;
+	rz_decoded_t *lines;
+	unsigned generation;	 // changes whenever cached code is invalidated
+	bool has_breakpoint;	 // RZ_OP_BREAKPOINT record is planted at breakpoint
+	rz_address_t breakpoint; // stays planted over flushes and invalidations
+} rz_icache_t, *rz_icache_p;
+
+/**
+ * @brief Decode one instruction, 32-bit or compressed (RV32C)
+ *
+ * @param raw instruction word, or 16-bit parcel when its low bits are not 11
+ * @param out decoded record, op is RZ_OP_ILLEGAL when raw is not valid
+ */
+void rz_decode(rz_register_t raw, rz_decoded_p out);
+
+/**
+ * @brief Get operation mnemonic
+ *
+ * @param op operation identifier
+ * @return const char* mnemonic
+ */
+const char *rz_op_name(unsigned op);
+
+/**
+ * @brief Get operation format letter (R, I, L, S, B, J, U, M, Y)
+ *
+ * @param op operation identifier
+ * @return char format letter
+ */
+char rz_op_format(unsigned op);
+
+/**
+ * @brief Get fused pair description
+ *
+ * @param fuse fusion identifier
+ * @return const char* description like "lui+addi"
+ */
+const char *rz_fuse_name(unsigned fuse);
+
+/**
+ * @brief Check whether two consecutive instructions form a fusable pair
+ *
+ * Fused pair is executed at once with the same result as of both
+ * instructions one after another, the first one writes a register
+ * consumed by the second.
+ *
+ * @param a first instruction
+ * @param b instruction following it
+ * @return rz_fuse_t pair kind or RZ_FUSE_NONE
+ */
+rz_fuse_t rz_fuse_pair(const rz_decoded_t *a, const rz_decoded_t *b);
+
+/**
+ * @brief Check whether operation changes PC by itself
+ *
+ * @param op operation identifier
+ * @return true for jumps and branches
+ */
+static inline bool rz_op_is_control(unsigned op)
+{
+	return op >= RZ_OP_JAL && op <= RZ_OP_BGEU;
+}
+
+/**
+ * @brief Check whether operation belongs to the M extension
+ *
+ * @param op operation identifier
+ * @return true for multiplication, division and remainder
+ */
+static inline bool rz_op_is_muldiv(unsigned op)
+{
+	return op >= RZ_OP_MUL && op <= RZ_OP_REMU;
+}
+
+/**
+ * @brief Check whether operation accesses a CSR
+ *
+ * @param op operation identifier
+ * @return true for CSRRW, CSRRS, CSRRC and their immediate forms
+ */
+static inline bool rz_op_is_csr(unsigned op)
+{
+	return op >= RZ_OP_CSRRW && op <= RZ_OP_CSRRCI;
+}
+
+/**
+ * @brief Print decoded instruction in assembler syntax
+ *
+ * @param d decoded instruction
+ * @param pc address of instruction
+ * @param buf output buffer
+ * @param size size of output buffer
+ * @return int number of characters as snprintf returns
+ */
+int rz_disasm(const rz_decoded_t *d, rz_address_t pc, char *buf, size_t size);
+
+/**
+ * @brief Initialize instruction cache over [base, base + size), one slot per halfword
+ *
+ * @param ic cache instance
+ * @param base first address covered by cache
+ * @param size size of covered area in bytes
+ * @return true on success
+ */
+bool rz_icache_init(rz_icache_p ic, rz_address_t base, size_t size);
+
+/**
+ * @brief Release memory of instruction cache
+ *
+ * @param ic cache instance
+ */
+void rz_icache_free(rz_icache_p ic);
+
+/**
+ * @brief Drop all predecoded records (FENCE.I)
+ *
+ * @param ic cache instance
+ */
+void rz_icache_flush(rz_icache_p ic);
+
+/**
+ * @brief Get cache slot for PC or NULL when PC is not covered
+ *
+ * @param ic cache instance
+ * @param pc address of instruction
+ * @return rz_decoded_p cache slot, op is RZ_OP_UNDECODED until filled
+ */
+static inline rz_decoded_p rz_icache_slot(rz_icache_p ic, rz_address_t pc)
+{
+	rz_address_t index = (pc - ic->base) / RZ_INSN_ALIGN;
+	if (index >= ic->count || (pc & (RZ_INSN_ALIGN - 1)))
+		return NULL;
+	return &ic->lines[index];
+}
+
+/**
+ * @brief Plant breakpoint record into its slot, if there is one
+ *
+ * @param ic cache instance
+ */
+static inline void rz_icache_plant(rz_icache_p ic)
+{
+	if (ic->has_breakpoint)
+		ic->lines[(ic->breakpoint - ic->base) / RZ_INSN_ALIGN] =
+			(rz_decoded_t){.op = RZ_OP_BREAKPOINT, .size = RZ_INSN_ALIGN};
+}
+
+/**
+ * @brief Stop every engine before executing instruction at pc
+ *
+ * Instruction at pc is replaced in cache by a RZ_OP_BREAKPOINT record,
+ * which stops CPU with RZ_STOP_BREAKPOINT without retiring. One
+ * breakpoint at a time, setting another one moves it.
+ *
+ * @param ic cache instance
+ * @param pc address of instruction in the cached text region
+ * @return false when pc is not covered by cache
+ */
+bool rz_icache_set_breakpoint(rz_icache_p ic, rz_address_t pc);
+
+/**
+ * @brief Remove breakpoint, instruction under it is decoded again
+ *
+ * @param ic cache instance
+ */
+void rz_icache_clear_breakpoint(rz_icache_p ic);
+
+/**
+ * @brief Invalidate records overlapped by a store of size bytes at addr
+ *
+ * A 32-bit instruction starting one halfword before the store is
+ * overlapped too, so are up to two halfwords before it, which may hold
+ * an instruction fused with the overlapped one.
+ *
+ * @param ic cache instance
+ * @param addr store address
+ * @param size store size in bytes
+ */
+static inline void rz_icache_invalidate(rz_icache_p ic, rz_address_t addr, unsigned size)
+{
+	int64_t first = (int64_t)addr - ic->base - 6;
+	int64_t last = (int64_t)addr - ic->base + size - 1;
+	int64_t end = (int64_t)(ic->count * RZ_INSN_ALIGN);
+	if (last < 0 || first >= end)
+		return;
+	if (first < 0)
+		first = 0;
+	if (last >= end)
+		last = end - 1;
+	for (int64_t i = first / RZ_INSN_ALIGN; i <= last / RZ_INSN_ALIGN; ++i)
+		ic->lines[i].op = RZ_OP_UNDECODED;
+	rz_icache_plant(ic);
+	++ic->generation;
+}
+
+#endif // DECODE_H__
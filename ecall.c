@@ -1,35 +1,257 @@
-#include "cpu.h"	 // для определения rz_cpu_p и rz_register_t
-#include "misc.h"	 // если rz_register_t определён здесь (если не в cpu.h)
-#include <stdio.h> // для printf, fprintf
-#include "ecall.h" // для объявления rz_ecall_handle
+#include <stdio.h>	// для snprintf, fprintf
+#include <string.h> // для memchr
+#include "cpu.h"	// для определения rz_cpu_p и rz_register_t
+#include "ecall.h"	// для объявления rz_ecall_handle
 
-bool rz_ecall_handle(rz_cpu_p pcpu)
+#define RZ_ECALL_PATH_MAX 4096u // Длина имени файла для open вместе с нулём
+
+// Вывод строки через обработчик машины
+static void rz_ecall_print(rz_machine_p m, const char *text, int len)
+{
+	if (len > 0)
+		m->io.write(m->io.ctx, text, (size_t)len);
+}
+
+// Аргумент вызова: в соглашении Venus номер занимает a0, аргументы сдвинуты на один
+static inline rz_register_t rz_ecall_arg(rz_machine_p m, unsigned n)
+{
+	return m->cpu->r_x[10 + n + (m->ecall_abi == RZ_ECALL_ABI_VENUS)];
+}
+
+// Кусок буфера гостя в пределах одной страницы: хост-указатель и его длина.
+// Буферы передаются обработчикам целиком, без побайтового копирования.
+// NULL — ошибка доступа, причина остановки выставлена
+static uint8_t *rz_ecall_chunk(rz_machine_p m, mem_kind_t kind, rz_address_t addr, size_t *len)
+{
+	uint8_t *host;
+	mem_fault_t fault = mem_translate(&m->mem, kind, addr, &host);
+	if (fault != MEM_OK)
+	{
+		rz_cpu_fault(m->cpu, fault, addr);
+		return NULL;
+	}
+	size_t left = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+	if (*len > left)
+		*len = left;
+	return host;
+}
+
+static bool rz_ecall_print_string(rz_machine_p m, rz_address_t addr)
 {
-	rz_register_t syscall_num = pcpu->r_x[17]; // a7 — номер системного вызова
+	for (;;)
+	{
+		size_t len = MEM_PAGE_SIZE;
+		const uint8_t *host = rz_ecall_chunk(m, MEM_LOAD, addr, &len);
+		if (!host)
+			return false;
+		const uint8_t *end = memchr(host, '\0', len);
+		m->io.write(m->io.ctx, (const char *)host, end ? (size_t)(end - host) : len);
+		if (end)
+			return true;
+		addr += (rz_address_t)len;
+	}
+}
+
+// Чтение в буфер гостя; запись в область текста сбрасывает кэш инструкций
+static bool rz_ecall_read(rz_machine_p m, int32_t fd, rz_address_t addr, rz_register_t size)
+{
+	rz_cpu_p pcpu = m->cpu;
+	int32_t total = 0;
+	if (!m->io.read || (int32_t)size < 0)
+		total = -1;
+	while (total >= 0 && (rz_register_t)total < size)
+	{
+		size_t len = size - (rz_register_t)total;
+		uint8_t *host = rz_ecall_chunk(m, MEM_STORE, addr, &len);
+		if (!host)
+			return false;
+		int32_t n = m->io.read(m->io.ctx, fd, host, len);
+		if (n < 0)
+		{
+			total = total ? total : -1;
+			break;
+		}
+		if (addr - pcpu->icache.base < pcpu->icache.count * RZ_INSN_ALIGN)
+			rz_icache_flush(&pcpu->icache);
+		total += n;
+		addr += (rz_address_t)n;
+		if ((size_t)n < len)
+			break; // конец файла или ввода
+	}
+	pcpu->r_x[10] = (rz_register_t)total;
+	return true;
+}
+
+static bool rz_ecall_write(rz_machine_p m, int32_t fd, rz_address_t addr, rz_register_t size)
+{
+	int32_t total = 0;
+	if ((fd != 1 && !m->io.write_fd) || (int32_t)size < 0)
+		total = -1;
+	while (total >= 0 && (rz_register_t)total < size)
+	{
+		size_t len = size - (rz_register_t)total;
+		const uint8_t *host = rz_ecall_chunk(m, MEM_LOAD, addr, &len);
+		if (!host)
+			return false;
+		int32_t n = (int32_t)len;
+		if (fd == 1)
+			m->io.write(m->io.ctx, (const char *)host, len);
+		else
+			n = m->io.write_fd(m->io.ctx, fd, host, len);
+		if (n < 0)
+		{
+			total = total ? total : -1;
+			break;
+		}
+		total += n;
+		addr += (rz_address_t)n;
+		if ((size_t)n < len)
+			break;
+	}
+	m->cpu->r_x[10] = (rz_register_t)total;
+	return true;
+}
+
+static bool rz_ecall_open(rz_machine_p m, rz_address_t addr, unsigned mode)
+{
+	char path[RZ_ECALL_PATH_MAX];
+	size_t used = 0;
+	for (;;)
+	{
+		size_t len = MEM_PAGE_SIZE;
+		const uint8_t *host = rz_ecall_chunk(m, MEM_LOAD, addr, &len);
+		if (!host)
+			return false;
+		const uint8_t *end = memchr(host, '\0', len);
+		size_t add = end ? (size_t)(end - host) : len;
+		if (used + add >= sizeof(path))
+		{
+			m->cpu->r_x[10] = (rz_register_t)-1; // слишком длинное имя
+			return true;
+		}
+		memcpy(path + used, host, add);
+		used += add;
+		if (end)
+			break;
+		addr += (rz_address_t)len;
+	}
+	path[used] = '\0';
+	m->cpu->r_x[10] = (rz_register_t)(m->io.open ? m->io.open(m->io.ctx, path, mode) : -1);
+	return true;
+}
+
+// Сдвиг границы кучи; новые страницы отображаются обнулёнными.
+// Возвращает старую границу или -1, если граница выходит за пределы кучи
+static rz_register_t rz_ecall_sbrk(rz_machine_p m, int32_t increment)
+{
+	if (!m->brk)
+		m->brk = HEAP_OFFSET;
+	rz_address_t old = m->brk;
+	int64_t brk = (int64_t)old + increment;
+	if (brk < (int64_t)DATA_OFFSET || brk > (int64_t)HEAP_LIMIT)
+		return (rz_register_t)-1;
+
+	// Отображаются только ещё не отображённые страницы, сплошными участками
+	rz_address_t first = (old + MEM_PAGE_MASK) & ~(rz_address_t)MEM_PAGE_MASK;
+	rz_address_t last = ((rz_address_t)brk + MEM_PAGE_MASK) & ~(rz_address_t)MEM_PAGE_MASK;
+	while (first < last)
+	{
+		if (mem_access(&m->mem, first))
+		{
+			first += MEM_PAGE_SIZE;
+			continue;
+		}
+		rz_address_t end = first + MEM_PAGE_SIZE;
+		while (end < last && !mem_access(&m->mem, end))
+			end += MEM_PAGE_SIZE;
+		if (!mem_map(&m->mem, first, end - first, NULL, MEM_PERM_READ | MEM_PERM_WRITE))
+			return (rz_register_t)-1;
+		first = end;
+	}
+	m->brk = (rz_address_t)brk;
+	return old;
+}
+
+bool rz_ecall_handle(rz_machine_p m)
+{
+	rz_cpu_p pcpu = m->cpu;
+	bool venus = m->ecall_abi == RZ_ECALL_ABI_VENUS;
+	rz_register_t syscall_num = pcpu->r_x[venus ? 10 : 17]; // a0 или a7 — номер системного вызова
+	char text[16];
+
+	// Обработчик хоста может взять вызов на себя, в том числе встроенный
+	if (m->ecall_hook)
+	{
+		rz_ecall_hook_result_t result = m->ecall_hook(m->ecall_ctx, m, syscall_num);
+		if (result == RZ_ECALL_HOOK_DONE)
+			return true;
+		if (result == RZ_ECALL_HOOK_FAIL)
+		{
+			pcpu->stop = RZ_STOP_ECALL_ERROR;
+			return false;
+		}
+		if (result == RZ_ECALL_HOOK_WAIT)
+		{
+			pcpu->stop = RZ_STOP_INPUT_ERROR;
+			return false;
+		}
+	}
 
 	switch (syscall_num)
 	{
-	case 0: // Ввод целого числа с stdin в a0
+	case RZ_ECALL_READ_INT_LEGACY: // Ввод целого числа в a0
+	case RZ_ECALL_READ_INT:
 	{
-		int value;
-		printf("Input integer: ");
-		int ret = scanf("%d", &value);
-		if (ret != 1)
+		int32_t value;
+		if (!m->io.read_int(m->io.ctx, &value))
 		{
 			fprintf(stderr, "Failed to read integer from input\n");
+			pcpu->stop = RZ_STOP_INPUT_ERROR;
 			return false; // Ошибка — остановить симулятор
 		}
 		pcpu->r_x[10] = (rz_register_t)value; // Записываем в a0
 		break;
 	}
-	case 1: // Вывод целого числа из a0 на stdout
-	{
-		int value = (int)pcpu->r_x[10]; // Значение из a0
-		printf("%d\n", value);
+	case RZ_ECALL_PRINT_INT: // Вывод целого числа; в своём соглашении — с переводом строки
+		rz_ecall_print(m, text, snprintf(text, sizeof(text), venus ? "%d" : "%d\n", (int32_t)rz_ecall_arg(m, 0)));
 		break;
-	}
+	case RZ_ECALL_PRINT_HEX:
+		rz_ecall_print(m, text, snprintf(text, sizeof(text), "0x%08x", rz_ecall_arg(m, 0)));
+		break;
+	case RZ_ECALL_PRINT_UNSIGNED:
+		rz_ecall_print(m, text, snprintf(text, sizeof(text), "%u", rz_ecall_arg(m, 0)));
+		break;
+	case RZ_ECALL_PRINT_CHAR:
+		text[0] = (char)rz_ecall_arg(m, 0);
+		rz_ecall_print(m, text, 1);
+		break;
+	case RZ_ECALL_PRINT_STRING:
+		return rz_ecall_print_string(m, rz_ecall_arg(m, 0));
+	case RZ_ECALL_SBRK:
+		pcpu->r_x[10] = rz_ecall_sbrk(m, (int32_t)rz_ecall_arg(m, 0));
+		break;
+	case RZ_ECALL_OPEN:
+		return rz_ecall_open(m, rz_ecall_arg(m, 0), rz_ecall_arg(m, 1));
+	case RZ_ECALL_READ:
+		return rz_ecall_read(m, (int32_t)rz_ecall_arg(m, 0), rz_ecall_arg(m, 1), rz_ecall_arg(m, 2));
+	case RZ_ECALL_WRITE:
+		return rz_ecall_write(m, (int32_t)rz_ecall_arg(m, 0), rz_ecall_arg(m, 1), rz_ecall_arg(m, 2));
+	case RZ_ECALL_CLOSE:
+		pcpu->r_x[10] = (rz_register_t)(m->io.close ? m->io.close(m->io.ctx, (int32_t)rz_ecall_arg(m, 0)) : -1);
+		break;
+	case RZ_ECALL_MARKER: // Метка области интереса: останов после вызова, если он запрошен
+		m->marker = rz_ecall_arg(m, 0);
+		if (m->marker_stop)
+			rz_cpu_stop_after(pcpu, RZ_STOP_MARKER);
+		break;
+	case RZ_ECALL_EXIT:
+	case RZ_ECALL_EXIT2:
+		pcpu->exit_code = syscall_num == RZ_ECALL_EXIT2 ? (int32_t)rz_ecall_arg(m, 0) : 0;
+		pcpu->stop = RZ_STOP_EXIT;
+		return false; // Программа завершилась сама
 	default:
 		fprintf(stderr, "Unknown syscall number: %d\n", (int)syscall_num);
+		pcpu->stop = RZ_STOP_ECALL_ERROR;
 		return false; // Неизвестный системный вызов — остановка
 	}
 
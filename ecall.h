@@ -1,11 +1,37 @@
 #ifndef __ECALL_H__
 #define __ECALL_H__
 
-#include "cpu.h"
+#include "machine.h"
 
-// Обработка инструкции ECALL и EBREAK
+/**
+ * @brief Environment call numbers, as in Venus (5, 34 and 36 as in RARS, 256 is RISC-Z own)
+ *
+ * Number and arguments are taken from registers by machine ecall ABI,
+ * result is returned in a0. Buffers of read, write and print string are
+ * passed to I/O handlers in place, page by page.
+ */
+typedef enum rz_ecall_e : unsigned
+{
+	RZ_ECALL_READ_INT_LEGACY = 0, // a0 = integer read from input
+	RZ_ECALL_PRINT_INT = 1,		  // print signed integer
+	RZ_ECALL_PRINT_STRING = 4,	  // print NUL-terminated string at address
+	RZ_ECALL_READ_INT = 5,		  // a0 = integer read from input
+	RZ_ECALL_SBRK = 9,			  // move program break by bytes, a0 = old break or -1
+	RZ_ECALL_EXIT = 10,			  // stop with exit code 0
+	RZ_ECALL_PRINT_CHAR = 11,	  // print low byte
+	RZ_ECALL_OPEN = 13,			  // open path in mode 0..5, a0 = descriptor or -1
+	RZ_ECALL_READ = 14,			  // read into buffer (fd, address, size), a0 = bytes or -1
+	RZ_ECALL_WRITE = 15,		  // write buffer (fd, address, size), a0 = bytes or -1
+	RZ_ECALL_CLOSE = 16,		  // close descriptor, a0 = 0 or -1
+	RZ_ECALL_EXIT2 = 17,		  // stop with exit code from argument
+	RZ_ECALL_PRINT_HEX = 34,	  // print as 0x%08x
+	RZ_ECALL_PRINT_UNSIGNED = 36, // print unsigned integer
+	RZ_ECALL_MARKER = 256,		  // region marker with id, no effect unless machine stops on markers
+} rz_ecall_t;
+
+// Обработка инструкции ECALL процессора машины, ввод-вывод — через обработчики машины
 // Возвращает true, если обработка успешна и симулятор должен продолжить работу,
-// false — если нужно остановить симулятор (например, при EBREAK)
-bool rz_ecall_handle(rz_cpu_p pcpu);
+// false — если нужно остановить симулятор (выход программы, ошибка)
+bool rz_ecall_handle(rz_machine_p m);
 
 #endif // ECALL_H__
@@ -0,0 +1,125 @@
+#ifndef __EXEC_H__
+#define __EXEC_H__
+
+#include "misc.h"
+#include "decode.h"
+#include "memory.h"
+
+/*
+ * Semantics of operations shared by execution engines.
+ *
+ * Every expression expects in scope:
+ *   x - register file (rz_register_t *)
+ *   d - decoded instruction (const rz_decoded_t *)
+ * except RZ_EXEC_VALUE and RZ_EXEC_COMPARE, which take operands.
+ */
+
+#define RZ_EXEC_ADDR (x[d->rs1] + d->imm)
+
+/*
+ * Division by the spec: by zero gives all ones (remainder — dividend),
+ * INT32_MIN / -1 gives dividend (remainder — zero), no exception.
+ */
+static inline rz_register_t rz_exec_div(rz_register_t a, rz_register_t b)
+{
+	if (b == 0)
+		return UINT32_MAX;
+	if (a == 0x80000000u && b == UINT32_MAX)
+		return a;
+	return (rz_register_t)((int32_t)a / (int32_t)b);
+}
+
+static inline rz_register_t rz_exec_rem(rz_register_t a, rz_register_t b)
+{
+	if (b == 0)
+		return a;
+	if (a == 0x80000000u && b == UINT32_MAX)
+		return 0;
+	return (rz_register_t)((int32_t)a % (int32_t)b);
+}
+
+/**
+ * @brief Values of operations which only write rd: X(name, value, ctx)
+ *
+ * Operands are expressions given by the engine, so the same table
+ * serves scalar and lane-wise register files.
+ */
+#define RZ_EXEC_VALUE(X, ctx, s1, s2, imm)                                               \
+	X(LUI, imm, ctx)                                                                     \
+	X(ADDI, s1 + imm, ctx)                                                               \
+	X(SLTI, (int32_t)s1 < (int32_t)imm, ctx)                                             \
+	X(SLTIU, s1 < imm, ctx)                                                              \
+	X(XORI, s1 ^ imm, ctx)                                                               \
+	X(ORI, s1 | imm, ctx)                                                                \
+	X(ANDI, s1 & imm, ctx)                                                               \
+	X(SLLI, s1 << imm, ctx)                                                              \
+	X(SRLI, s1 >> imm, ctx)                                                              \
+	X(SRAI, (rz_register_t)((int32_t)s1 >> imm), ctx)                                    \
+	X(ADD, s1 + s2, ctx)                                                                 \
+	X(SUB, s1 - s2, ctx)                                                                 \
+	X(SLL, s1 << (s2 & 0x1F), ctx)                                                       \
+	X(SLT, (int32_t)s1 < (int32_t)s2, ctx)                                               \
+	X(SLTU, s1 < s2, ctx)                                                                \
+	X(XOR, s1 ^ s2, ctx)                                                                 \
+	X(SRL, s1 >> (s2 & 0x1F), ctx)                                                       \
+	X(SRA, (rz_register_t)((int32_t)s1 >> (s2 & 0x1F)), ctx)                             \
+	X(OR, s1 | s2, ctx)                                                                  \
+	X(AND, s1 & s2, ctx)                                                                 \
+	X(MUL, s1 * s2, ctx)                                                                 \
+	X(MULH, (rz_register_t)(((int64_t)(int32_t)s1 * (int32_t)s2) >> 32), ctx)            \
+	X(MULHSU, (rz_register_t)(((int64_t)(int32_t)s1 * (int64_t)s2) >> 32), ctx)          \
+	X(MULHU, (rz_register_t)(((uint64_t)s1 * s2) >> 32), ctx)                            \
+	X(DIV, rz_exec_div(s1, s2), ctx)                                                     \
+	X(DIVU, s2 ? s1 / s2 : UINT32_MAX, ctx)                                              \
+	X(REM, rz_exec_rem(s1, s2), ctx)                                                     \
+	X(REMU, s2 ? s1 % s2 : s1, ctx)
+
+#define RZ_EXEC_ASSIGN(name, value, X) X(name, x[d->rd] = (value))
+
+/**
+ * @brief Operations which only write rd: X(name, expression)
+ *
+ */
+#define RZ_EXEC_SIMPLE(X) RZ_EXEC_VALUE(RZ_EXEC_ASSIGN, X, x[d->rs1], x[d->rs2], d->imm)
+
+/**
+ * @brief Loads: X(name, access width in bits, type of loaded value)
+ *
+ */
+#define RZ_EXEC_LOAD(X) \
+	X(LB, 8, int8_t)    \
+	X(LH, 16, int16_t)  \
+	X(LW, 32, int32_t)  \
+	X(LBU, 8, uint8_t)  \
+	X(LHU, 16, uint16_t)
+
+/**
+ * @brief Conditions of branches: X(name, condition, ctx), operands as in RZ_EXEC_VALUE
+ *
+ */
+#define RZ_EXEC_COMPARE(X, ctx, s1, s2)      \
+	X(BEQ, s1 == s2, ctx)                    \
+	X(BNE, s1 != s2, ctx)                    \
+	X(BLT, (int32_t)s1 < (int32_t)s2, ctx)   \
+	X(BGE, (int32_t)s1 >= (int32_t)s2, ctx)  \
+	X(BLTU, s1 < s2, ctx)                    \
+	X(BGEU, s1 >= s2, ctx)
+
+#define RZ_EXEC_CONDITION(name, cond, X) X(name, cond)
+
+/**
+ * @brief Conditional branches: X(name, condition)
+ *
+ */
+#define RZ_EXEC_BRANCH(X) RZ_EXEC_COMPARE(RZ_EXEC_CONDITION, X, x[d->rs1], x[d->rs2])
+
+/**
+ * @brief Stores: X(name, access width in bits)
+ *
+ */
+#define RZ_EXEC_STORE(X) \
+	X(SB, 8)             \
+	X(SH, 16)            \
+	X(SW, 32)
+
+#endif // EXEC_H__
@@ -0,0 +1,582 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc, realloc, free, strtol
+#include <string.h> // memcpy, memset, strlen
+#include <threads.h>
+
+#include "farm.h"
+#include "machine.h"
+#include "ecall.h"
+#include "jit.h"
+#include "lockstep.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+unsigned rz_farm_cpu_count(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? (unsigned)info.dwNumberOfProcessors : 1u;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1u;
+#else
+    return 1u;
+#endif
+}
+
+// Строка целиком в растущий буфер; false — конец файла или нет памяти
+static bool rz_farm_read_line(FILE *file, char **line, size_t *cap, bool *nomem)
+{
+    size_t len = 0;
+    for (;;)
+    {
+        if (*cap - len < 2)
+        {
+            size_t size = *cap ? *cap * 2 : 4096;
+            char *grown = realloc(*line, size);
+            if (!grown)
+            {
+                *nomem = true;
+                return false;
+            }
+            *line = grown;
+            *cap = size;
+        }
+        if (!fgets(*line + len, (int)(*cap - len), file))
+            return len != 0;
+        len += strlen(*line + len);
+        if ((*line)[len - 1] == '\n')
+            return true;
+    }
+}
+
+bool rz_farm_read_inputs(const char *path, rz_farm_job_p *jobs, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+
+    size_t n = 0, cap = 0;
+    rz_farm_job_p list = NULL;
+    char *line = NULL;
+    size_t line_cap = 0;
+    bool ok = true, nomem = false;
+    while (ok && rz_farm_read_line(file, &line, &line_cap, &nomem))
+    {
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            rz_farm_job_p grown = realloc(list, cap * sizeof(rz_farm_job_t));
+            if (!grown)
+            {
+                ok = false;
+                break;
+            }
+            list = grown;
+        }
+        rz_farm_job_p job = &list[n++];
+        memset(job, 0, sizeof(*job));
+
+        size_t input_cap = 0;
+        for (;;)
+        {
+            while (*p == ' ' || *p == '\t' || *p == ',')
+                ++p;
+            if (*p == '\n' || *p == '\r' || *p == '\0')
+                break;
+            char *end;
+            errno = 0;
+            long v = strtol(p, &end, 0);
+            if (end == p)
+            {
+                fprintf(stderr, "%s: bad integer in job %zu\n", path, n - 1);
+                ok = false;
+                break;
+            }
+            if (errno == ERANGE || v < INT32_MIN || v > INT32_MAX)
+            {
+                fprintf(stderr, "%s: integer %.*s out of 32-bit range in job %zu\n", path, (int)(end - p), p, n - 1);
+                ok = false;
+                break;
+            }
+            p = end;
+            if (job->input_count == input_cap)
+            {
+                input_cap = input_cap ? input_cap * 2 : 8;
+                int32_t *grown = realloc(job->input, input_cap * sizeof(int32_t));
+                if (!grown)
+                {
+                    ok = false;
+                    break;
+                }
+                job->input = grown;
+            }
+            job->input[job->input_count++] = (int32_t)v;
+        }
+    }
+    free(line);
+    fclose(file);
+    if (nomem)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        rz_farm_free_jobs(list, n);
+        return false;
+    }
+    *jobs = list;
+    *count = n;
+    return true;
+}
+
+void rz_farm_free_jobs(rz_farm_job_p jobs, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        free(jobs[i].input);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+bool rz_farm_write_results(const char *path, const rz_farm_job_t *jobs, size_t count)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    fprintf(file, "# job\tstatus\tinstructions\twall_us\toutput\n");
+    for (size_t i = 0; i < count; ++i)
+    {
+        const rz_farm_job_t *job = &jobs[i];
+        fprintf(file, "%zu\t%s", i, rz_stop_name(job->stop));
+        if (job->stop == RZ_STOP_EXIT)
+            fprintf(file, " %d", job->exit_code);
+        fprintf(file, "\t%llu\t%llu\t", (unsigned long long)job->retired,
+                (unsigned long long)(job->wall_ns / 1000u));
+        // Вывод гостя в одну строку: переводы строк — пробелы
+        size_t len = job->output_len;
+        while (len && (job->output[len - 1] == '\n' || job->output[len - 1] == ' '))
+            --len;
+        for (size_t k = 0; k < len; ++k)
+            fputc(job->output[k] == '\n' || job->output[k] == '\t' ? ' ' : job->output[k], file);
+        fputc('\n', file);
+    }
+    bool ok = !ferror(file);
+    if (file != stdout)
+        ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+// Ввод-вывод гостя: вектор входных чисел и буфер вывода задания
+static bool rz_farm_read_int(void *ctx, int32_t *value)
+{
+    rz_farm_job_p job = ctx;
+    if (job->input_next == job->input_count)
+        return false;
+    *value = job->input[job->input_next++];
+    return true;
+}
+
+static void rz_farm_write(void *ctx, const char *text, size_t len)
+{
+    rz_farm_job_p job = ctx;
+    if (job->output_len + len + 1 > job->output_cap)
+    {
+        size_t cap = job->output_cap ? job->output_cap : 64;
+        while (cap < job->output_len + len + 1)
+            cap *= 2;
+        char *grown = realloc(job->output, cap);
+        if (!grown)
+            return;
+        job->output = grown;
+        job->output_cap = cap;
+    }
+    memcpy(job->output + job->output_len, text, len);
+    job->output_len += len;
+    job->output[job->output_len] = '\0';
+}
+
+// Диапазон ещё не начатых заданий исполнителя [next, end)
+typedef struct
+{
+    mtx_t lock;
+    size_t next, end;
+} rz_farm_range_t;
+
+// Гость, которого исполнитель выполняет квантами
+typedef struct
+{
+    rz_machine_p machine;
+    rz_farm_job_p job;
+    uint64_t left; // остаток бюджета
+} rz_farm_guest_t;
+
+typedef struct rz_farm_s rz_farm_t;
+
+typedef struct
+{
+    rz_farm_t *farm;
+    rz_farm_range_t range;
+    uint64_t retired, slices, steals;
+    rz_lockstep_stats_t lockstep;
+} rz_farm_worker_t;
+
+struct rz_farm_s
+{
+    const rz_farm_config_t *cfg;
+    rz_farm_job_p jobs;
+    rz_farm_worker_t *workers;
+    unsigned threads;
+    uint64_t quantum;
+    const rz_snapshot_t *snapshot; // общее начало гостей
+    const rz_farm_job_t *prefix;   // вывод и инструкции до снимка
+};
+
+// Следующее своё задание; SIZE_MAX — диапазон пуст
+static size_t rz_farm_take(rz_farm_range_t *range)
+{
+    size_t index = SIZE_MAX;
+    mtx_lock(&range->lock);
+    if (range->next < range->end)
+        index = range->next++;
+    mtx_unlock(&range->lock);
+    return index;
+}
+
+// Кража: половина самого большого чужого диапазона становится своей
+static bool rz_farm_steal(rz_farm_worker_t *self)
+{
+    rz_farm_t *farm = self->farm;
+    for (;;)
+    {
+        rz_farm_worker_t *victim = NULL;
+        size_t best = 0;
+        for (unsigned i = 0; i < farm->threads; ++i)
+        {
+            rz_farm_worker_t *w = &farm->workers[i];
+            if (w == self)
+                continue;
+            mtx_lock(&w->range.lock);
+            size_t left = w->range.end - w->range.next;
+            mtx_unlock(&w->range.lock);
+            if (left > best)
+            {
+                best = left;
+                victim = w;
+            }
+        }
+        if (!victim)
+            return false;
+
+        size_t lo = 0, hi = 0;
+        mtx_lock(&victim->range.lock);
+        if (victim->range.next < victim->range.end)
+        {
+            size_t left = victim->range.end - victim->range.next;
+            lo = victim->range.end - (left + 1) / 2;
+            hi = victim->range.end;
+            victim->range.end = lo;
+        }
+        mtx_unlock(&victim->range.lock);
+        if (lo == hi)
+            continue; // пока выбирали, диапазон опустел
+
+        mtx_lock(&self->range.lock);
+        self->range.next = lo;
+        self->range.end = hi;
+        mtx_unlock(&self->range.lock);
+        ++self->steals;
+        return true;
+    }
+}
+
+rz_machine_p rz_farm_boot(const rz_image_t *image)
+{
+    rz_machine_p m = rz_machine_create(0);
+    if (!m || !rz_image_map(image, &m->mem) || !rz_cpu_set_text(m->cpu, image->text_base, image->text_size))
+    {
+        rz_machine_free(m);
+        return NULL;
+    }
+    m->cpu->r_pc = image->entry;
+    m->brk = image->heap_base;
+    return m;
+}
+
+// Создание гостя для задания: своя машина, общий образ программы или снимок
+static bool rz_farm_start(rz_farm_t *farm, rz_farm_guest_t *guest, size_t index)
+{
+    const rz_farm_config_t *cfg = farm->cfg;
+    rz_farm_job_p job = &farm->jobs[index];
+    job->stop = RZ_STOP_NONE;
+
+    rz_machine_p m = farm->snapshot ? rz_snapshot_fork(farm->snapshot) : rz_farm_boot(cfg->image);
+    if (!m)
+    {
+        job->stop = RZ_STOP_INVALID;
+        return false;
+    }
+    if (farm->prefix->output_len)
+        rz_farm_write(job, farm->prefix->output, farm->prefix->output_len);
+    job->retired = farm->prefix->retired;
+    rz_io_t io = {.ctx = job, .read_int = rz_farm_read_int, .write = rz_farm_write};
+    rz_machine_set_io(m, &io);
+    m->ecall_abi = cfg->ecall_abi;
+    if (cfg->engine == RZ_ENGINE_JIT)
+        rz_jit_set_threshold(m->cpu, cfg->jit_threshold);
+    rz_set_engine(m->cpu, cfg->engine);
+
+    guest->machine = m;
+    guest->job = job;
+    guest->left = cfg->budget - farm->prefix->retired;
+    return true;
+}
+
+// Запрос ввода в общем начале — его конец, а не ошибка
+static rz_ecall_hook_result_t rz_farm_prefix_hook(void *ctx, rz_machine_p m, rz_register_t number)
+{
+    (void)ctx, (void)m;
+    return number == RZ_ECALL_READ_INT || number == RZ_ECALL_READ_INT_LEGACY ? RZ_ECALL_HOOK_WAIT
+                                                                             : RZ_ECALL_HOOK_DEFAULT;
+}
+
+// Общее начало: образ исполняется без входных данных до первого чтения.
+// Ecall чтения останавливает машину, не продвигая PC, и в дочерних
+// машинах исполняется заново уже со своим вводом.
+static rz_snapshot_p rz_farm_prefix(const rz_farm_config_t *cfg, rz_farm_job_p prefix)
+{
+    rz_machine_p m = rz_farm_boot(cfg->image);
+    if (!m)
+        return NULL;
+    rz_io_t io = {.ctx = prefix, .read_int = rz_farm_read_int, .write = rz_farm_write};
+    rz_machine_set_io(m, &io);
+    m->ecall_hook = rz_farm_prefix_hook;
+    m->ecall_abi = cfg->ecall_abi;
+    if (cfg->engine == RZ_ENGINE_JIT)
+        rz_jit_set_threshold(m->cpu, cfg->jit_threshold);
+    rz_set_engine(m->cpu, cfg->engine);
+
+    rz_run_result_t r = rz_run(m->cpu, cfg->budget);
+    prefix->retired = r.retired;
+    prefix->stop = r.reason;
+    rz_snapshot_p snap = rz_snapshot_take(m);
+    rz_machine_free(m);
+    return snap;
+}
+
+// Группы по lanes гостей исполняются в ногу до конца, без квантов: у всех
+// одна программа и один остаток бюджета
+static void rz_farm_lockstep(rz_farm_worker_t *self)
+{
+    rz_farm_t *farm = self->farm;
+    unsigned lanes = farm->cfg->lanes < RZ_LOCKSTEP_LANES ? farm->cfg->lanes : RZ_LOCKSTEP_LANES;
+    rz_farm_guest_t group[RZ_LOCKSTEP_LANES];
+    rz_machine_p machines[RZ_LOCKSTEP_LANES];
+    uint64_t budgets[RZ_LOCKSTEP_LANES];
+    rz_run_result_t results[RZ_LOCKSTEP_LANES];
+    bool more = true;
+
+    for (;;)
+    {
+        unsigned count = 0;
+        while (more && count < lanes)
+        {
+            size_t index = rz_farm_take(&self->range);
+            if (index == SIZE_MAX)
+            {
+                if (!rz_farm_steal(self))
+                    more = false;
+                continue;
+            }
+            if (rz_farm_start(farm, &group[count], index))
+            {
+                machines[count] = group[count].machine;
+                budgets[count] = group[count].left;
+                ++count;
+            }
+        }
+        if (count == 0)
+            break;
+
+        uint64_t start = rz_clock_ns();
+        bool ok = rz_lockstep_run(machines, count, budgets, results, &self->lockstep);
+        uint64_t wall = rz_clock_ns() - start;
+        ++self->slices;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            rz_farm_guest_t *g = &group[i];
+            if (!ok)
+                results[i] = rz_run(g->machine->cpu, g->left);
+            g->job->wall_ns += wall;
+            g->job->retired += results[i].retired;
+            g->job->stop = results[i].reason;
+            g->job->exit_code = g->machine->cpu->exit_code;
+            self->retired += results[i].retired;
+            rz_machine_free(g->machine);
+        }
+    }
+}
+
+static int rz_farm_worker(void *arg)
+{
+    rz_farm_worker_t *self = arg;
+    rz_farm_t *farm = self->farm;
+    if (farm->cfg->lanes > 1)
+    {
+        rz_farm_lockstep(self);
+        return 0;
+    }
+    rz_farm_guest_t active[RZ_FARM_ACTIVE_MAX];
+    unsigned count = 0;
+    bool more = true;
+
+    for (;;)
+    {
+        // Пополнение активных гостей: свои задания, затем краденые
+        while (more && count < RZ_FARM_ACTIVE_MAX)
+        {
+            size_t index = rz_farm_take(&self->range);
+            if (index == SIZE_MAX)
+            {
+                if (!rz_farm_steal(self))
+                    more = false;
+                continue;
+            }
+            if (rz_farm_start(farm, &active[count], index))
+                ++count;
+        }
+        if (count == 0)
+            break;
+
+        // Квант каждому активному гостю по кругу
+        for (unsigned i = 0; i < count;)
+        {
+            rz_farm_guest_t *g = &active[i];
+            uint64_t slice = g->left < farm->quantum ? g->left : farm->quantum;
+            uint64_t start = rz_clock_ns();
+            rz_run_result_t r = rz_run(g->machine->cpu, slice);
+            g->job->wall_ns += rz_clock_ns() - start;
+            g->job->retired += r.retired;
+            g->left -= r.retired;
+            self->retired += r.retired;
+            ++self->slices;
+
+            if (r.reason == RZ_STOP_BUDGET && g->left > 0)
+            {
+                ++i;
+                continue;
+            }
+            g->job->stop = r.reason;
+            g->job->exit_code = g->machine->cpu->exit_code;
+            rz_machine_free(g->machine);
+            active[i] = active[--count];
+        }
+    }
+    return 0;
+}
+
+bool rz_farm_run(const rz_farm_config_t *cfg, rz_farm_job_p jobs, size_t count, rz_farm_stats_t *stats)
+{
+    rz_farm_t farm = {
+        .cfg = cfg,
+        .jobs = jobs,
+        .threads = cfg->threads ? cfg->threads : rz_farm_cpu_count(),
+        .quantum = cfg->quantum ? cfg->quantum : RZ_FARM_DEFAULT_QUANTUM,
+    };
+    // Исполнителю в ногу нужна полная группа гостей
+    size_t groups = cfg->lanes > 1 ? (count + cfg->lanes - 1) / cfg->lanes : count;
+    if (farm.threads > groups && groups > 0)
+        farm.threads = (unsigned)groups;
+
+    uint64_t start = rz_clock_ns();
+    rz_farm_job_t prefix = {0};
+    rz_snapshot_p own = NULL;
+    if (cfg->fork_prefix && !cfg->snapshot && !(own = rz_farm_prefix(cfg, &prefix)))
+        return false;
+    farm.snapshot = own ? own : cfg->snapshot;
+    farm.prefix = &prefix;
+
+    farm.workers = calloc(farm.threads, sizeof(rz_farm_worker_t));
+    thrd_t *handles = calloc(farm.threads, sizeof(thrd_t));
+    if (!farm.workers || !handles)
+    {
+        free(farm.workers);
+        free(handles);
+        free(prefix.output);
+        rz_snapshot_free(own);
+        return false;
+    }
+
+    // Начальное разбиение: по непрерывному диапазону заданий на исполнителя
+    for (unsigned i = 0; i < farm.threads; ++i)
+    {
+        rz_farm_worker_t *w = &farm.workers[i];
+        w->farm = &farm;
+        w->range.next = count * i / farm.threads;
+        w->range.end = count * (i + 1) / farm.threads;
+        mtx_init(&w->range.lock, mtx_plain);
+    }
+
+    unsigned started = 0;
+    for (; started < farm.threads; ++started)
+        if (thrd_create(&handles[started], rz_farm_worker, &farm.workers[started]) != thrd_success)
+            break;
+    // Задания несозданных потоков украдут остальные, в худшем случае — этот
+    unsigned joined = started;
+    if (started == 0)
+    {
+        rz_farm_worker(&farm.workers[0]);
+        started = 1;
+    }
+    for (unsigned i = 0; i < joined; ++i)
+        thrd_join(handles[i], NULL);
+
+    if (stats)
+    {
+        memset(stats, 0, sizeof(*stats));
+        stats->threads = started;
+        stats->wall_ns = rz_clock_ns() - start;
+        stats->retired = prefix.retired; // общее начало исполнено один раз
+        for (unsigned i = 0; i < farm.threads; ++i)
+        {
+            stats->retired += farm.workers[i].retired;
+            stats->slices += farm.workers[i].slices;
+            stats->steals += farm.workers[i].steals;
+            rz_lockstep_stats_t *ls = &farm.workers[i].lockstep;
+            stats->lockstep.steps += ls->steps;
+            stats->lockstep.lanes += ls->lanes;
+            stats->lockstep.divergent += ls->divergent;
+            stats->lockstep.scalar += ls->scalar;
+            stats->lockstep.evicted += ls->evicted;
+        }
+    }
+
+    for (unsigned i = 0; i < farm.threads; ++i)
+        mtx_destroy(&farm.workers[i].range.lock);
+    free(farm.workers);
+    free(handles);
+    free(prefix.output);
+    rz_snapshot_free(own);
+    return true;
+}
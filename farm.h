@@ -0,0 +1,129 @@
+#ifndef __FARM_H__
+#define __FARM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "loader.h"
+#include "lockstep.h"
+#include "snapshot.h"
+
+#define RZ_FARM_DEFAULT_QUANTUM (1u << 20) // instructions per time slice
+#define RZ_FARM_ACTIVE_MAX 4u			   // guests time-sliced by one worker
+
+/**
+ * @brief Batch job: input vector of one guest and its result
+ *
+ */
+typedef struct rz_farm_job_s
+{
+	int32_t *input; // integers returned by ecall 0 in order
+	size_t input_count;
+	size_t input_next;
+
+	rz_stop_t stop;	  // why guest stopped
+	int32_t exit_code; // code of exit ecall when stop is RZ_STOP_EXIT
+	uint64_t retired; // instructions retired, with the fork prefix
+	uint64_t wall_ns; // wall time of slices the guest ran
+	char *output;	  // text written by guest (ecall 1)
+	size_t output_len, output_cap;
+} rz_farm_job_t, *rz_farm_job_p;
+
+/**
+ * @brief Batch configuration
+ *
+ */
+typedef struct rz_farm_config_s
+{
+	const rz_image_t *image;	   // program shared by all guests
+	const rz_snapshot_t *snapshot; // if set, guests are forked from it instead of image
+	rz_engine_t engine;
+	unsigned jit_threshold;
+	unsigned threads;  // workers, 0 for number of host cores
+	uint64_t quantum;  // instructions per time slice, 0 for default
+	uint64_t budget;   // instructions per guest
+	bool fork_prefix;  // run image once until it reads input, fork guests from there
+	unsigned lanes;	   // guests run in lockstep by one worker, 0 or 1 for time slicing
+	rz_ecall_abi_t ecall_abi;
+} rz_farm_config_t;
+
+/**
+ * @brief Batch statistics
+ *
+ */
+typedef struct rz_farm_stats_s
+{
+	unsigned threads;
+	uint64_t retired; // instructions simulated, the fork prefix counted once
+	uint64_t wall_ns; // wall time of the whole batch, fork prefix included
+	uint64_t slices;  // time slices run
+	uint64_t steals;  // jobs taken from other workers
+	rz_lockstep_stats_t lockstep; // when guests ran in lockstep
+} rz_farm_stats_t;
+
+/**
+ * @brief Read input vectors, one job per line of whitespace or comma separated integers
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ *
+ * @param path file name
+ * @param jobs output array of jobs
+ * @param count output number of jobs
+ * @return true on success
+ */
+bool rz_farm_read_inputs(const char *path, rz_farm_job_p *jobs, size_t *count);
+
+/**
+ * @brief Run all jobs across worker threads
+ *
+ * Each worker time-slices a few guests in instruction quanta and takes new
+ * jobs from its own range, stealing half of the largest other range when
+ * its own is empty. With lanes above 1 a worker instead runs groups of
+ * that many guests to the end with rz_lockstep_run. With fork_prefix the
+ * common start of the program runs once and every guest is forked
+ * copy-on-write from its snapshot. The prefix ends at the first request for
+ * input, which is not an error; its output and instructions are counted in
+ * every job, as if the job ran alone, and only once in stats.
+ *
+ * @param cfg configuration
+ * @param jobs jobs, results are filled in
+ * @param count number of jobs
+ * @param stats output statistics, may be NULL
+ * @return true when all workers ran
+ */
+bool rz_farm_run(const rz_farm_config_t *cfg, rz_farm_job_p jobs, size_t count, rz_farm_stats_t *stats);
+
+/**
+ * @brief Write results: job, status, instructions, wall time and output per line
+ *
+ * @param path file name, "-" for stdout
+ * @param jobs jobs
+ * @param count number of jobs
+ * @return true on success
+ */
+bool rz_farm_write_results(const char *path, const rz_farm_job_t *jobs, size_t count);
+
+/**
+ * @brief Release jobs read by rz_farm_read_inputs
+ *
+ * @param jobs jobs
+ * @param count number of jobs
+ */
+void rz_farm_free_jobs(rz_farm_job_p jobs, size_t count);
+
+/**
+ * @brief Create machine with program image mapped and PC at its entry
+ *
+ * @param image program image
+ * @return rz_machine_p machine or NULL
+ */
+rz_machine_p rz_farm_boot(const rz_image_t *image);
+
+/**
+ * @brief Get number of host cores
+ *
+ * @return unsigned number of online cores, at least 1
+ */
+unsigned rz_farm_cpu_count(void);
+
+#endif // FARM_H__
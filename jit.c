@@ -0,0 +1,929 @@
+#include <stdint.h>
+#include <stddef.h> // offsetof
+#include <stdlib.h> // calloc, free
+#include <string.h> // memset
+
+#include "jit.h"
+#include "memory.h"
+#include "profile.h"
+
+// Трансляция поддерживается только на x86-64 с ABI System V
+#if defined(__x86_64__) && !defined(_WIN32)
+#define RZ_JIT_NATIVE 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_CACHE_SIZE (4UL << 20) // Размер кэша машинного кода
+#define JIT_BLOCK_MAX 64           // Максимальная длина блока в инструкциях
+#define JIT_BLOCK_BYTES (16UL << 10) // Запас места под один блок
+#define JIT_COLD UINT16_MAX        // Блок не транслируется (начинается с ECALL и т.п.)
+#define JIT_MODIFIED (1ULL << 32)  // Флаг выхода: блок записал в область текста
+#define JIT_FAULT (1ULL << 33)     // Флаг выхода: инструкция по адресу вызовет ошибку доступа
+#define JIT_PENDING_MAX 4096       // Выходы, ждущие трансляции блока-преемника
+#define JIT_RECORDS_MAX 16384      // Счётчики блоков; при переполнении кэш сбрасывается
+#define JIT_EXIT_RECORD 40         // Флаги выхода: номер счётчика блока с этого бита
+#define JIT_EXIT_INDEX 56          // и первая неисполненная инструкция с этого
+
+// Счётчики транслированного блока, переносятся в счётчики CPU при сбросе
+typedef struct
+{
+    uint64_t execs; // входов в тело блока
+    uint64_t taken; // выходов по условному переходу
+    unsigned count;
+    uint8_t ops[JIT_BLOCK_MAX];
+} rz_jit_record_t;
+
+// Вход в машинный код: сохраняет регистры хоста и переходит на блок
+typedef uint64_t (*rz_jit_enter_f)(rz_register_t *x, const void *block);
+
+// Выход блока, который будет связан с преемником после его трансляции
+typedef struct
+{
+    uint8_t *site; // поле rel32 инструкции jmp
+    rz_address_t target;
+} rz_jit_pending_t;
+
+struct rz_jit_s
+{
+    rz_address_t base;
+    size_t count;
+    uint8_t **map;  // машинный код блоков по (pc - base) / 2
+    uint16_t *hot;  // счётчики исполнений по (pc - base) / 2
+    unsigned threshold;
+    unsigned generation; // поколение кэша инструкций, из которого собраны блоки
+    uint8_t *code;
+    size_t code_start; // начало блоков, перед ним вход и общий эпилог
+    size_t code_used;
+    rz_jit_enter_f enter;
+    uint8_t *epilogue;
+    rz_jit_pending_t *pending;
+    size_t pending_count;
+    rz_jit_record_t *records;
+    size_t record_count;
+    rz_counters_t *counters; // счётчики CPU
+    rz_jit_stats_t stats;
+};
+
+#ifdef RZ_JIT_NATIVE
+static void rz_jit_emit_runtime(rz_jit_p pjit);
+#endif
+
+static rz_jit_p rz_jit_get(rz_cpu_p pcpu)
+{
+    if (pcpu->jit)
+        return pcpu->jit;
+
+    rz_jit_p pjit = calloc(1, sizeof(rz_jit_t));
+    if (!pjit)
+        return NULL;
+    pjit->base = pcpu->icache.base;
+    pjit->count = pcpu->icache.count;
+    pjit->generation = pcpu->icache.generation;
+    pjit->threshold = RZ_JIT_DEFAULT_THRESHOLD;
+    pjit->map = calloc(pjit->count, sizeof(uint8_t *));
+    pjit->hot = calloc(pjit->count, sizeof(uint16_t));
+    pjit->pending = malloc(JIT_PENDING_MAX * sizeof(rz_jit_pending_t));
+    pjit->records = calloc(JIT_RECORDS_MAX, sizeof(rz_jit_record_t));
+    pjit->counters = &pcpu->counters;
+    if (!pjit->map || !pjit->hot || !pjit->pending || !pjit->records)
+    {
+        rz_jit_free(pjit);
+        return NULL;
+    }
+#ifdef RZ_JIT_NATIVE
+    void *code = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED)
+    {
+        pjit->code = code;
+        rz_jit_emit_runtime(pjit);
+    }
+#endif
+    return pcpu->jit = pjit;
+}
+
+void rz_jit_fold(rz_jit_p pjit)
+{
+    if (!pjit)
+        return;
+    for (size_t i = 0; i < pjit->record_count; ++i)
+    {
+        rz_jit_record_t *rec = &pjit->records[i];
+        for (unsigned k = 0; k < rec->count; ++k)
+            pjit->counters->ops[rec->ops[k]] += rec->execs;
+        pjit->counters->taken += rec->taken;
+        rec->execs = rec->taken = 0;
+    }
+}
+
+void rz_jit_free(rz_jit_p pjit)
+{
+    if (!pjit)
+        return;
+    rz_jit_fold(pjit);
+#ifdef RZ_JIT_NATIVE
+    if (pjit->code)
+        munmap(pjit->code, JIT_CACHE_SIZE);
+#endif
+    free(pjit->map);
+    free(pjit->hot);
+    free(pjit->pending);
+    free(pjit->records);
+    free(pjit);
+}
+
+bool rz_jit_available(void)
+{
+#ifdef RZ_JIT_NATIVE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void rz_jit_set_threshold(rz_cpu_p pcpu, unsigned threshold)
+{
+    rz_jit_p pjit = rz_jit_get(pcpu);
+    if (pjit)
+        pjit->threshold = threshold < JIT_COLD ? threshold : JIT_COLD - 1;
+}
+
+void rz_jit_get_stats(const rz_cpu_p pcpu, rz_jit_stats_t *stats)
+{
+    if (pcpu->jit)
+    {
+        *stats = pcpu->jit->stats;
+        stats->code_bytes = pcpu->jit->code_used;
+    }
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+// Сброс кэша кода целиком: все блоки транслируются заново
+static void rz_jit_flush(rz_jit_p pjit)
+{
+    rz_jit_fold(pjit);
+    pjit->record_count = 0;
+    memset(pjit->map, 0, pjit->count * sizeof(uint8_t *));
+    memset(pjit->hot, 0, pjit->count * sizeof(uint16_t));
+    pjit->code_used = pjit->code_start;
+    pjit->pending_count = 0;
+}
+
+#ifdef RZ_JIT_NATIVE
+
+// Регистры x86-64
+enum rz_host_regs : unsigned
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Регистры, сохраняемые вызываемой функцией, под регистры гостя.
+// RBX всегда указывает на r_x[].
+static const unsigned cached_hosts[] = {RBP, R12, R13, R14, R15};
+#define JIT_CACHED (sizeof(cached_hosts) / sizeof(cached_hosts[0]))
+
+// Состояние трансляции одного блока
+typedef struct
+{
+    uint8_t *p;
+    rz_jit_p jit;
+    rz_memory_p mem;      // память машины, к которой обращается код
+    int8_t host[32];      // регистр хоста для регистра гостя или -1
+    uint32_t written;     // регистры гостя, изменяемые в блоке
+    unsigned count;       // число инструкций в блоке
+    unsigned index;       // номер транслируемой инструкции
+    size_t record;        // номер счётчиков блока
+} rz_emit_t;
+
+static inline void emit1(rz_emit_t *e, unsigned b)
+{
+    *e->p++ = (uint8_t)b;
+}
+
+static inline void emit4(rz_emit_t *e, uint32_t v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static inline void emit8(rz_emit_t *e, uint64_t v)
+{
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+static inline void emit_rex(rz_emit_t *e, unsigned w, unsigned reg, unsigned rm)
+{
+    if (w || reg >= R8 || rm >= R8)
+        emit1(e, 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+static inline void emit_modrm(rz_emit_t *e, unsigned mod, unsigned reg, unsigned rm)
+{
+    emit1(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op r/m32, r32 (add, sub, and, or, xor, cmp, mov)
+static void emit_rr(rz_emit_t *e, unsigned opcode, unsigned dst, unsigned src)
+{
+    emit_rex(e, 0, src, dst);
+    emit1(e, opcode);
+    emit_modrm(e, 3, src, dst);
+}
+
+// op r/m32, imm32 (группа 0x81: /0 add, /1 or, /4 and, /6 xor, /7 cmp)
+static void emit_ri(rz_emit_t *e, unsigned ext, unsigned dst, uint32_t imm)
+{
+    emit_rex(e, 0, 0, dst);
+    emit1(e, 0x81);
+    emit_modrm(e, 3, ext, dst);
+    emit4(e, imm);
+}
+
+static void emit_mov_imm(rz_emit_t *e, unsigned dst, uint32_t imm)
+{
+    emit_rex(e, 0, 0, dst);
+    emit1(e, 0xB8 + (dst & 7));
+    emit4(e, imm);
+}
+
+// mov r32, [rbx + 4 * g] и обратно
+static void emit_load_slot(rz_emit_t *e, unsigned dst, unsigned g)
+{
+    emit_rex(e, 0, dst, RBX);
+    emit1(e, 0x8B);
+    emit_modrm(e, 1, dst, RBX);
+    emit1(e, 4 * g);
+}
+
+static void emit_store_slot(rz_emit_t *e, unsigned g, unsigned src)
+{
+    emit_rex(e, 0, src, RBX);
+    emit1(e, 0x89);
+    emit_modrm(e, 1, src, RBX);
+    emit1(e, 4 * g);
+}
+
+// Чтение регистра гостя во временный регистр хоста
+static void emit_get(rz_emit_t *e, unsigned dst, unsigned g)
+{
+    if (g == 0)
+        emit_rr(e, 0x31, dst, dst); // xor dst, dst
+    else if (e->host[g] >= 0)
+        emit_rr(e, 0x89, dst, (unsigned)e->host[g]);
+    else
+        emit_load_slot(e, dst, g);
+}
+
+// Запись временного регистра хоста в регистр гостя; x0 не меняется
+static void emit_set(rz_emit_t *e, unsigned g, unsigned src)
+{
+    if (g == 0)
+        return;
+    if (e->host[g] >= 0)
+        emit_rr(e, 0x89, (unsigned)e->host[g], src);
+    else
+        emit_store_slot(e, g, src);
+}
+
+// Условный переход вперёд с последующей правкой смещения
+static uint8_t *emit_jcc_forward(rz_emit_t *e, unsigned cc)
+{
+    emit1(e, 0x0F);
+    emit1(e, 0x80 | cc);
+    emit4(e, 0);
+    return e->p;
+}
+
+static void patch_forward(rz_emit_t *e, uint8_t *after)
+{
+    uint32_t rel = (uint32_t)(e->p - after);
+    memcpy(after - 4, &rel, 4);
+}
+
+static void emit_jcc_to(rz_emit_t *e, unsigned cc, const uint8_t *target)
+{
+    emit1(e, 0x0F);
+    emit1(e, 0x80 | cc);
+    emit4(e, (uint32_t)(target - (e->p + 4)));
+}
+
+// Коды условий x86
+enum rz_host_cc : unsigned
+{
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_S = 0x8,
+    CC_NS = 0x9,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+};
+
+static void emit_jmp_to(rz_emit_t *e, const uint8_t *target)
+{
+    emit1(e, 0xE9);
+    emit4(e, (uint32_t)(target - (e->p + 4)));
+}
+
+// Сохранение изменённых в блоке регистров гостя
+static void emit_writeback(rz_emit_t *e)
+{
+    for (unsigned g = 1; g < 32; ++g)
+        if (e->host[g] >= 0 && (e->written & (1u << g)))
+            emit_store_slot(e, g, (unsigned)e->host[g]);
+}
+
+// Смещение pcpu->budget относительно r_x[], на который указывает RBX
+#define JIT_BUDGET_DISP ((int32_t)(offsetof(rz_cpu_t, budget) - offsetof(rz_cpu_t, r_x)))
+
+// add/sub qword [rbx + budget], imm32 (группа 0x81: /0 add, /5 sub)
+static void emit_budget(rz_emit_t *e, unsigned ext, uint32_t n)
+{
+    emit1(e, 0x48), emit1(e, 0x81);
+    emit_modrm(e, 2, ext, RBX);
+    emit4(e, (uint32_t)JIT_BUDGET_DISP);
+    emit4(e, n);
+}
+
+// inc qword [адрес]: счётчик в записи блока
+static void emit_count(rz_emit_t *e, uint64_t *counter)
+{
+    emit1(e, 0x48), emit1(e, 0xB8); // mov rax, imm64
+    emit8(e, (uint64_t)(uintptr_t)counter);
+    emit1(e, 0x48), emit1(e, 0xFF), emit1(e, 0x00);
+}
+
+// Флаги выхода из середины блока: по ним диспетчер вычитает из счётчиков
+// инструкции блока, начиная с first, которые не были исполнены
+static uint64_t emit_exit_flags(rz_emit_t *e, uint64_t flag, unsigned first)
+{
+    return flag | (uint64_t)e->record << JIT_EXIT_RECORD | (uint64_t)first << JIT_EXIT_INDEX;
+}
+
+// Выход в диспетчер, результат уже в RAX
+static void emit_exit(rz_emit_t *e)
+{
+    emit_writeback(e);
+    emit_jmp_to(e, e->jit->epilogue);
+}
+
+// Выход на адрес из RAX: поиск транслированного блока по карте прямо
+// в машинном коде, в диспетчер — только если блока нет
+static void emit_exit_dynamic(rz_emit_t *e)
+{
+    rz_jit_p pjit = e->jit;
+    emit_writeback(e);
+    emit_rr(e, 0x89, RDX, RAX);                                      // mov edx, eax
+    emit_ri(e, 5, RDX, pjit->base);                                  // sub edx, base
+    emit_ri(e, 7, RDX, (uint32_t)(pjit->count * RZ_INSN_ALIGN));    // cmp edx, size
+    uint8_t *outside = emit_jcc_forward(e, CC_AE);
+    emit1(e, 0xA9), emit4(e, RZ_INSN_ALIGN - 1);          // test eax, 1
+    uint8_t *unaligned = emit_jcc_forward(e, CC_NE);
+    emit1(e, 0xD1), emit1(e, 0xEA);                       // shr edx, 1
+    emit1(e, 0x48), emit1(e, 0xB9);                       // mov rcx, imm64
+    emit8(e, (uint64_t)(uintptr_t)pjit->map);
+    emit1(e, 0x48), emit1(e, 0x8B), emit1(e, 0x0C), emit1(e, 0xD1); // mov rcx, [rcx + rdx * 8]
+    emit1(e, 0x48), emit1(e, 0x85), emit1(e, 0xC9);       // test rcx, rcx
+    uint8_t *missing = emit_jcc_forward(e, CC_E);
+    emit1(e, 0xFF), emit1(e, 0xE1);                       // jmp rcx
+    patch_forward(e, outside);
+    patch_forward(e, unaligned);
+    patch_forward(e, missing);
+    emit_jmp_to(e, pjit->epilogue);
+}
+
+// Выход на известный адрес: прямой переход на блок-преемник, если он уже
+// транслирован, иначе через заглушку в диспетчер с последующей правкой перехода
+static void emit_exit_to(rz_emit_t *e, rz_address_t pc)
+{
+    rz_jit_p pjit = e->jit;
+    rz_address_t index = (pc - pjit->base) / RZ_INSN_ALIGN;
+    bool in_text = index < pjit->count && !(pc & (RZ_INSN_ALIGN - 1));
+
+    emit_writeback(e);
+    if (in_text && pjit->map[index])
+    {
+        emit_jmp_to(e, pjit->map[index]);
+        return;
+    }
+    emit1(e, 0xE9);
+    emit4(e, 0);
+    if (in_text && pjit->pending_count < JIT_PENDING_MAX)
+        pjit->pending[pjit->pending_count++] = (rz_jit_pending_t){e->p - 4, pc};
+    emit_mov_imm(e, RAX, pc);
+    emit_jmp_to(e, pjit->epilogue);
+}
+
+
+// setcc al; movzx eax, al
+static void emit_setcc(rz_emit_t *e, unsigned cc)
+{
+    emit1(e, 0x0F), emit1(e, 0x90 | cc), emit1(e, 0xC0);
+    emit1(e, 0x0F), emit1(e, 0xB6), emit1(e, 0xC0);
+}
+
+// esi = x[rs1] + imm; rax = mem_host(mem, esi, kind, size). При ошибке доступа
+// выход в диспетчер с флагом: инструкцию повторит интерпретатор
+static void emit_address(rz_emit_t *e, const rz_decoded_t *d, rz_address_t pc,
+                         mem_kind_t kind, unsigned size)
+{
+    emit_get(e, RSI, d->rs1);
+    if (d->imm)
+        emit_ri(e, 0, RSI, d->imm);
+    emit1(e, 0x89), emit1(e, 0x34), emit1(e, 0x24); // mov [rsp], esi
+    emit1(e, 0x48), emit1(e, 0xBF);                 // mov rdi, imm64
+    emit8(e, (uint64_t)(uintptr_t)e->mem);
+    emit_mov_imm(e, RDX, kind);
+    emit_mov_imm(e, RCX, size);
+    emit1(e, 0x48), emit1(e, 0xB8);                 // mov rax, imm64
+    emit8(e, (uint64_t)(uintptr_t)&mem_host);
+    emit1(e, 0xFF), emit1(e, 0xD0); // call rax
+    emit1(e, 0x48), emit1(e, 0x85), emit1(e, 0xC0); // test rax, rax
+    uint8_t *ok = emit_jcc_forward(e, CC_NE);
+    emit_budget(e, 0, e->count - e->index); // инструкция и остаток блока не исполнены
+    emit1(e, 0x48), emit1(e, 0xB8);         // mov rax, imm64
+    emit8(e, emit_exit_flags(e, JIT_FAULT, e->index) | pc);
+    emit_exit(e);
+    patch_forward(e, ok);
+}
+
+// Выбор регистров гостя, которые будут жить в регистрах хоста
+static void rz_jit_allocate(rz_emit_t *e, const rz_decoded_t *code, unsigned n)
+{
+    unsigned uses[32] = {0};
+    for (unsigned i = 0; i < n; ++i)
+    {
+        const rz_decoded_t *d = &code[i];
+        char format = rz_op_format(d->op);
+        if (format != 'U' && format != 'J')
+            ++uses[d->rs1];
+        if (format == 'R' || format == 'S' || format == 'B')
+            ++uses[d->rs2];
+        if (format != 'S' && format != 'B')
+        {
+            ++uses[d->rd];
+            e->written |= 1u << d->rd;
+        }
+    }
+    memset(e->host, -1, sizeof(e->host));
+    for (unsigned k = 0; k < JIT_CACHED; ++k)
+    {
+        unsigned best = 0;
+        for (unsigned g = 1; g < 32; ++g)
+            if (e->host[g] < 0 && uses[g] > uses[best])
+                best = g;
+        if (best == 0 || uses[best] < 2)
+            break;
+        e->host[best] = (int8_t)cached_hosts[k];
+    }
+}
+
+// Трансляция одной инструкции; false — инструкция не транслируется
+static bool rz_jit_insn(rz_emit_t *e, const rz_decoded_t *d, rz_address_t pc,
+                        rz_address_t block_pc, const uint8_t *body)
+{
+    switch (d->op)
+    {
+    case RZ_OP_LUI:
+    case RZ_OP_AUIPC:
+        emit_mov_imm(e, RAX, d->op == RZ_OP_LUI ? d->imm : pc + d->imm);
+        emit_set(e, d->rd, RAX);
+        return true;
+
+    case RZ_OP_ADD:
+    case RZ_OP_SUB:
+    case RZ_OP_AND:
+    case RZ_OP_OR:
+    case RZ_OP_XOR:
+    {
+        static const uint8_t opcodes[] = {
+            [RZ_OP_ADD] = 0x01, [RZ_OP_SUB] = 0x29, [RZ_OP_AND] = 0x21,
+            [RZ_OP_OR] = 0x09, [RZ_OP_XOR] = 0x31};
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit_rr(e, opcodes[d->op], RAX, RCX);
+        emit_set(e, d->rd, RAX);
+        return true;
+    }
+    case RZ_OP_SLL:
+    case RZ_OP_SRL:
+    case RZ_OP_SRA:
+        // Сдвиг на CL: x86 сам берёт младшие 5 бит, как и RISC-V
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit1(e, 0xD3);
+        emit_modrm(e, 3, d->op == RZ_OP_SLL ? 4 : d->op == RZ_OP_SRL ? 5 : 7, RAX);
+        emit_set(e, d->rd, RAX);
+        return true;
+    case RZ_OP_MUL:
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit1(e, 0x0F), emit1(e, 0xAF), emit1(e, 0xC1); // imul eax, ecx
+        emit_set(e, d->rd, RAX);
+        return true;
+    case RZ_OP_MULH:
+    case RZ_OP_MULHSU:
+    case RZ_OP_MULHU:
+        // Старшая половина 64-битного произведения; 32-битный mov уже
+        // расширил операнды нулями, знаковые расширяются movsxd
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        if (d->op != RZ_OP_MULHU)
+            emit1(e, 0x48), emit1(e, 0x63), emit1(e, 0xC0); // movsxd rax, eax
+        if (d->op == RZ_OP_MULH)
+            emit1(e, 0x48), emit1(e, 0x63), emit1(e, 0xC9); // movsxd rcx, ecx
+        emit1(e, 0x48), emit1(e, 0x0F), emit1(e, 0xAF), emit1(e, 0xC1); // imul rax, rcx
+        emit1(e, 0x48), emit1(e, 0xC1), emit1(e, 0xE8), emit1(e, 0x20); // shr rax, 32
+        emit_set(e, d->rd, RAX);
+        return true;
+    case RZ_OP_DIV:
+    case RZ_OP_DIVU:
+    case RZ_OP_REM:
+    case RZ_OP_REMU:
+    {
+        // Деление на ноль и INT32_MIN / -1 на x86 — исключение, их
+        // результаты по спецификации выбираются до деления
+        bool sign = d->op == RZ_OP_DIV || d->op == RZ_OP_REM;
+        bool rem = d->op == RZ_OP_REM || d->op == RZ_OP_REMU;
+        uint8_t *overflow = NULL;
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit1(e, 0x85), emit1(e, 0xC9); // test ecx, ecx
+        uint8_t *zero = emit_jcc_forward(e, CC_E);
+        if (sign)
+        {
+            emit_ri(e, 7, RCX, UINT32_MAX);
+            uint8_t *normal = emit_jcc_forward(e, CC_NE);
+            emit1(e, 0x3D), emit4(e, 0x80000000u); // cmp eax, INT32_MIN
+            uint8_t *normal2 = emit_jcc_forward(e, CC_NE);
+            if (rem)
+                emit_rr(e, 0x31, RAX, RAX); // частное — делимое, остаток — 0
+            emit1(e, 0xE9), emit4(e, 0);
+            overflow = e->p;
+            patch_forward(e, normal);
+            patch_forward(e, normal2);
+            emit1(e, 0x99), emit1(e, 0xF7), emit1(e, 0xF9); // cdq; idiv ecx
+        }
+        else
+        {
+            emit_rr(e, 0x31, RDX, RDX);
+            emit1(e, 0xF7), emit1(e, 0xF1); // div ecx
+        }
+        if (rem)
+            emit_rr(e, 0x89, RAX, RDX);
+        emit1(e, 0xE9), emit4(e, 0);
+        uint8_t *done = e->p;
+        patch_forward(e, zero);
+        if (!rem)
+            emit_mov_imm(e, RAX, UINT32_MAX); // на ноль: частное — все единицы, остаток — делимое
+        patch_forward(e, done);
+        if (overflow)
+            patch_forward(e, overflow);
+        emit_set(e, d->rd, RAX);
+        return true;
+    }
+    case RZ_OP_SLT:
+    case RZ_OP_SLTU:
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit_rr(e, 0x39, RAX, RCX);
+        emit_setcc(e, d->op == RZ_OP_SLT ? CC_L : CC_B);
+        emit_set(e, d->rd, RAX);
+        return true;
+
+    case RZ_OP_ADDI:
+    case RZ_OP_ANDI:
+    case RZ_OP_ORI:
+    case RZ_OP_XORI:
+    {
+        static const uint8_t exts[] = {
+            [RZ_OP_ADDI] = 0, [RZ_OP_ANDI] = 4, [RZ_OP_ORI] = 1, [RZ_OP_XORI] = 6};
+        emit_get(e, RAX, d->rs1);
+        emit_ri(e, exts[d->op], RAX, d->imm);
+        emit_set(e, d->rd, RAX);
+        return true;
+    }
+    case RZ_OP_SLLI:
+    case RZ_OP_SRLI:
+    case RZ_OP_SRAI:
+        emit_get(e, RAX, d->rs1);
+        emit1(e, 0xC1);
+        emit_modrm(e, 3, d->op == RZ_OP_SLLI ? 4 : d->op == RZ_OP_SRLI ? 5 : 7, RAX);
+        emit1(e, d->imm);
+        emit_set(e, d->rd, RAX);
+        return true;
+    case RZ_OP_SLTI:
+    case RZ_OP_SLTIU:
+        emit_get(e, RAX, d->rs1);
+        emit_ri(e, 7, RAX, d->imm);
+        emit_setcc(e, d->op == RZ_OP_SLTI ? CC_L : CC_B);
+        emit_set(e, d->rd, RAX);
+        return true;
+
+    case RZ_OP_LB:
+    case RZ_OP_LH:
+    case RZ_OP_LW:
+    case RZ_OP_LBU:
+    case RZ_OP_LHU:
+    {
+        // movsx/movzx/mov eax, [rax]
+        static const uint8_t loads[][3] = {
+            [RZ_OP_LB] = {0x0F, 0xBE, 0x00}, [RZ_OP_LH] = {0x0F, 0xBF, 0x00},
+            [RZ_OP_LW] = {0x8B, 0x00, 0x00}, [RZ_OP_LBU] = {0x0F, 0xB6, 0x00},
+            [RZ_OP_LHU] = {0x0F, 0xB7, 0x00}};
+        static const uint8_t sizes[] = {
+            [RZ_OP_LB] = 1, [RZ_OP_LH] = 2, [RZ_OP_LW] = 4, [RZ_OP_LBU] = 1, [RZ_OP_LHU] = 2};
+        // Проверка доступа нужна и для загрузки в x0
+        emit_address(e, d, pc, MEM_LOAD, sizes[d->op]);
+        if (d->rd == 0)
+            return true;
+        emit1(e, loads[d->op][0]);
+        emit1(e, loads[d->op][1]);
+        if (loads[d->op][0] == 0x0F)
+            emit1(e, loads[d->op][2]);
+        emit_set(e, d->rd, RAX);
+        return true;
+    }
+
+    case RZ_OP_SB:
+    case RZ_OP_SH:
+    case RZ_OP_SW:
+    {
+        emit_address(e, d, pc, MEM_STORE, d->op == RZ_OP_SB ? 1 : d->op == RZ_OP_SH ? 2 : 4);
+        emit_get(e, RCX, d->rs2);
+        if (d->op == RZ_OP_SH)
+            emit1(e, 0x66);
+        emit1(e, d->op == RZ_OP_SB ? 0x88 : 0x89); // mov [rax], cl/cx/ecx
+        emit1(e, 0x08);
+        // Запись в область текста — выход с флагом, код будет сброшен
+        emit1(e, 0x8B), emit1(e, 0x04), emit1(e, 0x24); // mov eax, [rsp]
+        emit_ri(e, 5, RAX, e->jit->base);               // sub eax, base
+        emit_ri(e, 7, RAX, (uint32_t)(e->jit->count * RZ_INSN_ALIGN)); // cmp eax, size
+        uint8_t *skip = emit_jcc_forward(e, CC_AE);
+        if (e->index + 1 < e->count)
+            emit_budget(e, 0, e->count - e->index - 1); // возврат неисполненного
+        emit1(e, 0x48), emit1(e, 0xB8); // mov rax, imm64
+        emit8(e, emit_exit_flags(e, JIT_MODIFIED, e->index + 1) | (pc + d->size));
+        emit_exit(e);
+        patch_forward(e, skip);
+        return true;
+    }
+
+    case RZ_OP_BEQ:
+    case RZ_OP_BNE:
+    case RZ_OP_BLT:
+    case RZ_OP_BGE:
+    case RZ_OP_BLTU:
+    case RZ_OP_BGEU:
+    {
+        static const uint8_t conds[] = {
+            [RZ_OP_BEQ] = CC_E, [RZ_OP_BNE] = CC_NE, [RZ_OP_BLT] = CC_L,
+            [RZ_OP_BGE] = CC_GE, [RZ_OP_BLTU] = CC_B, [RZ_OP_BGEU] = CC_AE};
+        rz_address_t target = pc + d->imm;
+        emit_get(e, RAX, d->rs1);
+        emit_get(e, RCX, d->rs2);
+        emit_rr(e, 0x39, RAX, RCX);
+        if (target == block_pc)
+        {
+            // Цикл на себя: переход к телу блока без выхода в диспетчер,
+            // пока хватает бюджета
+            uint8_t *taken = emit_jcc_forward(e, conds[d->op]);
+            emit_exit_to(e, pc + d->size);
+            patch_forward(e, taken);
+            emit_count(e, &e->jit->records[e->record].taken);
+            emit_budget(e, 5, e->count);
+            emit_jcc_to(e, CC_NS, body);
+            emit_budget(e, 0, e->count);
+            emit_mov_imm(e, RAX, block_pc);
+            emit_exit(e);
+        }
+        else
+        {
+            uint8_t *taken = emit_jcc_forward(e, conds[d->op]);
+            emit_exit_to(e, pc + d->size);
+            patch_forward(e, taken);
+            emit_count(e, &e->jit->records[e->record].taken);
+            emit_exit_to(e, target);
+        }
+        return true;
+    }
+
+    case RZ_OP_JAL:
+        emit_mov_imm(e, RAX, pc + d->size);
+        emit_set(e, d->rd, RAX);
+        emit_exit_to(e, pc + d->imm);
+        return true;
+    case RZ_OP_JALR:
+        emit_get(e, RDX, d->rs1);
+        emit_ri(e, 0, RDX, d->imm);
+        emit_ri(e, 4, RDX, ~1u);
+        emit_mov_imm(e, RAX, pc + d->size);
+        emit_set(e, d->rd, RAX);
+        emit_rr(e, 0x89, RAX, RDX);
+        emit_exit_dynamic(e);
+        return true;
+
+    case RZ_OP_FENCE:
+        return true;
+    default:
+        // ECALL, EBREAK, FENCE.I, недопустимые — через rz_cycle
+        return false;
+    }
+}
+
+// Общий для всех блоков код: вход из C и эпилог
+static void rz_jit_emit_runtime(rz_jit_p pjit)
+{
+    rz_emit_t e = {.p = pjit->code, .jit = pjit};
+
+    // enter(x, block): сохранение регистров, выравнивание стека, переход на блок
+    pjit->enter = (rz_jit_enter_f)(void *)e.p;
+    emit1(&e, 0x53); // push rbx
+    for (unsigned i = 0; i < JIT_CACHED; ++i)
+    {
+        emit_rex(&e, 0, 0, cached_hosts[i]);
+        emit1(&e, 0x50 + (cached_hosts[i] & 7));
+    }
+    emit1(&e, 0x48), emit1(&e, 0x83), emit1(&e, 0xEC), emit1(&e, 0x08); // sub rsp, 8
+    emit1(&e, 0x48), emit1(&e, 0x89), emit1(&e, 0xFB);                   // mov rbx, rdi
+    emit1(&e, 0xFF), emit1(&e, 0xE6);                                     // jmp rsi
+
+    pjit->epilogue = e.p;
+    emit1(&e, 0x48), emit1(&e, 0x83), emit1(&e, 0xC4), emit1(&e, 0x08); // add rsp, 8
+    for (int i = JIT_CACHED - 1; i >= 0; --i)
+    {
+        emit_rex(&e, 0, 0, cached_hosts[i]);
+        emit1(&e, 0x58 + (cached_hosts[i] & 7)); // pop
+    }
+    emit1(&e, 0x5B); // pop rbx
+    emit1(&e, 0xC3); // ret
+
+    pjit->code_start = pjit->code_used = (size_t)(e.p - pjit->code + 15) & ~(size_t)15;
+}
+
+// Трансляция блока, начинающегося с pc; NULL — транслировать нечего
+static uint8_t *rz_jit_translate(rz_cpu_p pcpu, rz_jit_p pjit, rz_address_t pc)
+{
+    rz_decoded_t code[JIT_BLOCK_MAX];
+    rz_decoded_p slot;
+    unsigned n = 0;
+    for (rz_address_t at = pc; n < JIT_BLOCK_MAX; at += slot->size)
+    {
+        slot = rz_icache_slot(&pcpu->icache, at);
+        if (!slot)
+            break;
+        if (slot->op == RZ_OP_UNDECODED)
+        {
+            rz_register_t raw;
+            if (mem_fetch(pcpu->mem, at, &raw) != MEM_OK)
+                break;
+            rz_decode(raw, slot);
+        }
+        if (slot->op == RZ_OP_ILLEGAL || slot->op == RZ_OP_FENCE_I ||
+            slot->op == RZ_OP_ECALL || slot->op == RZ_OP_EBREAK || slot->op == RZ_OP_BREAKPOINT ||
+            rz_op_is_csr(slot->op))
+            break;
+        // Вызовы и возвраты видит профилировщик — через интерпретатор
+        if (pcpu->profile && rz_profile_is_linkage(slot))
+            break;
+        code[n++] = *slot;
+        if (rz_op_is_control(slot->op))
+            break;
+    }
+    if (n == 0)
+        return NULL;
+
+    if (pjit->code_used + JIT_BLOCK_BYTES > JIT_CACHE_SIZE || pjit->record_count == JIT_RECORDS_MAX)
+    {
+        // Кэш кода или счётчиков полон — вытесняем всё
+        rz_jit_flush(pjit);
+        ++pjit->stats.evictions;
+    }
+
+    rz_emit_t e = {.p = pjit->code + pjit->code_used, .jit = pjit, .mem = pcpu->mem, .count = n,
+                   .record = pjit->record_count++};
+    rz_jit_record_t *rec = &pjit->records[e.record];
+    rec->execs = rec->taken = 0;
+    rec->count = n;
+    for (unsigned i = 0; i < n; ++i)
+        rec->ops[i] = code[i].op;
+    uint8_t *start = e.p;
+    rz_jit_allocate(&e, code, n);
+
+    // Вход в блок: списание бюджета, если его не хватает — выход в
+    // диспетчер, который доисполнит остаток по одной инструкции
+    emit_budget(&e, 5, n);
+    uint8_t *exhausted = emit_jcc_forward(&e, CC_S);
+
+    // Загрузка регистров гостя, живущих в регистрах хоста
+    for (unsigned g = 1; g < 32; ++g)
+        if (e.host[g] >= 0)
+            emit_load_slot(&e, (unsigned)e.host[g], g);
+    const uint8_t *body = e.p;
+    emit_count(&e, &rec->execs); // цикл на себя возвращается сюда же
+
+    rz_address_t at = pc;
+    for (unsigned i = 0; i < n; at += code[i++].size)
+    {
+        e.index = i;
+        rz_jit_insn(&e, &code[i], at, pc, body);
+    }
+    if (!rz_op_is_control(code[n - 1].op))
+        emit_exit_to(&e, at);
+
+    patch_forward(&e, exhausted);
+    emit_budget(&e, 0, n);
+    emit_mov_imm(&e, RAX, pc);
+    emit_jmp_to(&e, pjit->epilogue);
+
+    pjit->code_used += (size_t)(e.p - start + 15) & ~(size_t)15;
+    ++pjit->stats.blocks;
+
+    // Связываем выходы других блоков, ждавшие этот блок
+    for (size_t i = 0; i < pjit->pending_count;)
+    {
+        rz_jit_pending_t *pending = &pjit->pending[i];
+        if (pending->target != pc)
+        {
+            ++i;
+            continue;
+        }
+        uint32_t rel = (uint32_t)(start - (pending->site + 4));
+        memcpy(pending->site, &rel, 4);
+        *pending = pjit->pending[--pjit->pending_count];
+    }
+    return start;
+}
+
+#endif // RZ_JIT_NATIVE
+
+rz_stop_t rz_jit_run(rz_cpu_p pcpu)
+{
+    rz_jit_p pjit = rz_jit_get(pcpu);
+    if (!pjit || !pjit->code)
+    {
+        for (; pcpu->budget > 0; --pcpu->budget)
+            if (!rz_cycle(pcpu))
+                return pcpu->stop;
+        return RZ_STOP_BUDGET;
+    }
+
+#ifdef RZ_JIT_NATIVE
+    while (pcpu->budget > 0)
+    {
+        if (pjit->generation != pcpu->icache.generation)
+        {
+            // Код изменён записью в текст или FENCE.I
+            rz_jit_flush(pjit);
+            pjit->generation = pcpu->icache.generation;
+            ++pjit->stats.flushes;
+        }
+
+        rz_address_t index = (pcpu->r_pc - pjit->base) / RZ_INSN_ALIGN;
+        if (pcpu->budget >= JIT_BLOCK_MAX && index < pjit->count && !(pcpu->r_pc & (RZ_INSN_ALIGN - 1)))
+        {
+            uint8_t *block = pjit->map[index];
+            if (!block && pjit->hot[index] != JIT_COLD && pjit->hot[index]++ >= pjit->threshold)
+            {
+                block = rz_jit_translate(pcpu, pjit, pcpu->r_pc);
+                pjit->map[index] = block;
+                if (!block)
+                    pjit->hot[index] = JIT_COLD;
+            }
+            if (block)
+            {
+                pcpu->r_x[0] = 0u;
+                uint64_t result = pjit->enter(pcpu->r_x, block);
+                pcpu->r_pc = (rz_address_t)result;
+                ++pjit->stats.entries;
+                if (result & (JIT_MODIFIED | JIT_FAULT))
+                {
+                    // Остаток блока не исполнен, хотя учтён во входе в блок
+                    const rz_jit_record_t *rec = &pjit->records[(uint16_t)(result >> JIT_EXIT_RECORD)];
+                    for (unsigned i = (unsigned)(result >> JIT_EXIT_INDEX); i < rec->count; ++i)
+                        --pcpu->counters.ops[rec->ops[i]];
+                }
+                if (result & JIT_MODIFIED)
+                    rz_icache_flush(&pcpu->icache); // адрес записи неизвестен
+                if (!(result & JIT_FAULT))
+                    continue;
+                // Ошибку доступа сообщит интерпретатор
+                if (!rz_cycle(pcpu))
+                    return pcpu->stop;
+                --pcpu->budget;
+                continue;
+            }
+        }
+
+        // Холодный код, ECALL, EBREAK и остаток бюджета меньше блока
+        if (!rz_cycle(pcpu))
+            return pcpu->stop;
+        --pcpu->budget;
+    }
+#endif
+    return RZ_STOP_BUDGET;
+}
@@ -0,0 +1,78 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "cpu.h"
+
+#define RZ_JIT_DEFAULT_THRESHOLD 50u
+
+/**
+ * @brief State of x86-64 dynamic binary translator: hotness counters,
+ * executable code cache and map of translated blocks
+ *
+ */
+struct rz_jit_s;
+typedef struct rz_jit_s rz_jit_t, *rz_jit_p;
+
+/**
+ * @brief Translator statistics
+ *
+ */
+typedef struct rz_jit_stats_s
+{
+	uint64_t blocks;	// translated blocks
+	uint64_t evictions; // code cache flushes because it was full
+	uint64_t flushes;	// code cache flushes because guest code changed
+	uint64_t entries;	// transfers from dispatcher into native code
+	size_t code_bytes;	// bytes of native code currently in cache
+} rz_jit_stats_t;
+
+/**
+ * @brief Check whether native translation is supported on this host
+ *
+ * @return true on x86-64 System V hosts with executable memory
+ */
+bool rz_jit_available(void);
+
+/**
+ * @brief Set number of executions after which a block is translated
+ *
+ * @param pcpu pointer to CPU instance
+ * @param threshold executions, 0 translates on first execution
+ */
+void rz_jit_set_threshold(rz_cpu_p pcpu, unsigned threshold);
+
+/**
+ * @brief Run CPU with native translation of hot blocks while pcpu->budget lasts
+ *
+ * Cold code, ECALL, EBREAK, FENCE.I and code outside the text region are
+ * executed by rz_cycle, so is the tail of the budget shorter than a block.
+ * When translation is not available the whole program is interpreted.
+ *
+ * @param pcpu pointer to CPU instance
+ * @return rz_stop_t RZ_STOP_BUDGET or the reason CPU stopped
+ */
+rz_stop_t rz_jit_run(rz_cpu_p pcpu);
+
+/**
+ * @brief Get translator statistics
+ *
+ * @param pcpu pointer to CPU instance
+ * @param stats output statistics, zeroed when translator was not used
+ */
+void rz_jit_get_stats(const rz_cpu_p pcpu, rz_jit_stats_t *stats);
+
+/**
+ * @brief Add executions of translated blocks to CPU counters
+ *
+ * @param pjit translator state, may be NULL
+ */
+void rz_jit_fold(rz_jit_p pjit);
+
+/**
+ * @brief Release translator state attached to CPU
+ *
+ * @param pjit translator state, may be NULL
+ */
+void rz_jit_free(rz_jit_p pjit);
+
+#endif // JIT_H__
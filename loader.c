@@ -0,0 +1,558 @@
+#include <errno.h>
+#include <stddef.h> // offsetof
+#include <stdio.h>
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcmp, memcpy, strerror
+
+#include "loader.h"
+#include "memory.h"
+
+// Отображение файла в память есть только на POSIX-системах
+#if defined(__unix__) || defined(__APPLE__)
+#define RZ_LOADER_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Заголовки ELF32 (без <elf.h>, которого нет на Windows)
+#define EI_NIDENT 16
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_RISCV 243
+#define PT_LOAD 1
+#define PF_X 1u
+#define PF_W 2u
+#define PF_R 4u
+#define SHT_SYMTAB 2
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define SHN_UNDEF 0
+
+typedef struct
+{
+    uint8_t e_ident[EI_NIDENT];
+    uint16_t e_type, e_machine;
+    uint32_t e_version, e_entry, e_phoff, e_shoff, e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+} rz_elf32_ehdr_t;
+
+typedef struct
+{
+    uint32_t p_type, p_offset, p_vaddr, p_paddr, p_filesz, p_memsz, p_flags, p_align;
+} rz_elf32_phdr_t;
+
+typedef struct
+{
+    uint32_t sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info, sh_addralign, sh_entsize;
+} rz_elf32_shdr_t;
+
+typedef struct
+{
+    uint32_t st_name, st_value, st_size;
+    uint8_t st_info, st_other;
+    uint16_t st_shndx;
+} rz_elf32_sym_t;
+
+#define RZ_PAGE_UP(x) (((uint64_t)(x) + MEM_PAGE_MASK) & ~(uint64_t)MEM_PAGE_MASK)
+
+bool rz_image_parse_format(const char *name, rz_image_format_t *format)
+{
+    static const char *const names[] = {
+        [RZ_IMAGE_AUTO] = "auto", [RZ_IMAGE_RAW] = "raw",
+        [RZ_IMAGE_HEX] = "hex", [RZ_IMAGE_ELF] = "elf"};
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (rz_image_format_t)i;
+            return true;
+        }
+    return false;
+}
+
+// Содержимое файла: приватное отображение (копирование при записи) или
+// чтение в буфер, дополненный нулями до границы страницы
+static bool rz_image_read(rz_image_p img, const char *path)
+{
+#ifdef RZ_LOADER_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", path, st.st_size == 0 ? "empty file" : strerror(errno));
+        close(fd);
+        return false;
+    }
+    img->map_size = (size_t)st.st_size;
+    img->map = mmap(NULL, img->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img->map != MAP_FAILED)
+    {
+        img->mapped = true;
+        return true;
+    }
+    img->map = NULL;
+#endif
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        size = ftell(file);
+    if (size <= 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", path, size == 0 ? "empty file" : "cannot get size");
+        fclose(file);
+        return false;
+    }
+    img->map_size = (size_t)size;
+    img->map = calloc(1, (size_t)RZ_PAGE_UP(img->map_size));
+    if (!img->map || fread(img->map, 1, img->map_size, file) != img->map_size)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    return true;
+}
+
+// Плоский образ: страницы текста указывают прямо на содержимое файла,
+// если образ не разделяется между машинами, иначе копируются
+static bool rz_image_map_raw(const rz_image_t *img, rz_memory_p mem)
+{
+    size_t size = (size_t)RZ_PAGE_UP(img->map_size);
+    unsigned perm = MEM_PERM_READ | MEM_PERM_WRITE | MEM_PERM_EXEC;
+    if (!img->shared)
+        return mem_map(mem, TEXT_OFFSET, size, img->map, perm);
+    if (!mem_map(mem, TEXT_OFFSET, size, NULL, perm))
+        return false;
+    memcpy(mem_access(mem, TEXT_OFFSET), img->map, img->map_size);
+    return true;
+}
+
+// Образ в шестнадцатеричном виде: по слову в строке, разбор сразу в текст
+static bool rz_image_map_hex(const rz_image_t *img, rz_memory_p mem)
+{
+    const char *p = img->map, *end = p + img->map_size;
+    rz_address_t addr = TEXT_OFFSET;
+    unsigned line = 1;
+
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            line += *p++ == '\n';
+        if (p == end)
+            break;
+
+        uint32_t word = 0;
+        unsigned digits = 0;
+        if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            p += 2;
+        for (; p < end && digits < 9; ++p, ++digits)
+        {
+            unsigned c = (unsigned char)*p, v;
+            if (c >= '0' && c <= '9')
+                v = c - '0';
+            else if ((c | 0x20u) >= 'a' && (c | 0x20u) <= 'f')
+                v = (c | 0x20u) - 'a' + 10;
+            else
+                break;
+            word = word << 4 | v;
+        }
+        if (digits == 0 || digits > 8 || (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'))
+        {
+            fprintf(stderr, "Bad hex word at line %u\n", line);
+            return false;
+        }
+        if (addr - TEXT_OFFSET >= TEXT_SIZE)
+        {
+            fprintf(stderr, "Hex image does not fit into %lu bytes of text\n", TEXT_SIZE);
+            return false;
+        }
+        memcpy(mem_access(mem, addr), &word, sizeof(word));
+        addr += sizeof(word);
+    }
+    return true;
+}
+
+static unsigned rz_elf_perm(uint32_t flags)
+{
+    return (flags & PF_R ? MEM_PERM_READ : 0) | (flags & PF_W ? MEM_PERM_WRITE : 0) |
+           (flags & PF_X ? MEM_PERM_EXEC : 0);
+}
+
+static rz_elf32_phdr_t rz_elf_phdr(const rz_image_t *img, const rz_elf32_ehdr_t *eh, unsigned i)
+{
+    rz_elf32_phdr_t ph;
+    memcpy(&ph, (const uint8_t *)img->map + eh->e_phoff + i * sizeof(ph), sizeof(ph));
+    return ph;
+}
+
+// Проверка заголовков ELF, точка входа и границы исполняемого кода
+static bool rz_image_check_elf(rz_image_p img)
+{
+    rz_elf32_ehdr_t eh;
+    if (img->map_size < sizeof(eh))
+    {
+        fprintf(stderr, "Truncated ELF header\n");
+        return false;
+    }
+    memcpy(&eh, img->map, sizeof(eh));
+    if (eh.e_ident[4] != ELFCLASS32 || eh.e_ident[5] != ELFDATA2LSB ||
+        eh.e_machine != EM_RISCV || eh.e_type != ET_EXEC)
+    {
+        fprintf(stderr, "Not a little-endian ELF32 RISC-V executable\n");
+        return false;
+    }
+    if (eh.e_phentsize != sizeof(rz_elf32_phdr_t) ||
+        (uint64_t)eh.e_phoff + (uint64_t)eh.e_phnum * sizeof(rz_elf32_phdr_t) > img->map_size)
+    {
+        fprintf(stderr, "Bad ELF program header table\n");
+        return false;
+    }
+
+    uint64_t text_lo = UINT64_MAX, text_hi = 0, end = HEAP_OFFSET;
+    for (unsigned i = 0; i < eh.e_phnum; ++i)
+    {
+        rz_elf32_phdr_t ph = rz_elf_phdr(img, &eh, i);
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+            continue;
+        if (ph.p_filesz > ph.p_memsz || (uint64_t)ph.p_offset + ph.p_filesz > img->map_size ||
+            (uint64_t)ph.p_vaddr + ph.p_memsz > (1ULL << 32))
+        {
+            fprintf(stderr, "Bad ELF segment %u\n", i);
+            return false;
+        }
+        if (RZ_PAGE_UP((uint64_t)ph.p_vaddr + ph.p_memsz) > end)
+            end = RZ_PAGE_UP((uint64_t)ph.p_vaddr + ph.p_memsz);
+        if (ph.p_flags & PF_X)
+        {
+            if (ph.p_vaddr < text_lo)
+                text_lo = ph.p_vaddr;
+            if ((uint64_t)ph.p_vaddr + ph.p_memsz > text_hi)
+                text_hi = (uint64_t)ph.p_vaddr + ph.p_memsz;
+        }
+    }
+
+    if (text_hi == 0)
+    {
+        fprintf(stderr, "ELF has no executable segments\n");
+        return false;
+    }
+    img->entry = eh.e_entry;
+    img->text_base = (rz_address_t)text_lo & ~3u;
+    img->text_size = (size_t)(text_hi - img->text_base + 3) & ~(size_t)3;
+    // Куча начинается за последним сегментом
+    img->heap_base = end < HEAP_LIMIT ? (rz_address_t)end : 0;
+    return true;
+}
+
+// Сегменты [0, count), кроме skip, задевающие страницу page
+static bool rz_elf_page_used(const rz_image_t *img, const rz_elf32_ehdr_t *eh, unsigned count, unsigned skip,
+                             uint64_t page)
+{
+    for (unsigned k = 0; k < count; ++k)
+    {
+        rz_elf32_phdr_t ph = rz_elf_phdr(img, eh, k);
+        if (k != skip && ph.p_type == PT_LOAD && ph.p_memsz && page < (uint64_t)ph.p_vaddr + ph.p_memsz &&
+            page + MEM_PAGE_SIZE > ph.p_vaddr)
+            return true;
+    }
+    return false;
+}
+
+// Побайтовое заполнение сегмента: страницы гостя на хосте не обязательно подряд
+static void rz_elf_fill(rz_memory_p mem, rz_address_t addr, const uint8_t *src, size_t len)
+{
+    while (len)
+    {
+        size_t chunk = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (chunk > len)
+            chunk = len;
+        uint8_t *host = mem_access(mem, addr);
+        if (src)
+        {
+            memcpy(host, src, chunk);
+            src += chunk;
+        }
+        else
+            memset(host, 0, chunk);
+        addr += (rz_address_t)chunk;
+        len -= chunk;
+    }
+}
+
+// Страницы, общие с предыдущими сегментами, сохраняют содержимое и получают
+// права нового сегмента; остальные заменяют разметку по умолчанию
+static bool rz_elf_map_copy(const rz_image_t *img, const rz_elf32_ehdr_t *eh, unsigned i, rz_elf32_phdr_t ph,
+                            rz_memory_p mem)
+{
+    unsigned perm = rz_elf_perm(ph.p_flags);
+    uint64_t first = ph.p_vaddr & ~(uint64_t)MEM_PAGE_MASK;
+    uint64_t end = RZ_PAGE_UP((uint64_t)ph.p_vaddr + ph.p_memsz);
+    for (uint64_t page = first; page < end;)
+    {
+        uint64_t run = page;
+        if (rz_elf_page_used(img, eh, i, i, page))
+        {
+            if (!mem_add_perm(mem, (rz_address_t)page, MEM_PAGE_SIZE, perm))
+                return false;
+            page += MEM_PAGE_SIZE;
+            continue;
+        }
+        while (page < end && !rz_elf_page_used(img, eh, i, i, page))
+            page += MEM_PAGE_SIZE;
+        if (!mem_map(mem, (rz_address_t)run, (size_t)(page - run), NULL, perm))
+            return false;
+    }
+    // Остаток до p_memsz (.bss) — нули, в том числе на общей странице
+    rz_elf_fill(mem, ph.p_vaddr, (const uint8_t *)img->map + ph.p_offset, ph.p_filesz);
+    rz_elf_fill(mem, ph.p_vaddr + ph.p_filesz, NULL, ph.p_memsz - ph.p_filesz);
+    return true;
+}
+
+static bool rz_image_map_elf(const rz_image_t *img, rz_memory_p mem)
+{
+    rz_elf32_ehdr_t eh;
+    memcpy(&eh, img->map, sizeof(eh));
+
+    for (unsigned i = 0; i < eh.e_phnum; ++i)
+    {
+        rz_elf32_phdr_t ph = rz_elf_phdr(img, &eh, i);
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+            continue;
+
+        rz_address_t first = ph.p_vaddr & ~(rz_address_t)MEM_PAGE_MASK;
+        uint64_t end = RZ_PAGE_UP((uint64_t)ph.p_vaddr + ph.p_memsz);
+        bool shared = false;
+        for (uint64_t page = first; page < end && !shared; page += MEM_PAGE_SIZE)
+            shared = rz_elf_page_used(img, &eh, eh.e_phnum, i, page);
+        bool ok;
+        if (!shared && !(ph.p_flags & PF_W) && ph.p_filesz == ph.p_memsz &&
+            (ph.p_offset & MEM_PAGE_MASK) == (ph.p_vaddr & MEM_PAGE_MASK))
+        {
+            // Сегмент только для чтения на своих страницах — страницы гостя
+            // прямо в отображении файла
+            ok = mem_map(mem, first, (size_t)(end - first),
+                         (uint8_t *)img->map + (ph.p_offset & ~(uint32_t)MEM_PAGE_MASK), rz_elf_perm(ph.p_flags));
+        }
+        else
+            ok = rz_elf_map_copy(img, &eh, i, ph, mem);
+        if (!ok)
+        {
+            fprintf(stderr, "Cannot map ELF segment %u at 0x%08X\n", i, ph.p_vaddr);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void rz_image_init(rz_image_p img)
+{
+    memset(img, 0, sizeof(*img));
+    img->entry = TEXT_OFFSET;
+    img->text_base = TEXT_OFFSET;
+    img->text_size = TEXT_SIZE;
+    img->heap_base = HEAP_OFFSET;
+}
+
+// Определение формата и проверка прочитанного содержимого; path нужен для
+// расширения .hex и сообщений, у образа из памяти он NULL
+static bool rz_image_check(rz_image_p img, const char *path, rz_image_format_t format)
+{
+    if (format == RZ_IMAGE_AUTO)
+    {
+        size_t len = path ? strlen(path) : 0;
+        if (img->map_size >= 4 && memcmp(img->map, "\x7F" "ELF", 4) == 0)
+            format = RZ_IMAGE_ELF;
+        else if (len > 4 && strcmp(path + len - 4, ".hex") == 0)
+            format = RZ_IMAGE_HEX;
+        else
+            format = RZ_IMAGE_RAW;
+    }
+    img->format = format;
+
+    bool ok = true;
+    if (format == RZ_IMAGE_ELF)
+        ok = rz_image_check_elf(img);
+    else if (format == RZ_IMAGE_RAW)
+    {
+        size_t size = (size_t)RZ_PAGE_UP(img->map_size);
+        if (TEXT_OFFSET + (uint64_t)size > DATA_OFFSET)
+        {
+            fprintf(stderr, "Image of %zu bytes overlaps data region\n", img->map_size);
+            ok = false;
+        }
+        else if (size > TEXT_SIZE)
+            img->text_size = size;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Cannot load %s\n", path ? path : "image from memory");
+        rz_image_close(img);
+    }
+    return ok;
+}
+
+bool rz_image_open(rz_image_p img, const char *path, rz_image_format_t format)
+{
+    rz_image_init(img);
+    if (!rz_image_read(img, path))
+    {
+        rz_image_close(img);
+        return false;
+    }
+    return rz_image_check(img, path, format);
+}
+
+// Копия дополняется нулями до границы страницы, как прочитанный файл
+bool rz_image_open_memory(rz_image_p img, const void *data, size_t size, rz_image_format_t format)
+{
+    rz_image_init(img);
+    if (size == 0)
+    {
+        fprintf(stderr, "Cannot load empty image\n");
+        return false;
+    }
+    if (!(img->map = calloc(1, (size_t)RZ_PAGE_UP(size))))
+    {
+        fprintf(stderr, "Cannot allocate %zu bytes for image\n", size);
+        return false;
+    }
+    memcpy(img->map, data, size);
+    img->map_size = size;
+    return rz_image_check(img, NULL, format);
+}
+
+bool rz_image_map(const rz_image_t *img, rz_memory_p mem)
+{
+    bool ok = img->format == RZ_IMAGE_ELF   ? rz_image_map_elf(img, mem)
+              : img->format == RZ_IMAGE_HEX ? rz_image_map_hex(img, mem)
+                                            : rz_image_map_raw(img, mem);
+    if (!ok)
+        fprintf(stderr, "Cannot map image into guest memory\n");
+    return ok;
+}
+
+bool rz_image_load(rz_image_p img, rz_memory_p mem, const char *path, rz_image_format_t format)
+{
+    return rz_image_open(img, path, format) && rz_image_map(img, mem);
+}
+
+static int rz_symbol_compare(const void *a, const void *b)
+{
+    const rz_symbol_t *x = a, *y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return (y->size != 0) - (x->size != 0); // символ с размером — раньше метки
+}
+
+bool rz_image_symbols(const rz_image_t *img, rz_symbol_t **symbols, size_t *count)
+{
+    *symbols = NULL;
+    *count = 0;
+    if (img->format != RZ_IMAGE_ELF)
+        return true;
+
+    rz_elf32_ehdr_t eh;
+    memcpy(&eh, img->map, sizeof(eh));
+    if (eh.e_shentsize != sizeof(rz_elf32_shdr_t) ||
+        (uint64_t)eh.e_shoff + (uint64_t)eh.e_shnum * sizeof(rz_elf32_shdr_t) > img->map_size)
+        return true; // без таблицы секций символов нет
+
+    const uint8_t *base = img->map;
+    for (unsigned i = 0; i < eh.e_shnum; ++i)
+    {
+        rz_elf32_shdr_t sh, strtab;
+        memcpy(&sh, base + eh.e_shoff + i * sizeof(sh), sizeof(sh));
+        if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= eh.e_shnum ||
+            (uint64_t)sh.sh_offset + sh.sh_size > img->map_size)
+            continue;
+        memcpy(&strtab, base + eh.e_shoff + sh.sh_link * sizeof(strtab), sizeof(strtab));
+        if ((uint64_t)strtab.sh_offset + strtab.sh_size > img->map_size || strtab.sh_size == 0 ||
+            base[strtab.sh_offset + strtab.sh_size - 1] != '\0')
+            continue;
+
+        size_t total = sh.sh_size / sizeof(rz_elf32_sym_t);
+        rz_symbol_t *list = malloc((total ? total : 1) * sizeof(rz_symbol_t));
+        if (!list)
+            return false;
+        // Если есть функции, метки без типа — это метки внутри функций
+        unsigned want = STT_NOTYPE;
+        for (size_t k = 0; k < total && want == STT_NOTYPE; ++k)
+            if ((base[sh.sh_offset + k * sizeof(rz_elf32_sym_t) + offsetof(rz_elf32_sym_t, st_info)] & 0xFu) == STT_FUNC)
+                want = STT_FUNC;
+
+        size_t n = 0;
+        for (size_t k = 0; k < total; ++k)
+        {
+            rz_elf32_sym_t sym;
+            memcpy(&sym, base + sh.sh_offset + k * sizeof(sym), sizeof(sym));
+            if ((sym.st_info & 0xFu) != want || sym.st_shndx == SHN_UNDEF ||
+                sym.st_name == 0 || sym.st_name >= strtab.sh_size ||
+                sym.st_value - img->text_base >= img->text_size)
+                continue;
+            const char *name = (const char *)base + strtab.sh_offset + sym.st_name;
+            if (name[0] == '$' || strncmp(name, ".L", 2) == 0)
+                continue;
+            list[n++] = (rz_symbol_t){sym.st_value, sym.st_size, name};
+        }
+
+        // Из нескольких символов по одному адресу остаётся первый
+        qsort(list, n, sizeof(rz_symbol_t), rz_symbol_compare);
+        size_t unique = 0;
+        for (size_t k = 0; k < n; ++k)
+            if (unique == 0 || list[unique - 1].addr != list[k].addr)
+                list[unique++] = list[k];
+        *symbols = list;
+        *count = unique;
+        return true;
+    }
+    return true;
+}
+
+const rz_symbol_t *rz_symbol_find(const rz_symbol_t *symbols, size_t count, rz_address_t addr)
+{
+    // Последний символ с адресом не больше addr
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    const rz_symbol_t *sym = &symbols[lo - 1];
+    if (sym->size && addr - sym->addr >= sym->size)
+        return NULL;
+    return sym;
+}
+
+void rz_image_close(rz_image_p img)
+{
+    if (!img->map)
+        return;
+#ifdef RZ_LOADER_MMAP
+    if (img->mapped)
+        munmap(img->map, img->map_size);
+    else
+#endif
+        free(img->map);
+    img->map = NULL;
+    img->mapped = false;
+}
@@ -0,0 +1,141 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "misc.h"
+#include "memory.h"
+
+/**
+ * @brief Formats of program images
+ *
+ */
+typedef enum rz_image_format_e : unsigned
+{
+	RZ_IMAGE_AUTO = 0, // ELF by magic, hex by .hex extension, otherwise raw
+	RZ_IMAGE_RAW,	   // flat binary loaded at TEXT_OFFSET
+	RZ_IMAGE_HEX,	   // one 32-bit hexadecimal word per line (Venus dump)
+	RZ_IMAGE_ELF,	   // ELF32 RISC-V executable
+} rz_image_format_t;
+
+/**
+ * @brief Loaded program image
+ *
+ * Guest pages of read-only segments point into the file mapping,
+ * so the image must be closed only after guest memory is freed.
+ */
+typedef struct rz_image_s
+{
+	rz_image_format_t format;
+	rz_address_t entry;		// initial PC
+	rz_address_t text_base; // range of executable code for instruction cache
+	size_t text_size;
+	rz_address_t heap_base; // initial program break, above all loaded segments
+	void *map;		 // file contents, mapped or read
+	size_t map_size; // size of file contents
+	bool mapped;	 // map came from mmap
+	bool shared;	 // mapped into many machines: writable pages are copied
+} rz_image_t, *rz_image_p;
+
+/**
+ * @brief Code symbol of ELF image
+ *
+ */
+typedef struct rz_symbol_s
+{
+	rz_address_t addr;
+	uint32_t size;	  // 0 when unknown: symbol lasts until the next one
+	const char *name; // points into image contents
+} rz_symbol_t;
+
+/**
+ * @brief Parse image format name (auto, raw, hex, elf)
+ *
+ * @param name format name
+ * @param format output format
+ * @return true when name is known
+ */
+bool rz_image_parse_format(const char *name, rz_image_format_t *format);
+
+/**
+ * @brief Read and check program image without mapping it
+ *
+ * @param img output image description
+ * @param path file name
+ * @param format image format or RZ_IMAGE_AUTO
+ * @return true on success
+ */
+bool rz_image_open(rz_image_p img, const char *path, rz_image_format_t format);
+
+/**
+ * @brief Copy program image from memory and check it without mapping
+ *
+ * With RZ_IMAGE_AUTO an ELF is detected by magic, anything else is raw.
+ *
+ * @param img output image description, owns the copy
+ * @param data image contents
+ * @param size size of contents in bytes
+ * @param format image format or RZ_IMAGE_AUTO
+ * @return true on success
+ */
+bool rz_image_open_memory(rz_image_p img, const void *data, size_t size, rz_image_format_t format);
+
+/**
+ * @brief Map opened image into guest memory
+ *
+ * Image is not changed, so it may be mapped into many machines at once
+ * when img->shared is set.
+ *
+ * @param img opened image
+ * @param mem guest memory
+ * @return true on success
+ */
+bool rz_image_map(const rz_image_t *img, rz_memory_p mem);
+
+/**
+ * @brief Open program image and map it into guest memory
+ *
+ * Read-only ELF segments and raw images are mapped from the file
+ * privately (copy-on-write) without copying, writable segments are
+ * copied and .bss is zeroed. Errors are reported to stderr.
+ *
+ * @param img output image description
+ * @param mem guest memory to load into
+ * @param path file name
+ * @param format image format or RZ_IMAGE_AUTO
+ * @return true on success
+ */
+bool rz_image_load(rz_image_p img, rz_memory_p mem, const char *path, rz_image_format_t format);
+
+/**
+ * @brief Read functions and code labels from ELF symbol table
+ *
+ * Functions are taken when the table has any, otherwise all code labels;
+ * mapping symbols ($x) and local labels (.L*) are skipped. Names stay
+ * valid until the image is closed.
+ *
+ * @param img opened image
+ * @param symbols output array sorted by address, release with free()
+ * @param count output number of symbols, 0 for images without symbols
+ * @return false when out of memory
+ */
+bool rz_image_symbols(const rz_image_t *img, rz_symbol_t **symbols, size_t *count);
+
+/**
+ * @brief Find symbol containing address
+ *
+ * @param symbols symbols sorted by address
+ * @param count number of symbols
+ * @param addr guest address
+ * @return const rz_symbol_t* symbol or NULL
+ */
+const rz_symbol_t *rz_symbol_find(const rz_symbol_t *symbols, size_t count, rz_address_t addr);
+
+/**
+ * @brief Release file mapping of image
+ *
+ * @param img image, may be not loaded
+ */
+void rz_image_close(rz_image_p img);
+
+#endif // LOADER_H__
@@ -0,0 +1,467 @@
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcmp, memset
+
+#include "lockstep.h"
+#include "exec.h"
+#include "memory.h"
+
+// Группа полос: регистры — массивы по полосам, так что операция над
+// группой — цикл по полосам без зависимостей, и компилятор делает из него
+// векторный код. Полосы без общего PC исполняются группами по PC, первой —
+// группа с наименьшим: отставшие догоняют, ушедшие вперёд ждут их в точке
+// слияния. Маска m нужна только при расхождении, пока PC общий, значения
+// остановленных полос никто не читает и их можно портить
+
+#define RZ_LS_GONE UINT32_MAX // PC полосы вне группы, у инструкции он чётный
+
+typedef struct
+{
+    rz_register_t x[32][RZ_LOCKSTEP_LANES]; // строка на регистр
+    rz_register_t m[RZ_LOCKSTEP_LANES];     // все единицы у полос исполняемой группы
+    rz_address_t pc[RZ_LOCKSTEP_LANES];     // PC полос, пока они расходятся; RZ_LS_GONE вне группы
+    uint64_t retired[RZ_LOCKSTEP_LANES];
+    uint64_t instret[RZ_LOCKSTEP_LANES]; // instret CPU полосы до запуска
+    uint64_t budget[RZ_LOCKSTEP_LANES];  // свой у каждой полосы
+    uint64_t pending; // шаги общего PC, ещё не добавленные к retired полос
+    unsigned live;    // полосы в группе
+    unsigned evicted; // полосы, записавшие в код: доисполняются отдельно
+    rz_machine_p machine[RZ_LOCKSTEP_LANES];
+    rz_memory_p mem[RZ_LOCKSTEP_LANES];
+    rz_run_result_t *results;
+    rz_icache_t icache; // текст, декодированный один раз на все полосы
+    rz_lockstep_stats_t stats;
+} rz_lockstep_t;
+
+static unsigned rz_ls_count(unsigned lanes)
+{
+    unsigned n = 0;
+    for (; lanes; lanes &= lanes - 1)
+        ++n;
+    return n;
+}
+
+static unsigned rz_ls_first(unsigned lanes)
+{
+    unsigned l = 0;
+    while (!(lanes & (1u << l)))
+        ++l;
+    return l;
+}
+
+// Шаги общего PC засчитываются всем полосам группы разом
+static void rz_ls_flush(rz_lockstep_t *ls)
+{
+    if (!ls->pending)
+        return;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        if (ls->live & (1u << l))
+            ls->retired[l] += ls->pending;
+    ls->stats.steps += ls->pending;
+    ls->stats.lanes += ls->pending * rz_ls_count(ls->live);
+    ls->pending = 0;
+}
+
+// Полоса выходит из группы: состояние возвращается в её CPU
+static void rz_ls_leave(rz_lockstep_t *ls, unsigned l, rz_address_t pc)
+{
+    rz_ls_flush(ls);
+    rz_cpu_p pcpu = ls->machine[l]->cpu;
+    for (unsigned r = 1; r < 32; ++r)
+        pcpu->r_x[r] = ls->x[r][l];
+    pcpu->r_pc = pc;
+    ls->live &= ~(1u << l);
+    ls->pc[l] = RZ_LS_GONE;
+}
+
+static void rz_ls_fault(rz_lockstep_t *ls, unsigned l, rz_address_t pc, mem_fault_t fault, rz_address_t addr)
+{
+    rz_ls_leave(ls, l, pc);
+    rz_cpu_fault(ls->machine[l]->cpu, fault, addr);
+    ls->results[l].reason = RZ_STOP_MEMORY_FAULT;
+}
+
+// Запись в код полосы: её кэш инструкций сбрасывается, дальше код у неё
+// свой, и она доисполняется отдельно. Сама запись уже выполнена
+static void rz_ls_stored(rz_lockstep_t *ls, unsigned l, rz_address_t addr, unsigned size, rz_address_t next)
+{
+    rz_icache_p ic = &ls->machine[l]->cpu->icache;
+    unsigned generation = ic->generation;
+    rz_icache_invalidate(ic, addr, size);
+    if (ic->generation == generation)
+        return;
+    rz_ls_leave(ls, l, next);
+    ++ls->retired[l];
+    ls->evicted |= 1u << l;
+    ++ls->stats.evicted;
+}
+
+// Одна инструкция на собственном CPU полосы: системные вызовы, CSR, EBREAK,
+// недопустимые инструкции, ошибки выборки. Интерпретатор с бюджетом 1
+// ведёт себя как в rz_run, instret полосы при этом точный
+static void rz_ls_scalar(rz_lockstep_t *ls, unsigned l, rz_address_t pc)
+{
+    rz_ls_flush(ls);
+    rz_cpu_p pcpu = ls->machine[l]->cpu;
+    for (unsigned r = 1; r < 32; ++r)
+        pcpu->r_x[r] = ls->x[r][l];
+    pcpu->r_pc = pc;
+    pcpu->instret = ls->instret[l] + ls->retired[l];
+
+    rz_engine_t engine = pcpu->engine;
+    pcpu->engine = RZ_ENGINE_INTERP;
+    rz_run_result_t r = rz_run(pcpu, 1);
+    pcpu->engine = engine;
+    ls->stats.scalar += r.retired;
+
+    if (r.reason != RZ_STOP_BUDGET)
+    {
+        ls->retired[l] += r.retired;
+        ls->results[l].reason = r.reason;
+        ls->live &= ~(1u << l);
+        ls->pc[l] = RZ_LS_GONE;
+        return;
+    }
+    for (unsigned r = 1; r < 32; ++r)
+        ls->x[r][l] = pcpu->r_x[r];
+    ls->pc[l] = pcpu->r_pc;
+}
+
+// Следующие PC группы: общий в *next или по полосам в pc
+RZ_FORCE_INLINE bool rz_ls_target(rz_lockstep_t *ls, const rz_address_t *target, unsigned group,
+                                  rz_address_t *next)
+{
+    if (!group)
+        return true;
+    rz_address_t common = target[rz_ls_first(group)];
+    unsigned differ = 0;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        differ |= (unsigned)(target[l] != common) << l;
+    if (!(differ & group))
+    {
+        *next = common;
+        return true;
+    }
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        if (group & (1u << l))
+            ls->pc[l] = target[l];
+    return false;
+}
+
+static bool rz_ls_fallback(rz_lockstep_t *ls, rz_address_t pc, unsigned group, rz_address_t *next)
+{
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        if (group & (1u << l))
+            rz_ls_scalar(ls, l, pc);
+    return rz_ls_target(ls, ls->pc, group & ls->live, next);
+}
+
+// Выборка для группы; текст у полос группы одинаков, поэтому декодируется
+// из памяти любой. NULL — PC вне текста или ошибка выборки: инструкцию
+// исполнят CPU полос, они же сообщат ошибку
+static inline const rz_decoded_t *rz_ls_fetch(rz_lockstep_t *ls, rz_address_t pc, unsigned group)
+{
+    rz_decoded_p d = rz_icache_slot(&ls->icache, pc);
+    if (d == NULL || d->op != RZ_OP_UNDECODED)
+        return d;
+    rz_register_t raw;
+    if (mem_fetch(ls->mem[rz_ls_first(group)], pc, &raw) != MEM_OK)
+        return NULL;
+    rz_decode(raw, d);
+    return d;
+}
+
+RZ_FORCE_INLINE void rz_ls_write(rz_lockstep_t *ls, rz_register_t *rd, const rz_register_t *v, bool masked)
+{
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        rd[l] = masked ? (v[l] & ls->m[l]) | (rd[l] & ~ls->m[l]) : v[l];
+}
+
+// Исполнение инструкции для группы полос с общим PC; masked — константа
+// места вызова: при общем PC всех полос запись без маски. false — полосы
+// группы разошлись, их следующие PC в pc
+RZ_FORCE_INLINE bool rz_ls_execute(rz_lockstep_t *ls, const rz_decoded_t *d, rz_address_t pc, unsigned group,
+                                   rz_address_t *next, bool masked)
+{
+    const rz_register_t *a = ls->x[d->rs1], *b = ls->x[d->rs2];
+    rz_register_t *rd = ls->x[d->rd];
+    rz_register_t imm = d->imm;
+    rz_register_t v[RZ_LOCKSTEP_LANES];
+    *next = pc + d->size;
+
+    switch (d->op)
+    {
+#define RZ_LS_SIMPLE(name, value, ctx)                   \
+    case RZ_OP_##name:                                   \
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l) \
+            v[l] = (value);                              \
+        rz_ls_write(ls, rd, v, masked);                  \
+        return true;
+        RZ_EXEC_VALUE(RZ_LS_SIMPLE, 0, a[l], b[l], imm)
+#undef RZ_LS_SIMPLE
+
+#define RZ_LS_BRANCH(name, cond, ctx)                    \
+    case RZ_OP_##name:                                   \
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l) \
+            v[l] = (cond) ? pc + imm : pc + d->size;     \
+        return rz_ls_target(ls, v, group, next);
+        RZ_EXEC_COMPARE(RZ_LS_BRANCH, 0, a[l], b[l])
+#undef RZ_LS_BRANCH
+
+#define RZ_LS_LOAD(name, bits, type)                                              \
+    case RZ_OP_##name:                                                            \
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)                          \
+            if (group & (1u << l))                                                \
+            {                                                                     \
+                uint##bits##_t val;                                               \
+                rz_address_t addr = a[l] + imm;                                   \
+                mem_fault_t fault = mem_load##bits(ls->mem[l], addr, &val);       \
+                if (fault == MEM_OK)                                              \
+                    rd[l] = (rz_register_t)(type)val;                             \
+                else                                                              \
+                    rz_ls_fault(ls, l, pc, fault, addr);                          \
+            }                                                                     \
+        return true;
+        RZ_EXEC_LOAD(RZ_LS_LOAD)
+#undef RZ_LS_LOAD
+
+#define RZ_LS_STORE(name, bits)                                                   \
+    case RZ_OP_##name:                                                            \
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)                          \
+            if (group & (1u << l))                                                \
+            {                                                                     \
+                rz_address_t addr = a[l] + imm;                                   \
+                mem_fault_t fault = mem_store##bits(ls->mem[l], addr, (uint##bits##_t)b[l]); \
+                if (fault == MEM_OK)                                              \
+                    rz_ls_stored(ls, l, addr, bits / 8, *next);                   \
+                else                                                              \
+                    rz_ls_fault(ls, l, pc, fault, addr);                          \
+            }                                                                     \
+        return true;
+        RZ_EXEC_STORE(RZ_LS_STORE)
+#undef RZ_LS_STORE
+
+    case RZ_OP_AUIPC:
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            v[l] = pc + imm;
+        rz_ls_write(ls, rd, v, masked);
+        return true;
+    case RZ_OP_JAL:
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            v[l] = pc + d->size;
+        rz_ls_write(ls, rd, v, masked);
+        *next = pc + imm;
+        return true;
+    case RZ_OP_JALR:
+    {
+        // Цель считается до записи rd: rd может совпадать с rs1
+        rz_address_t target[RZ_LOCKSTEP_LANES];
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            target[l] = (a[l] + imm) & ~1u;
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            v[l] = pc + d->size;
+        rz_ls_write(ls, rd, v, masked);
+        return rz_ls_target(ls, target, group, next);
+    }
+    case RZ_OP_FENCE:
+        return true;
+    case RZ_OP_FENCE_I:
+        rz_icache_flush(&ls->icache);
+        return rz_ls_fallback(ls, pc, group, next);
+    default:
+        return rz_ls_fallback(ls, pc, group, next);
+    }
+}
+
+// Бюджет: полосы, исчерпавшие свой, останавливаются; результат — сколько
+// шагов можно сделать без проверки: за шаг полоса исполняет не больше одной
+// инструкции, так что это наименьший остаток среди полос
+static uint64_t rz_ls_budget(rz_lockstep_t *ls)
+{
+    rz_ls_flush(ls);
+    uint64_t least = UINT64_MAX;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+    {
+        if (!(ls->live & (1u << l)))
+            continue;
+        if (ls->retired[l] >= ls->budget[l])
+        {
+            rz_ls_leave(ls, l, ls->pc[l]);
+            ls->results[l].reason = RZ_STOP_BUDGET;
+        }
+        else if (ls->budget[l] - ls->retired[l] < least)
+            least = ls->budget[l] - ls->retired[l];
+    }
+    return least;
+}
+
+// Наименьший PC среди полос группы; true, если он у всех
+static inline bool rz_ls_lowest(const rz_lockstep_t *ls, rz_address_t *pc)
+{
+    rz_address_t lo = RZ_LS_GONE;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        lo = ls->pc[l] < lo ? ls->pc[l] : lo;
+    unsigned differ = 0;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        differ |= ls->pc[l] != lo && ls->pc[l] != RZ_LS_GONE;
+    *pc = lo;
+    return !differ;
+}
+
+// Общий декодированный текст годится полосе, только если байты кода у неё
+// те же; у машин, ответвлённых от одного снимка, страницы кода общие, и
+// сравнение сводится к указателям
+static bool rz_ls_same_text(rz_memory_p a, rz_memory_p b, rz_address_t base, size_t size)
+{
+    uint64_t end = (uint64_t)base + size;
+    for (uint64_t addr = base; addr < end;)
+    {
+        uint64_t stop = (addr | MEM_PAGE_MASK) + 1;
+        if (stop > end)
+            stop = end;
+        const uint8_t *x = mem_access(a, (rz_address_t)addr), *y = mem_access(b, (rz_address_t)addr);
+        if (x != y && (!x || !y || memcmp(x, y, (size_t)(stop - addr)) != 0))
+            return false;
+        addr = stop;
+    }
+    return true;
+}
+
+static void rz_ls_loop(rz_lockstep_t *ls)
+{
+    rz_address_t pc;
+    bool uniform = rz_ls_lowest(ls, &pc);
+    unsigned group = 0; // полосы маски m
+    uint64_t left = 0;
+
+    while (ls->live)
+    {
+        if (left == 0)
+        {
+            if (uniform)
+                for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+                    ls->pc[l] = ls->pc[l] == RZ_LS_GONE ? RZ_LS_GONE : pc;
+            left = rz_ls_budget(ls);
+            uniform = rz_ls_lowest(ls, &pc);
+            continue;
+        }
+        --left;
+        memset(ls->x[0], 0, sizeof(ls->x[0])); // x0 всегда 0
+
+        rz_address_t next = pc;
+        if (uniform)
+        {
+            unsigned live = ls->live;
+            const rz_decoded_t *d = rz_ls_fetch(ls, pc, live);
+            bool same = d ? rz_ls_execute(ls, d, pc, live, &next, false) : rz_ls_fallback(ls, pc, live, &next);
+            ++ls->pending;
+            if (same)
+                pc = next;
+            else
+            {
+                rz_ls_flush(ls);
+                uniform = false;
+            }
+            continue;
+        }
+
+        // Учёт по маске, без ветвлений по полосам
+        unsigned lanes = 0;
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            lanes |= (unsigned)(ls->pc[l] == pc) << l;
+        if (lanes != group)
+        {
+            group = lanes;
+            for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+                ls->m[l] = 0u - ((group >> l) & 1u);
+        }
+        const rz_decoded_t *d = rz_ls_fetch(ls, pc, group);
+        if (d ? rz_ls_execute(ls, d, pc, group, &next, true) : rz_ls_fallback(ls, pc, group, &next))
+            for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+                ls->pc[l] = (next & ls->m[l]) | (ls->pc[l] & ~ls->m[l]);
+        for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+            ls->retired[l] += ls->m[l] & 1u;
+        // Вышедшие на этом шаге уже учтены сами или инструкцию не исполнили
+        unsigned done = group & ls->live;
+        for (unsigned gone = group & ~done; gone; gone &= gone - 1)
+        {
+            unsigned l = rz_ls_first(gone);
+            --ls->retired[l];
+            ls->pc[l] = RZ_LS_GONE;
+        }
+        ++ls->stats.steps;
+        ++ls->stats.divergent;
+        ls->stats.lanes += rz_ls_count(done);
+        uniform = rz_ls_lowest(ls, &pc);
+    }
+    rz_ls_flush(ls);
+}
+
+bool rz_lockstep_run(rz_machine_p *machines, unsigned count, const uint64_t *budgets, rz_run_result_t *results,
+                     rz_lockstep_stats_t *stats)
+{
+    if (count > RZ_LOCKSTEP_LANES)
+        count = RZ_LOCKSTEP_LANES;
+    rz_lockstep_t *ls = calloc(1, sizeof(*ls));
+    if (!ls)
+        return false;
+    rz_icache_p text = &machines[0]->cpu->icache;
+    if (!rz_icache_init(&ls->icache, text->base, text->count * RZ_INSN_ALIGN))
+    {
+        free(ls);
+        return false;
+    }
+    ls->results = results;
+    for (unsigned l = 0; l < RZ_LOCKSTEP_LANES; ++l)
+        ls->pc[l] = RZ_LS_GONE;
+
+    // Полоса с другим текстом или его содержимым сразу исполняется отдельно
+    for (unsigned l = 0; l < count; ++l)
+    {
+        rz_machine_p m = machines[l];
+        rz_cpu_p pcpu = m->cpu;
+        ls->machine[l] = m;
+        ls->mem[l] = pcpu->mem;
+        ls->instret[l] = pcpu->instret;
+        ls->budget[l] = budgets[l];
+        for (unsigned r = 1; r < 32; ++r)
+            ls->x[r][l] = pcpu->r_x[r];
+        results[l] = (rz_run_result_t){.reason = RZ_STOP_NONE, .retired = 0};
+        if (pcpu->icache.base == text->base && pcpu->icache.count == text->count &&
+            rz_ls_same_text(pcpu->mem, machines[0]->cpu->mem, text->base, text->count * RZ_INSN_ALIGN))
+        {
+            ls->live |= 1u << l;
+            ls->pc[l] = pcpu->r_pc;
+        }
+        else
+            ls->evicted |= 1u << l;
+    }
+
+    rz_ls_loop(ls);
+
+    for (unsigned l = 0; l < count; ++l)
+    {
+        rz_cpu_p pcpu = ls->machine[l]->cpu;
+        pcpu->instret = ls->instret[l] + ls->retired[l];
+        if ((ls->evicted & (1u << l)) && ls->retired[l] >= ls->budget[l])
+            results[l].reason = RZ_STOP_BUDGET;
+        else if (ls->evicted & (1u << l))
+        {
+            rz_run_result_t r = rz_run(pcpu, ls->budget[l] - ls->retired[l]);
+            ls->retired[l] += r.retired;
+            results[l].reason = r.reason;
+        }
+        results[l].retired = ls->retired[l];
+    }
+
+    if (stats)
+    {
+        stats->steps += ls->stats.steps;
+        stats->lanes += ls->stats.lanes;
+        stats->divergent += ls->stats.divergent;
+        stats->scalar += ls->stats.scalar;
+        stats->evicted += ls->stats.evicted;
+    }
+    rz_icache_free(&ls->icache);
+    free(ls);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "machine.h"
+
+#define RZ_LOCKSTEP_LANES 16u // guests of one lockstep group, registers are vectors of this width
+
+/**
+ * @brief Lockstep statistics, summed over runs
+ *
+ */
+typedef struct rz_lockstep_stats_s
+{
+	uint64_t steps;		// instructions issued, each for a group of lanes
+	uint64_t lanes;		// lane instructions retired by them
+	uint64_t divergent; // steps while lanes were on different PCs
+	uint64_t scalar;	// lane instructions run on the lane's own CPU
+	uint64_t evicted;	// lanes which wrote into code and finished alone
+} rz_lockstep_stats_t;
+
+/**
+ * @brief Run machines with the same program as lanes of one vector register file
+ *
+ * Registers of all lanes are kept as arrays per register, and every
+ * instruction is decoded once and executed for a group of lanes with
+ * the same PC: ALU operations as loops over lanes the compiler turns
+ * into vector code, loads and stores lane by lane. When a branch or
+ * JALR diverges, the group with the lowest PC runs first; lanes merge
+ * back when their PCs meet. Environment calls, CSRs, EBREAK, invalid
+ * instructions and fetch faults run on the lane's own CPU. A lane that
+ * writes into code leaves the group and finishes alone on its engine,
+ * as does a lane whose code bytes differ from the first machine's.
+ *
+ * Results equal rz_run of every machine; simulator counters are kept
+ * only for instructions run on the lane's own CPU.
+ *
+ * @param machines machines with the same text, forked or booted from one image
+ * @param count number of machines, at most RZ_LOCKSTEP_LANES
+ * @param budgets maximum number of instructions every machine retires
+ * @param results output stop reason and retired instructions per machine
+ * @param stats statistics to add to, may be NULL
+ * @return true on success, false when out of memory and nothing ran
+ */
+bool rz_lockstep_run(rz_machine_p *machines, unsigned count, const uint64_t *budgets, rz_run_result_t *results,
+					 rz_lockstep_stats_t *stats);
+
+#endif // LOCKSTEP_H__
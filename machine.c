@@ -0,0 +1,170 @@
+#include <stdio.h>
+
+#include "machine.h"
+
+#define RZ_IO_FILES 16 // Дескрипторы файлов гостя, 0..2 — стандартные потоки
+
+// Файлы хоста, открытые гостем; таблица своя у каждой машины, её адрес —
+// контекст обработчиков stdio
+struct rz_stdio_s
+{
+    FILE *files[RZ_IO_FILES];
+};
+
+static bool rz_stdio_read_int(void *ctx, int32_t *value)
+{
+    (void)ctx;
+    int v;
+    if (scanf("%d", &v) != 1)
+        return false;
+    *value = v;
+    return true;
+}
+
+// Приглашение к вводу; вывод гостя буферизован, поэтому сначала сбрасывается
+static bool rz_stdio_read_int_prompt(void *ctx, int32_t *value)
+{
+    printf("Input integer: ");
+    fflush(stdout);
+    return rz_stdio_read_int(ctx, value);
+}
+
+static void rz_stdio_write(void *ctx, const char *text, size_t len)
+{
+    (void)ctx;
+    fwrite(text, 1, len, stdout);
+}
+
+static FILE *rz_stdio_file(const struct rz_stdio_s *stdio, int32_t fd)
+{
+    switch (fd)
+    {
+    case 0:
+        return stdin;
+    case 1:
+        return stdout;
+    case 2:
+        return stderr;
+    default:
+        return fd > 2 && fd < RZ_IO_FILES ? stdio->files[fd] : NULL;
+    }
+}
+
+static int32_t rz_stdio_open(void *ctx, const char *path, unsigned mode)
+{
+    struct rz_stdio_s *stdio = ctx;
+    static const char *const modes[] = {"rb", "wb", "ab", "r+b", "w+b", "a+b"};
+    if (mode >= sizeof(modes) / sizeof(modes[0]))
+        return -1;
+    for (int32_t fd = 3; fd < RZ_IO_FILES; ++fd)
+        if (!stdio->files[fd])
+            return (stdio->files[fd] = fopen(path, modes[mode])) ? fd : -1;
+    return -1;
+}
+
+// Чтение сразу в память гостя, без промежуточного буфера
+static int32_t rz_stdio_read(void *ctx, int32_t fd, void *buf, size_t len)
+{
+    FILE *file = rz_stdio_file(ctx, fd);
+    if (!file || file == stdout || file == stderr)
+        return -1;
+    if (file == stdin)
+        fflush(stdout);
+    size_t n = fread(buf, 1, len, file);
+    return n == 0 && ferror(file) ? -1 : (int32_t)n;
+}
+
+static int32_t rz_stdio_write_fd(void *ctx, int32_t fd, const void *buf, size_t len)
+{
+    FILE *file = rz_stdio_file(ctx, fd);
+    if (!file || file == stdin)
+        return -1;
+    size_t n = fwrite(buf, 1, len, file);
+    return n < len && ferror(file) ? -1 : (int32_t)n;
+}
+
+static int32_t rz_stdio_close(void *ctx, int32_t fd)
+{
+    struct rz_stdio_s *stdio = ctx;
+    if (fd < 3 || fd >= RZ_IO_FILES || !stdio->files[fd])
+        return -1;
+    int result = fclose(stdio->files[fd]);
+    stdio->files[fd] = NULL;
+    return result == 0 ? 0 : -1;
+}
+
+const rz_io_t rz_io_stdio = {NULL, rz_stdio_read_int_prompt, rz_stdio_write,
+                             rz_stdio_open, rz_stdio_read, rz_stdio_write_fd, rz_stdio_close, NULL};
+
+const rz_io_t rz_io_stdio_quiet = {NULL, rz_stdio_read_int, rz_stdio_write,
+                                   rz_stdio_open, rz_stdio_read, rz_stdio_write_fd, rz_stdio_close, NULL};
+
+static rz_machine_p rz_machine_alloc(size_t arena_size, bool layout)
+{
+    rz_arena_t arena;
+    if (!rz_arena_init(&arena, arena_size ? arena_size : RZ_MACHINE_ARENA_DEFAULT))
+        return NULL;
+
+    // Сама машина тоже живёт в своей арене
+    rz_machine_p m = rz_arena_alloc(&arena, sizeof(rz_machine_t));
+    if (!m)
+    {
+        rz_arena_free(&arena);
+        return NULL;
+    }
+    m->arena = arena;
+    m->stdio = rz_arena_alloc(&m->arena, sizeof(struct rz_stdio_s));
+    if (!m->stdio)
+    {
+        arena = m->arena;
+        rz_arena_free(&arena);
+        return NULL;
+    }
+    rz_machine_set_io(m, &rz_io_stdio);
+    m->ecall_abi = RZ_ECALL_ABI_RISCZ;
+    m->ecall_hook = NULL;
+    m->ecall_ctx = NULL;
+    m->brk = layout ? HEAP_OFFSET : 0;
+    m->marker_stop = false;
+    m->marker = 0;
+
+    if (!layout)
+        mem_reset(&m->mem, &m->arena);
+    if ((layout && !mem_init(&m->mem, &m->arena)) || !(m->cpu = rz_create_cpu(m)))
+    {
+        arena = m->arena;
+        rz_arena_free(&arena);
+        return NULL;
+    }
+    return m;
+}
+
+rz_machine_p rz_machine_create(size_t arena_size)
+{
+    return rz_machine_alloc(arena_size, true);
+}
+
+rz_machine_p rz_machine_create_empty(size_t arena_size)
+{
+    return rz_machine_alloc(arena_size, false);
+}
+
+void rz_machine_free(rz_machine_p m)
+{
+    if (!m)
+        return;
+    rz_free_cpu(m->cpu);
+    mem_release(&m->mem);
+    for (int32_t fd = 3; fd < RZ_IO_FILES; ++fd)
+        if (m->stdio->files[fd])
+            fclose(m->stdio->files[fd]);
+    rz_arena_t arena = m->arena; // m освобождается вместе с ареной
+    rz_arena_free(&arena);
+}
+
+void rz_machine_set_io(rz_machine_p m, const rz_io_t *io)
+{
+    m->io = *io;
+    if (io->open == rz_stdio_open && !io->ctx)
+        m->io.ctx = m->stdio;
+}
@@ -0,0 +1,133 @@
+#ifndef __MACHINE_H__
+#define __MACHINE_H__
+
+#include "cpu.h"
+#include "memory.h"
+#include "arena.h"
+
+#define RZ_MACHINE_ARENA_DEFAULT (256UL << 10)
+#define RZ_IO_BUFFER_SIZE (1UL << 20) // host buffer of guest standard output
+
+/**
+ * @brief Register conventions of environment calls
+ *
+ */
+typedef enum rz_ecall_abi_e : unsigned
+{
+	RZ_ECALL_ABI_RISCZ = 0, // number in a7, arguments from a0, print int adds newline
+	RZ_ECALL_ABI_VENUS,		// number in a0, arguments from a1, as in Venus
+} rz_ecall_abi_t;
+
+/**
+ * @brief Guest input and output used by environment calls
+ *
+ * File handlers may be NULL, the calls then fail with -1 in a0.
+ */
+typedef struct rz_io_s
+{
+	void *ctx; // passed to handlers
+	// read integer, false on end of input or error
+	bool (*read_int)(void *ctx, int32_t *value);
+	// write len bytes to standard output
+	void (*write)(void *ctx, const char *text, size_t len);
+	// open host file in Venus mode 0..5 (r, w, a, r+, w+, a+), descriptor or -1
+	int32_t (*open)(void *ctx, const char *path, unsigned mode);
+	// read up to len bytes, 0 is standard input; bytes read or -1
+	int32_t (*read)(void *ctx, int32_t fd, void *buf, size_t len);
+	// write len bytes to descriptor other than standard output; bytes written or -1
+	int32_t (*write_fd)(void *ctx, int32_t fd, const void *buf, size_t len);
+	// close descriptor, 0 or -1
+	int32_t (*close)(void *ctx, int32_t fd);
+	// time CSR in microseconds given host time now, NULL keeps host time
+	uint64_t (*time)(void *ctx, uint64_t now);
+} rz_io_t;
+
+/**
+ * @brief I/O handlers over stdin, stdout and host files, input is prompted
+ *
+ * Context is NULL here; rz_machine_set_io points it at the table of
+ * host files of that machine, which closes them when freed.
+ */
+extern const rz_io_t rz_io_stdio;
+
+/**
+ * @brief Same as rz_io_stdio without prompts, for piped input
+ *
+ */
+extern const rz_io_t rz_io_stdio_quiet;
+
+/**
+ * @brief Result of environment call hook
+ *
+ */
+typedef enum rz_ecall_hook_result_e : unsigned
+{
+	RZ_ECALL_HOOK_DEFAULT = 0, // not handled, built-in call runs
+	RZ_ECALL_HOOK_DONE,		   // handled, execution goes on
+	RZ_ECALL_HOOK_FAIL,		   // failed, CPU stops with RZ_STOP_ECALL_ERROR
+	RZ_ECALL_HOOK_WAIT,		   // input is not there yet, CPU stops at ECALL with RZ_STOP_INPUT_ERROR silently
+} rz_ecall_hook_result_t;
+
+struct rz_machine_s;
+
+/**
+ * @brief Host handler of environment calls, runs before built-in calls
+ *
+ * It may read and change guest registers and memory, PC moves past
+ * ECALL afterwards.
+ */
+typedef rz_ecall_hook_result_t (*rz_ecall_hook_t)(void *ctx, struct rz_machine_s *m, rz_register_t number);
+
+/**
+ * @brief Types to represent simulated machine and pointer to it
+ *
+ * Machine owns its CPU, guest memory and I/O handlers, everything
+ * besides engine caches is allocated from its arena.
+ */
+typedef struct rz_machine_s
+{
+	rz_arena_t arena;
+	rz_memory_t mem;
+	rz_io_t io;
+	rz_ecall_abi_t ecall_abi;
+	rz_ecall_hook_t ecall_hook; // NULL when only built-in calls are served
+	void *ecall_ctx;			// passed to ecall_hook
+	rz_address_t brk; // program break, end of heap grown by sbrk
+	bool marker_stop;	 // marker environment call stops CPU with RZ_STOP_MARKER
+	rz_register_t marker; // argument of the last marker environment call
+	struct rz_stdio_s *stdio; // host files opened by guest through stdio handlers
+	rz_cpu_p cpu;
+} rz_machine_t, *rz_machine_p;
+
+/**
+ * @brief Create machine with default memory layout and stdio handlers
+ *
+ * @param arena_size size of arena chunks in bytes, 0 for default
+ * @return rz_machine_p machine or NULL when out of memory
+ */
+rz_machine_p rz_machine_create(size_t arena_size);
+
+/**
+ * @brief Create machine without mapped guest memory, for restoring state
+ *
+ * @param arena_size size of arena chunks in bytes, 0 for default
+ * @return rz_machine_p machine or NULL when out of memory
+ */
+rz_machine_p rz_machine_create_empty(size_t arena_size);
+
+/**
+ * @brief Release machine, its CPU and all memory of its arena
+ *
+ * @param m machine, may be NULL
+ */
+void rz_machine_free(rz_machine_p m);
+
+/**
+ * @brief Replace I/O handlers of machine
+ *
+ * @param m machine
+ * @param io handlers
+ */
+void rz_machine_set_io(rz_machine_p m, const rz_io_t *io);
+
+#endif // MACHINE_H__
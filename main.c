@@ -1,29 +1,653 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
 #include "memory.h"
+#include "machine.h"
+#include "threaded.h"
+#include "jit.h"
+#include "loader.h"
+#include "farm.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "region.h"
+#include "timing.h"
+#include "tracefile.h"
+#include "replay.h"
+#include "server.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] image\n"
+            "       %s [options] --restore=FILE\n"
+            "       %s [options] --serve=SOCKET [image]\n"
+            "  --format=auto|raw|hex|elf\n"
+            "                       image format, auto detects ELF and .hex\n"
+            "  --trace=off|pc|full  trace level (compiled max: %d)\n"
+            "  --trace-depth=N      trace ring capacity in records\n"
+            "  --trace-dump=N       dump last N records on EBREAK or invalid instruction\n"
+            "  --trace-file=FILE    stream trace records into binary FILE, level full unless --trace\n"
+            "                       is given; view with risc-z-trace; the level must be compiled in\n"
+            "  --trace-compress     deflate --trace-file blocks in a background thread\n"
+            "  --engine=interp|threaded|jit\n"
+            "                       execution engine, only interp is traced\n"
+            "  --jit-threshold=N    executions before a block is translated\n"
+            "  --jit-stats          print translator statistics at exit\n"
+            "  --flat-memory        place guest memory in a reserved 4 GiB host range: interpreter\n"
+            "                       loads and stores skip translation, faults come from the host\n"
+            "  --counters           print instruction mix, branches and memory accesses at exit\n"
+            "  --profile=FILE       write sampled call stacks in folded format, - for stdout\n"
+            "  --profile-period=N   instructions between samples, 1 counts every instruction\n"
+            "  --profile-pc         add sampled PC below its function in stacks\n"
+            "  --ff=N|pc:ADDR|marker[:ID]\n"
+            "                       fast-forward on the engine to instruction N, PC or marker call\n"
+            "                       (ecall 256), then simulate in detail on the interpreter with\n"
+            "                       trace and counters\n"
+            "  --ff-window=N        instructions per detailed window\n"
+            "  --ff-period=N        start a window every N instructions, 0 for one window\n"
+            "  --timing             estimate cycles with L1 caches, branch predictor and in-order\n"
+            "                       pipeline; every instruction is interpreted (inside --ff windows only)\n"
+            "  --timing-l1i=SIZE:WAYS:LINE[:HIT[:MISS]]|off\n"
+            "  --timing-l1d=SIZE:WAYS:LINE[:HIT[:MISS]]|off\n"
+            "                       L1 cache geometry and latencies in cycles, SIZE may end in k\n"
+            "  --timing-bp=none|btfn|bimodal|gshare[:ENTRIES]\n"
+            "                       conditional branch predictor\n"
+            "  --ecall=riscz|venus  environment call registers: number in a7 or in a0 as in Venus\n"
+            "  --record=FILE        log guest input (integers, file reads, time) to FILE\n"
+            "  --replay=FILE        feed guest input from a --record log without stdio or host files,\n"
+            "                       discard output and check it matches the recorded run\n"
+            "  --quiet              no banner and no input prompts\n"
+            "  --budget=N           stop after N retired instructions\n"
+            "  --timeout=MS         stop after MS milliseconds of wall time\n"
+            "  --batch=FILE         run one guest per line of input integers in FILE\n"
+            "  --threads=N          batch or server worker threads, 0 for all cores\n"
+            "  --quantum=N          batch instructions per time slice\n"
+            "  --results=FILE       batch results, - for stdout\n"
+            "  --batch-fork         run program once until it reads input, fork jobs from there\n"
+            "  --lockstep=N         batch guests run in groups of N (at most %u) sharing decode and\n"
+            "                       executing each instruction for the whole group\n"
+            "  --serve=SOCKET       stay resident and run jobs sent to a Unix socket, image is cached\n"
+            "                       at start; --budget and --timeout limit every job\n"
+            "  --pool=N             server machines kept ready per cached image\n"
+            "  --checkpoint=FILE    save snapshot of the guest when it stops\n"
+            "  --restore=FILE       start from snapshot instead of image\n",
+            prog, prog, prog, RZ_TRACE_MAX, RZ_LOCKSTEP_LANES);
+}
+
+// Пакетный режим: один образ, по гостю на каждый входной вектор
+static int run_batch(rz_farm_config_t *cfg, const char *image, rz_image_format_t format,
+                     const char *restore, const char *batch, const char *results)
+{
+    rz_image_t img = {0};
+    rz_snapshot_p snap = NULL;
+    if (restore)
+    {
+        if (!(snap = rz_snapshot_load(restore)))
+            return 1;
+        cfg->snapshot = snap;
+    }
+    else
+    {
+        if (!rz_image_open(&img, image, format))
+            return 1;
+        img.shared = true;
+        cfg->image = &img;
+    }
+    if (cfg->engine == RZ_ENGINE_JIT && !rz_jit_available())
+        fprintf(stderr, "Native translation is not available, interpreting\n");
+
+    rz_farm_job_p jobs;
+    size_t count;
+    if (!rz_farm_read_inputs(batch, &jobs, &count))
+    {
+        rz_snapshot_free(snap);
+        rz_image_close(&img);
+        return 1;
+    }
+
+    rz_farm_stats_t stats;
+    bool ok = rz_farm_run(cfg, jobs, count, &stats) &&
+              rz_farm_write_results(results, jobs, count);
+    if (ok)
+    {
+        double seconds = (double)stats.wall_ns / 1e9;
+        fprintf(stderr, "Batch: %zu jobs, %u threads, %llu instructions in %.3f s (%.1f MIPS), "
+                "%llu slices, %llu steals\n",
+                count, stats.threads, (unsigned long long)stats.retired, seconds,
+                seconds > 0 ? (double)stats.retired / seconds / 1e6 : 0.0,
+                (unsigned long long)stats.slices, (unsigned long long)stats.steals);
+        if (cfg->lanes > 1 && stats.lockstep.steps)
+            fprintf(stderr, "Lockstep: %llu steps, %.1f of %u lanes busy, %llu divergent, "
+                    "%llu scalar instructions, %llu evicted\n",
+                    (unsigned long long)stats.lockstep.steps,
+                    (double)stats.lockstep.lanes / (double)stats.lockstep.steps, cfg->lanes,
+                    (unsigned long long)stats.lockstep.divergent, (unsigned long long)stats.lockstep.scalar,
+                    (unsigned long long)stats.lockstep.evicted);
+    }
+
+    // Статус 0, только если все гости дошли до EBREAK или вышли с кодом 0
+    for (size_t i = 0; ok && i < count; ++i)
+        ok = jobs[i].stop == RZ_STOP_EBREAK || (jobs[i].stop == RZ_STOP_EXIT && jobs[i].exit_code == 0);
+
+    rz_farm_free_jobs(jobs, count);
+    rz_snapshot_free(snap);
+    rz_image_close(&img);
+    return ok ? 0 : 2;
+}
 
 int main(int argc, const char *argv[])
 {
-    #ifdef DEBUG
-    puts("DEBUG");
-    #endif
+    // Вывод гостя копится в большом буфере, а не уходит построчно
+    setvbuf(stdout, NULL, _IOFBF, RZ_IO_BUFFER_SIZE);
+
+    const char *image = NULL;
+    unsigned trace_level = RZ_TRACE_OFF;
+    size_t trace_depth = RZ_TRACE_DEFAULT_DEPTH;
+    unsigned trace_dump = 0;
+    const char *trace_file = NULL;
+    bool trace_compress = false;
+    bool trace_given = false;
+    rz_engine_t engine = RZ_ENGINE_INTERP;
+    unsigned jit_threshold = RZ_JIT_DEFAULT_THRESHOLD;
+    bool jit_stats = false;
+    bool counters = false;
+    const char *profile = NULL;
+    uint64_t profile_period = RZ_PROFILE_DEFAULT_PERIOD;
+    bool profile_pc = false;
+    uint64_t budget = UINT64_MAX;
+    uint64_t timeout_ms = 0;
+    rz_image_format_t format = RZ_IMAGE_AUTO;
+    const char *batch = NULL;
+    const char *results = "-";
+    unsigned threads = 0;
+    uint64_t quantum = 0;
+    bool batch_fork = false;
+    unsigned lanes = 0;
+    const char *checkpoint = NULL;
+    const char *restore = NULL;
+    rz_ecall_abi_t ecall_abi = RZ_ECALL_ABI_RISCZ;
+    bool quiet = false;
+    bool flat_memory = false;
+    const char *record = NULL;
+    const char *replay = NULL;
+    const char *serve = NULL;
+    unsigned pool = 0;
+    rz_region_t region = {.window = RZ_REGION_DEFAULT_WINDOW};
+    bool fast_forward = false;
+    rz_timing_config_t timing_config;
+    rz_timing_default(&timing_config);
+    bool timing = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--trace=", 8) == 0)
+        {
+            if (!rz_trace_parse_level(arg + 8, &trace_level))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            trace_given = true;
+        }
+        else if (strncmp(arg, "--trace-depth=", 14) == 0)
+        {
+            trace_depth = strtoul(arg + 14, NULL, 0);
+        }
+        else if (strncmp(arg, "--trace-dump=", 13) == 0)
+        {
+            trace_dump = (unsigned)strtoul(arg + 13, NULL, 0);
+        }
+        else if (strncmp(arg, "--trace-file=", 13) == 0)
+        {
+            trace_file = arg + 13;
+        }
+        else if (strcmp(arg, "--trace-compress") == 0)
+        {
+            trace_compress = true;
+        }
+        else if (strcmp(arg, "--engine=interp") == 0)
+        {
+            engine = RZ_ENGINE_INTERP;
+        }
+        else if (strcmp(arg, "--engine=threaded") == 0)
+        {
+            engine = RZ_ENGINE_THREADED;
+        }
+        else if (strcmp(arg, "--engine=jit") == 0)
+        {
+            engine = RZ_ENGINE_JIT;
+        }
+        else if (strncmp(arg, "--jit-threshold=", 16) == 0)
+        {
+            jit_threshold = (unsigned)strtoul(arg + 16, NULL, 0);
+        }
+        else if (strcmp(arg, "--jit-stats") == 0)
+        {
+            jit_stats = true;
+        }
+        else if (strcmp(arg, "--counters") == 0)
+        {
+            counters = true;
+        }
+        else if (strncmp(arg, "--profile=", 10) == 0)
+        {
+            profile = arg + 10;
+        }
+        else if (strncmp(arg, "--profile-period=", 17) == 0)
+        {
+            profile_period = strtoull(arg + 17, NULL, 0);
+        }
+        else if (strcmp(arg, "--profile-pc") == 0)
+        {
+            profile_pc = true;
+        }
+        else if (strncmp(arg, "--format=", 9) == 0)
+        {
+            if (!rz_image_parse_format(arg + 9, &format))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strncmp(arg, "--ff=", 5) == 0)
+        {
+            if (!rz_region_parse(arg + 5, &region))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            fast_forward = true;
+        }
+        else if (strncmp(arg, "--ff-window=", 12) == 0)
+        {
+            region.window = strtoull(arg + 12, NULL, 0);
+        }
+        else if (strncmp(arg, "--ff-period=", 12) == 0)
+        {
+            region.period = strtoull(arg + 12, NULL, 0);
+        }
+        else if (strcmp(arg, "--timing") == 0)
+        {
+            timing = true;
+        }
+        else if (strncmp(arg, "--timing-l1i=", 13) == 0 || strncmp(arg, "--timing-l1d=", 13) == 0)
+        {
+            if (!rz_timing_parse_cache(arg + 13, arg[11] == 'i' ? &timing_config.icache : &timing_config.dcache))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            timing = true;
+        }
+        else if (strncmp(arg, "--timing-bp=", 12) == 0)
+        {
+            if (!rz_timing_parse_predictor(arg + 12, &timing_config))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            timing = true;
+        }
+        else if (strcmp(arg, "--ecall=riscz") == 0)
+        {
+            ecall_abi = RZ_ECALL_ABI_RISCZ;
+        }
+        else if (strcmp(arg, "--ecall=venus") == 0)
+        {
+            ecall_abi = RZ_ECALL_ABI_VENUS;
+        }
+        else if (strncmp(arg, "--record=", 9) == 0)
+        {
+            record = arg + 9;
+        }
+        else if (strncmp(arg, "--replay=", 9) == 0)
+        {
+            replay = arg + 9;
+        }
+        else if (strcmp(arg, "--quiet") == 0)
+        {
+            quiet = true;
+        }
+        else if (strcmp(arg, "--flat-memory") == 0)
+        {
+            flat_memory = true;
+        }
+        else if (strncmp(arg, "--budget=", 9) == 0)
+        {
+            budget = strtoull(arg + 9, NULL, 0);
+        }
+        else if (strncmp(arg, "--timeout=", 10) == 0)
+        {
+            timeout_ms = strtoull(arg + 10, NULL, 0);
+        }
+        else if (strncmp(arg, "--batch=", 8) == 0)
+        {
+            batch = arg + 8;
+        }
+        else if (strncmp(arg, "--threads=", 10) == 0)
+        {
+            threads = (unsigned)strtoul(arg + 10, NULL, 0);
+        }
+        else if (strncmp(arg, "--quantum=", 10) == 0)
+        {
+            quantum = strtoull(arg + 10, NULL, 0);
+        }
+        else if (strncmp(arg, "--results=", 10) == 0)
+        {
+            results = arg + 10;
+        }
+        else if (strcmp(arg, "--batch-fork") == 0)
+        {
+            batch_fork = true;
+        }
+        else if (strncmp(arg, "--lockstep=", 11) == 0)
+        {
+            lanes = (unsigned)strtoul(arg + 11, NULL, 0);
+        }
+        else if (strncmp(arg, "--serve=", 8) == 0)
+        {
+            serve = arg + 8;
+        }
+        else if (strncmp(arg, "--pool=", 7) == 0)
+        {
+            pool = (unsigned)strtoul(arg + 7, NULL, 0);
+        }
+        else if (strncmp(arg, "--checkpoint=", 13) == 0)
+        {
+            checkpoint = arg + 13;
+        }
+        else if (strncmp(arg, "--restore=", 10) == 0)
+        {
+            restore = arg + 10;
+        }
+        else if (arg[0] == '-' && arg[1] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            image = arg;
+        }
+    }
+
+    if (lanes > RZ_LOCKSTEP_LANES || (lanes && !batch))
+    {
+        fprintf(stderr, "--lockstep takes at most %u guests and needs --batch\n", RZ_LOCKSTEP_LANES);
+        return 1;
+    }
+    if (serve && (batch || restore || checkpoint || record || replay || profile || fast_forward || timing ||
+                  trace_file || flat_memory))
+    {
+        fprintf(stderr, "--serve runs jobs on its own and takes only engine, ecall and limit options\n");
+        return 1;
+    }
+    if (serve)
+        return rz_server_run(&(rz_server_config_t){
+            .path = serve,
+            .image = image,
+            .format = format,
+            .engine = engine,
+            .jit_threshold = jit_threshold,
+            .threads = threads,
+            .pool = pool,
+            .budget = budget,
+            .timeout_ns = timeout_ms * 1000000u,
+            .ecall_abi = ecall_abi,
+        }) ? 0 : 1;
+
+    if (!image && !restore)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (fast_forward && (profile || batch))
+    {
+        fprintf(stderr, "--ff cannot be combined with --profile or --batch\n");
+        return 1;
+    }
+    if (timing && batch)
+    {
+        fprintf(stderr, "--timing cannot be combined with --batch\n");
+        return 1;
+    }
+    if (flat_memory && batch)
+    {
+        fprintf(stderr, "--flat-memory cannot be combined with --batch\n");
+        return 1;
+    }
+    if ((record || replay) && batch)
+    {
+        fprintf(stderr, "--record and --replay cannot be combined with --batch\n");
+        return 1;
+    }
+    if (record && replay)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (trace_file && batch)
+    {
+        fprintf(stderr, "--trace-file cannot be combined with --batch\n");
+        return 1;
+    }
+    if (trace_file && !trace_given)
+        trace_level = RZ_TRACE_FULL;
+    if (trace_file && trace_level > RZ_TRACE_MAX)
+    {
+        fprintf(stderr, "--trace-file needs trace level %u, this build has %u: configure with -DRZ_TRACE_LEVEL=%u\n",
+                trace_level, (unsigned)RZ_TRACE_MAX, trace_level);
+        return 1;
+    }
+
+    if (!quiet)
+    {
+        #ifdef DEBUG
+        puts("DEBUG");
+        #endif
+
+        #ifdef NDEBUG
+        puts("RELEASE");
+        #endif
+    }
+
+    if (batch)
+        return run_batch(&(rz_farm_config_t){
+            .engine = engine,
+            .jit_threshold = jit_threshold,
+            .threads = threads,
+            .quantum = quantum,
+            .budget = budget,
+            .fork_prefix = batch_fork,
+            .lanes = lanes,
+            .ecall_abi = ecall_abi,
+        }, image, format, restore, batch, results);
+
+    rz_image_t img = {0};
+    rz_snapshot_p snap = NULL;
+    if (restore && !(snap = rz_snapshot_load(restore)))
+        return 1;
+
+    rz_machine_p machine = snap ? rz_snapshot_fork(snap) : rz_machine_create(0);
+    if (!machine)
+    {
+        fprintf(stderr, "Failed to create machine\n");
+        rz_snapshot_free(snap);
+        return 1;
+    }
+    // Отображённые страницы (и снимка) переезжают в окно, образ грузится уже туда
+    if (flat_memory && !mem_flat_enable(&machine->mem))
+    {
+        rz_machine_free(machine);
+        rz_snapshot_free(snap);
+        return 1;
+    }
+    rz_cpu_p pcpu = machine->cpu;
+    if (quiet)
+        rz_machine_set_io(machine, &rz_io_stdio_quiet);
+    else
+        printf("CPU Info: %s\n", rz_cpu_info(pcpu));
+    machine->ecall_abi = ecall_abi;
+
+    // Журнал ввода оборачивает уже выбранные обработчики
+    rz_replay_p input_log = NULL;
+    if ((record || replay) &&
+        !(input_log = record ? rz_replay_record(machine, record) : rz_replay_play(machine, replay)))
+    {
+        rz_machine_free(machine);
+        rz_snapshot_free(snap);
+        return 1;
+    }
+
+    if (trace_level != RZ_TRACE_OFF || trace_depth != RZ_TRACE_DEFAULT_DEPTH)
+    {
+        rz_trace_free(&pcpu->trace);
+        rz_trace_init(&pcpu->trace, trace_level, trace_depth);
+        if (pcpu->trace.level != trace_level)
+            fprintf(stderr, "Trace level limited to %u by build\n", pcpu->trace.level);
+    }
+    pcpu->trace.dump_depth = trace_dump;
+
+    rz_trace_writer_p trace_writer = NULL;
+    if (trace_file)
+    {
+        if (!(trace_writer = rz_trace_writer_open(trace_file, trace_compress)))
+        {
+            rz_machine_free(machine);
+            rz_snapshot_free(snap);
+            return 1;
+        }
+        rz_trace_stream(&pcpu->trace, trace_writer);
+    }
+
+    if (!snap)
+    {
+        if (!rz_image_load(&img, &machine->mem, image, format) ||
+            !rz_cpu_set_text(pcpu, img.text_base, img.text_size))
+        {
+            rz_machine_free(machine);
+            rz_image_close(&img);
+            return 1;
+        }
+        pcpu->r_pc = img.entry;
+        machine->brk = img.heap_base;
+    }
+
+    if (engine == RZ_ENGINE_JIT)
+    {
+        if (!rz_jit_available())
+            fprintf(stderr, "Native translation is not available, interpreting\n");
+        rz_jit_set_threshold(pcpu, jit_threshold);
+    }
+    rz_set_engine(pcpu, engine);
+
+    // Профилировщик именует кадры по символам ELF, если они есть
+    rz_profile_p prof = NULL;
+    rz_symbol_t *symbols = NULL;
+    size_t symbol_count = 0;
+    if (profile)
+    {
+        if (!(prof = rz_profile_create(profile_period, profile_pc)) ||
+            (!snap && !rz_image_symbols(&img, &symbols, &symbol_count)))
+        {
+            fprintf(stderr, "Failed to create profiler\n");
+            rz_profile_free(prof);
+            rz_machine_free(machine);
+            rz_snapshot_free(snap);
+            rz_image_close(&img);
+            return 1;
+        }
+        rz_profile_set_symbols(prof, symbols, symbol_count);
+        rz_profile_attach(pcpu, prof);
+    }
 
-    #ifdef NDEBUG
-    puts("RELEASE");
-    #endif
+    rz_timing_p model = NULL;
+    if (timing)
+    {
+        if (!(model = rz_timing_create(&timing_config)))
+        {
+            fprintf(stderr, "Failed to create timing model\n");
+            rz_profile_free(prof);
+            free(symbols);
+            rz_machine_free(machine);
+            rz_snapshot_free(snap);
+            rz_image_close(&img);
+            return 1;
+        }
+        rz_timing_attach(pcpu, model);
+    }
 
-    rz_cpu_p pcpu = rz_create_cpu();
-    printf("CPU Info: %s\n", rz_cpu_info(pcpu));
+    // Окна трассируются с уровнем --trace, перемотка — без трассы
+    rz_region_stats_t region_stats;
+    region.fast = engine;
+    region.trace_level = pcpu->trace.level;
+    region.log = stderr;
 
-    // load dumps
-    FILE *code_file = fopen(argv[1], "rb");
+    rz_run_result_t result = prof ? rz_profile_run(pcpu, budget, timeout_ms * 1000000u)
+        : fast_forward ? rz_region_run(pcpu, &region, budget, timeout_ms * 1000000u, &region_stats)
+        : timeout_ms ? rz_run_timed(pcpu, budget, timeout_ms * 1000000u)
+        : rz_run(pcpu, budget);
+    fflush(stdout);
+    bool saved = true;
+    if (trace_writer)
+    {
+        rz_trace_flush(&pcpu->trace);
+        rz_trace_stream(&pcpu->trace, NULL);
+        saved = rz_trace_writer_close(trace_writer);
+    }
+    fprintf(stderr, "Stopped: %s after %llu instructions\n",
+            rz_stop_name(result.reason), (unsigned long long)result.retired);
+    if (fast_forward)
+        fprintf(stderr, "Region: %u windows, %llu detailed instructions in %.3f s, "
+                "%llu fast-forwarded in %.3f s\n",
+                region_stats.windows, (unsigned long long)region_stats.detailed,
+                (double)region_stats.detailed_ns / 1e9, (unsigned long long)region_stats.fast,
+                (double)region_stats.fast_ns / 1e9);
+    if (input_log && !rz_replay_finish(input_log))
+        saved = false;
 
-    fread(mem_access(TEXT_OFFSET), 1, TEXT_SIZE, code_file);
-    fclose(code_file);
+    if (jit_stats)
+    {
+        rz_jit_stats_t stats;
+        rz_jit_get_stats(pcpu, &stats);
+        fprintf(stderr, "JIT: %llu blocks, %llu entries, %llu evictions, %llu flushes, %zu bytes of code\n",
+                (unsigned long long)stats.blocks, (unsigned long long)stats.entries,
+                (unsigned long long)stats.evictions, (unsigned long long)stats.flushes, stats.code_bytes);
+    }
+    if (counters)
+        rz_cpu_print_counters(pcpu, stderr);
+    if (model)
+    {
+        rz_timing_print(model, stderr);
+        rz_timing_attach(pcpu, NULL);
+        rz_timing_free(model);
+    }
 
-    while(rz_cycle(pcpu));
+    if (prof)
+    {
+        saved = rz_profile_write(prof, profile) && saved;
+        rz_profile_attach(pcpu, NULL);
+        rz_profile_free(prof);
+        free(symbols);
+    }
+    if (checkpoint)
+    {
+        rz_snapshot_p state = rz_snapshot_take(machine);
+        saved = state && rz_snapshot_save(state, checkpoint) && saved;
+        rz_snapshot_free(state);
+    }
 
-    rz_free_cpu(pcpu);
+    int exit_code = pcpu->exit_code;
+    rz_machine_free(machine);
+    rz_snapshot_free(snap);
+    rz_image_close(&img);
 
-    return 0;
+    if (!saved)
+        return 1;
+    // EBREAK и вызов exit — штатное завершение программы
+    if (result.reason == RZ_STOP_EXIT)
+        return exit_code;
+    return result.reason == RZ_STOP_EBREAK ? 0 : 2;
 }
@@ -1,28 +1,345 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // memfd_create, fallocate
+#endif
 #include <stddef.h>
+#include <stdio.h>
 #include "memory.h"
 
-typedef struct {
-    rz_address_t base;
-    size_t size;
-    uint8_t *data;
-} memory_region_t;
-
-static uint8_t text_memory[TEXT_SIZE];
-static uint8_t data_memory[DATA_SIZE];
-static uint8_t stack_memory[STACK_SIZE];
-
-memory_region_t regions[] = {
-    { TEXT_OFFSET,  TEXT_SIZE, text_memory },
-    { DATA_OFFSET,  DATA_SIZE, data_memory },
-    { STACK_OFFSET, STACK_SIZE, stack_memory },
-};
-
-void *mem_access(rz_address_t addr) {
-    static uint8_t nowhere;
-    for(int i = 0; i < 3; ++i) {
-        if(regions[i].base <= addr && addr < regions[i].base + regions[i].size)
-            return regions[i].data + addr - regions[i].base;
-    }
-    nowhere = 0;
-    return &nowhere;
+// Плоская память: окно 4 ГиБ на гостя, ошибки доступа приходят как SIGSEGV
+#if defined(__linux__) && UINTPTR_MAX > 0xFFFFFFFFu
+#define MEM_FLAT 1
+#include <errno.h>
+#include <fcntl.h> // fallocate
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h> // memfd_create, mmap, mprotect
+#include <threads.h>
+#include <unistd.h>
+#else
+#define MEM_FLAT 0
+#endif
+
+// Двухуровневая таблица страниц над 32-битным адресным пространством:
+// 10 бит индекса каталога, 10 бит индекса таблицы, 12 бит смещения
+
+static void mem_tlb_flush(rz_memory_p mem) {
+    for (unsigned k = 0; k < MEM_KINDS; ++k)
+        for (unsigned i = 0; i < MEM_TLB_SIZE; ++i)
+            mem->tlb[k][i].tag = MEM_TLB_INVALID;
+}
+
+static mem_page_t *mem_page(rz_memory_p mem, rz_address_t addr) {
+    mem_page_t *table = mem->dir[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+    if (!table)
+        return NULL;
+    mem_page_t *page = &table[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+    return page->host ? page : NULL;
+}
+
+// Записи таблицы страниц для [first, end): страница addr на хосте по data + (addr - first)
+static bool mem_set_pages(rz_memory_p mem, uint64_t first, uint64_t end, uint8_t *data, unsigned perm) {
+    for (uint64_t addr = first; addr < end; addr += MEM_PAGE_SIZE) {
+        mem_page_t **table = &mem->dir[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+        if (!*table && !(*table = rz_arena_alloc(mem->arena, MEM_TABLE_SIZE * sizeof(mem_page_t))))
+            return false;
+        mem_page_t *page = &(*table)[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+        page->host = data + (addr - first);
+        page->perm = perm;
+    }
+
+    // Отображение изменилось — старые переводы недействительны
+    mem_tlb_flush(mem);
+    return true;
+}
+
+#if MEM_FLAT
+
+#define MEM_FLAT_SIZE (1ULL << 32)
+
+// Страж тела mem_flat_run; стражи потока образуют стек
+typedef struct mem_flat_guard_s {
+    sigjmp_buf env;
+    rz_memory_p mem;
+    rz_address_t addr; // адрес гостя, на котором тело прервано
+    struct mem_flat_guard_s *prev;
+} mem_flat_guard_t;
+
+// Внутренний страж потока. Его читает обработчик сигнала, а динамическая
+// TLS библиотеки, загруженной dlopen, выделяется при первом обращении и
+// в обработчике небезопасна; initial-exec кладёт его в статический блок TLS
+static thread_local mem_flat_guard_t *mem_flat_top __attribute__((tls_model("initial-exec")));
+static struct sigaction mem_flat_prev;               // обработчик SIGSEGV до нас
+static once_flag mem_flat_once = ONCE_FLAG_INIT;
+
+// Права страницы в защищённом окне; только для записи хост не умеет — чтение тоже
+static int mem_flat_prot(unsigned perm) {
+    if (perm & MEM_PERM_WRITE)
+        return PROT_READ | PROT_WRITE;
+    return perm & MEM_PERM_READ ? PROT_READ : PROT_NONE;
+}
+
+// Ошибка в окне внутреннего стража — прыжок к нему, иначе чужая ошибка
+static void mem_flat_signal(int sig, siginfo_t *info, void *context) {
+    mem_flat_guard_t *guard = mem_flat_top;
+    uintptr_t offset = (uintptr_t)info->si_addr - (uintptr_t)(guard ? guard->mem->flat : NULL);
+    if (guard && offset < MEM_FLAT_SIZE) {
+        guard->addr = (rz_address_t)offset;
+        siglongjmp(guard->env, 1);
+    }
+    if ((mem_flat_prev.sa_flags & SA_SIGINFO) && mem_flat_prev.sa_sigaction) {
+        mem_flat_prev.sa_sigaction(sig, info, context);
+    } else if (mem_flat_prev.sa_handler != SIG_DFL && mem_flat_prev.sa_handler != SIG_IGN) {
+        mem_flat_prev.sa_handler(sig);
+    } else {
+        // Инструкция повторится и завершит процесс как без нас
+        signal(sig, SIG_DFL);
+    }
+}
+
+// SA_NODEFER: после siglongjmp без восстановления маски SIGSEGV не остаётся заблокированным
+static void mem_flat_install(void) {
+    struct sigaction action = {0};
+    action.sa_sigaction = mem_flat_signal;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &mem_flat_prev);
+}
+
+// Тело вызывается из отдельной функции: sigsetjmp не мешает оптимизации его цикла
+bool mem_flat_run(rz_memory_p mem, void (*body)(void *ctx), void *ctx, rz_address_t *addr) {
+    mem_flat_guard_t guard = {.mem = mem, .prev = mem_flat_top};
+    if (sigsetjmp(guard.env, 0)) {
+        mem_flat_top = guard.prev;
+        *addr = guard.addr;
+        return false;
+    }
+    mem_flat_top = &guard;
+    body(ctx);
+    mem_flat_top = guard.prev;
+    return true;
+}
+
+// Отображение в окне: страницы обнуляются или заполняются из host, таблица
+// страниц указывает на изменяемый вид, права задаются защищённому окну
+static bool mem_flat_map(rz_memory_p mem, rz_address_t base, size_t size, uint64_t first, uint64_t end,
+                         const void *host, unsigned perm) {
+    if (host && ((base & MEM_PAGE_MASK) || (size & MEM_PAGE_MASK)))
+        return false;
+    size_t len = (size_t)(end - first);
+    if (host) {
+        memcpy(mem->alias + first, host, len);
+    } else if (fallocate(mem->flat_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)first, (off_t)len) != 0) {
+        memset(mem->alias + first, 0, len);
+    }
+    perm &= ~MEM_PERM_COW;
+    return mem_set_pages(mem, first, end, mem->alias + first, perm) &&
+           mprotect(mem->flat + first, len, mem_flat_prot(perm)) == 0;
+}
+
+bool mem_flat_enable(rz_memory_p mem) {
+    if (mem->flat)
+        return true;
+
+    // Оба вида — общие отображения одного файла в памяти: запись через
+    // изменяемый вид сразу видна в окне, неотображённое место не занимает памяти
+    int fd = memfd_create("risc-z-guest", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)MEM_FLAT_SIZE) != 0) {
+        fprintf(stderr, "Failed to create guest memory file: %s\n", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    uint8_t *flat = mmap(NULL, MEM_FLAT_SIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    uint8_t *alias = mmap(NULL, MEM_FLAT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    bool ok = flat != MAP_FAILED && alias != MAP_FAILED;
+    if (!ok)
+        fprintf(stderr, "Failed to reserve 4 GiB of host address space: %s\n", strerror(errno));
+
+    // Уже отображённые страницы копируются в окно по своим адресам; таблица
+    // страниц меняется, только когда окно готово целиком, так что при ошибке
+    // память остаётся прежней
+    for (uint64_t addr = 0; ok && addr < MEM_FLAT_SIZE; addr += MEM_PAGE_SIZE) {
+        mem_page_t *page = mem_page(mem, (rz_address_t)addr);
+        if (!page)
+            continue;
+        memcpy(alias + addr, page->host, MEM_PAGE_SIZE);
+        if (mprotect(flat + addr, MEM_PAGE_SIZE, mem_flat_prot(page->perm)) != 0) {
+            fprintf(stderr, "Failed to protect guest page: %s\n", strerror(errno));
+            ok = false;
+        }
+    }
+    if (!ok) {
+        if (flat != MAP_FAILED)
+            munmap(flat, MEM_FLAT_SIZE);
+        if (alias != MAP_FAILED)
+            munmap(alias, MEM_FLAT_SIZE);
+        close(fd);
+        return false;
+    }
+
+    for (uint64_t addr = 0; addr < MEM_FLAT_SIZE; addr += MEM_PAGE_SIZE) {
+        mem_page_t *page = mem_page(mem, (rz_address_t)addr);
+        if (!page)
+            continue;
+        page->host = alias + addr;
+        page->perm &= ~MEM_PERM_COW;
+    }
+    mem->flat = flat;
+    mem->alias = alias;
+    mem->flat_fd = fd;
+    call_once(&mem_flat_once, mem_flat_install);
+    mem_tlb_flush(mem);
+    return true;
+}
+
+void mem_release(rz_memory_p mem) {
+    if (!mem->flat)
+        return;
+    munmap(mem->flat, MEM_FLAT_SIZE);
+    munmap(mem->alias, MEM_FLAT_SIZE);
+    close(mem->flat_fd);
+    mem->flat = mem->alias = NULL;
+}
+
+#else
+
+static bool mem_flat_map(rz_memory_p mem, rz_address_t base, size_t size, uint64_t first, uint64_t end,
+                         const void *host, unsigned perm) {
+    (void)mem, (void)base, (void)size, (void)first, (void)end, (void)host, (void)perm;
+    return false;
+}
+
+bool mem_flat_enable(rz_memory_p mem) {
+    (void)mem;
+    fprintf(stderr, "Flat guest memory needs a 64-bit Linux host\n");
+    return false;
+}
+
+bool mem_flat_run(rz_memory_p mem, void (*body)(void *ctx), void *ctx, rz_address_t *addr) {
+    (void)mem, (void)addr;
+    body(ctx);
+    return true;
+}
+
+void mem_release(rz_memory_p mem) {
+    (void)mem;
+}
+
+#endif
+
+bool mem_map(rz_memory_p mem, rz_address_t base, size_t size, void *host, unsigned perm) {
+    if (size == 0)
+        return false;
+
+    uint64_t first = base & ~(uint64_t)MEM_PAGE_MASK;
+    uint64_t end = ((uint64_t)base + size + MEM_PAGE_MASK) & ~(uint64_t)MEM_PAGE_MASK;
+    if (end > (1ULL << 32))
+        return false;
+
+    if (mem->flat)
+        return mem_flat_map(mem, base, size, first, end, host, perm);
+
+    uint8_t *data = host;
+    if (!data) {
+        data = rz_arena_alloc(mem->arena, (size_t)(end - first));
+        if (!data)
+            return false;
+    } else if ((base & MEM_PAGE_MASK) || (size & MEM_PAGE_MASK)) {
+        return false;
+    }
+
+    return mem_set_pages(mem, first, end, data, perm);
+}
+
+bool mem_add_perm(rz_memory_p mem, rz_address_t base, size_t size, unsigned perm) {
+    uint64_t first = base & ~(uint64_t)MEM_PAGE_MASK;
+    uint64_t end = ((uint64_t)base + size + MEM_PAGE_MASK) & ~(uint64_t)MEM_PAGE_MASK;
+    for (uint64_t addr = first; addr < end; addr += MEM_PAGE_SIZE) {
+        mem_page_t *page = mem_page(mem, (rz_address_t)addr);
+        if (!page)
+            return false;
+        page->perm |= perm;
+#if MEM_FLAT
+        if (mem->flat && mprotect(mem->flat + addr, MEM_PAGE_SIZE, mem_flat_prot(page->perm)) != 0)
+            return false;
+#endif
+    }
+    mem_tlb_flush(mem);
+    return true;
+}
+
+void mem_reset(rz_memory_p mem, rz_arena_p arena) {
+    memset(mem->dir, 0, sizeof(mem->dir));
+    memset(mem->accesses, 0, sizeof(mem->accesses));
+    mem->arena = arena;
+    mem->flat = mem->alias = NULL;
+    mem_tlb_flush(mem);
+}
+
+bool mem_init(rz_memory_p mem, rz_arena_p arena) {
+    mem_reset(mem, arena);
+    // Текст доступен на запись: самомодифицирующийся код поддерживается
+    return mem_map(mem, TEXT_OFFSET, TEXT_SIZE, NULL, MEM_PERM_READ | MEM_PERM_WRITE | MEM_PERM_EXEC) &&
+           mem_map(mem, DATA_OFFSET, DATA_SIZE, NULL, MEM_PERM_READ | MEM_PERM_WRITE) &&
+           mem_map(mem, STACK_OFFSET, STACK_SIZE, NULL, MEM_PERM_READ | MEM_PERM_WRITE);
+}
+
+void *mem_access(rz_memory_p mem, rz_address_t addr) {
+    mem_page_t *page = mem_page(mem, addr);
+    return page ? page->host + (addr & MEM_PAGE_MASK) : NULL;
+}
+
+mem_fault_t mem_translate(rz_memory_p mem, mem_kind_t kind, rz_address_t addr, uint8_t **host) {
+    mem_page_t *page = mem_page(mem, addr);
+    if (!page)
+        return MEM_FAULT_UNMAPPED;
+    if (!(page->perm & (1u << kind)))
+        return MEM_FAULT_PERMISSION;
+
+    rz_address_t vpn = addr >> MEM_PAGE_BITS;
+    if (kind == MEM_STORE && (page->perm & MEM_PERM_COW)) {
+        // Первая запись в общую страницу: своя копия, старые переводы страницы сбрасываются
+        uint8_t *copy = rz_arena_alloc(mem->arena, MEM_PAGE_SIZE);
+        if (!copy)
+            return MEM_FAULT_NOMEM;
+        memcpy(copy, page->host, MEM_PAGE_SIZE);
+        page->host = copy;
+        page->perm &= ~MEM_PERM_COW;
+        for (unsigned k = 0; k < MEM_KINDS; ++k)
+            if (mem->tlb[k][vpn & (MEM_TLB_SIZE - 1)].tag == vpn)
+                mem->tlb[k][vpn & (MEM_TLB_SIZE - 1)].tag = MEM_TLB_INVALID;
+    }
+
+    mem_tlb_entry_t *t = &mem->tlb[kind][vpn & (MEM_TLB_SIZE - 1)];
+    t->tag = vpn;
+    t->addend = (uintptr_t)page->host - (addr & ~(rz_address_t)MEM_PAGE_MASK);
+    *host = page->host + (addr & MEM_PAGE_MASK);
+    return MEM_OK;
+}
+
+void *mem_host(rz_memory_p mem, rz_address_t addr, mem_kind_t kind, unsigned size) {
+    if (addr & (size - 1))
+        return NULL;
+    uint8_t *p = mem_tlb_lookup(mem, kind, addr);
+    if (!p && mem_translate(mem, kind, addr, &p) != MEM_OK)
+        return NULL;
+    if (kind != MEM_FETCH)
+        ++mem->accesses[kind][addr >> MEM_SEGMENT_BITS];
+    return p;
+}
+
+const char *mem_fault_name(mem_fault_t fault) {
+    switch (fault) {
+    case MEM_OK:
+        return "no fault";
+    case MEM_FAULT_UNMAPPED:
+        return "unmapped address";
+    case MEM_FAULT_MISALIGNED:
+        return "misaligned access";
+    case MEM_FAULT_PERMISSION:
+        return "access not permitted";
+    case MEM_FAULT_NOMEM:
+        return "out of host memory";
+    }
+    return "unknown";
 }
@@ -1,7 +1,11 @@
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include "misc.h"
+#include "arena.h"
 
 #define TEXT_SIZE (1UL << 14)
 #define TEXT_OFFSET 0UL
@@ -9,14 +13,329 @@
 #define DATA_SIZE (1UL << 14)
 #define DATA_OFFSET 0x10000000UL
 
+#define HEAP_OFFSET (DATA_OFFSET + DATA_SIZE) // program break of images without own data
+#define HEAP_LIMIT 0x70000000UL			   // sbrk never moves the break above
+
 #define STACK_SIZE (1UL << 14)
 #define STACK_OFFSET 0x7FFFFF00UL
 
+#define MEM_PAGE_BITS 12u
+#define MEM_PAGE_SIZE (1UL << MEM_PAGE_BITS)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_TLB_SIZE 64u // entries per access kind, power of two
+#define MEM_SEGMENT_BITS 28u // loads and stores are counted per 256 MiB segment
+#define MEM_SEGMENTS (1u << (32u - MEM_SEGMENT_BITS))
+
+// Page permissions
+#define MEM_PERM_READ 1u
+#define MEM_PERM_WRITE 2u
+#define MEM_PERM_EXEC 4u
+#define MEM_PERM_COW 8u // shared page, first store copies it
+
+/**
+ * @brief Kinds of guest memory access, each has its own TLB
+ *
+ */
+typedef enum mem_kind_e : unsigned
+{
+	MEM_LOAD = 0, // needs MEM_PERM_READ
+	MEM_STORE,	  // needs MEM_PERM_WRITE
+	MEM_FETCH,	  // needs MEM_PERM_EXEC
+	MEM_KINDS,
+} mem_kind_t;
+
+/**
+ * @brief Result of guest memory access
+ *
+ */
+typedef enum mem_fault_e : uint8_t
+{
+	MEM_OK = 0,
+	MEM_FAULT_UNMAPPED,	  // no page at address
+	MEM_FAULT_MISALIGNED, // address is not a multiple of access size
+	MEM_FAULT_PERMISSION, // page does not allow this kind of access
+	MEM_FAULT_NOMEM,	  // no host memory to copy shared page
+} mem_fault_t;
+
+/**
+ * @brief TLB entry: host address of guest byte is addend + guest address
+ *
+ */
+typedef struct mem_tlb_entry_s
+{
+	rz_address_t tag; // guest page number, MEM_TLB_INVALID when empty
+	uintptr_t addend;
+} mem_tlb_entry_t;
+
+#define MEM_TLB_INVALID UINT32_MAX
+
+#define MEM_DIR_BITS 10u
+#define MEM_TABLE_BITS (32u - MEM_PAGE_BITS - MEM_DIR_BITS)
+#define MEM_TABLE_SIZE (1u << MEM_TABLE_BITS)
+
+/**
+ * @brief Page table entry
+ *
+ */
+typedef struct mem_page_s
+{
+	uint8_t *host; // start of page on the host, NULL when page is not mapped
+	unsigned perm; // MEM_PERM_* bits
+} mem_page_t;
+
+/**
+ * @brief Guest memory of one machine: two-level page table and TLBs
+ *
+ */
+typedef struct rz_memory_s
+{
+	mem_tlb_entry_t tlb[MEM_KINDS][MEM_TLB_SIZE];
+	mem_page_t *dir[1u << MEM_DIR_BITS];
+	rz_arena_p arena; // page tables and regions without host memory
+	uint64_t accesses[MEM_FETCH][MEM_SEGMENTS]; // loads and stores per segment
+	uint8_t *flat;	  // guest address 0 in the protected window, NULL without flat memory
+	uint8_t *alias;	  // writable view of the same pages, page table points here
+	int flat_fd;	  // memory file backing both views
+} rz_memory_t, *rz_memory_p;
+
+/**
+ * @brief Initialize guest memory without any mapped pages
+ *
+ * @param mem memory instance
+ * @param arena arena for page tables and region memory
+ */
+void mem_reset(rz_memory_p mem, rz_arena_p arena);
+
+/**
+ * @brief Initialize guest memory and map default text, data and stack regions
+ *
+ * @param mem memory instance
+ * @param arena arena for page tables and region memory
+ * @return true on success
+ */
+bool mem_init(rz_memory_p mem, rz_arena_p arena);
+
+/**
+ * @brief Move guest memory into a reserved 4 GiB host window
+ *
+ * Guest byte A lives at flat + A. Pages outside mapped regions are
+ * inaccessible and pages without MEM_PERM_WRITE are read-only in the
+ * window, so mem_flat_load/store need no lookup: a bad access faults on
+ * the host and is reported by mem_flat_run. Mapped pages are
+ * copied into the window, shared copy-on-write pages become private.
+ * Page table and TLBs keep working for fetches, engines and the loader.
+ * Only on 64-bit Linux, elsewhere an error is printed.
+ *
+ * @param mem memory instance
+ * @return true on success or if already flat
+ */
+bool mem_flat_enable(rz_memory_p mem);
+
+/**
+ * @brief Release host window of flat memory, page table is left dangling
+ *
+ * @param mem memory instance, may be without flat memory
+ */
+void mem_release(rz_memory_p mem);
+
+/**
+ * @brief Run code accessing flat memory and catch faults in its window
+ *
+ * A fault unwinds body at the faulting access, so body must keep guest
+ * state in memory up to each access. Bodies may nest per thread, the
+ * innermost one catches faults of its memory.
+ *
+ * @param mem memory instance
+ * @param body code calling mem_flat_load/store
+ * @param ctx argument of body
+ * @param addr output guest address of the fault
+ * @return true if body returned, false if it faulted at addr
+ */
+bool mem_flat_run(rz_memory_p mem, void (*body)(void *ctx), void *ctx, rz_address_t *addr);
+
+/**
+ * @brief Map region of guest memory
+ *
+ * With host == NULL zeroed memory is allocated from the arena and the region
+ * is widened to page boundaries, otherwise base and size must be page-aligned
+ * and host memory must outlive the mapping (shared buffers). Pages mapped
+ * with MEM_PERM_COW are copied into the arena on first store, so one buffer
+ * may back many machines.
+ *
+ * @param mem memory instance
+ * @param base guest address of region
+ * @param size size of region in bytes
+ * @param host backing memory or NULL
+ * @param perm MEM_PERM_* bits
+ * @return true on success
+ */
+bool mem_map(rz_memory_p mem, rz_address_t base, size_t size, void *host, unsigned perm);
+
 /**
- * @brief ...
+ * @brief Add permissions to mapped pages, contents are kept
+ *
+ * @param mem memory instance
+ * @param base guest address, widened to page boundaries with size
+ * @param size size of range in bytes
+ * @param perm MEM_PERM_* bits to add
+ * @return true on success, false if a page in range is not mapped
+ */
+bool mem_add_perm(rz_memory_p mem, rz_address_t base, size_t size, unsigned perm);
+
+/**
+ * @brief Get host pointer of guest byte without permission checks (loader, debugger)
+ *
+ * Memory of a region is contiguous on the host. Shared copy-on-write
+ * pages are returned as is, so they must not be written through it.
+ *
+ * @param mem memory instance
+ * @param addr guest address
+ * @return void* host pointer or NULL when address is not mapped
+ */
+void *mem_access(rz_memory_p mem, rz_address_t addr);
+
+/**
+ * @brief Translate guest address by page table and refill TLB (TLB miss path)
+ *
+ * @param mem memory instance
+ * @param kind access kind
+ * @param addr guest address
+ * @param host output host pointer
+ * @return mem_fault_t MEM_OK or fault
+ */
+mem_fault_t mem_translate(rz_memory_p mem, mem_kind_t kind, rz_address_t addr, uint8_t **host);
+
+/**
+ * @brief Host pointer for access of size bytes, for translated code
+ *
+ * @param mem memory instance
+ * @param addr guest address
+ * @param kind access kind
+ * @param size access size in bytes
+ * @return void* host pointer or NULL on any fault
+ */
+void *mem_host(rz_memory_p mem, rz_address_t addr, mem_kind_t kind, unsigned size);
+
+/**
+ * @brief Get text description of memory fault
+ *
+ * @param fault memory fault
+ * @return const char* description
+ */
+const char *mem_fault_name(mem_fault_t fault);
+
+// Поиск в TLB: указатель хоста или NULL при промахе
+static inline uint8_t *mem_tlb_lookup(rz_memory_p mem, mem_kind_t kind, rz_address_t addr)
+{
+	const mem_tlb_entry_t *t = &mem->tlb[kind][(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+	if (t->tag != addr >> MEM_PAGE_BITS)
+		return NULL;
+	return (uint8_t *)(t->addend + addr);
+}
+
+// Выровненный доступ не пересекает границу страницы
+#define MEM_ACCESSORS(bits)                                                                           \
+	static inline mem_fault_t mem_load##bits(rz_memory_p mem, rz_address_t addr, uint##bits##_t *val) \
+	{                                                                                                 \
+		if (addr & (bits / 8 - 1))                                                                    \
+			return MEM_FAULT_MISALIGNED;                                                              \
+		uint8_t *p = mem_tlb_lookup(mem, MEM_LOAD, addr);                                             \
+		if (!p)                                                                                       \
+		{                                                                                             \
+			mem_fault_t fault = mem_translate(mem, MEM_LOAD, addr, &p);                               \
+			if (fault != MEM_OK)                                                                      \
+				return fault;                                                                         \
+		}                                                                                             \
+		memcpy(val, p, sizeof(*val));                                                                 \
+		++mem->accesses[MEM_LOAD][addr >> MEM_SEGMENT_BITS];                                          \
+		return MEM_OK;                                                                                \
+	}                                                                                                 \
+	static inline mem_fault_t mem_store##bits(rz_memory_p mem, rz_address_t addr, uint##bits##_t val) \
+	{                                                                                                 \
+		if (addr & (bits / 8 - 1))                                                                    \
+			return MEM_FAULT_MISALIGNED;                                                              \
+		uint8_t *p = mem_tlb_lookup(mem, MEM_STORE, addr);                                            \
+		if (!p)                                                                                       \
+		{                                                                                             \
+			mem_fault_t fault = mem_translate(mem, MEM_STORE, addr, &p);                              \
+			if (fault != MEM_OK)                                                                      \
+				return fault;                                                                         \
+		}                                                                                             \
+		memcpy(p, &val, sizeof(val));                                                                 \
+		++mem->accesses[MEM_STORE][addr >> MEM_SEGMENT_BITS];                                         \
+		return MEM_OK;                                                                                \
+	} \
+	static inline mem_fault_t mem_flat_load##bits(rz_memory_p mem, rz_address_t addr, uint##bits##_t *val) \
+	{                                                                                                 \
+		if (addr & (bits / 8 - 1))                                                                    \
+			return MEM_FAULT_MISALIGNED;                                                              \
+		memcpy(val, mem->flat + addr, sizeof(*val));                                                  \
+		++mem->accesses[MEM_LOAD][addr >> MEM_SEGMENT_BITS];                                          \
+		return MEM_OK;                                                                                \
+	}                                                                                                 \
+	static inline mem_fault_t mem_flat_store##bits(rz_memory_p mem, rz_address_t addr, uint##bits##_t val) \
+	{                                                                                                 \
+		if (addr & (bits / 8 - 1))                                                                    \
+			return MEM_FAULT_MISALIGNED;                                                              \
+		memcpy(mem->flat + addr, &val, sizeof(val));                                                  \
+		++mem->accesses[MEM_STORE][addr >> MEM_SEGMENT_BITS];                                         \
+		return MEM_OK;                                                                                \
+	}
+
+/**
+ * @brief Typed guest accessors mem_load8/16/32 and mem_store8/16/32
+ *
+ * Check alignment and permissions, return MEM_OK or fault.
+ * mem_flat_load/store variants check alignment only and access the
+ * flat window directly, they may be called only inside mem_flat_run.
+ */
+MEM_ACCESSORS(8)
+MEM_ACCESSORS(16)
+MEM_ACCESSORS(32)
+
+#undef MEM_ACCESSORS
+
+// Выборка 16-битной части инструкции
+static inline mem_fault_t mem_fetch16(rz_memory_p mem, rz_address_t addr, uint16_t *parcel)
+{
+	uint8_t *p = mem_tlb_lookup(mem, MEM_FETCH, addr);
+	if (!p)
+	{
+		mem_fault_t fault = mem_translate(mem, MEM_FETCH, addr, &p);
+		if (fault != MEM_OK)
+			return fault;
+	}
+	memcpy(parcel, p, sizeof(*parcel));
+	return MEM_OK;
+}
+
+/**
+ * @brief Fetch instruction, needs executable page
+ *
+ * Instruction is 32-bit when low bits of its first halfword are 11,
+ * otherwise it is compressed and only the first halfword is read.
+ * 32-bit instruction may cross a page boundary.
  *
- * @param ...
+ * @param mem memory instance
+ * @param addr guest address, even
+ * @param raw output instruction word or zero-extended halfword
+ * @return mem_fault_t MEM_OK or fault
  */
-void *mem_access(rz_address_t addr);
+static inline mem_fault_t mem_fetch(rz_memory_p mem, rz_address_t addr, uint32_t *raw)
+{
+	if (addr & 1u)
+		return MEM_FAULT_MISALIGNED;
+	uint16_t lo, hi;
+	mem_fault_t fault = mem_fetch16(mem, addr, &lo);
+	if (fault != MEM_OK || (lo & 3u) != 3u)
+	{
+		*raw = lo;
+		return fault;
+	}
+	if ((fault = mem_fetch16(mem, addr + 2, &hi)) != MEM_OK)
+		return fault;
+	*raw = (uint32_t)hi << 16 | lo;
+	return MEM_OK;
+}
 
 #endif // MEMORY_H__
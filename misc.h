@@ -8,4 +8,14 @@ typedef uint32_t rz_register_t;
 typedef rz_register_t rz_address_t;
 // typedef rz_register_t rz_instruction_t;
 
+// Inline even past compiler size limits: hot loops instantiate the
+// function with different constant arguments
+#if defined(__GNUC__)
+#define RZ_FORCE_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define RZ_FORCE_INLINE static __forceinline
+#else
+#define RZ_FORCE_INLINE static inline
+#endif
+
 #endif // MISC_H__
@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc, free, qsort
+#include <string.h> // memcmp, memcpy, strerror
+
+#include "profile.h"
+
+#define RZ_PROFILE_CHECK_TIME (1u << 20) // Инструкций между проверками времени
+
+// Кадр теневого стека: вызванная функция и адрес возврата из неё
+typedef struct
+{
+    rz_address_t func;
+    rz_address_t ret;
+} rz_profile_frame_t;
+
+// Уникальный стек и число попавших на него выборок
+typedef struct
+{
+    uint64_t hash;
+    uint64_t count; // 0 — свободная запись
+    size_t offset;  // адреса стека в pool, от корня к листу
+    unsigned length;
+} rz_profile_stack_t;
+
+struct rz_profile_s
+{
+    uint64_t period;
+    bool per_pc;
+    const rz_symbol_t *symbols;
+    size_t symbol_count;
+    rz_address_t root; // PC при подключении — корень всех стеков
+
+    rz_profile_frame_t frames[RZ_PROFILE_DEPTH];
+    unsigned depth;
+    unsigned lost; // вызовы глубже RZ_PROFILE_DEPTH, кадры не сохранены
+
+    rz_profile_stack_t *table; // открытая адресация, размер — степень двойки
+    size_t table_size, table_used;
+    rz_address_t *pool;
+    size_t pool_used, pool_size;
+};
+
+rz_profile_p rz_profile_create(uint64_t period, bool per_pc)
+{
+    rz_profile_p prof = calloc(1, sizeof(rz_profile_t));
+    if (!prof)
+        return NULL;
+    prof->period = period ? period : RZ_PROFILE_DEFAULT_PERIOD;
+    prof->per_pc = per_pc;
+    prof->table_size = 1024;
+    prof->table = calloc(prof->table_size, sizeof(rz_profile_stack_t));
+    prof->pool_size = 16384;
+    prof->pool = malloc(prof->pool_size * sizeof(rz_address_t));
+    if (!prof->table || !prof->pool)
+    {
+        rz_profile_free(prof);
+        return NULL;
+    }
+    return prof;
+}
+
+void rz_profile_free(rz_profile_p prof)
+{
+    if (!prof)
+        return;
+    free(prof->table);
+    free(prof->pool);
+    free(prof);
+}
+
+void rz_profile_set_symbols(rz_profile_p prof, const rz_symbol_t *symbols, size_t count)
+{
+    prof->symbols = symbols;
+    prof->symbol_count = count;
+}
+
+void rz_profile_attach(rz_cpu_p pcpu, rz_profile_p prof)
+{
+    pcpu->profile = prof;
+    if (prof)
+    {
+        prof->root = pcpu->r_pc;
+        prof->depth = prof->lost = 0;
+    }
+    // Движки решают при трансляции, исполнять ли вызовы сами
+    rz_icache_flush(&pcpu->icache);
+}
+
+void rz_profile_jump(rz_profile_p prof, const rz_decoded_t *d, rz_address_t pc, rz_address_t target)
+{
+    if (d->rd == 1 || d->rd == 5)
+    {
+        if (prof->depth < RZ_PROFILE_DEPTH)
+            prof->frames[prof->depth++] = (rz_profile_frame_t){target, pc + d->size};
+        else
+            ++prof->lost;
+        return;
+    }
+    if (prof->lost)
+    {
+        --prof->lost;
+        return;
+    }
+    // Возврат снимает кадры до того, чей адрес возврата совпал, —
+    // так стек переживает longjmp и выход из нескольких уровней сразу
+    for (unsigned i = prof->depth; i-- > 0;)
+        if (prof->frames[i].ret == target)
+        {
+            prof->depth = i;
+            return;
+        }
+}
+
+static uint64_t rz_profile_hash(const rz_address_t *key, unsigned length)
+{
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (unsigned i = 0; i < length; ++i)
+    {
+        h ^= key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool rz_profile_grow(rz_profile_p prof)
+{
+    size_t size = prof->table_size * 2;
+    rz_profile_stack_t *table = calloc(size, sizeof(rz_profile_stack_t));
+    if (!table)
+        return false;
+    for (size_t i = 0; i < prof->table_size; ++i)
+    {
+        const rz_profile_stack_t *s = &prof->table[i];
+        if (!s->count)
+            continue;
+        size_t at = s->hash & (size - 1);
+        while (table[at].count)
+            at = (at + 1) & (size - 1);
+        table[at] = *s;
+    }
+    free(prof->table);
+    prof->table = table;
+    prof->table_size = size;
+    return true;
+}
+
+// Выборка: стек корень → вызванные функции → функция с PC → сам PC
+static void rz_profile_sample(rz_profile_p prof, rz_address_t pc)
+{
+    rz_address_t key[RZ_PROFILE_DEPTH + 3];
+    unsigned n = 0;
+    key[n++] = prof->root;
+    for (unsigned i = 0; i < prof->depth; ++i)
+        key[n++] = prof->frames[i].func;
+    // Без символов функцией считается последний вызов; с ними видны и
+    // переходы без вызова (хвостовые вызовы)
+    const rz_symbol_t *sym = rz_symbol_find(prof->symbols, prof->symbol_count, pc);
+    if (sym && sym->addr != key[n - 1])
+        key[n++] = sym->addr;
+    if (prof->per_pc)
+        key[n++] = pc;
+
+    uint64_t hash = rz_profile_hash(key, n);
+    size_t mask = prof->table_size - 1;
+    size_t at = hash & mask;
+    for (; prof->table[at].count; at = (at + 1) & mask)
+    {
+        rz_profile_stack_t *s = &prof->table[at];
+        if (s->hash == hash && s->length == n &&
+            memcmp(prof->pool + s->offset, key, n * sizeof(rz_address_t)) == 0)
+        {
+            ++s->count;
+            return;
+        }
+    }
+
+    // Новый стек: таблица заполнена не больше чем наполовину, так что поиск
+    // выше всегда находит пустое место; не вышло вырасти — выборка теряется
+    if ((prof->table_used + 1) * 2 > prof->table_size)
+    {
+        if (!rz_profile_grow(prof))
+            return;
+        mask = prof->table_size - 1;
+        for (at = hash & mask; prof->table[at].count; at = (at + 1) & mask)
+            ;
+    }
+    if (prof->pool_used + n > prof->pool_size)
+    {
+        rz_address_t *pool = realloc(prof->pool, 2 * (prof->pool_size + n) * sizeof(rz_address_t));
+        if (!pool)
+            return; // выборка теряется, профиль остаётся корректным
+        prof->pool = pool;
+        prof->pool_size = 2 * (prof->pool_size + n);
+    }
+    memcpy(prof->pool + prof->pool_used, key, n * sizeof(rz_address_t));
+    prof->table[at] = (rz_profile_stack_t){hash, 1, prof->pool_used, n};
+    prof->pool_used += n;
+    ++prof->table_used;
+}
+
+rz_run_result_t rz_profile_run(rz_cpu_p pcpu, uint64_t budget, uint64_t timeout_ns)
+{
+    rz_profile_p prof = pcpu->profile;
+    rz_run_result_t total = {RZ_STOP_BUDGET, 0};
+    uint64_t deadline = rz_clock_ns() + timeout_ns, unchecked = 0;
+
+    while (total.retired < budget)
+    {
+        uint64_t slice = budget - total.retired;
+        if (slice > prof->period)
+            slice = prof->period;
+
+        rz_run_result_t part = rz_run(pcpu, slice);
+        total.retired += part.retired;
+        total.reason = part.reason;
+        if (part.reason != RZ_STOP_BUDGET)
+            break;
+        if (slice == prof->period)
+            rz_profile_sample(prof, pcpu->r_pc);
+
+        if (timeout_ns && (unchecked += slice) >= RZ_PROFILE_CHECK_TIME)
+        {
+            unchecked = 0;
+            if (rz_clock_ns() >= deadline)
+            {
+                total.reason = total.retired < budget ? RZ_STOP_DEADLINE : RZ_STOP_BUDGET;
+                break;
+            }
+        }
+    }
+    return total;
+}
+
+// Имя кадра: символ, символ+смещение или адрес; у кадра с PC смещение всегда
+static void rz_profile_name(rz_profile_p prof, rz_address_t addr, bool pc, char *buf, size_t size)
+{
+    const rz_symbol_t *sym = rz_symbol_find(prof->symbols, prof->symbol_count, addr);
+    if (!sym)
+        snprintf(buf, size, "0x%08X", addr);
+    else if (sym->addr == addr && !pc)
+        snprintf(buf, size, "%s", sym->name);
+    else
+        snprintf(buf, size, "%s+0x%X", sym->name, addr - sym->addr);
+}
+
+typedef struct
+{
+    char *text;
+    uint64_t count;
+} rz_profile_line_t;
+
+static int rz_profile_line_compare(const void *a, const void *b)
+{
+    return strcmp(((const rz_profile_line_t *)a)->text, ((const rz_profile_line_t *)b)->text);
+}
+
+bool rz_profile_write(rz_profile_p prof, const char *path)
+{
+    rz_profile_line_t *lines = malloc((prof->table_used ? prof->table_used : 1) * sizeof(rz_profile_line_t));
+    if (!lines)
+        return false;
+
+    // Стеки из разных адресов могут дать одинаковые имена — строки
+    // сортируются и сливаются
+    size_t n = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < prof->table_size; ++i)
+    {
+        const rz_profile_stack_t *s = &prof->table[i];
+        if (!s->count)
+            continue;
+        size_t cap = 64 * s->length, len = 0;
+        char *text = malloc(cap);
+        for (unsigned k = 0; text && k < s->length; ++k)
+        {
+            char name[256];
+            rz_profile_name(prof, prof->pool[s->offset + k], prof->per_pc && k + 1 == s->length, name,
+                            sizeof(name));
+            size_t add = strlen(name) + 1;
+            if (len + add > cap)
+            {
+                char *grown = realloc(text, cap = 2 * (len + add));
+                if (!grown)
+                    free(text);
+                text = grown;
+                if (!text)
+                    break;
+            }
+            memcpy(text + len, name, add);
+            len += add;
+            text[len - 1] = ';';
+        }
+        if (!text)
+        {
+            ok = false;
+            break;
+        }
+        text[len - 1] = '\0';
+        lines[n++] = (rz_profile_line_t){text, s->count};
+    }
+
+    FILE *out = NULL;
+    if (ok)
+    {
+        qsort(lines, n, sizeof(rz_profile_line_t), rz_profile_line_compare);
+        out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+        if (!out)
+        {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            ok = false;
+        }
+    }
+    for (size_t i = 0; ok && i < n;)
+    {
+        size_t j = i;
+        uint64_t count = 0;
+        for (; j < n && strcmp(lines[j].text, lines[i].text) == 0; ++j)
+            count += lines[j].count;
+        fprintf(out, "%s %llu\n", lines[i].text, (unsigned long long)count);
+        i = j;
+    }
+    if (out && out != stdout && fclose(out) != 0)
+        ok = false;
+    else if (out == stdout)
+        fflush(stdout);
+
+    for (size_t i = 0; i < n; ++i)
+        free(lines[i].text);
+    free(lines);
+    if (!ok)
+        fprintf(stderr, "%s: failed to write profile\n", path);
+    return ok;
+}
@@ -0,0 +1,100 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "loader.h"
+
+#define RZ_PROFILE_DEFAULT_PERIOD 10007u // prime, so that samples do not follow loop periods
+#define RZ_PROFILE_DEPTH 256u			 // call frames kept in shadow stack
+
+/**
+ * @brief Sampling profiler: call stacks of guest sampled every N retired instructions
+ *
+ */
+struct rz_profile_s;
+typedef struct rz_profile_s rz_profile_t, *rz_profile_p;
+
+/**
+ * @brief Check whether instruction is a call or return by the standard
+ * calling convention (link register ra or t0)
+ *
+ * @param d decoded instruction
+ * @return true for JAL/JALR writing ra or t0 and JALR x0 through them
+ */
+static inline bool rz_profile_is_linkage(const rz_decoded_t *d)
+{
+	if (d->op != RZ_OP_JAL && d->op != RZ_OP_JALR)
+		return false;
+	if (d->rd == 1 || d->rd == 5)
+		return true;
+	return d->op == RZ_OP_JALR && d->rd == 0 && (d->rs1 == 1 || d->rs1 == 5);
+}
+
+/**
+ * @brief Create profiler
+ *
+ * @param period retired instructions between samples, 1 counts every instruction exactly
+ * @param per_pc add sampled PC as the innermost frame
+ * @return rz_profile_p profiler or NULL when out of memory
+ */
+rz_profile_p rz_profile_create(uint64_t period, bool per_pc);
+
+/**
+ * @brief Set symbols used to name frames, without them frames are addresses
+ *
+ * @param prof profiler
+ * @param symbols symbols sorted by address, must live until output is written
+ * @param count number of symbols
+ */
+void rz_profile_set_symbols(rz_profile_p prof, const rz_symbol_t *symbols, size_t count);
+
+/**
+ * @brief Attach profiler to CPU, translated code is flushed
+ *
+ * Calls and returns are executed by the interpreter in every engine
+ * while profiler is attached, so that the shadow stack sees them.
+ *
+ * @param pcpu pointer to CPU instance
+ * @param prof profiler, NULL detaches
+ */
+void rz_profile_attach(rz_cpu_p pcpu, rz_profile_p prof);
+
+/**
+ * @brief Track call or return executed by CPU
+ *
+ * @param prof profiler
+ * @param d decoded JAL or JALR
+ * @param pc address of instruction
+ * @param target jump target
+ */
+void rz_profile_jump(rz_profile_p prof, const rz_decoded_t *d, rz_address_t pc, rz_address_t target);
+
+/**
+ * @brief Run CPU like rz_run_timed, taking a sample every period instructions
+ *
+ * @param pcpu pointer to CPU instance with attached profiler
+ * @param budget instructions to retire at most
+ * @param timeout_ns wall time limit, 0 for none
+ * @return rz_run_result_t why CPU stopped and instructions retired
+ */
+rz_run_result_t rz_profile_run(rz_cpu_p pcpu, uint64_t budget, uint64_t timeout_ns);
+
+/**
+ * @brief Write folded stacks ("main;f;g 42" per line) for flamegraph tools
+ *
+ * @param prof profiler
+ * @param path file name, "-" for stdout
+ * @return true on success
+ */
+bool rz_profile_write(rz_profile_p prof, const char *path);
+
+/**
+ * @brief Release profiler
+ *
+ * @param prof profiler, may be NULL
+ */
+void rz_profile_free(rz_profile_p prof);
+
+#endif // PROFILE_H__
@@ -0,0 +1,194 @@
+#include <stdlib.h> // strtoull
+#include <string.h> // memcpy, strncmp
+
+#include "region.h"
+#include "machine.h"
+#include "jit.h"
+#include "threaded.h"
+
+bool rz_region_parse(const char *text, rz_region_t *region)
+{
+    char *end;
+    if (strncmp(text, "pc:", 3) == 0)
+    {
+        region->start = RZ_REGION_AT_PC;
+        region->at = strtoull(text + 3, &end, 0);
+        return end != text + 3 && *end == '\0';
+    }
+    if (strcmp(text, "marker") == 0)
+    {
+        region->start = RZ_REGION_AT_MARKER;
+        region->at = RZ_REGION_ANY_MARKER;
+        return true;
+    }
+    if (strncmp(text, "marker:", 7) == 0)
+    {
+        region->start = RZ_REGION_AT_MARKER;
+        region->at = strtoull(text + 7, &end, 0);
+        return end != text + 7 && *end == '\0';
+    }
+    region->start = RZ_REGION_AT_INSTRET;
+    region->at = strtoull(text, &end, 0);
+    return end != text && *end == '\0';
+}
+
+// Участок исполнения с учётом общего срока
+static rz_run_result_t rz_region_exec(rz_cpu_p pcpu, uint64_t budget, uint64_t deadline)
+{
+    if (!deadline)
+        return rz_run(pcpu, budget);
+    uint64_t now = rz_clock_ns();
+    if (now >= deadline)
+        return (rz_run_result_t){RZ_STOP_DEADLINE, 0};
+    return rz_run_timed(pcpu, budget, deadline - now);
+}
+
+// Быстрый участок: движок быстрой перемотки без трассы и модели времени,
+// его счётчики и обращения к памяти отбрасываются. Останов по точке или метке,
+// которые ждёт перемотка, сообщается как есть
+static rz_run_result_t rz_region_fast(rz_cpu_p pcpu, const rz_region_t *region, uint64_t budget,
+                                      uint64_t deadline, rz_region_stats_t *stats)
+{
+    rz_counters_t counters;
+    uint64_t accesses[MEM_FETCH][MEM_SEGMENTS];
+    rz_cpu_get_counters(pcpu, &counters);
+    memcpy(accesses, pcpu->mem->accesses, sizeof(accesses));
+
+    struct rz_timing_s *timing = pcpu->timing;
+    pcpu->timing = NULL;
+    rz_trace_set_level(&pcpu->trace, RZ_TRACE_OFF);
+    rz_set_engine(pcpu, region->fast);
+    uint64_t start = rz_clock_ns();
+    rz_run_result_t result = rz_region_exec(pcpu, budget, deadline);
+    stats->fast_ns += rz_clock_ns() - start;
+    stats->fast += result.retired;
+
+    // Счёт блоков движков переносится в счётчики CPU, иначе он попал бы
+    // в окно при следующей свёртке, — затем счётчики восстанавливаются
+    rz_threaded_fold(pcpu->threaded);
+    rz_jit_fold(pcpu->jit);
+    pcpu->counters = counters;
+    memcpy(pcpu->mem->accesses, accesses, sizeof(accesses));
+    pcpu->timing = timing;
+    return result;
+}
+
+// Перемотка до первого окна; RZ_STOP_NONE — окно достигнуто
+static rz_run_result_t rz_region_seek(rz_cpu_p pcpu, const rz_region_t *region, uint64_t budget,
+                                      uint64_t deadline, rz_region_stats_t *stats)
+{
+    rz_run_result_t total = {RZ_STOP_BUDGET, 0};
+    rz_machine_p m = pcpu->machine;
+
+    switch (region->start)
+    {
+    case RZ_REGION_AT_INSTRET:
+        total = rz_region_fast(pcpu, region, region->at < budget ? region->at : budget, deadline, stats);
+        if (total.reason == RZ_STOP_BUDGET && total.retired == region->at)
+            total.reason = RZ_STOP_NONE;
+        break;
+    case RZ_REGION_AT_PC:
+        if (!rz_icache_set_breakpoint(&pcpu->icache, (rz_address_t)region->at))
+        {
+            fprintf(stderr, "Region start 0x%08llX is outside of text\n", (unsigned long long)region->at);
+            total.reason = RZ_STOP_INVALID;
+            break;
+        }
+        total = rz_region_fast(pcpu, region, budget, deadline, stats);
+        rz_icache_clear_breakpoint(&pcpu->icache);
+        if (total.reason == RZ_STOP_BREAKPOINT)
+            total.reason = RZ_STOP_NONE;
+        break;
+    case RZ_REGION_AT_MARKER:
+        // Метки с другим номером пропускаются
+        m->marker_stop = true;
+        while (total.retired < budget)
+        {
+            rz_run_result_t part = rz_region_fast(pcpu, region, budget - total.retired, deadline, stats);
+            total.retired += part.retired;
+            total.reason = part.reason;
+            if (part.reason != RZ_STOP_MARKER)
+                break;
+            if (region->at == RZ_REGION_ANY_MARKER || m->marker == (rz_register_t)region->at)
+            {
+                total.reason = RZ_STOP_NONE;
+                break;
+            }
+            total.reason = RZ_STOP_BUDGET;
+        }
+        m->marker_stop = false;
+        break;
+    }
+    return total;
+}
+
+// Окно подробного моделирования: интерпретатор с трассой
+static rz_run_result_t rz_region_window(rz_cpu_p pcpu, const rz_region_t *region, uint64_t budget,
+                                        uint64_t deadline, rz_region_stats_t *stats)
+{
+    uint64_t first = rz_cpu_instret(pcpu);
+    size_t head = pcpu->trace.head;
+    rz_trace_set_level(&pcpu->trace, region->trace_level);
+    rz_set_engine(pcpu, RZ_ENGINE_INTERP);
+    ++stats->windows;
+
+    uint64_t start = rz_clock_ns();
+    rz_run_result_t result = rz_region_exec(pcpu, budget, deadline);
+    stats->detailed_ns += rz_clock_ns() - start;
+    stats->detailed += result.retired;
+    rz_trace_set_level(&pcpu->trace, RZ_TRACE_OFF);
+
+    if (region->log)
+    {
+        fprintf(region->log, "Window %u: instructions %llu..%llu, PC=0x%08X\n", stats->windows,
+                (unsigned long long)first, (unsigned long long)(first + result.retired), pcpu->r_pc);
+        if (pcpu->trace.head != head)
+            rz_trace_dump(&pcpu->trace, region->log, pcpu->trace.head - head);
+    }
+    return result;
+}
+
+rz_run_result_t rz_region_run(rz_cpu_p pcpu, const rz_region_t *region, uint64_t budget, uint64_t timeout_ns,
+                              rz_region_stats_t *stats)
+{
+    rz_region_stats_t local;
+    if (!stats)
+        stats = &local;
+    *stats = (rz_region_stats_t){0};
+    uint64_t deadline = timeout_ns ? rz_clock_ns() + timeout_ns : 0;
+    uint64_t window = region->window ? region->window : RZ_REGION_DEFAULT_WINDOW;
+
+    rz_run_result_t total = rz_region_seek(pcpu, region, budget, deadline, stats);
+    while (total.reason == RZ_STOP_NONE && total.retired < budget)
+    {
+        uint64_t left = budget - total.retired;
+        rz_run_result_t part = rz_region_window(pcpu, region, window < left ? window : left, deadline, stats);
+        total.retired += part.retired;
+        total.reason = part.reason;
+        if (part.reason != RZ_STOP_BUDGET || total.retired == budget)
+            break;
+
+        // Следующее окно — через period инструкций от начала этого
+        if (region->period)
+        {
+            left = budget - total.retired;
+            uint64_t gap = region->period > part.retired ? region->period - part.retired : 0;
+            part = rz_region_fast(pcpu, region, gap < left ? gap : left, deadline, stats);
+            total.retired += part.retired;
+            total.reason = part.reason;
+            if (part.reason == RZ_STOP_BUDGET && part.retired == gap)
+                total.reason = RZ_STOP_NONE;
+        }
+    }
+
+    // После последнего окна — до конца быстрой перемоткой
+    if (total.reason == RZ_STOP_NONE)
+        total.reason = RZ_STOP_BUDGET;
+    if (total.reason == RZ_STOP_BUDGET && total.retired < budget)
+    {
+        rz_run_result_t part = rz_region_fast(pcpu, region, budget - total.retired, deadline, stats);
+        total.retired += part.retired;
+        total.reason = part.reason;
+    }
+    return total;
+}
@@ -0,0 +1,80 @@
+#ifndef __REGION_H__
+#define __REGION_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "cpu.h"
+
+#define RZ_REGION_ANY_MARKER UINT64_MAX	   // marker trigger matching every id
+#define RZ_REGION_DEFAULT_WINDOW 1000000u // detailed instructions per window
+
+/**
+ * @brief Where the first detailed window starts
+ *
+ */
+typedef enum rz_region_start_e : unsigned
+{
+	RZ_REGION_AT_INSTRET = 0, // after given number of instructions of the run
+	RZ_REGION_AT_PC,		  // when PC reaches address, before its instruction executes
+	RZ_REGION_AT_MARKER,	  // after marker environment call with given id
+} rz_region_start_t;
+
+/**
+ * @brief Two-speed run: fast-forward, then detailed windows
+ *
+ * Fast-forward runs on any engine with tracing off, and counters of
+ * its instructions are dropped. Windows run on the interpreter with
+ * trace level of the region, counters keep only their instructions;
+ * an attached timing model sees only instructions of windows.
+ * Windows after the first one start every period instructions
+ * whatever the trigger was; after the last window the run goes on
+ * fast-forward to the end of the budget.
+ */
+typedef struct rz_region_s
+{
+	rz_region_start_t start;
+	uint64_t at;		  // instruction count, PC or marker id (RZ_REGION_ANY_MARKER)
+	uint64_t window;	  // instructions simulated in detail per window
+	uint64_t period;	  // instructions from start of one window to the next, 0 for one window
+	rz_engine_t fast;	  // engine of fast-forward
+	unsigned trace_level; // trace level inside windows
+	FILE *log;			  // window boundaries and their traces, NULL for none
+} rz_region_t;
+
+/**
+ * @brief Where the time of a region run went
+ *
+ */
+typedef struct rz_region_stats_s
+{
+	unsigned windows;		  // windows started
+	uint64_t detailed, fast;  // instructions retired in each mode
+	uint64_t detailed_ns, fast_ns; // wall time of each mode
+} rz_region_stats_t;
+
+/**
+ * @brief Parse trigger: instruction count N, pc:ADDR, marker or marker:ID
+ *
+ * @param text trigger text
+ * @param region region whose start and at are set
+ * @return true if text is valid
+ */
+bool rz_region_parse(const char *text, rz_region_t *region);
+
+/**
+ * @brief Run CPU fast until the region, then in detail for its windows
+ *
+ * Breakpoint for the PC trigger needs the address inside the text
+ * region; the marker trigger needs guest to call RZ_ECALL_MARKER.
+ *
+ * @param pcpu pointer to CPU instance
+ * @param region region to simulate in detail
+ * @param budget instructions to retire at most
+ * @param timeout_ns wall time limit, 0 for none
+ * @param stats output statistics, may be NULL
+ * @return rz_run_result_t why CPU stopped and instructions retired
+ */
+rz_run_result_t rz_region_run(rz_cpu_p pcpu, const rz_region_t *region, uint64_t budget, uint64_t timeout_ns,
+							  rz_region_stats_t *stats);
+
+#endif // REGION_H__
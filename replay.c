@@ -0,0 +1,391 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcmp, strerror
+
+#include "replay.h"
+
+// Формат журнала: магия, затем события в порядке обращений гостя.
+// Событие — байт типа и его поля: числа — varint, знаковые — zigzag,
+// включая хэш вывода в конце, так что журнал не зависит от хоста
+#define RZ_REPLAY_MAGIC "RZREPLY\2"
+#define RZ_REPLAY_BUFFER (1u << 20)
+
+typedef enum rz_replay_event_e : uint8_t
+{
+    RZ_REPLAY_READ_INT = 1, // успех, значение
+    RZ_REPLAY_READ,         // дескриптор, результат, прочитанные байты
+    RZ_REPLAY_OPEN,         // результат
+    RZ_REPLAY_WRITE_FD,     // дескриптор, результат
+    RZ_REPLAY_CLOSE,        // дескриптор, результат
+    RZ_REPLAY_TIME,         // приращение времени
+    RZ_REPLAY_END,          // байт вывода, его хэш
+} rz_replay_event_t;
+
+static const char *const rz_replay_event_names[] = {
+    "?", "integer read", "read", "open", "file write", "close", "time read", "end of run",
+};
+
+struct rz_replay_s
+{
+    rz_machine_p m;
+    rz_io_t inner; // обработчики машины до записи или воспроизведения
+    FILE *log;
+    const char *path;
+    bool playing;
+    bool failed; // ошибка журнала или расхождение, дальше ввода нет
+    uint64_t events;
+    uint64_t output, hash; // байт вывода гостя и его FNV-1a
+    uint64_t time;         // предыдущее значение времени
+};
+
+static void rz_replay_hash(rz_replay_p r, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; ++i)
+    {
+        r->hash ^= p[i];
+        r->hash *= 1099511628211ULL;
+    }
+    r->output += len;
+}
+
+static void rz_replay_put(rz_replay_p r, uint64_t value)
+{
+    while (value >= 0x80u)
+    {
+        putc((int)(value & 0x7Fu) | 0x80, r->log);
+        value >>= 7;
+    }
+    putc((int)value, r->log);
+}
+
+static void rz_replay_put_signed(rz_replay_p r, int32_t value)
+{
+    rz_replay_put(r, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static bool rz_replay_get(rz_replay_p r, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int byte = getc(r->log);
+        if (byte == EOF)
+            return false;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool rz_replay_get_signed(rz_replay_p r, int32_t *value)
+{
+    uint64_t raw;
+    if (!rz_replay_get(r, &raw) || raw > UINT32_MAX)
+        return false;
+    *value = (int32_t)(((uint32_t)raw >> 1) ^ (0u - ((uint32_t)raw & 1u)));
+    return true;
+}
+
+// Расхождение или повреждение журнала сообщается один раз, дальше
+// гость получает только отказы
+static bool rz_replay_fail(rz_replay_p r, const char *what)
+{
+    if (!r->failed)
+        fprintf(stderr, "%s: replay diverged at event %llu: %s\n", r->path, (unsigned long long)r->events, what);
+    r->failed = true;
+    return false;
+}
+
+// Начало события воспроизведения: тип должен совпасть с запросом гостя
+static bool rz_replay_expect(rz_replay_p r, rz_replay_event_t event)
+{
+    if (r->failed)
+        return false;
+    ++r->events;
+    int type = getc(r->log);
+    if (type == (int)event)
+        return true;
+    char what[96];
+    if (type == EOF)
+        snprintf(what, sizeof(what), "guest asks for %s after the end of log", rz_replay_event_names[event]);
+    else if (type < RZ_REPLAY_READ_INT || type > RZ_REPLAY_END)
+        snprintf(what, sizeof(what), "damaged log");
+    else
+        snprintf(what, sizeof(what), "guest asks for %s, log has %s", rz_replay_event_names[event],
+                 rz_replay_event_names[type]);
+    return rz_replay_fail(r, what);
+}
+
+// Запись: вызов уходит прежним обработчикам, результат — в журнал
+
+static bool rz_record_read_int(void *ctx, int32_t *value)
+{
+    rz_replay_p r = ctx;
+    bool ok = r->inner.read_int(r->inner.ctx, value);
+    putc(RZ_REPLAY_READ_INT, r->log);
+    putc(ok, r->log);
+    if (ok)
+        rz_replay_put_signed(r, *value);
+    ++r->events;
+    return ok;
+}
+
+static void rz_record_write(void *ctx, const char *text, size_t len)
+{
+    rz_replay_p r = ctx;
+    rz_replay_hash(r, text, len);
+    r->inner.write(r->inner.ctx, text, len);
+}
+
+static int32_t rz_record_open(void *ctx, const char *path, unsigned mode)
+{
+    rz_replay_p r = ctx;
+    int32_t fd = r->inner.open ? r->inner.open(r->inner.ctx, path, mode) : -1;
+    putc(RZ_REPLAY_OPEN, r->log);
+    rz_replay_put_signed(r, fd);
+    ++r->events;
+    return fd;
+}
+
+static int32_t rz_record_read(void *ctx, int32_t fd, void *buf, size_t len)
+{
+    rz_replay_p r = ctx;
+    int32_t n = r->inner.read ? r->inner.read(r->inner.ctx, fd, buf, len) : -1;
+    putc(RZ_REPLAY_READ, r->log);
+    rz_replay_put_signed(r, fd);
+    rz_replay_put_signed(r, n);
+    if (n > 0)
+        fwrite(buf, 1, (size_t)n, r->log);
+    ++r->events;
+    return n;
+}
+
+static int32_t rz_record_write_fd(void *ctx, int32_t fd, const void *buf, size_t len)
+{
+    rz_replay_p r = ctx;
+    int32_t n = r->inner.write_fd ? r->inner.write_fd(r->inner.ctx, fd, buf, len) : -1;
+    putc(RZ_REPLAY_WRITE_FD, r->log);
+    rz_replay_put_signed(r, fd);
+    rz_replay_put_signed(r, n);
+    if (n > 0)
+        rz_replay_hash(r, buf, (size_t)n);
+    ++r->events;
+    return n;
+}
+
+static int32_t rz_record_close(void *ctx, int32_t fd)
+{
+    rz_replay_p r = ctx;
+    int32_t result = r->inner.close ? r->inner.close(r->inner.ctx, fd) : -1;
+    putc(RZ_REPLAY_CLOSE, r->log);
+    rz_replay_put_signed(r, fd);
+    rz_replay_put_signed(r, result);
+    ++r->events;
+    return result;
+}
+
+static uint64_t rz_record_time(void *ctx, uint64_t now)
+{
+    rz_replay_p r = ctx;
+    if (r->inner.time)
+        now = r->inner.time(r->inner.ctx, now);
+    putc(RZ_REPLAY_TIME, r->log);
+    rz_replay_put(r, now - r->time);
+    r->time = now;
+    ++r->events;
+    return now;
+}
+
+// Воспроизведение: результаты из журнала, вывод только хэшируется
+
+static bool rz_play_read_int(void *ctx, int32_t *value)
+{
+    rz_replay_p r = ctx;
+    if (!rz_replay_expect(r, RZ_REPLAY_READ_INT))
+        return false;
+    int ok = getc(r->log);
+    if (ok == 1 && rz_replay_get_signed(r, value))
+        return true;
+    if (ok != 0)
+        rz_replay_fail(r, "damaged log");
+    return false;
+}
+
+static void rz_play_write(void *ctx, const char *text, size_t len)
+{
+    rz_replay_hash(ctx, text, len);
+}
+
+// Дескриптор и результат вызова с файлом; дескриптор должен совпасть
+static bool rz_play_result(rz_replay_p r, rz_replay_event_t event, int32_t fd, int32_t *result)
+{
+    int32_t logged;
+    if (!rz_replay_expect(r, event))
+        return false;
+    if (event != RZ_REPLAY_OPEN && (!rz_replay_get_signed(r, &logged) || logged != fd))
+        return rz_replay_fail(r, "guest uses another descriptor");
+    if (!rz_replay_get_signed(r, result))
+        return rz_replay_fail(r, "damaged log");
+    return true;
+}
+
+static int32_t rz_play_open(void *ctx, const char *path, unsigned mode)
+{
+    (void)path;
+    (void)mode;
+    int32_t fd;
+    return rz_play_result(ctx, RZ_REPLAY_OPEN, 0, &fd) ? fd : -1;
+}
+
+static int32_t rz_play_read(void *ctx, int32_t fd, void *buf, size_t len)
+{
+    rz_replay_p r = ctx;
+    int32_t n;
+    if (!rz_play_result(r, RZ_REPLAY_READ, fd, &n))
+        return -1;
+    if (n > 0 && (size_t)n > len)
+    {
+        rz_replay_fail(r, "guest reads into a smaller buffer");
+        return -1;
+    }
+    if (n > 0 && fread(buf, 1, (size_t)n, r->log) != (size_t)n)
+    {
+        rz_replay_fail(r, "damaged log");
+        return -1;
+    }
+    return n;
+}
+
+static int32_t rz_play_write_fd(void *ctx, int32_t fd, const void *buf, size_t len)
+{
+    rz_replay_p r = ctx;
+    int32_t n;
+    if (!rz_play_result(r, RZ_REPLAY_WRITE_FD, fd, &n))
+        return -1;
+    if (n > 0 && (size_t)n > len)
+    {
+        rz_replay_fail(r, "guest writes a shorter buffer");
+        return -1;
+    }
+    if (n > 0)
+        rz_replay_hash(r, buf, (size_t)n);
+    return n;
+}
+
+static int32_t rz_play_close(void *ctx, int32_t fd)
+{
+    int32_t result;
+    return rz_play_result(ctx, RZ_REPLAY_CLOSE, fd, &result) ? result : -1;
+}
+
+static uint64_t rz_play_time(void *ctx, uint64_t now)
+{
+    rz_replay_p r = ctx;
+    uint64_t delta;
+    if (!rz_replay_expect(r, RZ_REPLAY_TIME))
+        return now;
+    if (!rz_replay_get(r, &delta))
+    {
+        rz_replay_fail(r, "damaged log");
+        return now;
+    }
+    return r->time += delta;
+}
+
+static rz_replay_p rz_replay_open(rz_machine_p m, const char *path, bool playing)
+{
+    rz_replay_p r = calloc(1, sizeof(rz_replay_t));
+    if (!r)
+        return NULL;
+    r->m = m;
+    r->inner = m->io;
+    r->path = path;
+    r->playing = playing;
+    r->hash = 14695981039346656037ULL;
+    if (!(r->log = fopen(path, playing ? "rb" : "wb")))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(r);
+        return NULL;
+    }
+    setvbuf(r->log, NULL, _IOFBF, RZ_REPLAY_BUFFER);
+    return r;
+}
+
+rz_replay_p rz_replay_record(rz_machine_p m, const char *path)
+{
+    rz_replay_p r = rz_replay_open(m, path, false);
+    if (!r)
+        return NULL;
+    fwrite(RZ_REPLAY_MAGIC, 1, 8, r->log);
+    m->io = (rz_io_t){r, rz_record_read_int, rz_record_write, rz_record_open, rz_record_read,
+                      rz_record_write_fd, rz_record_close, rz_record_time};
+    return r;
+}
+
+rz_replay_p rz_replay_play(rz_machine_p m, const char *path)
+{
+    rz_replay_p r = rz_replay_open(m, path, true);
+    if (!r)
+        return NULL;
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), r->log) != sizeof(magic) || memcmp(magic, RZ_REPLAY_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a RISC-Z input log\n", path);
+        fclose(r->log);
+        free(r);
+        return NULL;
+    }
+    m->io = (rz_io_t){r, rz_play_read_int, rz_play_write, rz_play_open, rz_play_read,
+                      rz_play_write_fd, rz_play_close, rz_play_time};
+    return r;
+}
+
+bool rz_replay_finish(rz_replay_p r)
+{
+    if (!r)
+        return true;
+    r->m->io = r->inner;
+    bool ok = true;
+    if (!r->playing)
+    {
+        putc(RZ_REPLAY_END, r->log);
+        rz_replay_put(r, r->output);
+        rz_replay_put(r, r->hash);
+        if (ferror(r->log))
+            ok = false;
+        if (fclose(r->log) != 0)
+            ok = false;
+        if (ok)
+            fprintf(stderr, "Recorded %llu input events, %llu bytes of output\n", (unsigned long long)r->events,
+                    (unsigned long long)r->output);
+        else
+            fprintf(stderr, "%s: failed to write input log\n", r->path);
+        free(r);
+        return ok;
+    }
+
+    // Гость должен дойти до конца журнала с тем же выводом
+    uint64_t output, hash;
+    uint64_t events = r->events;
+    if (rz_replay_expect(r, RZ_REPLAY_END))
+    {
+        if (!rz_replay_get(r, &output) || !rz_replay_get(r, &hash))
+            rz_replay_fail(r, "damaged log");
+        else if (output != r->output || hash != r->hash)
+            rz_replay_fail(r, "output differs from the recorded run");
+    }
+    ok = !r->failed;
+    if (ok)
+        fprintf(stderr, "Replayed %llu input events, output matches (%llu bytes)\n", (unsigned long long)events,
+                (unsigned long long)r->output);
+    fclose(r->log);
+    free(r);
+    return ok;
+}
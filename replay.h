@@ -0,0 +1,53 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdbool.h>
+#include "machine.h"
+
+/**
+ * @brief Recorder or player of guest input
+ *
+ * Recording wraps I/O handlers of a machine and logs every result the
+ * guest can observe: integers and bytes read, results of open, write
+ * and close on host files, values of the time CSR. Output is passed
+ * through and only its length and hash are logged. Playing replaces
+ * the handlers: results come from the log, host files and stdio are
+ * not touched and output is discarded after hashing.
+ */
+struct rz_replay_s;
+typedef struct rz_replay_s rz_replay_t, *rz_replay_p;
+
+/**
+ * @brief Start logging input of machine
+ *
+ * @param m machine, its current handlers keep serving the guest
+ * @param path log file
+ * @return rz_replay_p recorder or NULL, error is printed
+ */
+rz_replay_p rz_replay_record(rz_machine_p m, const char *path);
+
+/**
+ * @brief Feed machine with input of a log
+ *
+ * When the guest asks for other input than the log holds next, the
+ * call fails like end of input and the divergence is reported by
+ * rz_replay_finish.
+ *
+ * @param m machine, its handlers are replaced
+ * @param path log file
+ * @return rz_replay_p player or NULL, error is printed
+ */
+rz_replay_p rz_replay_play(rz_machine_p m, const char *path);
+
+/**
+ * @brief Finish recording or check replay, restore handlers and release
+ *
+ * Recording writes length and hash of output. Replay succeeds when
+ * the guest consumed the whole log and wrote the same output.
+ *
+ * @param r recorder or player, may be NULL
+ * @return true if log was written or replay matched, result is printed
+ */
+bool rz_replay_finish(rz_replay_p r);
+
+#endif // REPLAY_H__
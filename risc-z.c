@@ -0,0 +1,227 @@
+#include <assert.h> // static_assert
+#include <stdlib.h> // calloc, free
+#include <string.h> // memcpy
+
+#include "risc-z.h"
+#include "machine.h"
+#include "loader.h"
+
+// Открытый API поверх машины: значения перечислений закреплены в risc-z.h
+// и совпадают с внутренними, поэтому переводятся приведением
+
+static_assert(RZ_VM_STOP_BUDGET == (int)RZ_STOP_BUDGET && RZ_VM_STOP_EBREAK == (int)RZ_STOP_EBREAK &&
+                  RZ_VM_STOP_EXIT == (int)RZ_STOP_EXIT && RZ_VM_STOP_INVALID == (int)RZ_STOP_INVALID &&
+                  RZ_VM_STOP_ECALL_ERROR == (int)RZ_STOP_ECALL_ERROR &&
+                  RZ_VM_STOP_INPUT_ERROR == (int)RZ_STOP_INPUT_ERROR &&
+                  RZ_VM_STOP_MEMORY_FAULT == (int)RZ_STOP_MEMORY_FAULT && RZ_VM_STOP_MARKER == (int)RZ_STOP_MARKER,
+              "stop reasons of the API");
+static_assert(RZ_VM_IMAGE_RAW == (int)RZ_IMAGE_RAW && RZ_VM_IMAGE_HEX == (int)RZ_IMAGE_HEX &&
+                  RZ_VM_IMAGE_ELF == (int)RZ_IMAGE_ELF,
+              "image formats of the API");
+static_assert(RZ_VM_ENGINE_THREADED == (int)RZ_ENGINE_THREADED && RZ_VM_ENGINE_JIT == (int)RZ_ENGINE_JIT,
+              "engines of the API");
+static_assert(RZ_VM_ABI_VENUS == (int)RZ_ECALL_ABI_VENUS, "ecall conventions of the API");
+static_assert(RZ_VM_ECALL_DONE == (int)RZ_ECALL_HOOK_DONE && RZ_VM_ECALL_FAIL == (int)RZ_ECALL_HOOK_FAIL,
+              "ecall results of the API");
+
+struct rz_vm_s
+{
+    rz_machine_p m;
+    rz_image_t img; // страницы только для чтения указывают в копию образа
+    rz_vm_output_fn output;
+    void *output_ctx;
+    rz_vm_input_fn input;
+    void *input_ctx;
+    rz_vm_ecall_fn ecall;
+    void *ecall_ctx;
+};
+
+static bool rz_vm_read_int(void *ctx, int32_t *value)
+{
+    rz_vm_t *vm = ctx;
+    return vm->input && vm->input(vm->input_ctx, value);
+}
+
+static void rz_vm_write_out(void *ctx, const char *text, size_t len)
+{
+    rz_vm_t *vm = ctx;
+    if (vm->output)
+        vm->output(vm->output_ctx, text, len);
+}
+
+static rz_ecall_hook_result_t rz_vm_ecall_hook(void *ctx, rz_machine_p m, rz_register_t number)
+{
+    (void)m;
+    rz_vm_t *vm = ctx;
+    return (rz_ecall_hook_result_t)vm->ecall(vm->ecall_ctx, vm, number);
+}
+
+unsigned rz_api_version(void)
+{
+    return RZ_API_VERSION;
+}
+
+rz_vm_t *rz_vm_create(void)
+{
+    rz_vm_t *vm = calloc(1, sizeof(*vm));
+    if (!vm)
+        return NULL;
+    if (!(vm->m = rz_machine_create(0)))
+    {
+        free(vm);
+        return NULL;
+    }
+    // Файлы хоста встраивающей программе не открываются: обработчиков нет
+    rz_machine_set_io(vm->m, &(rz_io_t){.ctx = vm, .read_int = rz_vm_read_int, .write = rz_vm_write_out});
+    return vm;
+}
+
+void rz_vm_free(rz_vm_t *vm)
+{
+    if (!vm)
+        return;
+    rz_machine_free(vm->m);
+    rz_image_close(&vm->img);
+    free(vm);
+}
+
+// При ошибке отображения копия образа остаётся до rz_vm_free: на неё
+// могут указывать уже отображённые страницы
+bool rz_vm_load(rz_vm_t *vm, const void *image, size_t size, rz_vm_image_t format)
+{
+    if (vm->img.map || !rz_image_open_memory(&vm->img, image, size, (rz_image_format_t)format))
+        return false;
+    rz_cpu_p pcpu = vm->m->cpu;
+    if (!rz_image_map(&vm->img, &vm->m->mem) || !rz_cpu_set_text(pcpu, vm->img.text_base, vm->img.text_size))
+        return false;
+    pcpu->r_pc = vm->img.entry;
+    vm->m->brk = vm->img.heap_base;
+    return true;
+}
+
+rz_vm_stop_t rz_vm_run(rz_vm_t *vm, uint64_t budget, uint64_t *retired)
+{
+    rz_run_result_t result = rz_run(vm->m->cpu, budget);
+    if (retired)
+        *retired = result.retired;
+    return (rz_vm_stop_t)result.reason;
+}
+
+const char *rz_vm_stop_name(rz_vm_stop_t reason)
+{
+    return rz_stop_name((rz_stop_t)reason);
+}
+
+int32_t rz_vm_exit_code(const rz_vm_t *vm)
+{
+    return vm->m->cpu->exit_code;
+}
+
+uint64_t rz_vm_instret(const rz_vm_t *vm)
+{
+    return rz_cpu_instret(vm->m->cpu);
+}
+
+uint32_t rz_vm_get_reg(const rz_vm_t *vm, unsigned index)
+{
+    return index && index < 32 ? vm->m->cpu->r_x[index] : 0u;
+}
+
+void rz_vm_set_reg(rz_vm_t *vm, unsigned index, uint32_t value)
+{
+    if (index && index < 32)
+        vm->m->cpu->r_x[index] = value;
+}
+
+uint32_t rz_vm_get_pc(const rz_vm_t *vm)
+{
+    return vm->m->cpu->r_pc;
+}
+
+void rz_vm_set_pc(rz_vm_t *vm, uint32_t pc)
+{
+    vm->m->cpu->r_pc = pc;
+}
+
+// Копирование по страницам: память региона непрерывна, но регионы — нет.
+// Сначала проверяется весь диапазон, чтобы запись не оборвалась на середине
+static bool rz_vm_copy(rz_vm_t *vm, uint32_t addr, uint8_t *out, const uint8_t *in, size_t len)
+{
+    if (len > (1ULL << 32) - addr)
+        return false;
+    for (uint64_t page = addr & ~(uint64_t)MEM_PAGE_MASK; page < (uint64_t)addr + len; page += MEM_PAGE_SIZE)
+        if (!mem_access(&vm->m->mem, (rz_address_t)page))
+            return false;
+    while (len)
+    {
+        size_t chunk = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (chunk > len)
+            chunk = len;
+        uint8_t *host = mem_access(&vm->m->mem, addr);
+        if (out)
+        {
+            memcpy(out, host, chunk);
+            out += chunk;
+        }
+        else
+        {
+            memcpy(host, in, chunk);
+            in += chunk;
+        }
+        addr += (rz_address_t)chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool rz_vm_read(rz_vm_t *vm, uint32_t addr, void *buf, size_t len)
+{
+    return rz_vm_copy(vm, addr, buf, NULL, len);
+}
+
+bool rz_vm_write(rz_vm_t *vm, uint32_t addr, const void *buf, size_t len)
+{
+    if (!rz_vm_copy(vm, addr, NULL, buf, len))
+        return false;
+    // Пересечение с текстом сбрасывает кэш инструкций и построенные на нём движки
+    rz_icache_p ic = &vm->m->cpu->icache;
+    uint64_t text_end = (uint64_t)ic->base + ic->count * RZ_INSN_ALIGN;
+    if (len && addr < text_end && (uint64_t)addr + len > ic->base)
+        rz_icache_flush(ic);
+    return true;
+}
+
+void rz_vm_set_engine(rz_vm_t *vm, rz_vm_engine_t engine)
+{
+    rz_set_engine(vm->m->cpu, (rz_engine_t)engine);
+}
+
+void rz_vm_set_abi(rz_vm_t *vm, rz_vm_abi_t abi)
+{
+    vm->m->ecall_abi = (rz_ecall_abi_t)abi;
+}
+
+void rz_vm_set_marker_stop(rz_vm_t *vm, bool stop)
+{
+    vm->m->marker_stop = stop;
+}
+
+void rz_vm_set_output(rz_vm_t *vm, rz_vm_output_fn fn, void *ctx)
+{
+    vm->output = fn;
+    vm->output_ctx = ctx;
+}
+
+void rz_vm_set_input(rz_vm_t *vm, rz_vm_input_fn fn, void *ctx)
+{
+    vm->input = fn;
+    vm->input_ctx = ctx;
+}
+
+void rz_vm_set_ecall(rz_vm_t *vm, rz_vm_ecall_fn fn, void *ctx)
+{
+    vm->ecall = fn;
+    vm->ecall_ctx = ctx;
+    vm->m->ecall_hook = fn ? rz_vm_ecall_hook : NULL;
+    vm->m->ecall_ctx = vm;
+}
@@ -0,0 +1,319 @@
+#ifndef __RISC_Z_H__
+#define __RISC_Z_H__
+
+/*
+ * Embedding API of RISC-Z: a guest machine in the host process.
+ *
+ *     rz_vm_t *vm = rz_vm_create();
+ *     rz_vm_set_output(vm, on_output, ctx);
+ *     if (rz_vm_load(vm, image, image_size, RZ_VM_IMAGE_AUTO))
+ *         reason = rz_vm_run(vm, budget, &retired);
+ *     rz_vm_free(vm);
+ *
+ * Only this header is public. It is plain C99 usable from C++, types
+ * are opaque and enum values are fixed, so programs built against
+ * RZ_API_VERSION keep working with later libraries of the same version.
+ * Errors of loading are also printed to stderr.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(RZ_API_EXPORT)
+#define RZ_API __declspec(dllexport)
+#elif defined(RZ_API_SHARED)
+#define RZ_API __declspec(dllimport)
+#else
+#define RZ_API
+#endif
+#elif defined(__GNUC__)
+#define RZ_API __attribute__((visibility("default")))
+#else
+#define RZ_API
+#endif
+
+#define RZ_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/**
+	 * @brief Guest machine: CPU, memory, loaded image and callbacks
+	 *
+	 */
+	typedef struct rz_vm_s rz_vm_t;
+
+	/**
+	 * @brief Why rz_vm_run returned
+	 *
+	 */
+	typedef enum rz_vm_stop_e
+	{
+		RZ_VM_STOP_NONE = 0,		 // not stopped
+		RZ_VM_STOP_BUDGET = 1,		 // instruction budget is exhausted
+		RZ_VM_STOP_EBREAK = 3,		 // EBREAK instruction
+		RZ_VM_STOP_EXIT = 4,		 // exit environment call, see rz_vm_exit_code
+		RZ_VM_STOP_INVALID = 5,		 // invalid instruction
+		RZ_VM_STOP_ECALL_ERROR = 6,	 // unknown environment call or callback failed
+		RZ_VM_STOP_INPUT_ERROR = 7,	 // input callback had no integer
+		RZ_VM_STOP_MEMORY_FAULT = 8, // fetch, load or store faulted
+		RZ_VM_STOP_MARKER = 10,		 // marker environment call (ecall 256) with stop on markers
+	} rz_vm_stop_t;
+
+	/**
+	 * @brief Formats of program images
+	 *
+	 */
+	typedef enum rz_vm_image_e
+	{
+		RZ_VM_IMAGE_AUTO = 0, // ELF by magic, otherwise raw
+		RZ_VM_IMAGE_RAW = 1,  // flat binary loaded at address 0
+		RZ_VM_IMAGE_HEX = 2,  // one 32-bit hexadecimal word per line (Venus dump)
+		RZ_VM_IMAGE_ELF = 3,  // ELF32 RISC-V executable
+	} rz_vm_image_t;
+
+	/**
+	 * @brief Execution engines, all of them give the same results
+	 *
+	 */
+	typedef enum rz_vm_engine_e
+	{
+		RZ_VM_ENGINE_INTERP = 0,   // predecoding interpreter
+		RZ_VM_ENGINE_THREADED = 1, // threaded code with chained basic blocks
+		RZ_VM_ENGINE_JIT = 2,	   // native translation of hot blocks, interpreter on other hosts
+	} rz_vm_engine_t;
+
+	/**
+	 * @brief Register conventions of environment calls
+	 *
+	 */
+	typedef enum rz_vm_abi_e
+	{
+		RZ_VM_ABI_RISCZ = 0, // number in a7, arguments from a0
+		RZ_VM_ABI_VENUS = 1, // number in a0, arguments from a1
+	} rz_vm_abi_t;
+
+	/**
+	 * @brief Result of environment call callback
+	 *
+	 */
+	typedef enum rz_vm_ecall_e
+	{
+		RZ_VM_ECALL_DEFAULT = 0, // not handled, built-in call runs
+		RZ_VM_ECALL_DONE = 1,	 // handled, execution goes on
+		RZ_VM_ECALL_FAIL = 2,	 // failed, run stops with RZ_VM_STOP_ECALL_ERROR
+	} rz_vm_ecall_t;
+
+	/**
+	 * @brief Guest output of print and write-to-stdout calls
+	 *
+	 */
+	typedef void (*rz_vm_output_fn)(void *ctx, const char *text, size_t len);
+
+	/**
+	 * @brief Guest request for an integer, false on end of input
+	 *
+	 */
+	typedef bool (*rz_vm_input_fn)(void *ctx, int32_t *value);
+
+	/**
+	 * @brief Environment call, before the built-in one
+	 *
+	 * Arguments and results are in guest registers, see rz_vm_get_reg
+	 * and rz_vm_set_reg. PC moves past ECALL afterwards.
+	 */
+	typedef rz_vm_ecall_t (*rz_vm_ecall_fn)(void *ctx, rz_vm_t *vm, uint32_t number);
+
+	/**
+	 * @brief Get version of the library API
+	 *
+	 * @return unsigned RZ_API_VERSION the library was built with
+	 */
+	RZ_API unsigned rz_api_version(void);
+
+	/**
+	 * @brief Create machine with default memory layout
+	 *
+	 * Without callbacks output is discarded, integer input is at its
+	 * end and host files are not accessible.
+	 *
+	 * @return rz_vm_t* machine or NULL when out of memory
+	 */
+	RZ_API rz_vm_t *rz_vm_create(void);
+
+	/**
+	 * @brief Release machine with its memory and image
+	 *
+	 * @param vm machine, may be NULL
+	 */
+	RZ_API void rz_vm_free(rz_vm_t *vm);
+
+	/**
+	 * @brief Load program image from memory, once per machine
+	 *
+	 * Contents are copied, PC is set to the entry point.
+	 *
+	 * @param vm machine
+	 * @param image image contents
+	 * @param size size of contents in bytes
+	 * @param format image format
+	 * @return true on success, on failure the machine may only be freed
+	 */
+	RZ_API bool rz_vm_load(rz_vm_t *vm, const void *image, size_t size, rz_vm_image_t format);
+
+	/**
+	 * @brief Execute instructions until budget is exhausted or machine stops
+	 *
+	 * May be called again to go on after RZ_VM_STOP_BUDGET or
+	 * RZ_VM_STOP_MARKER.
+	 *
+	 * @param vm machine
+	 * @param budget maximum number of instructions to retire
+	 * @param retired output number of retired instructions, may be NULL
+	 * @return rz_vm_stop_t stop reason
+	 */
+	RZ_API rz_vm_stop_t rz_vm_run(rz_vm_t *vm, uint64_t budget, uint64_t *retired);
+
+	/**
+	 * @brief Get description of stop reason
+	 *
+	 * @param reason stop reason
+	 * @return const char* description
+	 */
+	RZ_API const char *rz_vm_stop_name(rz_vm_stop_t reason);
+
+	/**
+	 * @brief Get exit code after RZ_VM_STOP_EXIT
+	 *
+	 * @param vm machine
+	 * @return int32_t exit code
+	 */
+	RZ_API int32_t rz_vm_exit_code(const rz_vm_t *vm);
+
+	/**
+	 * @brief Get number of instructions retired since creation
+	 *
+	 * @param vm machine
+	 * @return uint64_t retired instructions
+	 */
+	RZ_API uint64_t rz_vm_instret(const rz_vm_t *vm);
+
+	/**
+	 * @brief Read guest register
+	 *
+	 * @param vm machine
+	 * @param index register x0..x31
+	 * @return uint32_t value, 0 for x0 and bad index
+	 */
+	RZ_API uint32_t rz_vm_get_reg(const rz_vm_t *vm, unsigned index);
+
+	/**
+	 * @brief Write guest register, x0 and bad index are ignored
+	 *
+	 * @param vm machine
+	 * @param index register x0..x31
+	 * @param value new value
+	 */
+	RZ_API void rz_vm_set_reg(rz_vm_t *vm, unsigned index, uint32_t value);
+
+	/**
+	 * @brief Read program counter
+	 *
+	 * @param vm machine
+	 * @return uint32_t address of the next instruction
+	 */
+	RZ_API uint32_t rz_vm_get_pc(const rz_vm_t *vm);
+
+	/**
+	 * @brief Write program counter, not from the ecall callback
+	 *
+	 * @param vm machine
+	 * @param pc address of the next instruction
+	 */
+	RZ_API void rz_vm_set_pc(rz_vm_t *vm, uint32_t pc);
+
+	/**
+	 * @brief Copy bytes out of guest memory, ignoring page permissions
+	 *
+	 * @param vm machine
+	 * @param addr guest address
+	 * @param buf output buffer
+	 * @param len number of bytes
+	 * @return true if the whole range is mapped
+	 */
+	RZ_API bool rz_vm_read(rz_vm_t *vm, uint32_t addr, void *buf, size_t len);
+
+	/**
+	 * @brief Copy bytes into guest memory, ignoring page permissions
+	 *
+	 * Decoded instructions of the range are dropped, so code may be
+	 * patched between runs.
+	 *
+	 * @param vm machine
+	 * @param addr guest address
+	 * @param buf bytes to write
+	 * @param len number of bytes
+	 * @return true if the whole range is mapped, otherwise nothing is written
+	 */
+	RZ_API bool rz_vm_write(rz_vm_t *vm, uint32_t addr, const void *buf, size_t len);
+
+	/**
+	 * @brief Choose execution engine for the next runs
+	 *
+	 * @param vm machine
+	 * @param engine engine
+	 */
+	RZ_API void rz_vm_set_engine(rz_vm_t *vm, rz_vm_engine_t engine);
+
+	/**
+	 * @brief Choose register conventions of environment calls
+	 *
+	 * @param vm machine
+	 * @param abi conventions
+	 */
+	RZ_API void rz_vm_set_abi(rz_vm_t *vm, rz_vm_abi_t abi);
+
+	/**
+	 * @brief Stop runs after each marker environment call (ecall 256)
+	 *
+	 * @param vm machine
+	 * @param stop true to return RZ_VM_STOP_MARKER, argument is in a0
+	 */
+	RZ_API void rz_vm_set_marker_stop(rz_vm_t *vm, bool stop);
+
+	/**
+	 * @brief Install output callback
+	 *
+	 * @param vm machine
+	 * @param fn callback or NULL to discard output
+	 * @param ctx passed to callback
+	 */
+	RZ_API void rz_vm_set_output(rz_vm_t *vm, rz_vm_output_fn fn, void *ctx);
+
+	/**
+	 * @brief Install integer input callback
+	 *
+	 * @param vm machine
+	 * @param fn callback or NULL for no input
+	 * @param ctx passed to callback
+	 */
+	RZ_API void rz_vm_set_input(rz_vm_t *vm, rz_vm_input_fn fn, void *ctx);
+
+	/**
+	 * @brief Install environment call callback
+	 *
+	 * @param vm machine
+	 * @param fn callback or NULL for built-in calls only
+	 * @param ctx passed to callback
+	 */
+	RZ_API void rz_vm_set_ecall(rz_vm_t *vm, rz_vm_ecall_fn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RISC_Z_H__
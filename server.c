@@ -0,0 +1,906 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc, realloc, free, strtol, qsort
+#include <string.h> // memcpy, memchr, memmove
+#include <threads.h>
+
+#include "server.h"
+#include "farm.h"
+#include "jit.h"
+#include "snapshot.h"
+
+#if defined(_WIN32)
+
+bool rz_server_run(const rz_server_config_t *cfg)
+{
+    (void)cfg;
+    fprintf(stderr, "Server mode needs Unix domain sockets\n");
+    return false;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define RZ_SERVER_LINE_MAX (1u << 20) // request line, enough for RZ_SERVER_INPUT_MAX integers
+#define RZ_SERVER_RECV_CHUNK 65536u
+#define RZ_SERVER_BUFFER_MAX (RZ_SERVER_IMAGE_SIZE_MAX + 2 * RZ_SERVER_LINE_MAX) // образ и строки вокруг
+#define RZ_SERVER_SEND_TIMEOUT 10     // seconds a reply may wait for a slow client
+
+// Образ в кэше: снимок сразу после загрузки и простаивающие машины,
+// ответвлённые от него копированием при записи
+typedef struct
+{
+    uint64_t id; // FNV-1a формата и содержимого
+    rz_snapshot_p snap;
+    rz_machine_p *idle; // стек под замком сервера
+    unsigned idle_count;
+} rz_server_image_t;
+
+// Задание RUN: ввод и результат как в пакетном режиме плюс задержки;
+// у задания LOAD только образ в начале буфера клиента
+typedef struct
+{
+    bool load; // LOAD, ответ — идентификатор образа
+    rz_server_image_t *image;
+    uint64_t budget;
+    rz_farm_job_t io;
+    uint64_t loads, stores, taken;
+    uint64_t queued_ns, started_ns, done_ns;
+    bool failed; // машину не удалось создать
+    bool sent;   // ответ отправлен целиком
+} rz_server_job_t;
+
+typedef struct rz_server_client_s rz_server_client_t;
+
+struct rz_server_client_s
+{
+    int fd;
+    char *buf; // принятые и ещё не разобранные байты
+    size_t len, cap;
+    size_t load_size; // LOAD ждёт столько байтов образа или разбирает их, 0 — ждёт строку запроса
+    rz_image_format_t load_format;
+    bool busy;   // задание у исполнителей, сокет не опрашивается
+    bool closed; // клиент ушёл или ответ не отправился
+    rz_server_job_t job;
+    rz_server_client_t *next; // в очереди заданий или в списке выполненных
+};
+
+typedef struct
+{
+    const rz_server_config_t *cfg;
+    unsigned pool;
+    mtx_t lock;
+    cnd_t wake; // новое задание или остановка
+    rz_server_client_t *queue_head, *queue_tail;
+    rz_server_client_t *done; // выполнены, ждут основной поток
+    bool stop;
+    uint64_t jobs;
+    uint32_t *queue_us, *run_us; // кольца последних RZ_SERVER_SAMPLES заданий
+    rz_server_image_t images[RZ_SERVER_IMAGES_MAX]; // добавляются под замком, не удаляются до остановки
+    unsigned image_count;                            // под замком
+    rz_server_client_t **clients; // только основной поток
+    unsigned client_count;
+} rz_server_t;
+
+// Исполнители и обработчик сигнала будят основной поток байтом в канал
+static int rz_server_notify[2] = {-1, -1};
+static volatile sig_atomic_t rz_server_stopping;
+
+static void rz_server_on_signal(int sig)
+{
+    (void)sig;
+    int saved = errno;
+    rz_server_stopping = 1;
+    if (write(rz_server_notify[1], "", 1) < 0)
+        (void)0; // канал полон: основной поток и так проснётся
+    errno = saved;
+}
+
+static void rz_server_wakeup(void)
+{
+    if (write(rz_server_notify[1], "", 1) < 0)
+        (void)0;
+}
+
+static const char *const rz_server_stops[] = {
+    [RZ_STOP_NONE] = "none",
+    [RZ_STOP_BUDGET] = "budget",
+    [RZ_STOP_DEADLINE] = "deadline",
+    [RZ_STOP_EBREAK] = "ebreak",
+    [RZ_STOP_EXIT] = "exit",
+    [RZ_STOP_INVALID] = "invalid",
+    [RZ_STOP_ECALL_ERROR] = "ecall-error",
+    [RZ_STOP_INPUT_ERROR] = "input-error",
+    [RZ_STOP_MEMORY_FAULT] = "memory-fault",
+    [RZ_STOP_BREAKPOINT] = "breakpoint",
+    [RZ_STOP_MARKER] = "marker",
+};
+
+// Ввод-вывод гостя: вектор чисел запроса и ограниченный буфер ответа
+static bool rz_server_read_int(void *ctx, int32_t *value)
+{
+    rz_farm_job_p job = ctx;
+    if (job->input_next == job->input_count)
+        return false;
+    *value = job->input[job->input_next++];
+    return true;
+}
+
+static void rz_server_write(void *ctx, const char *text, size_t len)
+{
+    rz_farm_job_p job = ctx;
+    if (len > RZ_SERVER_OUTPUT_MAX - job->output_len)
+        len = RZ_SERVER_OUTPUT_MAX - job->output_len;
+    if (!len)
+        return;
+    if (job->output_len + len > job->output_cap)
+    {
+        size_t cap = job->output_cap ? job->output_cap : 256;
+        while (cap < job->output_len + len)
+            cap *= 2;
+        char *grown = realloc(job->output, cap);
+        if (!grown)
+            return;
+        job->output = grown;
+        job->output_cap = cap;
+    }
+    memcpy(job->output + job->output_len, text, len);
+    job->output_len += len;
+}
+
+static bool rz_server_send(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len)
+    {
+        ssize_t n = send(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool rz_server_reply(rz_server_client_t *c, const char *format, ...)
+{
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0)
+        return false;
+    if ((size_t)len >= sizeof(line))
+        len = sizeof(line) - 1;
+    if (!rz_server_send(c->fd, line, (size_t)len))
+        c->closed = true;
+    return !c->closed;
+}
+
+// Машина для задания: движок и соглашения сервера, ввод-вывод — задания
+static rz_machine_p rz_server_fork(const rz_server_t *srv, const rz_server_image_t *image)
+{
+    const rz_server_config_t *cfg = srv->cfg;
+    rz_machine_p m = rz_snapshot_fork(image->snap);
+    if (!m)
+        return NULL;
+    m->ecall_abi = cfg->ecall_abi;
+    if (cfg->engine == RZ_ENGINE_JIT)
+        rz_jit_set_threshold(m->cpu, cfg->jit_threshold);
+    rz_set_engine(m->cpu, cfg->engine);
+    return m;
+}
+
+static rz_machine_p rz_server_take(rz_server_t *srv, rz_server_image_t *image)
+{
+    rz_machine_p m = NULL;
+    mtx_lock(&srv->lock);
+    if (image->idle_count)
+        m = image->idle[--image->idle_count];
+    mtx_unlock(&srv->lock);
+    return m ? m : rz_server_fork(srv, image);
+}
+
+// Пополнение пула после ответа: ответвление не входит в задержку задания
+static void rz_server_refill(rz_server_t *srv, rz_server_image_t *image)
+{
+    mtx_lock(&srv->lock);
+    bool needed = image->idle_count < srv->pool;
+    mtx_unlock(&srv->lock);
+    if (!needed)
+        return;
+    rz_machine_p m = rz_server_fork(srv, image);
+    if (!m)
+        return;
+    mtx_lock(&srv->lock);
+    if (image->idle_count < srv->pool)
+    {
+        image->idle[image->idle_count++] = m;
+        m = NULL;
+    }
+    mtx_unlock(&srv->lock);
+    rz_machine_free(m);
+}
+
+static void rz_server_execute(rz_server_t *srv, rz_server_job_t *job)
+{
+    const rz_server_config_t *cfg = srv->cfg;
+    job->started_ns = rz_clock_ns();
+    rz_machine_p m = rz_server_take(srv, job->image);
+    if (!m)
+    {
+        job->failed = true;
+        job->done_ns = rz_clock_ns();
+        return;
+    }
+    rz_machine_set_io(m, &(rz_io_t){.ctx = &job->io, .read_int = rz_server_read_int, .write = rz_server_write});
+    rz_run_result_t r = cfg->timeout_ns ? rz_run_timed(m->cpu, job->budget, cfg->timeout_ns)
+                                        : rz_run(m->cpu, job->budget);
+    job->done_ns = rz_clock_ns();
+    job->io.stop = r.reason;
+    job->io.retired = r.retired;
+    job->io.exit_code = m->cpu->exit_code;
+
+    rz_counters_t counters;
+    rz_cpu_get_counters(m->cpu, &counters);
+    for (unsigned op = 0; op < RZ_OP_COUNT; ++op)
+    {
+        char format = rz_op_format(op);
+        if (format == 'L')
+            job->loads += counters.ops[op];
+        else if (format == 'S')
+            job->stores += counters.ops[op];
+    }
+    job->taken = counters.taken;
+    rz_machine_free(m);
+}
+
+static bool rz_server_reply_job(rz_server_client_t *c)
+{
+    rz_server_job_t *job = &c->job;
+    if (job->failed)
+        return rz_server_reply(c, "ERR out of memory\n");
+    unsigned long long queue_us = (job->started_ns - job->queued_ns) / 1000u;
+    unsigned long long run_us = (job->done_ns - job->started_ns) / 1000u;
+    return rz_server_reply(c,
+                           "OK %s exit=%d retired=%llu loads=%llu stores=%llu taken=%llu "
+                           "queue_us=%llu run_us=%llu output=%zu\n",
+                           rz_server_stops[job->io.stop], job->io.exit_code,
+                           (unsigned long long)job->io.retired, (unsigned long long)job->loads,
+                           (unsigned long long)job->stores, (unsigned long long)job->taken, queue_us, run_us,
+                           job->io.output_len) &&
+           rz_server_send(c->fd, job->io.output, job->io.output_len);
+}
+
+// Поиск образа под замком сервера
+static rz_server_image_t *rz_server_find(rz_server_t *srv, uint64_t id)
+{
+    for (unsigned i = 0; i < srv->image_count; ++i)
+        if (srv->images[i].id == id)
+            return &srv->images[i];
+    return NULL;
+}
+
+static void rz_server_image_free(rz_server_image_t *image)
+{
+    while (image->idle_count)
+        rz_machine_free(image->idle[--image->idle_count]);
+    free(image->idle);
+    rz_snapshot_free(image->snap);
+}
+
+// Образ в кэш: снимок до первой инструкции и пул машин. Открытый образ
+// закрывается: страницы снимка свои. Идентификатор — хэш определённого
+// формата и содержимого, так что auto и явный формат дают один образ.
+// Образ строится без замка; если тот же успел добавить другой исполнитель,
+// построенный освобождается. *full — кэш полон
+static rz_server_image_t *rz_server_add(rz_server_t *srv, rz_image_p img, bool *full)
+{
+    const uint8_t *data = img->map;
+    uint64_t id = 0xcbf29ce484222325ULL;
+    id = (id ^ (uint8_t)img->format) * 0x100000001b3ULL;
+    for (size_t i = 0; i < img->map_size; ++i)
+        id = (id ^ data[i]) * 0x100000001b3ULL;
+    mtx_lock(&srv->lock);
+    rz_server_image_t *image = rz_server_find(srv, id);
+    *full = !image && srv->image_count == RZ_SERVER_IMAGES_MAX;
+    mtx_unlock(&srv->lock);
+    if (image || *full)
+    {
+        rz_image_close(img);
+        return image;
+    }
+
+    rz_machine_p m = rz_farm_boot(img);
+    rz_snapshot_p snap = m ? rz_snapshot_take(m) : NULL;
+    rz_machine_free(m);
+    rz_image_close(img);
+    rz_machine_p *idle = calloc(srv->pool, sizeof(rz_machine_p));
+    if (!snap || !idle)
+    {
+        rz_snapshot_free(snap);
+        free(idle);
+        return NULL;
+    }
+    rz_server_image_t built = {.id = id, .snap = snap, .idle = idle};
+    while (built.idle_count < srv->pool && (m = rz_server_fork(srv, &built)))
+        built.idle[built.idle_count++] = m;
+
+    mtx_lock(&srv->lock);
+    image = rz_server_find(srv, id);
+    *full = !image && srv->image_count == RZ_SERVER_IMAGES_MAX;
+    if (!image && !*full)
+    {
+        image = &srv->images[srv->image_count++];
+        *image = built;
+        built = (rz_server_image_t){0};
+    }
+    mtx_unlock(&srv->lock);
+    rz_server_image_free(&built);
+    return image;
+}
+
+// Задание LOAD у исполнителя: образ — первые load_size байтов буфера,
+// основной поток не трогает его, пока клиент занят
+static bool rz_server_load(rz_server_t *srv, rz_server_client_t *c)
+{
+    bool full = false;
+    rz_image_t img;
+    rz_server_image_t *image = NULL;
+    if (rz_image_open_memory(&img, c->buf, c->load_size, c->load_format))
+        image = rz_server_add(srv, &img, &full);
+    if (image)
+        return rz_server_reply(c, "OK %016llx\n", (unsigned long long)image->id);
+    return rz_server_reply(c, full ? "ERR image cache is full\n" : "ERR cannot load image\n");
+}
+
+// Исполнитель: задание из общей очереди, ответ клиенту прямо отсюда,
+// чтобы большой вывод не задерживал основной поток
+static int rz_server_worker(void *arg)
+{
+    rz_server_t *srv = arg;
+    mtx_lock(&srv->lock);
+    for (;;)
+    {
+        while (!srv->queue_head && !srv->stop)
+            cnd_wait(&srv->wake, &srv->lock);
+        if (srv->stop)
+            break;
+        rz_server_client_t *c = srv->queue_head;
+        srv->queue_head = c->next;
+        if (!srv->queue_head)
+            srv->queue_tail = NULL;
+        mtx_unlock(&srv->lock);
+
+        if (c->job.load)
+            c->job.sent = rz_server_load(srv, c);
+        else
+        {
+            rz_server_execute(srv, &c->job);
+            c->job.sent = rz_server_reply_job(c);
+            if (!c->job.failed)
+                rz_server_refill(srv, c->job.image);
+        }
+
+        mtx_lock(&srv->lock);
+        if (!c->job.load && !c->job.failed)
+        {
+            size_t slot = srv->jobs++ % RZ_SERVER_SAMPLES;
+            srv->queue_us[slot] = (uint32_t)((c->job.started_ns - c->job.queued_ns) / 1000u);
+            srv->run_us[slot] = (uint32_t)((c->job.done_ns - c->job.started_ns) / 1000u);
+        }
+        c->next = srv->done;
+        srv->done = c;
+        rz_server_wakeup();
+    }
+    mtx_unlock(&srv->lock);
+    return 0;
+}
+
+static int rz_server_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// p50/p90/p99/max по ближайшему рангу, выборка сортируется на месте
+static void rz_server_percentiles(uint32_t *samples, size_t n, char *text, size_t size)
+{
+    if (!n)
+    {
+        snprintf(text, size, "0/0/0/0");
+        return;
+    }
+    qsort(samples, n, sizeof(uint32_t), rz_server_compare);
+    snprintf(text, size, "%u/%u/%u/%u", samples[(n - 1) * 50 / 100], samples[(n - 1) * 90 / 100],
+             samples[(n - 1) * 99 / 100], samples[n - 1]);
+}
+
+// Сводка задержек: копия колец под замком, сортировка без него
+static bool rz_server_stats(rz_server_t *srv, char *text, size_t size)
+{
+    uint32_t *queue = malloc(RZ_SERVER_SAMPLES * sizeof(uint32_t));
+    uint32_t *run = malloc(RZ_SERVER_SAMPLES * sizeof(uint32_t));
+    if (!queue || !run)
+    {
+        free(queue);
+        free(run);
+        return false;
+    }
+    mtx_lock(&srv->lock);
+    uint64_t jobs = srv->jobs;
+    unsigned images = srv->image_count;
+    size_t n = jobs < RZ_SERVER_SAMPLES ? (size_t)jobs : RZ_SERVER_SAMPLES;
+    memcpy(queue, srv->queue_us, n * sizeof(uint32_t));
+    memcpy(run, srv->run_us, n * sizeof(uint32_t));
+    mtx_unlock(&srv->lock);
+
+    char q[64], r[64];
+    rz_server_percentiles(queue, n, q, sizeof(q));
+    rz_server_percentiles(run, n, r, sizeof(r));
+    snprintf(text, size, "jobs=%llu images=%u queue_us=%s run_us=%s", (unsigned long long)jobs, images, q, r);
+    free(queue);
+    free(run);
+    return true;
+}
+
+static void rz_server_enqueue(rz_server_t *srv, rz_server_client_t *c)
+{
+    c->busy = true;
+    c->job.queued_ns = rz_clock_ns();
+    c->next = NULL;
+    mtx_lock(&srv->lock);
+    if (srv->queue_tail)
+        srv->queue_tail->next = c;
+    else
+        srv->queue_head = c;
+    srv->queue_tail = c;
+    cnd_signal(&srv->wake);
+    mtx_unlock(&srv->lock);
+}
+
+// RUN <id> <budget> [integer...]: разбор как у входных векторов пакетного режима
+static void rz_server_run_request(rz_server_t *srv, rz_server_client_t *c, char *p)
+{
+    char *end;
+    uint64_t id = strtoull(p, &end, 16);
+    rz_server_image_t *image = NULL;
+    if (end != p)
+    {
+        mtx_lock(&srv->lock);
+        image = rz_server_find(srv, id);
+        mtx_unlock(&srv->lock);
+    }
+    if (!image)
+    {
+        rz_server_reply(c, "ERR unknown image\n");
+        return;
+    }
+    p = end;
+    uint64_t budget = strtoull(p, &end, 0);
+    if (end == p)
+    {
+        rz_server_reply(c, "ERR bad budget\n");
+        return;
+    }
+    p = end;
+
+    rz_server_job_t *job = &c->job;
+    free(job->io.input);
+    free(job->io.output);
+    *job = (rz_server_job_t){
+        .image = image,
+        .budget = budget && budget < srv->cfg->budget ? budget : srv->cfg->budget,
+    };
+    size_t cap = 0;
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            ++p;
+        if (*p == '\0')
+            break;
+        errno = 0;
+        long v = strtol(p, &end, 0);
+        if (end == p || job->io.input_count == RZ_SERVER_INPUT_MAX)
+        {
+            rz_server_reply(c, end == p ? "ERR bad integer\n" : "ERR too many integers\n");
+            return;
+        }
+        if (errno == ERANGE || v < INT32_MIN || v > INT32_MAX)
+        {
+            rz_server_reply(c, "ERR integer out of 32-bit range\n");
+            return;
+        }
+        p = end;
+        if (job->io.input_count == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            int32_t *grown = realloc(job->io.input, cap * sizeof(int32_t));
+            if (!grown)
+            {
+                rz_server_reply(c, "ERR out of memory\n");
+                return;
+            }
+            job->io.input = grown;
+        }
+        job->io.input[job->io.input_count++] = (int32_t)v;
+    }
+    rz_server_enqueue(srv, c);
+}
+
+static void rz_server_request(rz_server_t *srv, rz_server_client_t *c, char *line)
+{
+    if (strncmp(line, "LOAD ", 5) == 0)
+    {
+        char *end;
+        unsigned long long size = strtoull(line + 5, &end, 0);
+        while (*end == ' ')
+            ++end;
+        c->load_format = RZ_IMAGE_AUTO;
+        if (end == line + 5 || size == 0 || size > RZ_SERVER_IMAGE_SIZE_MAX)
+            rz_server_reply(c, "ERR bad image size\n");
+        else if (*end && !rz_image_parse_format(end, &c->load_format))
+            rz_server_reply(c, "ERR unknown image format\n");
+        else
+            c->load_size = (size_t)size;
+    }
+    else if (strncmp(line, "RUN ", 4) == 0)
+        rz_server_run_request(srv, c, line + 4);
+    else if (strcmp(line, "STATS") == 0)
+    {
+        char text[256];
+        if (rz_server_stats(srv, text, sizeof(text)))
+            rz_server_reply(c, "OK %s\n", text);
+        else
+            rz_server_reply(c, "ERR out of memory\n");
+    }
+    else
+        rz_server_reply(c, "ERR unknown request\n");
+}
+
+// Разбор принятого, пока клиент не ждёт задания: запросы можно слать
+// подряд, ответы идут в том же порядке. Принятый образ отдаётся
+// исполнителю и убирается из буфера, когда клиент вернётся
+static void rz_server_serve(rz_server_t *srv, rz_server_client_t *c)
+{
+    while (!c->busy && !c->closed)
+    {
+        size_t used;
+        if (c->load_size)
+        {
+            if (c->len < c->load_size)
+                return;
+            c->job.load = true;
+            rz_server_enqueue(srv, c);
+            return;
+        }
+        else
+        {
+            char *eol = memchr(c->buf, '\n', c->len);
+            if (!eol)
+            {
+                if (c->len > RZ_SERVER_LINE_MAX)
+                {
+                    rz_server_reply(c, "ERR request too long\n");
+                    c->closed = true;
+                }
+                return;
+            }
+            used = (size_t)(eol - c->buf) + 1;
+            *eol = '\0';
+            if (eol > c->buf && eol[-1] == '\r')
+                eol[-1] = '\0';
+            rz_server_request(srv, c, c->buf);
+        }
+        c->len -= used;
+        memmove(c->buf, c->buf + used, c->len);
+    }
+}
+
+// Буфер растёт удвоением, последний шаг — до предела
+static bool rz_server_receive(rz_server_client_t *c)
+{
+    if (c->cap - c->len < RZ_SERVER_RECV_CHUNK && c->cap < RZ_SERVER_BUFFER_MAX)
+    {
+        size_t cap = c->cap ? c->cap * 2 : 2 * RZ_SERVER_RECV_CHUNK;
+        if (cap > RZ_SERVER_BUFFER_MAX)
+            cap = RZ_SERVER_BUFFER_MAX;
+        char *grown = realloc(c->buf, cap);
+        if (!grown)
+            return false;
+        c->buf = grown;
+        c->cap = cap;
+    }
+    if (c->len == c->cap)
+        return false;
+    ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+    if (n < 0 && errno == EINTR)
+        return true;
+    if (n <= 0)
+        return false;
+    c->len += (size_t)n;
+    return true;
+}
+
+static void rz_server_drop(rz_server_client_t *c)
+{
+    close(c->fd);
+    free(c->buf);
+    free(c->job.io.input);
+    free(c->job.io.output);
+    free(c);
+}
+
+static int rz_server_listen(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: socket path is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // Сокет прошлого запуска заменяется, другие файлы — нет
+    struct stat st;
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            fprintf(stderr, "%s: exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool rz_server_preload(rz_server_t *srv, const char *path, rz_image_format_t format)
+{
+    rz_image_t img;
+    if (!rz_image_open(&img, path, format))
+        return false;
+    bool full;
+    rz_server_image_t *image = rz_server_add(srv, &img, &full);
+    if (!image)
+    {
+        fprintf(stderr, "Cannot cache %s\n", path);
+        return false;
+    }
+    fprintf(stderr, "Image %s: %016llx\n", path, (unsigned long long)image->id);
+    return true;
+}
+
+// Основной поток: приём соединений и разбор запросов через poll, задания
+// RUN и разбор образов LOAD уходят исполнителям. Клиент с заданием не
+// опрашивается, пока исполнитель не вернёт его через список выполненных
+static bool rz_server_loop(rz_server_t *srv, int listener)
+{
+    struct pollfd *fds = calloc(RZ_SERVER_CLIENTS_MAX + 2, sizeof(struct pollfd));
+    unsigned *owner = calloc(RZ_SERVER_CLIENTS_MAX + 2, sizeof(unsigned));
+    bool ok = fds && owner;
+    if (!ok)
+        fprintf(stderr, "Out of memory\n");
+
+    rz_server_client_t **clients = srv->clients;
+    while (ok && !rz_server_stopping)
+    {
+        nfds_t n = 0;
+        fds[n++] = (struct pollfd){.fd = listener, .events = POLLIN};
+        fds[n++] = (struct pollfd){.fd = rz_server_notify[0], .events = POLLIN};
+        for (unsigned i = 0; i < srv->client_count; ++i)
+            if (!clients[i]->busy)
+            {
+                owner[n] = i;
+                fds[n++] = (struct pollfd){.fd = clients[i]->fd, .events = POLLIN};
+            }
+        if (poll(fds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            ok = false;
+            break;
+        }
+
+        for (nfds_t k = 2; k < n; ++k)
+            if (fds[k].revents)
+            {
+                rz_server_client_t *c = clients[owner[k]];
+                if (rz_server_receive(c))
+                    rz_server_serve(srv, c);
+                else
+                    c->closed = true;
+            }
+
+        if (fds[1].revents)
+        {
+            char drain[256];
+            while (read(rz_server_notify[0], drain, sizeof(drain)) > 0)
+                ;
+            mtx_lock(&srv->lock);
+            rz_server_client_t *done = srv->done;
+            srv->done = NULL;
+            mtx_unlock(&srv->lock);
+            while (done)
+            {
+                rz_server_client_t *c = done;
+                done = c->next;
+                c->busy = false;
+                if (!c->job.sent)
+                    c->closed = true;
+                if (c->job.load)
+                {
+                    c->len -= c->load_size;
+                    memmove(c->buf, c->buf + c->load_size, c->len);
+                    c->load_size = 0;
+                    c->job.load = false;
+                }
+                rz_server_serve(srv, c);
+            }
+        }
+
+        if (fds[0].revents)
+        {
+            int fd = accept(listener, NULL, NULL);
+            rz_server_client_t *c = NULL;
+            if (fd >= 0 && srv->client_count < RZ_SERVER_CLIENTS_MAX && (c = calloc(1, sizeof(*c))))
+            {
+                struct timeval timeout = {.tv_sec = RZ_SERVER_SEND_TIMEOUT};
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                c->fd = fd;
+                clients[srv->client_count++] = c;
+            }
+            else if (fd >= 0)
+            {
+                static const char full[] = "ERR too many clients\n";
+                rz_server_send(fd, full, sizeof(full) - 1);
+                close(fd);
+            }
+        }
+
+        // Ушедший клиент освобождается, только когда его задание выполнено
+        for (unsigned i = 0; i < srv->client_count;)
+            if (clients[i]->closed && !clients[i]->busy)
+            {
+                rz_server_drop(clients[i]);
+                clients[i] = clients[--srv->client_count];
+            }
+            else
+                ++i;
+    }
+    free(fds);
+    free(owner);
+    return ok;
+}
+
+bool rz_server_run(const rz_server_config_t *cfg)
+{
+    rz_server_t *srv = calloc(1, sizeof(*srv));
+    if (!srv)
+        return false;
+    srv->cfg = cfg;
+    srv->pool = cfg->pool ? cfg->pool : RZ_SERVER_DEFAULT_POOL;
+    srv->queue_us = calloc(RZ_SERVER_SAMPLES, sizeof(uint32_t));
+    srv->run_us = calloc(RZ_SERVER_SAMPLES, sizeof(uint32_t));
+    srv->clients = calloc(RZ_SERVER_CLIENTS_MAX, sizeof(rz_server_client_t *));
+    unsigned threads = cfg->threads ? cfg->threads : rz_farm_cpu_count();
+    thrd_t *handles = calloc(threads, sizeof(thrd_t));
+    mtx_init(&srv->lock, mtx_plain);
+    cnd_init(&srv->wake);
+
+    bool ok = srv->queue_us && srv->run_us && srv->clients && handles;
+    if (!ok)
+        fprintf(stderr, "Out of memory\n");
+    if (ok && cfg->engine == RZ_ENGINE_JIT && !rz_jit_available())
+        fprintf(stderr, "Native translation is not available, interpreting\n");
+    ok = ok && (!cfg->image || rz_server_preload(srv, cfg->image, cfg->format));
+
+    int listener = ok ? rz_server_listen(cfg->path) : -1;
+    ok = listener >= 0;
+    if (ok && pipe(rz_server_notify) != 0)
+    {
+        perror("pipe");
+        rz_server_notify[0] = rz_server_notify[1] = -1;
+        ok = false;
+    }
+    if (ok)
+    {
+        fcntl(rz_server_notify[0], F_SETFL, O_NONBLOCK);
+        fcntl(rz_server_notify[1], F_SETFL, O_NONBLOCK);
+    }
+
+    // Ответ ушедшему клиенту — ошибка send, а не SIGPIPE; повторный
+    // сигнал остановки, пока исполнители доделывают задания, — выход
+    struct sigaction old_int, old_term, old_pipe;
+    struct sigaction on_stop = {.sa_handler = rz_server_on_signal, .sa_flags = SA_RESETHAND};
+    struct sigaction ignore = {.sa_handler = SIG_IGN};
+    sigemptyset(&on_stop.sa_mask);
+    sigemptyset(&ignore.sa_mask);
+    rz_server_stopping = 0;
+    sigaction(SIGINT, &on_stop, &old_int);
+    sigaction(SIGTERM, &on_stop, &old_term);
+    sigaction(SIGPIPE, &ignore, &old_pipe);
+
+    unsigned started = 0;
+    for (; ok && started < threads; ++started)
+        if (thrd_create(&handles[started], rz_server_worker, srv) != thrd_success)
+            break;
+    if (ok && started == 0)
+    {
+        fprintf(stderr, "Cannot start workers\n");
+        ok = false;
+    }
+
+    uint64_t start = rz_clock_ns();
+    if (ok)
+    {
+        fprintf(stderr, "Serving on %s with %u workers\n", cfg->path, started);
+        ok = rz_server_loop(srv, listener);
+    }
+
+    // Начатые задания доделываются, очередь отменяется
+    mtx_lock(&srv->lock);
+    srv->stop = true;
+    cnd_broadcast(&srv->wake);
+    mtx_unlock(&srv->lock);
+    for (unsigned i = 0; i < started; ++i)
+        thrd_join(handles[i], NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+
+    if (started)
+    {
+        char text[256];
+        double seconds = (double)(rz_clock_ns() - start) / 1e9;
+        if (rz_server_stats(srv, text, sizeof(text)))
+            fprintf(stderr, "Server: %.1f s, %s\n", seconds, text);
+    }
+
+    for (unsigned i = 0; i < srv->client_count; ++i)
+        rz_server_drop(srv->clients[i]);
+    for (unsigned i = 0; i < srv->image_count; ++i)
+        rz_server_image_free(&srv->images[i]);
+    if (listener >= 0)
+    {
+        close(listener);
+        unlink(cfg->path);
+    }
+    for (unsigned i = 0; i < 2; ++i)
+        if (rz_server_notify[i] >= 0)
+        {
+            close(rz_server_notify[i]);
+            rz_server_notify[i] = -1;
+        }
+    cnd_destroy(&srv->wake);
+    mtx_destroy(&srv->lock);
+    free(handles);
+    free(srv->clients);
+    free(srv->queue_us);
+    free(srv->run_us);
+    free(srv);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "loader.h"
+#include "machine.h"
+
+#define RZ_SERVER_IMAGES_MAX 64u		   // cached program images, no eviction
+#define RZ_SERVER_IMAGE_SIZE_MAX (64u << 20) // bytes of uploaded image
+#define RZ_SERVER_CLIENTS_MAX 1024u		   // open connections
+#define RZ_SERVER_OUTPUT_MAX RZ_IO_BUFFER_SIZE // guest output returned per job, rest is dropped
+#define RZ_SERVER_INPUT_MAX 65536u		   // integers of one job
+#define RZ_SERVER_DEFAULT_POOL 4u		   // idle machines kept per image
+#define RZ_SERVER_SAMPLES 65536u		   // latest jobs kept for latency percentiles
+
+/**
+ * @brief Server configuration
+ *
+ * Jobs run with the engine, conventions and limits of the server; the
+ * budget of a request is capped by the budget of the server.
+ */
+typedef struct rz_server_config_s
+{
+	const char *path;		// Unix socket, replaced if it exists
+	const char *image;		// image cached at start, may be NULL
+	rz_image_format_t format; // its format
+	rz_engine_t engine;
+	unsigned jit_threshold;
+	unsigned threads;		// workers, 0 for number of host cores
+	unsigned pool;			// idle machines per image, 0 for default
+	uint64_t budget;		// instructions per job
+	uint64_t timeout_ns;	// wall time per job, 0 for no limit
+	rz_ecall_abi_t ecall_abi;
+} rz_server_config_t;
+
+/**
+ * @brief Serve jobs until SIGINT or SIGTERM
+ *
+ * Requests are lines of text, one at a time per connection:
+ *
+ *     LOAD <size> [auto|raw|hex|elf]\n<size bytes>
+ *         -> OK <image id>
+ *     RUN <image id> <budget, 0 for the server one> [integer...]
+ *         -> OK <stop> exit=<code> retired=<n> loads=<n> stores=<n> taken=<n>
+ *               queue_us=<n> run_us=<n> output=<len>\n<len bytes>
+ *     STATS
+ *         -> OK jobs=<n> images=<n> queue_us=<p50>/<p90>/<p99>/<max>
+ *               run_us=<p50>/<p90>/<p99>/<max>
+ *
+ * Errors are answered with ERR <message>. Image id is the content hash,
+ * so loading the same image again is answered from the cache. Every
+ * cached image keeps a pool of machines forked from its boot snapshot,
+ * a job takes one and a fresh one is forked after the reply. Stop is a
+ * word: budget, deadline, ebreak, exit, invalid, ecall-error,
+ * input-error, memory-fault or marker.
+ *
+ * @param cfg configuration
+ * @return true when the server started and shut down cleanly, statistics are printed
+ */
+bool rz_server_run(const rz_server_config_t *cfg);
+
+#endif // SERVER_H__
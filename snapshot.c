@@ -0,0 +1,296 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h> // memcmp, memcpy, strerror
+
+#include "snapshot.h"
+#include "memory.h"
+
+// Формат файла: заголовок, затем записи страниц; данные есть только
+// у ненулевых страниц. Поля пишутся в порядке байтов хоста; строка магии
+// от него не зависит, поэтому порядок проверяется отдельным словом order.
+#define RZ_SNAPSHOT_MAGIC "RZSNAP\0\2"
+#define RZ_SNAPSHOT_ORDER 0x01020304u // на чужом хосте читается как 0x04030201
+#define RZ_SNAPSHOT_ZERO 0x100u // флаг записи: страница из нулей
+
+typedef struct
+{
+    char magic[8];
+    uint32_t order; // RZ_SNAPSHOT_ORDER
+    uint32_t page_count;
+    uint32_t pc;
+    uint32_t text_base, text_size;
+    uint32_t engine, brk;
+    uint64_t instret;
+    uint32_t x[32];
+} rz_snapshot_header_t;
+
+typedef struct
+{
+    uint32_t base;
+    uint32_t flags; // MEM_PERM_* и RZ_SNAPSHOT_ZERO
+} rz_snapshot_record_t;
+
+static bool rz_page_is_zero(const uint8_t *data)
+{
+    static const uint8_t zero[MEM_PAGE_SIZE];
+    return memcmp(data, zero, MEM_PAGE_SIZE) == 0;
+}
+
+// Страницы за концом образа под кодом могут быть не отображены (кэш hex-образа
+// всегда TEXT_SIZE), поэтому проверяется первая страница и конец карты
+static bool rz_snapshot_text_fits(const rz_snapshot_t *snap, rz_address_t base, size_t size)
+{
+    bool first = false;
+    uint64_t end = 0;
+    for (size_t i = 0; i < snap->page_count; ++i)
+    {
+        const rz_snapshot_page_t *page = &snap->pages[i];
+        if (page->base == (base & ~(rz_address_t)MEM_PAGE_MASK))
+            first = (page->perm & MEM_PERM_EXEC) != 0;
+        if ((uint64_t)page->base + MEM_PAGE_SIZE > end)
+            end = (uint64_t)page->base + MEM_PAGE_SIZE;
+    }
+    return first && (uint64_t)base + size <= end;
+}
+
+// Снимок живёт в собственной арене, как и машина
+static rz_snapshot_p rz_snapshot_alloc(size_t page_count)
+{
+    rz_arena_t arena;
+    if (!rz_arena_init(&arena, RZ_SNAPSHOT_ARENA_DEFAULT))
+        return NULL;
+    rz_snapshot_p snap = rz_arena_alloc(&arena, sizeof(rz_snapshot_t));
+    rz_snapshot_page_t *pages = rz_arena_alloc(&arena, (page_count ? page_count : 1) * sizeof(rz_snapshot_page_t));
+    if (!snap || !pages)
+    {
+        rz_arena_free(&arena);
+        return NULL;
+    }
+    snap->arena = arena;
+    snap->pages = pages;
+    snap->page_count = page_count;
+    return snap;
+}
+
+rz_snapshot_p rz_snapshot_take(rz_machine_p m)
+{
+    size_t count = 0;
+    for (unsigned d = 0; d < (1u << MEM_DIR_BITS); ++d)
+        if (m->mem.dir[d])
+            for (unsigned t = 0; t < MEM_TABLE_SIZE; ++t)
+                count += m->mem.dir[d][t].host != NULL;
+
+    rz_snapshot_p snap = rz_snapshot_alloc(count);
+    if (!snap)
+        return NULL;
+
+    rz_cpu_p pcpu = m->cpu;
+    snap->r_pc = pcpu->r_pc;
+    memcpy(snap->r_x, pcpu->r_x, sizeof(snap->r_x));
+    snap->instret = pcpu->instret;
+    snap->engine = pcpu->engine;
+    snap->brk = m->brk;
+    snap->text_base = pcpu->icache.base;
+    snap->text_size = pcpu->icache.count * RZ_INSN_ALIGN;
+
+    // Нулевые страницы (.bss, стек) делят один буфер
+    uint8_t *zero = NULL;
+    size_t n = 0;
+    for (unsigned d = 0; d < (1u << MEM_DIR_BITS); ++d)
+    {
+        const mem_page_t *table = m->mem.dir[d];
+        if (!table)
+            continue;
+        for (unsigned t = 0; t < MEM_TABLE_SIZE; ++t)
+        {
+            if (!table[t].host)
+                continue;
+            rz_snapshot_page_t *page = &snap->pages[n++];
+            page->base = ((rz_address_t)d << (MEM_PAGE_BITS + MEM_TABLE_BITS)) | ((rz_address_t)t << MEM_PAGE_BITS);
+            page->perm = table[t].perm & ~MEM_PERM_COW;
+            if (rz_page_is_zero(table[t].host))
+            {
+                if (!zero)
+                    zero = rz_arena_alloc(&snap->arena, MEM_PAGE_SIZE);
+                page->data = zero;
+            }
+            else if ((page->data = rz_arena_alloc(&snap->arena, MEM_PAGE_SIZE)))
+            {
+                memcpy(page->data, table[t].host, MEM_PAGE_SIZE);
+            }
+            if (!page->data)
+            {
+                rz_snapshot_free(snap);
+                return NULL;
+            }
+        }
+    }
+    return snap;
+}
+
+rz_machine_p rz_snapshot_fork(const rz_snapshot_t *snap)
+{
+    rz_machine_p m = rz_machine_create_empty(0);
+    if (!m)
+        return NULL;
+
+    // Страницы снимка не меняются: дочерняя машина копирует их при записи
+    for (size_t i = 0; i < snap->page_count; ++i)
+    {
+        const rz_snapshot_page_t *page = &snap->pages[i];
+        if (!mem_map(&m->mem, page->base, MEM_PAGE_SIZE, page->data, page->perm | MEM_PERM_COW))
+        {
+            rz_machine_free(m);
+            return NULL;
+        }
+    }
+
+    rz_cpu_p pcpu = m->cpu;
+    if (!rz_cpu_set_text(pcpu, snap->text_base, snap->text_size))
+    {
+        rz_machine_free(m);
+        return NULL;
+    }
+    pcpu->r_pc = snap->r_pc;
+    memcpy(pcpu->r_x, snap->r_x, sizeof(pcpu->r_x));
+    pcpu->instret = snap->instret;
+    rz_set_engine(pcpu, snap->engine);
+    m->brk = snap->brk;
+    return m;
+}
+
+bool rz_snapshot_save(const rz_snapshot_t *snap, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    rz_snapshot_header_t h = {
+        .order = RZ_SNAPSHOT_ORDER,
+        .page_count = (uint32_t)snap->page_count,
+        .pc = snap->r_pc,
+        .text_base = snap->text_base,
+        .text_size = (uint32_t)snap->text_size,
+        .engine = (uint32_t)snap->engine,
+        .brk = snap->brk,
+        .instret = snap->instret,
+    };
+    memcpy(h.magic, RZ_SNAPSHOT_MAGIC, sizeof(h.magic));
+    memcpy(h.x, snap->r_x, sizeof(h.x));
+    bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+
+    for (size_t i = 0; ok && i < snap->page_count; ++i)
+    {
+        const rz_snapshot_page_t *page = &snap->pages[i];
+        bool zero = rz_page_is_zero(page->data);
+        rz_snapshot_record_t r = {page->base, page->perm | (zero ? RZ_SNAPSHOT_ZERO : 0u)};
+        ok = fwrite(&r, sizeof(r), 1, file) == 1 &&
+             (zero || fwrite(page->data, MEM_PAGE_SIZE, 1, file) == 1);
+    }
+
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "%s: failed to write snapshot\n", path);
+    return ok;
+}
+
+rz_snapshot_p rz_snapshot_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    rz_snapshot_header_t h;
+    if (fread(&h, sizeof(h), 1, file) != 1 || memcmp(h.magic, RZ_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+        h.page_count > (1u << (32 - MEM_PAGE_BITS)))
+    {
+        fprintf(stderr, "%s: not a RISC-Z snapshot\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (h.order != RZ_SNAPSHOT_ORDER)
+    {
+        fprintf(stderr, "%s: snapshot was written on a host with other byte order\n", path);
+        fclose(file);
+        return NULL;
+    }
+    // Движок, x0 и код проверяются до того, как попадут в процессор
+    if (h.engine > RZ_ENGINE_JIT || h.x[0] != 0 || (h.text_base % RZ_INSN_ALIGN) || (h.text_size % RZ_INSN_ALIGN) ||
+        (uint64_t)h.text_base + h.text_size > ((uint64_t)1 << 32))
+    {
+        fprintf(stderr, "%s: damaged snapshot header\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    rz_snapshot_p snap = rz_snapshot_alloc(h.page_count);
+    if (!snap)
+    {
+        fclose(file);
+        return NULL;
+    }
+    snap->r_pc = h.pc;
+    memcpy(snap->r_x, h.x, sizeof(snap->r_x));
+    snap->instret = h.instret;
+    snap->engine = (rz_engine_t)h.engine;
+    snap->brk = h.brk;
+    snap->text_base = h.text_base;
+    snap->text_size = h.text_size;
+
+    uint8_t *zero = NULL;
+    bool ok = true;
+    for (size_t i = 0; ok && i < snap->page_count; ++i)
+    {
+        rz_snapshot_page_t *page = &snap->pages[i];
+        rz_snapshot_record_t r;
+        // Снимок пишет страницы по возрастанию адресов, каждую один раз
+        if (fread(&r, sizeof(r), 1, file) != 1 || (r.base & MEM_PAGE_MASK) ||
+            (i > 0 && r.base <= snap->pages[i - 1].base))
+        {
+            ok = false;
+            break;
+        }
+        page->base = r.base;
+        page->perm = r.flags & (MEM_PERM_READ | MEM_PERM_WRITE | MEM_PERM_EXEC);
+        if (r.flags & RZ_SNAPSHOT_ZERO)
+        {
+            if (!zero)
+                zero = rz_arena_alloc(&snap->arena, MEM_PAGE_SIZE);
+            page->data = zero;
+        }
+        else
+        {
+            page->data = rz_arena_alloc(&snap->arena, MEM_PAGE_SIZE);
+            ok = page->data && fread(page->data, MEM_PAGE_SIZE, 1, file) == 1;
+        }
+        if (!page->data)
+            ok = false;
+    }
+    fclose(file);
+
+    // Код начинается в исполнимой странице снимка и не выходит за его карту
+    ok = ok && rz_snapshot_text_fits(snap, h.text_base, h.text_size);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: truncated or damaged snapshot\n", path);
+        rz_snapshot_free(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+void rz_snapshot_free(rz_snapshot_p snap)
+{
+    if (!snap)
+        return;
+    rz_arena_t arena = snap->arena; // snap освобождается вместе с ареной
+    rz_arena_free(&arena);
+}
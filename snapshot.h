@@ -0,0 +1,85 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "misc.h"
+#include "arena.h"
+#include "machine.h"
+
+#define RZ_SNAPSHOT_ARENA_DEFAULT (256UL << 10)
+
+/**
+ * @brief Guest page saved in snapshot
+ *
+ */
+typedef struct rz_snapshot_page_s
+{
+	rz_address_t base; // guest address of page
+	unsigned perm;	   // MEM_PERM_* bits without MEM_PERM_COW
+	uint8_t *data;	   // MEM_PAGE_SIZE bytes, all zero pages share one buffer
+} rz_snapshot_page_t;
+
+/**
+ * @brief Frozen guest state: registers, PC and all mapped pages
+ *
+ * Snapshot is immutable once taken, machines forked from it share its
+ * pages copy-on-write, so it must be freed only after all of them.
+ */
+typedef struct rz_snapshot_s
+{
+	rz_arena_t arena; // snapshot itself, page list and page data
+	rz_register_t r_pc, r_x[32];
+	uint64_t instret;
+	rz_engine_t engine;
+	rz_address_t text_base; // range of instruction cache
+	size_t text_size;
+	rz_address_t brk; // program break, 0 when not known
+	size_t page_count;
+	rz_snapshot_page_t *pages; // sorted by address
+} rz_snapshot_t, *rz_snapshot_p;
+
+/**
+ * @brief Take snapshot of stopped machine, pages are copied once
+ *
+ * @param m machine
+ * @return rz_snapshot_p snapshot or NULL when out of memory
+ */
+rz_snapshot_p rz_snapshot_take(rz_machine_p m);
+
+/**
+ * @brief Create machine from snapshot, memory is shared copy-on-write
+ *
+ * Child gets stdio handlers and the engine of the snapshot; changing
+ * either after fork is allowed.
+ *
+ * @param snap snapshot
+ * @return rz_machine_p machine or NULL when out of memory
+ */
+rz_machine_p rz_snapshot_fork(const rz_snapshot_t *snap);
+
+/**
+ * @brief Save snapshot to file, all zero pages are stored without data
+ *
+ * @param snap snapshot
+ * @param path file name
+ * @return true on success, errors are reported to stderr
+ */
+bool rz_snapshot_save(const rz_snapshot_t *snap, const char *path);
+
+/**
+ * @brief Load snapshot saved by rz_snapshot_save
+ *
+ * @param path file name
+ * @return rz_snapshot_p snapshot or NULL, errors are reported to stderr
+ */
+rz_snapshot_p rz_snapshot_load(const char *path);
+
+/**
+ * @brief Release snapshot
+ *
+ * @param snap snapshot, may be NULL
+ */
+void rz_snapshot_free(rz_snapshot_p snap);
+
+#endif // SNAPSHOT_H__
@@ -0,0 +1,90 @@
+    .option norvc
+    li a7, 1
+    lui s0, 0x10000       # data base
+    li t0, -7
+    li t1, 3
+    add a0, t0, t1
+    ecall
+    sub a0, t0, t1
+    ecall
+    sll a0, t0, t1
+    ecall
+    slt a0, t0, t1
+    ecall
+    sltu a0, t0, t1
+    ecall
+    xor a0, t0, t1
+    ecall
+    srl a0, t0, t1
+    ecall
+    sra a0, t0, t1
+    ecall
+    or a0, t0, t1
+    ecall
+    and a0, t0, t1
+    ecall
+    li s2, 17
+    li s3, 20
+    add a0, s2, s3          # regs >= 16 (baseline decode bug)
+    ecall
+    slti a0, t0, -3
+    ecall
+    sltiu a0, t1, -1
+    ecall
+    xori a0, t0, 0x55
+    ecall
+    ori a0, t0, 0x100
+    ecall
+    andi a0, t0, 0x0f0
+    ecall
+    slli a0, t0, 17
+    ecall
+    srli a0, t0, 17
+    ecall
+    srai a0, t0, 17
+    ecall
+    li t2, -2
+    sw t2, 0(s0)
+    lb a0, 0(s0)
+    ecall
+    lbu a0, 0(s0)
+    ecall
+    lh a0, 2(s0)
+    ecall
+    lhu a0, 2(s0)
+    ecall
+    sb t1, 1(s0)
+    sh t1, 2(s0)
+    lw a0, 0(s0)
+    ecall
+    auipc a0, 1
+    ecall
+    li t3, 0
+    li t4, 5
+bl: addi t3, t3, 1
+    blt t3, t4, bl
+    bge t3, t4, b2
+    ebreak
+b2: bltu t0, t1, bad
+    bgeu t0, t1, b3
+bad: ebreak
+b3: beq t3, t4, b4
+    ebreak
+b4: bne t3, t4, bad
+    mv a0, t3
+    ecall
+    jal ra, fn
+    mv a0, ra
+    ecall
+    # self-modifying: patch smc to "li a0, 99"
+    auipc t5, 0
+    lw t6, 36(t5)          # word at patch
+    sw t6, 24(t5)          # overwrite smc
+    fence.i
+    fence
+    nop
+smc: li a0, 11
+    ecall
+    ebreak
+patch: li a0, 99
+fn: ret
@@ -0,0 +1,58 @@
+    # Ввод: начальное число и код выхода. Цикл с вызовами, стеком и
+    # ветвлениями, зависящими от данных; код выхода 1 — ошибка памяти
+    li a7, 5
+    ecall
+    mv s0, a0
+    li s1, 300
+    li s2, 0
+    addi sp, sp, -64
+outer:
+    mv a0, s0
+    call collatz
+    add s2, s2, a0
+    andi t1, s0, 15
+    slli t1, t1, 2
+    add t1, sp, t1
+    sw a0, 0(t1)
+    lb t2, 0(t1)
+    divu t3, s2, s1
+    rem t4, s2, t2
+    add s2, s2, t4
+    add s2, s2, t3
+    mulh t5, s2, s0
+    xor s2, s2, t5
+    addi s0, s0, 1
+    addi s1, s1, -1
+    bnez s1, outer
+    mv a0, s2
+    li a7, 1
+    ecall
+    li a7, 5
+    ecall
+    li t0, 1
+    beq a0, t0, fault
+    li a7, 17
+    ecall
+fault:
+    lui t5, 0x50000
+    lw a0, 0(t5)
+    ebreak
+collatz:
+    li t0, 0
+c_loop:
+    li t1, 1
+    beq a0, t1, c_done
+    andi t2, a0, 1
+    beqz t2, even
+    slli t3, a0, 1
+    add a0, a0, t3
+    addi a0, a0, 1
+    j c_next
+even:
+    srli a0, a0, 1
+c_next:
+    addi t0, t0, 1
+    j c_loop
+c_done:
+    mv a0, t0
+    ret
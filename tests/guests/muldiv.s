@@ -0,0 +1,35 @@
+    # RV32M на граничных значениях: деление на ноль и переполнение
+    li a7, 1
+    li s0, 0x80000000
+    li s1, -1
+    li s2, 7
+    li s3, -3
+    mul a0, s2, s3
+    ecall
+    mulh a0, s0, s0
+    ecall
+    mulhsu a0, s3, s1
+    ecall
+    mulhu a0, s1, s1
+    ecall
+    div a0, s2, s3
+    ecall
+    rem a0, s2, s3
+    ecall
+    divu a0, s2, s3
+    ecall
+    remu a0, s3, s2
+    ecall
+    div a0, s2, zero
+    ecall
+    divu a0, s2, zero
+    ecall
+    rem a0, s2, zero
+    ecall
+    remu a0, s3, zero
+    ecall
+    div a0, s0, s1
+    ecall
+    rem a0, s0, s1
+    ecall
+    ebreak
@@ -0,0 +1,15 @@
+    # Текст (R+X, 0x0) и данные (R+W, 0x40: 1234, 5678, затем .bss) на одной
+    # странице; ELF собирает shared_elf.py из двоичного кода этой программы
+    .option norvc
+    li a7, 1
+    lw a0, 0x40(zero)
+    ecall
+    lw a0, 0x44(zero)
+    ecall
+    lw a0, 0x48(zero)
+    ecall
+    li t0, 77
+    sw t0, 0x4C(zero)
+    lw a0, 0x4C(zero)
+    ecall
+    ebreak
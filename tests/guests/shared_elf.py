@@ -0,0 +1,16 @@
+# ELF32 RISC-V из кода shared.s: два сегмента PT_LOAD на одной странице
+# python3 shared_elf.py shared.bin shared.elf
+import struct, sys
+
+code = open(sys.argv[1], 'rb').read()
+data = struct.pack('<2I', 1234, 5678)
+text_off, data_off, data_addr, data_mem = 0x1000, 0x1040, 0x40, 16
+assert len(code) <= data_addr
+
+eh = b'\x7fELF' + bytes([1, 1, 1]) + bytes(9) + struct.pack('<HHIIIIIHHHHHH', 2, 243, 1, 0, 52, 0, 0, 52, 32, 2, 40, 0, 0)
+ph = struct.pack('<8I', 1, text_off, 0, 0, len(code), len(code), 5, 0x1000)       # R+X
+ph += struct.pack('<8I', 1, data_off, data_addr, data_addr, len(data), data_mem, 6, 0x1000)  # R+W
+image = bytearray(eh + ph)
+image += bytes(text_off - len(image)) + code
+image += bytes(data_off - len(image)) + data
+open(sys.argv[2], 'wb').write(image)
@@ -0,0 +1,26 @@
+    # Самомодифицирующийся код в горячем цикле: каждую итерацию в тело
+    # записывается одна из двух команд, кэши и блоки движков сбрасываются
+    .option norvc
+    j start
+add1:
+    addi s1, s1, 1
+add3:
+    addi s1, s1, 3
+start:
+    li s0, 1000
+    li s1, 0
+    li a7, 1
+loop:
+    auipc t0, 0
+    andi t1, s0, 1
+    slli t1, t1, 2
+    add t1, t1, t0
+    lw t2, -20(t1)         # add1 - loop
+    sw t2, 24(t0)          # body - loop
+body:
+    addi s1, s1, 1
+    addi s0, s0, -1
+    bnez s0, loop
+    mv a0, s1
+    ecall
+    ebreak
@@ -0,0 +1,16 @@
+    # Запись в x0 — подсказка без эффекта: x0 остаётся нулём в том же блоке
+    auipc x0, 1
+    addi a7, x0, 1
+    add a0, x0, x0
+    ecall
+    lui x0, 0x12345
+    add a0, x0, x0
+    ecall
+    auipc x0, 0xfffff
+    addi x0, x0, 5
+    addi a0, x0, 7
+    ecall
+    slli x0, a0, 3
+    sub a0, a0, x0
+    ecall
+    ebreak
@@ -0,0 +1,43 @@
+# Runs risc-z on a guest program and compares what it printed with a file.
+#
+#   RISCZ   simulator
+#   ARGS    arguments, a list
+#   ARGS2   arguments of a second run whose output is appended (restore
+#           of a checkpoint written by the first one), optional
+#   INPUT   standard input of every run, optional
+#   EXPECT  expected standard output, followed by the "Stopped:" line of
+#           each run; wall times of batch results are replaced by "-"
+#   STATUS  expected exit code of the last run
+
+function(rz_run args out_var status_var)
+    if(INPUT)
+        set(input INPUT_FILE ${INPUT})
+    else()
+        set(input INPUT_FILE /dev/null)
+    endif()
+    execute_process(COMMAND ${RISCZ} --quiet ${args} ${input}
+                    OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    string(REGEX MATCH "Stopped: [^\n]*\n" stopped "${err}")
+    string(REGEX REPLACE "(\n|^)([0-9]+\t[^\t\n]*\t[0-9]+\t)[0-9]+\t" "\\1\\2-\t" out "${out}")
+    set(${out_var} "${out}${stopped}" PARENT_SCOPE)
+    set(${status_var} ${status} PARENT_SCOPE)
+    if(NOT status EQUAL STATUS)
+        message("${err}")
+    endif()
+endfunction()
+
+string(REPLACE "|" ";" ARGS "${ARGS}")
+string(REPLACE "|" ";" ARGS2 "${ARGS2}")
+rz_run("${ARGS}" out status)
+if(ARGS2)
+    rz_run("${ARGS2}" out2 status)
+    string(APPEND out "${out2}")
+endif()
+
+file(READ ${EXPECT} expect)
+if(NOT out STREQUAL expect)
+    message(FATAL_ERROR "Output differs from ${EXPECT}:\n${out}")
+endif()
+if(NOT status EQUAL STATUS)
+    message(FATAL_ERROR "Exit code ${status}, expected ${STATUS}")
+endif()
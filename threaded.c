@@ -0,0 +1,500 @@
+#include <stdint.h>
+#include <stdlib.h> // calloc, free
+#include <string.h> // memset
+
+#include "threaded.h"
+#include "exec.h"   // Семантика операций, общая с интерпретатором
+#include "memory.h"
+#include "profile.h"
+
+#define TC_BLOCK_MAX 64            // Максимальная длина блока в инструкциях
+#define TC_POOL_SIZE (1UL << 20)   // Память под транслированные блоки
+
+// Computed goto есть в GCC и Clang, иначе — switch внутри блока
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RZ_NO_COMPUTED_GOTO)
+#define TC_COMPUTED_GOTO 1
+#endif
+
+// Служебные обработчики, не соответствующие операциям
+enum rz_tc_handlers : unsigned
+{
+    TH_NOP = RZ_OP_COUNT, // запись в x0, FENCE
+    TH_FALL,              // выход из блока на следующий по порядку
+    TH_INTERP,            // инструкция исполняется интерпретатором
+    TH_COUNT,
+};
+
+// Инструкция шитого кода
+typedef struct
+{
+    const void *handler;
+    rz_decoded_t d;
+} rz_tinsn_t;
+
+// Базовый блок и прямые ссылки на блоки-преемники
+typedef struct rz_block_s
+{
+    rz_address_t pc;             // адрес первой инструкции
+    rz_address_t taken_pc;       // цель перехода последней инструкции
+    rz_address_t fall_pc;        // адрес после блока
+    unsigned count;              // инструкций, исполняемых самим блоком
+    unsigned length;             // записей в code[], с завершающей TH_FALL
+    uint64_t execs;              // входов в блок с последнего переноса в счётчики
+    uint64_t taken;              // из них выходов по переходу
+    struct rz_block_s *link[2];  // [0] — по переходу, [1] — по порядку
+    rz_tinsn_t code[];
+} rz_block_t;
+
+struct rz_threaded_s
+{
+    rz_block_t **map; // блоки по (pc - base) / 2
+    rz_address_t base;
+    size_t count;
+    uint8_t *pool;
+    size_t pool_used;
+    unsigned generation; // поколение кэша инструкций, из которого собраны блоки
+    rz_counters_t *counters; // счётчики CPU, в которые переносятся исполнения блоков
+};
+
+static inline size_t rz_block_size(unsigned length)
+{
+    return (sizeof(rz_block_t) + length * sizeof(rz_tinsn_t) + 15) & ~(size_t)15;
+}
+
+void rz_threaded_fold(rz_threaded_p pth)
+{
+    if (!pth)
+        return;
+    for (size_t at = 0; at < pth->pool_used;)
+    {
+        rz_block_t *b = (rz_block_t *)(pth->pool + at);
+        at += rz_block_size(b->length);
+        if (!b->execs)
+            continue;
+        for (unsigned i = 0; i < b->count; ++i)
+            pth->counters->ops[b->code[i].d.op] += b->execs;
+        // Выход по переходу у JAL безусловный — считаются только ветвления
+        if (b->count && rz_op_format(b->code[b->count - 1].d.op) == 'B')
+            pth->counters->taken += b->taken;
+        b->execs = b->taken = 0;
+    }
+}
+
+void rz_threaded_free(rz_threaded_p pth)
+{
+    if (!pth)
+        return;
+    rz_threaded_fold(pth);
+    free(pth->map);
+    free(pth->pool);
+    free(pth);
+}
+
+static rz_threaded_p rz_threaded_create(rz_cpu_p pcpu)
+{
+    rz_threaded_p pth = calloc(1, sizeof(rz_threaded_t));
+    if (!pth)
+        return NULL;
+    pth->base = pcpu->icache.base;
+    pth->generation = pcpu->icache.generation;
+    pth->count = pcpu->icache.count;
+    pth->counters = &pcpu->counters;
+    pth->map = calloc(pth->count, sizeof(rz_block_t *));
+    pth->pool = malloc(TC_POOL_SIZE);
+    if (!pth->map || !pth->pool)
+    {
+        rz_threaded_free(pth);
+        return NULL;
+    }
+    return pth;
+}
+
+// Сброс всех блоков: ссылки между ними становятся недействительными
+static void rz_threaded_flush(rz_threaded_p pth, unsigned generation)
+{
+    rz_threaded_fold(pth);
+    memset(pth->map, 0, pth->count * sizeof(rz_block_t *));
+    pth->pool_used = 0;
+    pth->generation = generation;
+}
+
+static inline rz_block_t *rz_threaded_lookup(rz_threaded_p pth, rz_address_t pc)
+{
+    rz_address_t index = (pc - pth->base) / RZ_INSN_ALIGN;
+    if (index >= pth->count || (pc & (RZ_INSN_ALIGN - 1)))
+        return NULL;
+    return pth->map[index];
+}
+
+// Трансляция блока начиная с pc; NULL — pc вне текста или кончился пул
+static rz_block_t *rz_threaded_translate(rz_cpu_p pcpu, rz_threaded_p pth, rz_address_t pc,
+                                         const void *const *handlers)
+{
+    size_t need = sizeof(rz_block_t) + (TC_BLOCK_MAX + 1) * sizeof(rz_tinsn_t);
+    if (pth->pool_used + need > TC_POOL_SIZE)
+        return NULL;
+
+    rz_block_t *b = (rz_block_t *)(pth->pool + pth->pool_used);
+    b->pc = pc;
+    b->taken_pc = 0;
+    b->execs = b->taken = 0;
+    b->link[0] = b->link[1] = NULL;
+
+    unsigned n = 0;
+    bool end = false, interp = false;
+    while (!end && n < TC_BLOCK_MAX)
+    {
+        rz_decoded_p slot = rz_icache_slot(&pcpu->icache, pc);
+        if (!slot)
+            break;
+        if (slot->op == RZ_OP_UNDECODED)
+        {
+            // Ошибку выборки сообщит интерпретатор
+            rz_register_t raw;
+            if (mem_fetch(pcpu->mem, pc, &raw) != MEM_OK)
+                break;
+            rz_decode(raw, slot);
+        }
+
+        rz_tinsn_t *ti = &b->code[n++];
+        ti->d = *slot;
+        unsigned h = slot->op;
+
+        // Вызовы и возвраты видит профилировщик — через интерпретатор
+        switch (pcpu->profile && rz_profile_is_linkage(slot) ? RZ_OP_ECALL : slot->op)
+        {
+        case RZ_OP_AUIPC:
+            // PC известен при трансляции — это просто константа; x0 не пишется
+            h = slot->rd == 0 ? TH_NOP : RZ_OP_LUI;
+            ti->d.imm = pc + slot->imm;
+            break;
+        case RZ_OP_FENCE:
+            h = TH_NOP;
+            break;
+        case RZ_OP_JAL:
+        case RZ_OP_BEQ:
+        case RZ_OP_BNE:
+        case RZ_OP_BLT:
+        case RZ_OP_BGE:
+        case RZ_OP_BLTU:
+        case RZ_OP_BGEU:
+            b->taken_pc = pc + slot->imm;
+            end = true;
+            break;
+        case RZ_OP_JALR:
+            end = true;
+            break;
+        case RZ_OP_LB:
+        case RZ_OP_LH:
+        case RZ_OP_LW:
+        case RZ_OP_LBU:
+        case RZ_OP_LHU:
+        case RZ_OP_SB:
+        case RZ_OP_SH:
+        case RZ_OP_SW:
+            // Доступ к памяти может завершиться ошибкой даже при rd = x0
+            break;
+        case RZ_OP_ECALL:
+        case RZ_OP_EBREAK:
+        case RZ_OP_BREAKPOINT:
+        case RZ_OP_FENCE_I:
+        case RZ_OP_CSRRW:
+        case RZ_OP_CSRRS:
+        case RZ_OP_CSRRC:
+        case RZ_OP_CSRRWI:
+        case RZ_OP_CSRRSI:
+        case RZ_OP_CSRRCI:
+        case RZ_OP_ILLEGAL:
+            h = TH_INTERP;
+            end = interp = true;
+            break;
+        default:
+            // Остальные операции пишут только rd: запись в x0 не нужна
+            if (slot->rd == 0)
+                h = TH_NOP;
+            break;
+        }
+        ti->handler = handlers[h];
+        pc += slot->size;
+    }
+
+    if (n == 0)
+        return NULL;
+    // Последнюю инструкцию через интерпретатор считает rz_cycle
+    b->count = interp ? n - 1 : n;
+    if (!end)
+        b->code[n++].handler = handlers[TH_FALL];
+
+    b->fall_pc = pc;
+    b->length = n;
+    pth->pool_used += rz_block_size(n);
+    pth->map[(b->pc - pth->base) / RZ_INSN_ALIGN] = b;
+    return b;
+}
+
+#ifdef TC_COMPUTED_GOTO
+#define TC_HANDLER(id) &&l_##id
+#define TC_LABEL(id) l_##id
+#define TC_DISPATCH() goto *ip->handler
+#define TC_SWITCH_BEGIN
+#define TC_SWITCH_END
+#else
+#define TC_LABEL(id) case id
+#define TC_DISPATCH() goto dispatch
+#define TC_SWITCH_BEGIN \
+    dispatch:           \
+    switch ((uintptr_t)ip->handler)  \
+    {
+#define TC_SWITCH_END }
+#endif
+
+// Адрес инструкции блока: длины инструкций разные, поэтому суммируются
+static rz_address_t rz_block_pc(const rz_block_t *b, const rz_tinsn_t *ip)
+{
+    rz_address_t pc = b->pc;
+    for (const rz_tinsn_t *i = b->code; i < ip; ++i)
+        pc += i->d.size;
+    return pc;
+}
+
+// Блок покинут досрочно: инструкции с from до конца уже учтены во входе
+// в блок, но не исполнены
+static void rz_threaded_unretire(rz_threaded_p pth, const rz_block_t *b, unsigned from)
+{
+    for (unsigned i = from; i < b->count; ++i)
+        --pth->counters->ops[b->code[i].d.op];
+}
+
+// Исполнение одной инструкции интерпретатором с учётом бюджета
+static inline bool rz_threaded_step(rz_cpu_p pcpu)
+{
+    if (!rz_cycle(pcpu))
+        return false;
+    --pcpu->budget;
+    return true;
+}
+
+rz_stop_t rz_threaded_run(rz_cpu_p pcpu)
+{
+    if (!pcpu->threaded && !(pcpu->threaded = rz_threaded_create(pcpu)))
+    {
+        while (pcpu->budget > 0)
+            if (!rz_threaded_step(pcpu))
+                return pcpu->stop;
+        return RZ_STOP_BUDGET;
+    }
+
+#ifdef TC_COMPUTED_GOTO
+    static const void *const handlers[TH_COUNT] = {
+        [RZ_OP_UNDECODED] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_ILLEGAL] = TC_HANDLER(TH_INTERP),
+#define TC_ENTRY(name, ...) [RZ_OP_##name] = TC_HANDLER(RZ_OP_##name),
+        RZ_EXEC_SIMPLE(TC_ENTRY)
+        RZ_EXEC_LOAD(TC_ENTRY)
+        RZ_EXEC_BRANCH(TC_ENTRY)
+        RZ_EXEC_STORE(TC_ENTRY)
+#undef TC_ENTRY
+        [RZ_OP_AUIPC] = TC_HANDLER(RZ_OP_LUI),
+        [RZ_OP_JAL] = TC_HANDLER(RZ_OP_JAL),
+        [RZ_OP_JALR] = TC_HANDLER(RZ_OP_JALR),
+        [RZ_OP_FENCE] = TC_HANDLER(TH_NOP),
+        [RZ_OP_FENCE_I] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_ECALL] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_EBREAK] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_BREAKPOINT] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRW] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRS] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRC] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRWI] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRSI] = TC_HANDLER(TH_INTERP),
+        [RZ_OP_CSRRCI] = TC_HANDLER(TH_INTERP),
+        [TH_NOP] = TC_HANDLER(TH_NOP),
+        [TH_FALL] = TC_HANDLER(TH_FALL),
+        [TH_INTERP] = TC_HANDLER(TH_INTERP),
+    };
+#else
+    const void *handlers[TH_COUNT];
+    for (uintptr_t i = 0; i < TH_COUNT; ++i)
+        handlers[i] = (const void *)i;
+#endif
+
+    rz_threaded_p pth = pcpu->threaded;
+    rz_register_t *x = pcpu->r_x;
+    rz_block_t **patch = NULL; // ссылка, которую нужно заполнить следующим блоком
+    rz_block_t *b;
+    const rz_tinsn_t *ip;
+    const rz_decoded_t *d;
+    rz_address_t next_pc;
+
+    for (;;)
+    {
+        x[0] = 0u;
+        if (pcpu->budget <= 0)
+            return RZ_STOP_BUDGET;
+        if (pth->generation != pcpu->icache.generation)
+        {
+            // Код изменён записью в текст или FENCE.I
+            rz_threaded_flush(pth, pcpu->icache.generation);
+            patch = NULL;
+        }
+
+        b = rz_threaded_lookup(pth, pcpu->r_pc);
+        if (!b && rz_icache_slot(&pcpu->icache, pcpu->r_pc))
+        {
+            b = rz_threaded_translate(pcpu, pth, pcpu->r_pc, handlers);
+            if (!b)
+            {
+                // Пул кончился — начинаем трансляцию заново
+                rz_threaded_flush(pth, pcpu->icache.generation);
+                patch = NULL;
+                b = rz_threaded_translate(pcpu, pth, pcpu->r_pc, handlers);
+            }
+        }
+        if (patch && b)
+            *patch = b;
+        patch = NULL;
+        if (!b || pcpu->budget < b->count)
+        {
+            // Код вне области текста и остаток бюджета меньше блока —
+            // по одной инструкции интерпретатором
+            if (!rz_threaded_step(pcpu))
+                return pcpu->stop;
+            continue;
+        }
+
+    enter:
+        if (pcpu->budget < b->count)
+        {
+            pcpu->r_pc = b->pc;
+            continue;
+        }
+        pcpu->budget -= b->count;
+        ++b->execs;
+        ip = b->code;
+        TC_DISPATCH();
+
+        TC_SWITCH_BEGIN
+
+#define TC_CASE_SIMPLE(name, expr) \
+    TC_LABEL(RZ_OP_##name) :       \
+        d = &ip->d;                \
+        expr;                      \
+        ++ip;                      \
+        TC_DISPATCH();
+        RZ_EXEC_SIMPLE(TC_CASE_SIMPLE)
+#undef TC_CASE_SIMPLE
+
+#define TC_CASE_BRANCH(name, cond) \
+    TC_LABEL(RZ_OP_##name) :       \
+        d = &ip->d;                \
+        if (cond)                  \
+            goto taken;            \
+        goto fall;
+        RZ_EXEC_BRANCH(TC_CASE_BRANCH)
+#undef TC_CASE_BRANCH
+
+#define TC_CASE_LOAD(name, bits, type)                                          \
+    TC_LABEL(RZ_OP_##name) :                                                    \
+    {                                                                           \
+        d = &ip->d;                                                             \
+        uint##bits##_t val;                                                     \
+        if (mem_load##bits(pcpu->mem, RZ_EXEC_ADDR, &val) != MEM_OK)            \
+            goto fault;                                                         \
+        x[d->rd] = (rz_register_t)(type)val;                                    \
+        x[0] = 0u;                                                              \
+        ++ip;                                                                   \
+        TC_DISPATCH();                                                          \
+    }
+        RZ_EXEC_LOAD(TC_CASE_LOAD)
+#undef TC_CASE_LOAD
+
+#define TC_CASE_STORE(name, bits)                                                  \
+    TC_LABEL(RZ_OP_##name) :                                                       \
+    {                                                                              \
+        d = &ip->d;                                                                \
+        rz_address_t addr = RZ_EXEC_ADDR;                                          \
+        if (mem_store##bits(pcpu->mem, addr, (uint##bits##_t)x[d->rs2]) != MEM_OK) \
+            goto fault;                                                            \
+        if (addr - pth->base < pth->count * RZ_INSN_ALIGN)                         \
+            goto modified;                                                         \
+        ++ip;                                                                      \
+        TC_DISPATCH();                                                             \
+    }
+        RZ_EXEC_STORE(TC_CASE_STORE)
+#undef TC_CASE_STORE
+
+    TC_LABEL(RZ_OP_JAL) :
+        d = &ip->d;
+        x[d->rd] = b->fall_pc;
+        x[0] = 0u;
+        goto taken;
+
+    TC_LABEL(RZ_OP_JALR) :
+        d = &ip->d;
+        next_pc = RZ_EXEC_ADDR & ~1u;
+        x[d->rd] = b->fall_pc;
+        x[0] = 0u;
+        // Цель динамическая: ищем блок по карте, без патча ссылок
+        if ((b = rz_threaded_lookup(pth, next_pc)) != NULL)
+            goto enter;
+        pcpu->r_pc = next_pc;
+        continue;
+
+    TC_LABEL(TH_NOP) :
+        ++ip;
+        TC_DISPATCH();
+
+    TC_LABEL(TH_FALL) :
+        goto fall;
+
+    TC_LABEL(TH_INTERP) :
+        // ECALL, EBREAK, FENCE.I и недопустимые инструкции — медленный путь
+        pcpu->r_pc = rz_block_pc(b, ip);
+        if (pcpu->budget <= 0)
+            return RZ_STOP_BUDGET;
+        if (!rz_threaded_step(pcpu))
+            return pcpu->stop;
+        continue;
+
+        TC_SWITCH_END
+
+    modified:
+        // Запись в область текста: инвалидация сменит поколение и сбросит блоки
+        rz_icache_invalidate(&pcpu->icache, RZ_EXEC_ADDR, 4);
+        pcpu->r_pc = rz_block_pc(b, ip + 1);
+        // Инструкции после записи не исполнены — возвращаем их в бюджет
+        pcpu->budget += b->count - (ip - b->code + 1);
+        rz_threaded_unretire(pth, b, (unsigned)(ip - b->code + 1));
+        continue;
+
+    fault:
+        // Ошибку доступа сообщает интерпретатор, повторив инструкцию
+        pcpu->r_pc = rz_block_pc(b, ip);
+        pcpu->budget += b->count - (ip - b->code);
+        rz_threaded_unretire(pth, b, (unsigned)(ip - b->code));
+        if (!rz_threaded_step(pcpu))
+            return pcpu->stop;
+        continue;
+
+    taken:
+        ++b->taken;
+        if (b->link[0])
+        {
+            b = b->link[0];
+            goto enter;
+        }
+        patch = &b->link[0];
+        pcpu->r_pc = b->taken_pc;
+        continue;
+
+    fall:
+        if (b->link[1])
+        {
+            b = b->link[1];
+            goto enter;
+        }
+        patch = &b->link[1];
+        pcpu->r_pc = b->fall_pc;
+        continue;
+    }
+}
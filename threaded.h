@@ -0,0 +1,39 @@
+#ifndef __THREADED_H__
+#define __THREADED_H__
+
+#include "cpu.h"
+
+/**
+ * @brief State of threaded-code engine: translated basic blocks of
+ * the text region linked directly to their successors
+ *
+ */
+struct rz_threaded_s;
+typedef struct rz_threaded_s rz_threaded_t, *rz_threaded_p;
+
+/**
+ * @brief Run CPU with threaded-code engine while pcpu->budget lasts
+ *
+ * Blocks are translated on first execution and chained to successors,
+ * code outside the text region is executed by rz_cycle.
+ *
+ * @param pcpu pointer to CPU instance
+ * @return rz_stop_t RZ_STOP_BUDGET or the reason CPU stopped
+ */
+rz_stop_t rz_threaded_run(rz_cpu_p pcpu);
+
+/**
+ * @brief Add executions of translated blocks to CPU counters
+ *
+ * @param pth engine state, may be NULL
+ */
+void rz_threaded_fold(rz_threaded_p pth);
+
+/**
+ * @brief Release engine state attached to CPU, counters are folded first
+ *
+ * @param pth engine state, may be NULL
+ */
+void rz_threaded_free(rz_threaded_p pth);
+
+#endif // THREADED_H__
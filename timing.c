@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h> // calloc, free, strtoul
+#include <string.h> // strcmp, strncmp
+
+#include "timing.h"
+#include "memory.h"
+
+// Кэш одного уровня: set-associative, замена LRU по меткам обращений
+typedef struct
+{
+    rz_cache_config_t config;
+    unsigned line_shift;
+    uint32_t set_mask;
+    uint32_t *tags; // номер строки + 1, 0 — пустой путь; NULL — идеальный кэш
+    uint64_t *used; // метка последнего обращения к пути
+    uint64_t clock;
+    uint64_t accesses, misses;
+} rz_cache_t;
+
+struct rz_timing_s
+{
+    rz_timing_config_t config;
+    rz_cache_t icache, dcache;
+
+    uint8_t *counters;     // двухбитные счётчики предсказателя
+    rz_address_t *targets; // последние цели JALR, кроме возвратов
+    uint32_t entry_mask, history, history_mask;
+    rz_address_t ras[RZ_TIMING_RAS_DEPTH];
+    unsigned ras_top; // кольцевой стек: переполнение затирает старые адреса
+
+    uint8_t load_rd; // приёмник загрузки предыдущей инструкции, 0 — нет
+    uint64_t cycles, instructions;
+    uint64_t branches, mispredicts, load_use_stalls;
+};
+
+static bool rz_is_pow2(uint32_t value)
+{
+    return value && !(value & (value - 1));
+}
+
+static unsigned rz_log2(uint32_t value)
+{
+    unsigned shift = 0;
+    while (value >>= 1)
+        ++shift;
+    return shift;
+}
+
+void rz_timing_default(rz_timing_config_t *config)
+{
+    *config = (rz_timing_config_t){
+        .icache = {16384, 4, 64, 0, 20},
+        .dcache = {16384, 4, 64, 0, 20},
+        .predictor = RZ_PREDICT_GSHARE,
+        .predictor_entries = 1024,
+        .history_bits = 8,
+        .mispredict_penalty = 2, // переход решается в EX, выбросить IF и ID
+        .taken_penalty = 1,      // цель известна в ID
+        .load_use_penalty = 1,
+        .mul_latency = 3,
+        .div_latency = 20,
+    };
+}
+
+// Размер с необязательным суффиксом k или m
+static bool rz_timing_parse_size(const char *text, char **end, uint32_t *size)
+{
+    unsigned long value = strtoul(text, end, 0);
+    if (*end == text)
+        return false;
+    if (**end == 'k' || **end == 'K')
+        value <<= 10, ++*end;
+    else if (**end == 'm' || **end == 'M')
+        value <<= 20, ++*end;
+    *size = (uint32_t)value;
+    return value <= UINT32_MAX;
+}
+
+bool rz_timing_parse_cache(const char *text, rz_cache_config_t *cache)
+{
+    if (strcmp(text, "off") == 0)
+    {
+        cache->size = 0;
+        cache->latency = cache->miss_penalty = 0;
+        return true;
+    }
+    uint32_t *fields[] = {&cache->size, &cache->ways, &cache->line, &cache->latency, &cache->miss_penalty};
+    char *end;
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        uint32_t value;
+        if (!rz_timing_parse_size(text, &end, &value))
+            return false;
+        *fields[i] = value;
+        if (*end == '\0')
+            return i >= 2; // задержки можно опустить
+        if (*end != ':')
+            return false;
+        text = end + 1;
+    }
+    return false;
+}
+
+bool rz_timing_parse_predictor(const char *text, rz_timing_config_t *config)
+{
+    static const struct
+    {
+        const char *name;
+        rz_predictor_t kind;
+    } names[] = {
+        {"none", RZ_PREDICT_NOT_TAKEN},
+        {"btfn", RZ_PREDICT_BTFN},
+        {"bimodal", RZ_PREDICT_BIMODAL},
+        {"gshare", RZ_PREDICT_GSHARE},
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        size_t len = strlen(names[i].name);
+        if (strncmp(text, names[i].name, len) != 0 || (text[len] != '\0' && text[len] != ':'))
+            continue;
+        config->predictor = names[i].kind;
+        if (text[len] == '\0')
+            return true;
+        char *end;
+        return rz_timing_parse_size(text + len + 1, &end, &config->predictor_entries) && *end == '\0';
+    }
+    return false;
+}
+
+static bool rz_cache_init(rz_cache_t *c, const rz_cache_config_t *config, const char *name)
+{
+    c->config = *config;
+    if (!config->size)
+        return true;
+    if (!rz_is_pow2(config->line) || config->line < 4 || !config->ways ||
+        config->size % (config->ways * config->line) || !rz_is_pow2(config->size / (config->ways * config->line)))
+    {
+        fprintf(stderr, "%s: %u bytes, %u ways, %u-byte lines is not a valid cache\n", name, config->size,
+                config->ways, config->line);
+        return false;
+    }
+    size_t lines = config->size / config->line;
+    c->line_shift = rz_log2(config->line);
+    c->set_mask = (uint32_t)(lines / config->ways - 1);
+    c->tags = calloc(lines, sizeof(uint32_t));
+    c->used = calloc(lines, sizeof(uint64_t));
+    return c->tags && c->used;
+}
+
+rz_timing_p rz_timing_create(const rz_timing_config_t *config)
+{
+    rz_timing_p t = calloc(1, sizeof(rz_timing_t));
+    if (!t)
+        return NULL;
+    t->config = *config;
+    if (!rz_is_pow2(config->predictor_entries))
+    {
+        fprintf(stderr, "Predictor: %u entries is not a power of two\n", config->predictor_entries);
+        free(t);
+        return NULL;
+    }
+    if (config->history_bits > 31)
+    {
+        fprintf(stderr, "Predictor: history of %u bits is longer than 31\n", config->history_bits);
+        free(t);
+        return NULL;
+    }
+    t->entry_mask = config->predictor_entries - 1;
+    t->history_mask = (1u << config->history_bits) - 1;
+    t->counters = malloc(config->predictor_entries);
+    t->targets = calloc(config->predictor_entries, sizeof(rz_address_t));
+    if (!rz_cache_init(&t->icache, &config->icache, "L1I") || !rz_cache_init(&t->dcache, &config->dcache, "L1D") ||
+        !t->counters || !t->targets)
+    {
+        rz_timing_free(t);
+        return NULL;
+    }
+    memset(t->counters, 1, config->predictor_entries); // слабо «не перейдёт»
+    return t;
+}
+
+void rz_timing_free(rz_timing_p timing)
+{
+    if (!timing)
+        return;
+    free(timing->icache.tags);
+    free(timing->icache.used);
+    free(timing->dcache.tags);
+    free(timing->dcache.used);
+    free(timing->counters);
+    free(timing->targets);
+    free(timing);
+}
+
+void rz_timing_attach(rz_cpu_p pcpu, rz_timing_p timing)
+{
+    pcpu->timing = timing;
+}
+
+// Обращение к строке: такты простоя, задержка попадания или промаха
+static unsigned rz_cache_access(rz_cache_t *c, rz_address_t addr)
+{
+    ++c->accesses;
+    if (!c->tags)
+        return c->config.latency;
+    uint32_t line = addr >> c->line_shift;
+    size_t set = (size_t)(line & c->set_mask) * c->config.ways;
+    uint32_t *tags = c->tags + set;
+    uint64_t *used = c->used + set;
+    unsigned victim = 0;
+    for (unsigned w = 0; w < c->config.ways; ++w)
+    {
+        if (tags[w] == line + 1)
+        {
+            used[w] = ++c->clock;
+            return c->config.latency;
+        }
+        if (used[w] < used[victim])
+            victim = w;
+    }
+    ++c->misses;
+    tags[victim] = line + 1;
+    used[victim] = ++c->clock;
+    return c->config.latency + c->config.miss_penalty;
+}
+
+// Предсказание условного перехода и обучение по его исходу
+static bool rz_timing_predict(rz_timing_p t, rz_address_t pc, bool backward, bool taken)
+{
+    if (t->config.predictor == RZ_PREDICT_NOT_TAKEN)
+        return !taken;
+    if (t->config.predictor == RZ_PREDICT_BTFN)
+        return backward == taken;
+
+    uint32_t at = pc >> 1;
+    if (t->config.predictor == RZ_PREDICT_GSHARE)
+    {
+        at ^= t->history;
+        t->history = ((t->history << 1) | taken) & t->history_mask;
+    }
+    uint8_t *counter = &t->counters[at & t->entry_mask];
+    bool predicted = *counter >= 2;
+    if (taken && *counter < 3)
+        ++*counter;
+    else if (!taken && *counter > 0)
+        --*counter;
+    return predicted == taken;
+}
+
+static void rz_timing_push(rz_timing_p t, rz_address_t ret)
+{
+    t->ras[t->ras_top] = ret;
+    t->ras_top = (t->ras_top + 1) % RZ_TIMING_RAS_DEPTH;
+}
+
+// JALR: возврат предсказывается стеком адресов возврата, прочие — последней целью
+static bool rz_timing_predict_jalr(rz_timing_p t, const rz_decoded_t *d, rz_address_t pc, rz_address_t next)
+{
+    bool link = d->rd == 1 || d->rd == 5;
+    bool ret = !link && (d->rs1 == 1 || d->rs1 == 5);
+    bool hit;
+    if (ret)
+    {
+        t->ras_top = (t->ras_top - 1) % RZ_TIMING_RAS_DEPTH;
+        hit = t->ras[t->ras_top] == next;
+    }
+    else
+    {
+        rz_address_t *target = &t->targets[(pc >> 1) & t->entry_mask];
+        hit = *target == next;
+        *target = next;
+    }
+    if (link)
+        rz_timing_push(t, pc + d->size);
+    return hit;
+}
+
+void rz_timing_retire(rz_timing_p t, const rz_decoded_t *d, rz_address_t pc, rz_address_t addr, rz_address_t next)
+{
+    uint64_t cycles = 1 + rz_cache_access(&t->icache, pc);
+    // 32-битная инструкция RV32C может пересечь границу строки
+    if (t->icache.config.size && ((pc + d->size - 1) ^ pc) >> t->icache.line_shift)
+        cycles += rz_cache_access(&t->icache, pc + d->size - 1);
+
+    // Загруженное значение готово только после MEM — зависимая инструкция ждёт
+    char format = rz_op_format(d->op);
+    bool reads_rs2 = format == 'R' || format == 'S' || format == 'B';
+    bool reads_rs1 = reads_rs2 || format == 'I' || format == 'L';
+    if (t->load_rd && ((reads_rs1 && d->rs1 == t->load_rd) || (reads_rs2 && d->rs2 == t->load_rd)))
+    {
+        cycles += t->config.load_use_penalty;
+        ++t->load_use_stalls;
+    }
+    t->load_rd = format == 'L' ? d->rd : 0;
+
+    switch (format)
+    {
+    case 'L':
+    case 'S':
+        cycles += rz_cache_access(&t->dcache, addr);
+        break;
+    case 'B':
+    {
+        bool taken = next != pc + d->size;
+        ++t->branches;
+        if (!rz_timing_predict(t, pc, (int32_t)d->imm < 0, taken))
+        {
+            cycles += t->config.mispredict_penalty;
+            ++t->mispredicts;
+        }
+        else if (taken)
+            cycles += t->config.taken_penalty;
+        break;
+    }
+    case 'J':
+        cycles += t->config.taken_penalty;
+        if (d->rd == 1 || d->rd == 5)
+            rz_timing_push(t, pc + d->size);
+        break;
+    default:
+        if (d->op == RZ_OP_JALR)
+        {
+            ++t->branches;
+            if (rz_timing_predict_jalr(t, d, pc, next))
+                cycles += t->config.taken_penalty;
+            else
+            {
+                cycles += t->config.mispredict_penalty;
+                ++t->mispredicts;
+            }
+        }
+        else if (d->op >= RZ_OP_MUL && d->op <= RZ_OP_MULHU && t->config.mul_latency)
+            cycles += t->config.mul_latency - 1;
+        else if (d->op >= RZ_OP_DIV && d->op <= RZ_OP_REMU && t->config.div_latency)
+            cycles += t->config.div_latency - 1;
+        break;
+    }
+    t->cycles += cycles;
+    ++t->instructions;
+}
+
+// Интерпретатор модели времени: запись и адрес обращения к памяти снимаются
+// до исполнения, исход перехода — по PC после него. Исполняет rz_cycle, а
+// не встроенный цикл интерпретатора, — пары не сливаются, модель видит
+// каждую инструкцию
+rz_stop_t rz_timing_run(rz_cpu_p pcpu)
+{
+    rz_timing_p timing = pcpu->timing;
+    int64_t budget = pcpu->budget;
+    while (budget > 0)
+    {
+        pcpu->budget = budget;
+        rz_address_t pc = pcpu->r_pc;
+        rz_decoded_t insn; // копия: инструкция может переписать собственную запись
+        const rz_decoded_t *d = rz_icache_slot(&pcpu->icache, pc);
+        rz_register_t raw;
+        if (d != NULL && d->op != RZ_OP_UNDECODED)
+            insn = *d;
+        else if (mem_fetch(pcpu->mem, pc, &raw) == MEM_OK)
+            rz_decode(raw, &insn);
+        else
+            insn = (rz_decoded_t){.op = RZ_OP_UNDECODED}; // ошибку выборки сообщит rz_cycle
+        pcpu->r_x[0] = 0u;
+        rz_address_t addr = pcpu->r_x[insn.rs1] + insn.imm;
+        if (!rz_cycle(pcpu))
+            return pcpu->stop;
+        rz_timing_retire(timing, &insn, pc, addr, pcpu->r_pc);
+        budget = pcpu->budget - 1;
+    }
+    pcpu->budget = 0;
+    return RZ_STOP_BUDGET;
+}
+
+uint64_t rz_timing_cycles(const rz_timing_t *timing)
+{
+    return timing->cycles;
+}
+
+void rz_timing_get_stats(const rz_timing_t *t, rz_timing_stats_t *stats)
+{
+    *stats = (rz_timing_stats_t){
+        .cycles = t->cycles,
+        .instructions = t->instructions,
+        .icache_accesses = t->icache.accesses,
+        .icache_misses = t->icache.misses,
+        .dcache_accesses = t->dcache.accesses,
+        .dcache_misses = t->dcache.misses,
+        .branches = t->branches,
+        .mispredicts = t->mispredicts,
+        .load_use_stalls = t->load_use_stalls,
+    };
+}
+
+static double rz_percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+void rz_timing_print(const rz_timing_t *t, FILE *out)
+{
+    rz_timing_stats_t s;
+    rz_timing_get_stats(t, &s);
+    fprintf(out, "Timing: %llu cycles, %llu instructions, CPI %.3f\n", (unsigned long long)s.cycles,
+            (unsigned long long)s.instructions, s.instructions ? (double)s.cycles / (double)s.instructions : 0.0);
+    fprintf(out, "  L1I: %llu accesses, %llu misses (%.2f%%)\n", (unsigned long long)s.icache_accesses,
+            (unsigned long long)s.icache_misses, rz_percent(s.icache_misses, s.icache_accesses));
+    fprintf(out, "  L1D: %llu accesses, %llu misses (%.2f%%)\n", (unsigned long long)s.dcache_accesses,
+            (unsigned long long)s.dcache_misses, rz_percent(s.dcache_misses, s.dcache_accesses));
+    fprintf(out, "  Branches: %llu, mispredicted %llu (%.2f%%)\n", (unsigned long long)s.branches,
+            (unsigned long long)s.mispredicts, rz_percent(s.mispredicts, s.branches));
+    fprintf(out, "  Load-use stalls: %llu\n", (unsigned long long)s.load_use_stalls);
+}
@@ -0,0 +1,176 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "cpu.h"
+
+#define RZ_TIMING_RAS_DEPTH 8u // return address stack entries
+
+/**
+ * @brief Cache geometry and costs, size 0 is a perfect cache
+ *
+ */
+typedef struct rz_cache_config_s
+{
+	uint32_t size;		   // bytes, sets = size / (ways * line) must be a power of two
+	uint32_t ways;		   // associativity, LRU replacement
+	uint32_t line;		   // line size in bytes, power of two
+	uint32_t latency;	   // stall cycles of a hit
+	uint32_t miss_penalty; // stall cycles to fill a line
+} rz_cache_config_t;
+
+/**
+ * @brief Conditional branch predictors
+ *
+ */
+typedef enum rz_predictor_e : unsigned
+{
+	RZ_PREDICT_NOT_TAKEN = 0, // static, never taken
+	RZ_PREDICT_BTFN,		  // static, backward taken and forward not taken
+	RZ_PREDICT_BIMODAL,		  // 2-bit counters indexed by PC
+	RZ_PREDICT_GSHARE,		  // 2-bit counters indexed by PC xor global history
+} rz_predictor_t;
+
+/**
+ * @brief Configuration of the in-order core
+ *
+ * Every instruction takes one cycle plus stalls: cache latencies and
+ * misses, load-use hazard, multiply and divide latency, fetch bubble
+ * of correctly predicted taken control transfers and flush of
+ * mispredicted ones. JALR returns are predicted by a return address
+ * stack of RZ_TIMING_RAS_DEPTH entries, other JALR by the last target
+ * seen at that PC in a table of predictor_entries targets indexed by
+ * PC bits from bit 1 up.
+ */
+typedef struct rz_timing_config_s
+{
+	rz_cache_config_t icache, dcache;
+	rz_predictor_t predictor;
+	uint32_t predictor_entries;	 // 2-bit counters and JALR targets, power of two
+	uint32_t history_bits;		 // global history length of gshare, at most 31
+	uint32_t mispredict_penalty; // cycles lost on wrong prediction
+	uint32_t taken_penalty;		 // bubble of correctly predicted taken branch or jump
+	uint32_t load_use_penalty;	 // stall when next instruction reads loaded register
+	uint32_t mul_latency;		 // cycles of multiplication in execute stage
+	uint32_t div_latency;		 // cycles of division and remainder
+} rz_timing_config_t;
+
+/**
+ * @brief Counters of the timing model
+ *
+ */
+typedef struct rz_timing_stats_s
+{
+	uint64_t cycles, instructions;
+	uint64_t icache_accesses, icache_misses;
+	uint64_t dcache_accesses, dcache_misses;
+	uint64_t branches, mispredicts; // conditional branches and JALR
+	uint64_t load_use_stalls;
+} rz_timing_stats_t;
+
+/**
+ * @brief Timing model of one CPU
+ *
+ */
+struct rz_timing_s;
+typedef struct rz_timing_s rz_timing_t, *rz_timing_p;
+
+/**
+ * @brief Fill configuration of the default core: 16 KiB 4-way L1 caches
+ * with 64-byte lines, 1024-entry gshare, five-stage pipeline costs
+ *
+ * @param config output configuration
+ */
+void rz_timing_default(rz_timing_config_t *config);
+
+/**
+ * @brief Parse cache geometry SIZE[k]:WAYS:LINE[:LATENCY[:MISS]]
+ *
+ * @param text cache description, "off" for a perfect cache
+ * @param cache cache configuration, unspecified costs are kept
+ * @return true if text is valid
+ */
+bool rz_timing_parse_cache(const char *text, rz_cache_config_t *cache);
+
+/**
+ * @brief Parse predictor name: none, btfn, bimodal or gshare, optionally :ENTRIES
+ *
+ * @param text predictor description
+ * @param config configuration whose predictor is set
+ * @return true if text is valid
+ */
+bool rz_timing_parse_predictor(const char *text, rz_timing_config_t *config);
+
+/**
+ * @brief Create timing model
+ *
+ * @param config core configuration
+ * @return rz_timing_p model or NULL for invalid geometry or out of memory
+ */
+rz_timing_p rz_timing_create(const rz_timing_config_t *config);
+
+/**
+ * @brief Attach timing model to CPU
+ *
+ * While a model is attached rz_run interprets every instruction through
+ * the model whatever engine is selected; without it execution costs
+ * nothing extra. CSR cycle reads cycles of the attached model.
+ *
+ * @param pcpu pointer to CPU instance
+ * @param timing model, NULL detaches
+ */
+void rz_timing_attach(rz_cpu_p pcpu, rz_timing_p timing);
+
+/**
+ * @brief Run budget of rz_run through the attached model, called by rz_run
+ *
+ * @param pcpu pointer to CPU instance with timing model
+ * @return rz_stop_t why CPU stopped
+ */
+rz_stop_t rz_timing_run(rz_cpu_p pcpu);
+
+/**
+ * @brief Account one retired instruction
+ *
+ * @param timing model
+ * @param d decoded instruction
+ * @param pc address of instruction
+ * @param addr effective address of load or store
+ * @param next PC after instruction
+ */
+void rz_timing_retire(rz_timing_p timing, const rz_decoded_t *d, rz_address_t pc, rz_address_t addr,
+					  rz_address_t next);
+
+/**
+ * @brief Get cycles of retired instructions
+ *
+ * @param timing model
+ * @return uint64_t estimated cycles
+ */
+uint64_t rz_timing_cycles(const rz_timing_t *timing);
+
+/**
+ * @brief Get model counters
+ *
+ * @param timing model
+ * @param stats output counters
+ */
+void rz_timing_get_stats(const rz_timing_t *timing, rz_timing_stats_t *stats);
+
+/**
+ * @brief Print cycles, CPI, miss rates of caches and predictor
+ *
+ * @param timing model
+ * @param out output stream
+ */
+void rz_timing_print(const rz_timing_t *timing, FILE *out);
+
+/**
+ * @brief Release timing model
+ *
+ * @param timing model, may be NULL
+ */
+void rz_timing_free(rz_timing_p timing);
+
+#endif // TIMING_H__
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+#include "decode.h"
+
+// Просмотр двоичных трасс: фильтрация, сводка, перевод в текст или
+// в новый двоичный файл
+
+typedef struct
+{
+    uint64_t first, count;      // номера записей от начала трассы
+    rz_address_t pc_lo, pc_hi;  // включительно
+    rz_address_t addr_lo, addr_hi;
+    bool by_addr;               // только обращения к памяти в диапазоне
+    bool memory;                // только загрузки и записи
+    bool ops_set;
+    bool ops[RZ_OP_COUNT];
+} trace_filter_t;
+
+typedef struct
+{
+    uint64_t records, full, jumps, loads, stores;
+    uint64_t ops[RZ_OP_COUNT];
+    rz_address_t pc_lo, pc_hi, addr_lo, addr_hi;
+} trace_summary_t;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] trace\n"
+            "  --summary            print record counts and instruction mix instead of records\n"
+            "  --output=FILE        write selected records to a new binary trace instead of text\n"
+            "  --compress           deflate blocks of --output\n"
+            "  --first=N            skip records before record N\n"
+            "  --count=N            stop after record first + N\n"
+            "  --pc=LO[:HI]         only records with PC in range\n"
+            "  --op=NAME[,NAME...]  only these mnemonics, e.g. lw,sw,jalr\n"
+            "  --mem                only loads and stores\n"
+            "  --addr=LO[:HI]       only loads and stores with address in range\n",
+            prog);
+}
+
+// Диапазон LO или LO:HI
+static bool parse_range(const char *text, rz_address_t *lo, rz_address_t *hi)
+{
+    char *end;
+    *lo = (rz_address_t)strtoul(text, &end, 0);
+    if (end == text)
+        return false;
+    *hi = *lo;
+    if (*end == ':')
+    {
+        text = end + 1;
+        *hi = (rz_address_t)strtoul(text, &end, 0);
+        if (end == text)
+            return false;
+    }
+    return *end == '\0' && *lo <= *hi;
+}
+
+static bool parse_ops(const char *text, trace_filter_t *f)
+{
+    f->ops_set = true;
+    while (*text)
+    {
+        size_t len = strcspn(text, ",");
+        bool found = false;
+        for (unsigned op = 0; op < RZ_OP_COUNT; ++op)
+        {
+            const char *name = rz_op_name(op);
+            if (strlen(name) == len && strncmp(name, text, len) == 0)
+                found = f->ops[op] = true;
+        }
+        if (!found)
+        {
+            fprintf(stderr, "Unknown instruction %.*s\n", (int)len, text);
+            return false;
+        }
+        text += len + (text[len] == ',');
+    }
+    return true;
+}
+
+// Операция записи; у записей уровня PC слова нет
+static unsigned record_op(const rz_trace_record_t *rec)
+{
+    if (rec->level < RZ_TRACE_FULL)
+        return RZ_OP_UNDECODED;
+    rz_decoded_t d;
+    rz_decode(rec->raw, &d);
+    return d.op;
+}
+
+static bool selected(const trace_filter_t *f, const rz_trace_record_t *rec, unsigned op)
+{
+    if (rec->pc < f->pc_lo || rec->pc > f->pc_hi)
+        return false;
+    if (f->ops_set && !f->ops[op])
+        return false;
+    char format = rz_op_format(op);
+    bool memory = format == 'L' || format == 'S';
+    if ((f->memory || f->by_addr) && !memory)
+        return false;
+    return !f->by_addr || (rec->addr >= f->addr_lo && rec->addr <= f->addr_hi);
+}
+
+static void summarize(trace_summary_t *s, const rz_trace_record_t *rec, unsigned op, rz_address_t expected)
+{
+    if (!s->records++)
+        s->pc_lo = s->pc_hi = rec->pc;
+    if (rec->pc < s->pc_lo)
+        s->pc_lo = rec->pc;
+    if (rec->pc > s->pc_hi)
+        s->pc_hi = rec->pc;
+    if (rec->pc != expected)
+        ++s->jumps;
+    if (rec->level < RZ_TRACE_FULL)
+        return;
+    ++s->full;
+    ++s->ops[op];
+    char format = rz_op_format(op);
+    if (format != 'L' && format != 'S')
+        return;
+    if (!s->loads && !s->stores)
+        s->addr_lo = s->addr_hi = rec->addr;
+    if (rec->addr < s->addr_lo)
+        s->addr_lo = rec->addr;
+    if (rec->addr > s->addr_hi)
+        s->addr_hi = rec->addr;
+    if (format == 'L')
+        ++s->loads;
+    else
+        ++s->stores;
+}
+
+static void print_summary(const trace_summary_t *s, uint64_t total, FILE *out)
+{
+    fprintf(out, "Records: %llu selected of %llu, %llu with instruction words\n", (unsigned long long)s->records,
+            (unsigned long long)total, (unsigned long long)s->full);
+    if (!s->records)
+        return;
+    fprintf(out, "PC range: 0x%08X..0x%08X, %llu non-sequential\n", s->pc_lo, s->pc_hi,
+            (unsigned long long)s->jumps);
+    if (s->loads || s->stores)
+        fprintf(out, "Memory: %llu loads, %llu stores, addresses 0x%08X..0x%08X\n", (unsigned long long)s->loads,
+                (unsigned long long)s->stores, s->addr_lo, s->addr_hi);
+    for (unsigned op = 0; op < RZ_OP_COUNT; ++op)
+        if (s->ops[op])
+            fprintf(out, "  %-10s %12llu  %6.2f%%\n", rz_op_name(op), (unsigned long long)s->ops[op],
+                    100.0 * (double)s->ops[op] / (double)s->full);
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *input = NULL;
+    const char *output = NULL;
+    bool compress = false;
+    bool summary = false;
+    trace_filter_t filter = {.count = UINT64_MAX, .pc_hi = UINT32_MAX};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        bool ok = true;
+        if (strcmp(arg, "--summary") == 0)
+        {
+            summary = true;
+        }
+        else if (strncmp(arg, "--output=", 9) == 0)
+        {
+            output = arg + 9;
+        }
+        else if (strcmp(arg, "--compress") == 0)
+        {
+            compress = true;
+        }
+        else if (strncmp(arg, "--first=", 8) == 0)
+        {
+            filter.first = strtoull(arg + 8, NULL, 0);
+        }
+        else if (strncmp(arg, "--count=", 8) == 0)
+        {
+            filter.count = strtoull(arg + 8, NULL, 0);
+        }
+        else if (strncmp(arg, "--pc=", 5) == 0)
+        {
+            ok = parse_range(arg + 5, &filter.pc_lo, &filter.pc_hi);
+        }
+        else if (strncmp(arg, "--op=", 5) == 0)
+        {
+            ok = parse_ops(arg + 5, &filter);
+        }
+        else if (strcmp(arg, "--mem") == 0)
+        {
+            filter.memory = true;
+        }
+        else if (strncmp(arg, "--addr=", 7) == 0)
+        {
+            ok = parse_range(arg + 7, &filter.addr_lo, &filter.addr_hi);
+            filter.by_addr = true;
+        }
+        else if (arg[0] == '-' && arg[1] == '-')
+        {
+            ok = false;
+        }
+        else
+        {
+            input = arg;
+        }
+        if (!ok)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input || (summary && output))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    rz_trace_reader_p reader = rz_trace_reader_open(input);
+    if (!reader)
+        return 1;
+    rz_trace_writer_p writer = NULL;
+    if (output && !(writer = rz_trace_writer_open(output, compress)))
+    {
+        rz_trace_reader_close(reader);
+        return 1;
+    }
+
+    // Номер записи нужен и при фильтрации: по нему трассу можно сверить с --first
+    trace_summary_t s = {0};
+    rz_trace_record_t rec;
+    rz_address_t expected = 0;
+    uint64_t index = 0;
+    uint64_t last = filter.count > UINT64_MAX - filter.first ? UINT64_MAX : filter.first + filter.count;
+    for (; index < last && rz_trace_reader_next(reader, &rec); ++index)
+    {
+        unsigned op = record_op(&rec);
+        rz_address_t pc = rec.pc;
+        bool take = index >= filter.first && selected(&filter, &rec, op);
+        if (take && summary)
+            summarize(&s, &rec, op, expected);
+        else if (take && writer)
+            rz_trace_writer_put(writer, &rec, 1);
+        else if (take)
+        {
+            printf("%llu: ", (unsigned long long)index);
+            rz_trace_print_record(&rec, stdout);
+        }
+        expected = pc + (rec.level < RZ_TRACE_FULL ? 4u : (rec.raw & 3u) == 3u ? 4u : 2u);
+    }
+
+    bool ok = !rz_trace_reader_failed(reader);
+    if (!ok)
+        fprintf(stderr, "%s: damaged or truncated after %llu records\n", input, (unsigned long long)index);
+    rz_trace_reader_close(reader);
+    if (summary)
+        print_summary(&s, index, stdout);
+    if (writer && !rz_trace_writer_close(writer))
+        ok = false;
+    return ok ? 0 : 1;
+}
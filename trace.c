@@ -0,0 +1,131 @@
+#include <stdlib.h> // calloc, free, strtoul
+#include <string.h> // strcmp
+
+#include "trace.h"
+#include "tracefile.h"
+#include "decode.h" // ленивое форматирование записей через дизассемблер
+
+bool rz_trace_init(rz_trace_p tr, unsigned level, size_t depth)
+{
+    size_t capacity = 1;
+    while (capacity < depth)
+        capacity <<= 1;
+
+    tr->dump_depth = 0;
+    tr->head = tr->streamed = 0;
+    tr->writer = NULL;
+    tr->mask = capacity - 1;
+    tr->ring = NULL;
+    tr->level = RZ_TRACE_OFF;
+
+#if RZ_TRACE_MAX > RZ_TRACE_OFF
+    // Кольцо нужно только если трассировка вообще собрана
+    tr->ring = calloc(capacity, sizeof(rz_trace_record_t));
+    if (!tr->ring)
+        return false;
+    rz_trace_set_level(tr, level);
+#else
+    (void)level;
+#endif
+    return true;
+}
+
+void rz_trace_free(rz_trace_p tr)
+{
+    free(tr->ring);
+    tr->ring = NULL;
+    tr->level = RZ_TRACE_OFF;
+}
+
+unsigned rz_trace_set_level(rz_trace_p tr, unsigned level)
+{
+    if (level > RZ_TRACE_MAX)
+        level = RZ_TRACE_MAX;
+    if (!tr->ring)
+        level = RZ_TRACE_OFF;
+    tr->level = level;
+    return level;
+}
+
+bool rz_trace_parse_level(const char *name, unsigned *level)
+{
+    if (strcmp(name, "off") == 0)
+        *level = RZ_TRACE_OFF;
+    else if (strcmp(name, "pc") == 0)
+        *level = RZ_TRACE_PC;
+    else if (strcmp(name, "full") == 0)
+        *level = RZ_TRACE_FULL;
+    else
+    {
+        char *end;
+        unsigned long value = strtoul(name, &end, 10);
+        if (*name == '\0' || *end != '\0' || value > RZ_TRACE_FULL)
+            return false;
+        *level = (unsigned)value;
+    }
+    return true;
+}
+
+void rz_trace_stream(rz_trace_p tr, rz_trace_writer_p writer)
+{
+    tr->writer = writer;
+    tr->streamed = tr->head;
+}
+
+void rz_trace_flush(rz_trace_p tr)
+{
+    // Непрерывные куски кольца: до его конца и с начала
+    while (tr->writer && tr->streamed != tr->head)
+    {
+        size_t at = tr->streamed & tr->mask;
+        size_t count = tr->head - tr->streamed;
+        if (count > tr->mask + 1 - at)
+            count = tr->mask + 1 - at;
+        rz_trace_writer_put(tr->writer, &tr->ring[at], count);
+        tr->streamed += count;
+    }
+    tr->streamed = tr->head;
+}
+
+void rz_trace_print_record(const rz_trace_record_t *rec, FILE *out)
+{
+    if (rec->level < RZ_TRACE_FULL)
+    {
+        fprintf(out, "PC=0x%08X\n", rec->pc);
+        return;
+    }
+
+    rz_decoded_t d;
+    char text[64];
+    rz_decode(rec->raw, &d);
+    rz_disasm(&d, rec->pc, text, sizeof(text));
+    char format = rz_op_format(d.op);
+    if (format == 'S')
+    {
+        // Записывается только младшая часть регистра
+        rz_register_t data = d.op == RZ_OP_SB ? rec->value & 0xFFu : d.op == RZ_OP_SH ? rec->value & 0xFFFFu : rec->value;
+        fprintf(out, "PC=0x%08X instr=0x%08X  %-28s [0x%08X]=0x%08X\n", rec->pc, rec->raw, text, rec->addr, data);
+    }
+    else if (format == 'L')
+        fprintf(out, "PC=0x%08X instr=0x%08X  %-28s x%u=0x%08X [0x%08X]\n", rec->pc, rec->raw, text, rec->rd,
+                rec->value, rec->addr);
+    else if (format == 'B' || rec->rd == 0)
+        fprintf(out, "PC=0x%08X instr=0x%08X  %s\n", rec->pc, rec->raw, text);
+    else
+        fprintf(out, "PC=0x%08X instr=0x%08X  %-28s x%u=0x%08X\n", rec->pc, rec->raw, text, rec->rd, rec->value);
+}
+
+void rz_trace_dump(const rz_trace_t *tr, FILE *out, size_t count)
+{
+    if (!tr->ring)
+        return;
+
+    size_t capacity = tr->mask + 1;
+    size_t available = tr->head < capacity ? tr->head : capacity;
+    if (count == 0 || count > available)
+        count = available;
+
+    fprintf(out, "--- last %zu of %zu traced instructions ---\n", count, tr->head);
+    for (size_t i = tr->head - count; i != tr->head; ++i)
+        rz_trace_print_record(&tr->ring[i & tr->mask], out);
+}
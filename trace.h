@@ -0,0 +1,153 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "misc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Trace levels, macros to be usable in #if
+ *
+ */
+#define RZ_TRACE_OFF 0	// nothing is recorded
+#define RZ_TRACE_PC 1	// retired PC only
+#define RZ_TRACE_FULL 2 // PC, instruction word and written register
+
+/**
+ * @brief Highest trace level compiled in, RZ_TRACE_OFF removes tracing
+ * from the hot path completely
+ *
+ */
+#ifndef RZ_TRACE_MAX
+#ifdef NDEBUG
+#define RZ_TRACE_MAX RZ_TRACE_OFF
+#else
+#define RZ_TRACE_MAX RZ_TRACE_FULL
+#endif
+#endif
+
+#define RZ_TRACE_DEFAULT_DEPTH 4096u
+
+/**
+ * @brief Fixed-size binary trace record, formatted only when dumped
+ *
+ */
+typedef struct rz_trace_record_s
+{
+	rz_address_t pc;
+	rz_register_t raw;	 // instruction word, 0 in RZ_TRACE_PC level
+	rz_register_t value; // value of rd after execution
+	rz_address_t addr;	 // effective address of load or store
+	uint8_t rd;			 // for stores the source register of data
+	uint8_t level;
+	uint16_t reserved;
+} rz_trace_record_t, *rz_trace_record_p;
+
+struct rz_trace_writer_s;
+
+/**
+ * @brief Ring buffer of trace records
+ *
+ */
+typedef struct rz_trace_s
+{
+	unsigned level;		 // runtime level, never above RZ_TRACE_MAX
+	unsigned dump_depth; // records to dump on EBREAK or invalid instruction
+	size_t mask;		 // ring capacity - 1, capacity is a power of two
+	size_t head;		 // total number of records written
+	size_t streamed;	 // records already passed to writer
+	rz_trace_record_t *ring;
+	struct rz_trace_writer_s *writer; // binary trace file, NULL for none
+} rz_trace_t, *rz_trace_p;
+
+/**
+ * @brief Initialize tracer
+ *
+ * @param tr tracer instance
+ * @param level requested level, clamped to RZ_TRACE_MAX
+ * @param depth ring capacity in records, rounded up to a power of two
+ * @return true on success
+ */
+bool rz_trace_init(rz_trace_p tr, unsigned level, size_t depth);
+
+/**
+ * @brief Release ring buffer
+ *
+ * @param tr tracer instance
+ */
+void rz_trace_free(rz_trace_p tr);
+
+/**
+ * @brief Change runtime trace level
+ *
+ * @param tr tracer instance
+ * @param level requested level, clamped to RZ_TRACE_MAX
+ * @return unsigned level actually set
+ */
+unsigned rz_trace_set_level(rz_trace_p tr, unsigned level);
+
+/**
+ * @brief Parse level name: off, pc, full or a number
+ *
+ * @param name level name
+ * @param level parsed level
+ * @return true if name is valid
+ */
+bool rz_trace_parse_level(const char *name, unsigned *level);
+
+/**
+ * @brief Stream records of the ring into binary trace file
+ *
+ * The ring keeps working for dumps; whenever it is full its records
+ * go to the writer in one batch, the rest is written by rz_trace_flush.
+ *
+ * @param tr tracer instance
+ * @param writer writer of binary trace, NULL stops streaming
+ */
+void rz_trace_stream(rz_trace_p tr, struct rz_trace_writer_s *writer);
+
+/**
+ * @brief Pass records of the ring not streamed yet to the writer
+ *
+ * @param tr tracer instance
+ */
+void rz_trace_flush(rz_trace_p tr);
+
+/**
+ * @brief Reserve next record of the ring
+ *
+ * @param tr tracer instance
+ * @return rz_trace_record_p record to fill
+ */
+static inline rz_trace_record_p rz_trace_next(rz_trace_p tr)
+{
+	if (tr->writer && tr->head - tr->streamed > tr->mask)
+		rz_trace_flush(tr); // records of a full ring are all complete
+	return &tr->ring[tr->head++ & tr->mask];
+}
+
+/**
+ * @brief Format one record as text
+ *
+ * @param rec record
+ * @param out output stream
+ */
+void rz_trace_print_record(const rz_trace_record_t *rec, FILE *out);
+
+/**
+ * @brief Format the last records of the ring as text
+ *
+ * @param tr tracer instance
+ * @param out output stream
+ * @param count number of records, 0 for the whole ring
+ */
+void rz_trace_dump(const rz_trace_t *tr, FILE *out, size_t count);
+
+#if RZ_TRACE_MAX > RZ_TRACE_OFF
+#define RZ_TRACE_ENABLED(tr) ((tr)->level != RZ_TRACE_OFF)
+#else
+#define RZ_TRACE_ENABLED(tr) false
+#endif
+
+#endif // TRACE_H__
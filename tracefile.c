@@ -0,0 +1,525 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc, malloc, free
+#include <string.h> // memcmp, memcpy, strerror
+#include <threads.h>
+
+#ifdef RZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "tracefile.h"
+#include "decode.h"
+
+// Формат файла: заголовок, затем блоки; блок — его заголовок и данные,
+// сжатые deflate, если это указано в заголовке файла. Слова заголовков и
+// инструкций хранятся в little-endian независимо от хоста, остальное —
+// байты и varint. Записи кодируются относительно состояния, которое
+// писатель и читатель ведут одинаково от начала файла
+#define RZ_TRACEFILE_MAGIC "RZTRACE\2"
+#define RZ_TRACEFILE_DEFLATE 1u // флаг файла: блоки сжаты
+#define RZ_TRACEFILE_RECORD_MAX 24u // байт на запись в худшем случае
+#define RZ_TRACEFILE_WORDS 4096u    // слов инструкций в кэше по PC
+
+// Флаги записи, первый байт
+#define RZ_TF_JUMP 0x01u  // PC не следующий за предыдущим, разность следует
+#define RZ_TF_WORD 0x02u  // слово инструкции следует, в кэше другое
+#define RZ_TF_VALUE 0x04u // значение rd изменилось, разность следует
+#define RZ_TF_ADDR 0x08u  // адрес обращения к памяти следует разностью
+#define RZ_TF_FULL 0x10u  // запись уровня RZ_TRACE_FULL
+
+// Заголовок файла: магия, флаги, наибольший размер несжатого блока
+#define RZ_TRACEFILE_HEADER_SIZE 16u
+// Заголовок блока: байт записей и байт в файле, равные без сжатия
+#define RZ_TRACEFILE_BLOCK_HEADER_SIZE 8u
+
+// Последнее слово, виденное по PC, и разобранные из него поля
+typedef struct
+{
+    rz_address_t pc;
+    rz_register_t raw;
+    uint8_t rd;     // у записи в память — регистр данных
+    uint8_t memory; // загрузка или запись в память
+    uint8_t size;
+} rz_tracefile_word_t;
+
+// Состояние кодирования, одно у писателя и у читателя
+typedef struct
+{
+    rz_address_t next_pc; // PC следующей по порядку инструкции
+    rz_address_t addr;    // предыдущий адрес обращения к памяти
+    rz_register_t x[32];  // последние значения регистров
+    rz_tracefile_word_t words[RZ_TRACEFILE_WORDS];
+} rz_tracefile_state_t;
+
+struct rz_trace_writer_s
+{
+    FILE *file;
+    bool compress;
+    bool ok;
+    rz_tracefile_state_t state;
+    uint8_t *buffers[2]; // со сжатием блоки кодируются в них по очереди
+    uint8_t *block;      // кодируемый блок
+    size_t used;
+
+    // Сжатие и запись блоков в фоновом потоке
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t changed;
+    uint8_t *pending; // блок, отданный потоку, NULL — поток свободен
+    size_t pending_size;
+    bool closing;
+};
+
+struct rz_trace_reader_s
+{
+    FILE *file;
+    bool compressed;
+    bool failed;
+    uint32_t block_max;
+    rz_tracefile_state_t state;
+    uint8_t *block, *stored;
+    size_t size, at;
+};
+
+bool rz_tracefile_compression(void)
+{
+#ifdef RZ_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+static inline rz_tracefile_word_t *rz_tracefile_word(rz_tracefile_state_t *s, rz_address_t pc)
+{
+    return &s->words[(pc >> 1) & (RZ_TRACEFILE_WORDS - 1)];
+}
+
+// Поля слова, которые нужны кодированию, — один раз при его смене
+static void rz_tracefile_set_word(rz_tracefile_word_t *w, rz_address_t pc, rz_register_t raw)
+{
+    rz_decoded_t d;
+    rz_decode(raw, &d);
+    char format = rz_op_format(d.op);
+    w->pc = pc;
+    w->raw = raw;
+    w->rd = format == 'S' ? d.rs2 : d.rd;
+    w->memory = format == 'S' || format == 'L';
+    w->size = d.size;
+}
+
+static inline uint32_t rz_zigzag(rz_register_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline rz_register_t rz_unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (0u - (value & 1u));
+}
+
+static inline void rz_put_le32(uint8_t *p, uint32_t value)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint32_t rz_get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint8_t *rz_put_varint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80u)
+    {
+        *p++ = (uint8_t)(value | 0x80u);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+// Запись блока в файл; вызывается потоком сжатия или сразу при записи без сжатия
+static bool rz_trace_writer_emit(rz_trace_writer_p w, const uint8_t *data, size_t size, uint8_t *scratch)
+{
+    uint32_t stored = (uint32_t)size;
+#ifdef RZ_HAVE_ZLIB
+    if (w->compress)
+    {
+        uLongf deflated = compressBound(RZ_TRACEFILE_BLOCK + RZ_TRACEFILE_RECORD_MAX);
+        if (compress2(scratch, &deflated, data, size, Z_BEST_SPEED) != Z_OK)
+            return false;
+        stored = (uint32_t)deflated;
+        data = scratch;
+    }
+#else
+    (void)scratch;
+#endif
+    uint8_t h[RZ_TRACEFILE_BLOCK_HEADER_SIZE];
+    rz_put_le32(h, (uint32_t)size);
+    rz_put_le32(h + 4, stored);
+    return fwrite(h, sizeof(h), 1, w->file) == 1 && fwrite(data, stored, 1, w->file) == 1;
+}
+
+static int rz_trace_writer_thread(void *arg)
+{
+    rz_trace_writer_p w = arg;
+#ifdef RZ_HAVE_ZLIB
+    uint8_t *scratch = malloc(compressBound(RZ_TRACEFILE_BLOCK + RZ_TRACEFILE_RECORD_MAX));
+#else
+    uint8_t *scratch = NULL;
+#endif
+    mtx_lock(&w->lock);
+    for (;;)
+    {
+        while (!w->pending && !w->closing)
+            cnd_wait(&w->changed, &w->lock);
+        if (!w->pending)
+            break;
+        uint8_t *data = w->pending;
+        size_t size = w->pending_size;
+        mtx_unlock(&w->lock);
+
+        bool ok = scratch && rz_trace_writer_emit(w, data, size, scratch);
+
+        mtx_lock(&w->lock);
+        w->ok = w->ok && ok;
+        w->pending = NULL;
+        cnd_broadcast(&w->changed);
+    }
+    mtx_unlock(&w->lock);
+    free(scratch);
+    return 0;
+}
+
+// Готовый блок уходит потоку сжатия, кодирование продолжается во втором
+// буфере, как только поток освободит его
+static void rz_trace_writer_block(rz_trace_writer_p w)
+{
+    if (!w->used)
+        return;
+    if (!w->compress)
+    {
+        w->ok = w->ok && rz_trace_writer_emit(w, w->block, w->used, NULL);
+        w->used = 0;
+        return;
+    }
+    mtx_lock(&w->lock);
+    while (w->pending)
+        cnd_wait(&w->changed, &w->lock);
+    w->pending = w->block;
+    w->pending_size = w->used;
+    cnd_broadcast(&w->changed);
+    mtx_unlock(&w->lock);
+    w->block = w->block == w->buffers[0] ? w->buffers[1] : w->buffers[0];
+    w->used = 0;
+}
+
+rz_trace_writer_p rz_trace_writer_open(const char *path, bool compress)
+{
+    if (compress && !rz_tracefile_compression())
+    {
+        fprintf(stderr, "%s: compressed traces need a build with zlib\n", path);
+        return NULL;
+    }
+    rz_trace_writer_p w = calloc(1, sizeof(rz_trace_writer_t));
+    if (!w)
+        return NULL;
+    w->compress = compress;
+    w->ok = true;
+    w->buffers[0] = malloc(RZ_TRACEFILE_BLOCK + RZ_TRACEFILE_RECORD_MAX);
+    w->buffers[1] = compress ? malloc(RZ_TRACEFILE_BLOCK + RZ_TRACEFILE_RECORD_MAX) : NULL;
+    w->block = w->buffers[0];
+    if (!w->buffers[0] || (compress && !w->buffers[1]))
+    {
+        free(w->buffers[0]);
+        free(w->buffers[1]);
+        free(w);
+        return NULL;
+    }
+    if (!(w->file = fopen(path, "wb")))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(w->buffers[0]);
+        free(w->buffers[1]);
+        free(w);
+        return NULL;
+    }
+
+    mtx_init(&w->lock, mtx_plain);
+    cnd_init(&w->changed);
+    if (compress && thrd_create(&w->thread, rz_trace_writer_thread, w) != thrd_success)
+    {
+        fprintf(stderr, "%s: failed to start compression thread\n", path);
+        w->compress = false;
+        w->used = 0;
+        rz_trace_writer_close(w);
+        return NULL;
+    }
+
+    uint8_t h[RZ_TRACEFILE_HEADER_SIZE];
+    memcpy(h, RZ_TRACEFILE_MAGIC, 8);
+    rz_put_le32(h + 8, compress ? RZ_TRACEFILE_DEFLATE : 0u);
+    rz_put_le32(h + 12, RZ_TRACEFILE_BLOCK);
+    w->ok = fwrite(h, sizeof(h), 1, w->file) == 1;
+    return w;
+}
+
+void rz_trace_writer_put(rz_trace_writer_p w, const rz_trace_record_t *rec, size_t count)
+{
+    rz_tracefile_state_t *s = &w->state;
+    for (const rz_trace_record_t *end = rec + count; rec != end; ++rec)
+    {
+        if (w->used > RZ_TRACEFILE_BLOCK)
+            rz_trace_writer_block(w);
+        uint8_t *start = w->block + w->used;
+        uint8_t *p = start + 1;
+        uint8_t tag = 0;
+
+        if (rec->pc != s->next_pc)
+        {
+            tag |= RZ_TF_JUMP;
+            p = rz_put_varint(p, rz_zigzag(rec->pc - s->next_pc));
+        }
+        if (rec->level < RZ_TRACE_FULL)
+        {
+            s->next_pc = rec->pc + 4;
+            *start = tag;
+            w->used = (size_t)(p - w->block);
+            continue;
+        }
+
+        tag |= RZ_TF_FULL;
+        rz_tracefile_word_t *word = rz_tracefile_word(s, rec->pc);
+        if (word->pc != rec->pc || word->raw != rec->raw)
+        {
+            tag |= RZ_TF_WORD;
+            rz_put_le32(p, rec->raw);
+            p += 4;
+            rz_tracefile_set_word(word, rec->pc, rec->raw);
+        }
+        if (word->rd && rec->value != s->x[word->rd])
+        {
+            tag |= RZ_TF_VALUE;
+            p = rz_put_varint(p, rz_zigzag(rec->value - s->x[word->rd]));
+            s->x[word->rd] = rec->value;
+        }
+        if (word->memory)
+        {
+            tag |= RZ_TF_ADDR;
+            p = rz_put_varint(p, rz_zigzag(rec->addr - s->addr));
+            s->addr = rec->addr;
+        }
+        s->next_pc = rec->pc + word->size;
+        *start = tag;
+        w->used = (size_t)(p - w->block);
+    }
+}
+
+bool rz_trace_writer_close(rz_trace_writer_p w)
+{
+    if (!w)
+        return true;
+    rz_trace_writer_block(w);
+    if (w->compress)
+    {
+        mtx_lock(&w->lock);
+        w->closing = true;
+        cnd_broadcast(&w->changed);
+        mtx_unlock(&w->lock);
+        thrd_join(w->thread, NULL);
+    }
+    mtx_destroy(&w->lock);
+    cnd_destroy(&w->changed);
+    bool ok = w->ok;
+    if (fclose(w->file) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Failed to write trace file\n");
+    free(w->buffers[0]);
+    free(w->buffers[1]);
+    free(w);
+    return ok;
+}
+
+rz_trace_reader_p rz_trace_reader_open(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    uint8_t h[RZ_TRACEFILE_HEADER_SIZE];
+    uint32_t flags = 0, block = 0;
+    if (fread(h, sizeof(h), 1, file) == 1)
+    {
+        flags = rz_get_le32(h + 8);
+        block = rz_get_le32(h + 12);
+    }
+    if (block == 0 || memcmp(h, RZ_TRACEFILE_MAGIC, 8) != 0 || block > (1u << 30))
+    {
+        fprintf(stderr, "%s: not a RISC-Z trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if ((flags & RZ_TRACEFILE_DEFLATE) && !rz_tracefile_compression())
+    {
+        fprintf(stderr, "%s: compressed traces need a build with zlib\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    rz_trace_reader_p r = calloc(1, sizeof(rz_trace_reader_t));
+    if (!r)
+    {
+        fclose(file);
+        return NULL;
+    }
+    r->file = file;
+    r->compressed = flags & RZ_TRACEFILE_DEFLATE;
+    r->block_max = block + RZ_TRACEFILE_RECORD_MAX;
+    r->block = malloc(r->block_max);
+#ifdef RZ_HAVE_ZLIB
+    if (r->compressed)
+        r->stored = malloc(compressBound(r->block_max));
+#endif
+    if (!r->block || (r->compressed && !r->stored))
+    {
+        rz_trace_reader_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Следующий блок; false — конец файла или ошибка
+static bool rz_trace_reader_block(rz_trace_reader_p r)
+{
+    uint8_t h[RZ_TRACEFILE_BLOCK_HEADER_SIZE];
+    size_t got = fread(h, 1, sizeof(h), r->file);
+    if (got != sizeof(h))
+    {
+        r->failed = got != 0;
+        return false;
+    }
+    uint32_t size = rz_get_le32(h), stored = rz_get_le32(h + 4);
+    if (size > r->block_max || (!r->compressed && stored != size))
+    {
+        r->failed = true;
+        return false;
+    }
+#ifdef RZ_HAVE_ZLIB
+    if (r->compressed)
+    {
+        uLongf inflated = r->block_max;
+        if (stored > compressBound(r->block_max) || fread(r->stored, 1, stored, r->file) != stored ||
+            uncompress(r->block, &inflated, r->stored, stored) != Z_OK || inflated != size)
+        {
+            r->failed = true;
+            return false;
+        }
+    }
+    else
+#endif
+        if (fread(r->block, 1, size, r->file) != size)
+    {
+        r->failed = true;
+        return false;
+    }
+    r->size = size;
+    r->at = 0;
+    return true;
+}
+
+static inline bool rz_get_varint(rz_trace_reader_p r, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7)
+    {
+        if (r->at == r->size)
+            return false;
+        uint8_t byte = r->block[r->at++];
+        result |= (uint32_t)(byte & 0x7Fu) << shift;
+        if (!(byte & 0x80u))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rz_trace_reader_next(rz_trace_reader_p r, rz_trace_record_p rec)
+{
+    if (r->failed || (r->at == r->size && !rz_trace_reader_block(r)))
+        return false;
+
+    rz_tracefile_state_t *s = &r->state;
+    uint8_t tag = r->block[r->at++];
+    uint32_t value;
+    *rec = (rz_trace_record_t){.pc = s->next_pc, .level = RZ_TRACE_PC};
+    if (tag & RZ_TF_JUMP)
+    {
+        if (!rz_get_varint(r, &value))
+            goto damaged;
+        rec->pc += rz_unzigzag(value);
+    }
+    if (!(tag & RZ_TF_FULL))
+    {
+        s->next_pc = rec->pc + 4;
+        return true;
+    }
+
+    rec->level = RZ_TRACE_FULL;
+    rz_tracefile_word_t *word = rz_tracefile_word(s, rec->pc);
+    if (tag & RZ_TF_WORD)
+    {
+        if (r->size - r->at < 4)
+            goto damaged;
+        rz_register_t raw = rz_get_le32(r->block + r->at);
+        r->at += 4;
+        rz_tracefile_set_word(word, rec->pc, raw);
+    }
+    else if (word->pc != rec->pc)
+        goto damaged;
+    rec->raw = word->raw;
+    rec->rd = word->rd;
+    if (tag & RZ_TF_VALUE)
+    {
+        if (!rz_get_varint(r, &value) || !word->rd)
+            goto damaged;
+        s->x[word->rd] += rz_unzigzag(value);
+    }
+    rec->value = s->x[word->rd];
+    if (tag & RZ_TF_ADDR)
+    {
+        if (!rz_get_varint(r, &value))
+            goto damaged;
+        s->addr += rz_unzigzag(value);
+        rec->addr = s->addr;
+    }
+    s->next_pc = rec->pc + word->size;
+    return true;
+
+damaged:
+    r->failed = true;
+    return false;
+}
+
+bool rz_trace_reader_failed(const rz_trace_reader_t *r)
+{
+    return r->failed;
+}
+
+void rz_trace_reader_close(rz_trace_reader_p r)
+{
+    if (!r)
+        return;
+    if (r->file)
+        fclose(r->file);
+    free(r->block);
+    free(r->stored);
+    free(r);
+}
@@ -0,0 +1,102 @@
+#ifndef __TRACEFILE_H__
+#define __TRACEFILE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "trace.h"
+
+#define RZ_TRACEFILE_BLOCK (1u << 20) // encoded bytes per block before compression
+
+/**
+ * @brief Streaming writer of binary trace files
+ *
+ * File is a header and a sequence of blocks, each one optionally
+ * deflated. Records are delta-encoded against the previous record:
+ * sequential PC is one flag bit, instruction word is omitted when
+ * the same word was last seen at that PC, register values and memory
+ * addresses are zigzag varints of differences to the previous value
+ * of that register and the previous address. Typical loop record
+ * takes 2-4 bytes before compression.
+ */
+struct rz_trace_writer_s;
+typedef struct rz_trace_writer_s rz_trace_writer_t, *rz_trace_writer_p;
+
+/**
+ * @brief Sequential reader of binary trace files
+ *
+ */
+struct rz_trace_reader_s;
+typedef struct rz_trace_reader_s rz_trace_reader_t, *rz_trace_reader_p;
+
+/**
+ * @brief Check whether compressed traces can be written and read
+ *
+ * @return true if built with zlib
+ */
+bool rz_tracefile_compression(void);
+
+/**
+ * @brief Create trace file
+ *
+ * With compression full blocks are deflated and written by a
+ * background thread while the next block is being encoded.
+ *
+ * @param path file name
+ * @param compress deflate blocks, needs rz_tracefile_compression
+ * @return rz_trace_writer_p writer or NULL, error is printed
+ */
+rz_trace_writer_p rz_trace_writer_open(const char *path, bool compress);
+
+/**
+ * @brief Append records
+ *
+ * Store records carry source register of data in rd and the data in
+ * value; loads and stores carry effective address in addr.
+ *
+ * @param w writer
+ * @param rec records
+ * @param count number of records
+ */
+void rz_trace_writer_put(rz_trace_writer_p w, const rz_trace_record_t *rec, size_t count);
+
+/**
+ * @brief Flush pending blocks, close file and release writer
+ *
+ * @param w writer, may be NULL
+ * @return true if every block was written
+ */
+bool rz_trace_writer_close(rz_trace_writer_p w);
+
+/**
+ * @brief Open trace file
+ *
+ * @param path file name
+ * @return rz_trace_reader_p reader or NULL, error is printed
+ */
+rz_trace_reader_p rz_trace_reader_open(const char *path);
+
+/**
+ * @brief Read next record
+ *
+ * @param r reader
+ * @param rec output record, fields as written by rz_trace_writer_put
+ * @return true if record was read, false at the end or on damaged file
+ */
+bool rz_trace_reader_next(rz_trace_reader_p r, rz_trace_record_p rec);
+
+/**
+ * @brief Check whether reading stopped on damaged or truncated file
+ *
+ * @param r reader
+ * @return true if file is damaged
+ */
+bool rz_trace_reader_failed(const rz_trace_reader_t *r);
+
+/**
+ * @brief Close file and release reader
+ *
+ * @param r reader, may be NULL
+ */
+void rz_trace_reader_close(rz_trace_reader_p r);
+
+#endif // TRACEFILE_H__